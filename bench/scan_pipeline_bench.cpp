@@ -0,0 +1,609 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file scan_pipeline_bench.cpp
+ * @brief Headless benchmarks of the profile pipeline.
+ *
+ * Runs each stage a profile goes through on its way to the screen, from the
+ * receiver threads through conversion, analytics, history and decimation,
+ * without a window or scan heads. Everything runs on synthetic profiles; if
+ * a recording is passed in with `--recording FILE`, the same benchmarks run
+ * on its profiles as well. Results can be written as JSON to compare builds:
+ *
+ * ```shell
+ * > ./scan_pipeline_bench --benchmark_format=json --benchmark_out=bench.json
+ * ```
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <joescan_pinchot.h>
+#include "event_log.hpp"
+#include "metrics.hpp"
+#include "point_decimator.hpp"
+#include "profile_analytics.hpp"
+#include "profile_convert.hpp"
+#include "profile_history.hpp"
+#include "profile_receiver.hpp"
+#include "profile_replay.hpp"
+#include "profile_shm.hpp"
+#include "profile_source.hpp"
+#include "spsc_ring.hpp"
+
+static const double kPi = 3.14159265358979;
+// The GUI's level of detail settings; see `scan_gui_example.cpp`.
+static const uint32_t kHistoryGatherLimit = 1000000;
+static const uint32_t kHistoryAlphaBands = 8;
+// New profiles per camera and frame at 200 Hz and 60 frames per second,
+// rounded up.
+static const uint32_t kProfilesPerFrame = 4;
+// Size of the plot on screen, in pixels.
+static const uint32_t kPlotWidthPx = 1200;
+static const uint32_t kPlotHeightPx = 800;
+// Upper bound on the profiles loaded from a recording.
+static const size_t kMaxRecordedProfiles = 4096;
+
+/**
+ * @brief Profiles the benchmarks run on.
+ */
+struct ProfileSet {
+  std::string name;
+  std::vector<jsProfile> profiles;
+  uint64_t point_count = 0;
+};
+
+/**
+ * @brief Makes profiles shaped like a log seen from above: an arc of points
+ * with a bit of noise, and a gap of invalid points where the log is out of
+ * view of the camera.
+ */
+static ProfileSet make_synthetic_profiles(uint32_t count)
+{
+  ProfileSet set;
+  set.name = "synthetic";
+  set.profiles.resize(count);
+  uint32_t seed = 1;
+  auto noise = [&seed]() {
+    seed = seed * 1664525u + 1013904223u;
+    return static_cast<int32_t>(seed >> 24) - 128;
+  };
+
+  for (uint32_t n = 0; n < count; n++) {
+    jsProfile &p = set.profiles[n];
+    std::memset(&p, 0, offsetof(jsProfile, data));
+    p.scan_head_id = 0;
+    p.camera = static_cast<decltype(p.camera)>(n % kCamerasPerHead);
+    p.timestamp_ns = 5000000ull * n;
+    p.sequence_number = n;
+    p.format = JS_DATA_FORMAT_XY_FULL_LM_FULL;
+    p.data_len = JS_PROFILE_DATA_LEN;
+    for (uint32_t i = 0; i < JS_PROFILE_DATA_LEN; i++) {
+      double a = kPi * i / JS_PROFILE_DATA_LEN;
+      jsProfileData &d = p.data[i];
+      if ((i % 400) < 40) {
+        d.x = JS_PROFILE_DATA_INVALID_XY;
+        d.y = JS_PROFILE_DATA_INVALID_XY;
+        d.brightness = JS_PROFILE_DATA_INVALID_BRIGHTNESS;
+        continue;
+      }
+      d.x = static_cast<int32_t>(-10000.0 * std::cos(a)) + noise();
+      d.y = static_cast<int32_t>(10000.0 * std::sin(a)) + noise();
+      d.brightness = 100 + (noise() & 0x7f);
+    }
+    set.point_count += p.data_len;
+  }
+  return set;
+}
+
+/**
+ * @brief Reads profiles out of a recording the same way a replay does, as
+ * fast as they can be read.
+ *
+ * @throws std::runtime_error if the recording can't be opened.
+ */
+static ProfileSet load_recorded_profiles(const std::string &path)
+{
+  RecordingReader reader(path);
+  ReplayClock clock(reader.get_first_timestamp_ns(),
+                    reader.get_last_timestamp_ns());
+  clock.set_max_speed(true);
+
+  ProfileSet set;
+  set.name = "recorded";
+  for (auto &head : reader.get_heads()) {
+    ReplaySource source(reader, clock, head.id);
+    while (set.profiles.size() < kMaxRecordedProfiles) {
+      size_t n = set.profiles.size();
+      set.profiles.resize(n + 64);
+      int32_t got = source.get_profiles(&set.profiles[n], 64);
+      set.profiles.resize(n + std::max<int32_t>(0, got));
+      if (0 >= got) {
+        break;
+      }
+    }
+  }
+  // The benchmarks pick their own scan head IDs.
+  for (auto &p : set.profiles) {
+    p.scan_head_id = 0;
+    set.point_count += p.data_len;
+  }
+  return set;
+}
+
+/**
+ * @brief Source that hands out the same profiles over and over without ever
+ * waiting, so the receiver runs as fast as it can.
+ */
+class LoopingSource : public ProfileSource {
+public:
+  LoopingSource(const ProfileSet &set, uint32_t id) : set(set), id(id)
+  {
+  }
+
+  uint32_t get_id() const override
+  {
+    return id;
+  }
+
+  int32_t wait_until_available(uint32_t count, uint32_t) override
+  {
+    return static_cast<int32_t>(std::max<uint32_t>(count, 64));
+  }
+
+  int32_t get_profiles(jsProfile *profiles, uint32_t max_profiles) override
+  {
+    const std::vector<jsProfile> &src = set.profiles;
+    for (uint32_t n = 0; n < max_profiles; n++) {
+      const jsProfile &p = src[next];
+      std::memcpy(&profiles[n], &p, offsetof(jsProfile, data));
+      std::memcpy(profiles[n].data, p.data, p.data_len * sizeof(jsProfileData));
+      profiles[n].scan_head_id = id;
+      profiles[n].sequence_number = sequence++;
+      next = (next + 1) % src.size();
+    }
+    return static_cast<int32_t>(max_profiles);
+  }
+
+private:
+  const ProfileSet &set;
+  uint32_t id;
+  size_t next = 0;
+  uint32_t sequence = 0;
+};
+
+/**
+ * @brief Conversion of profile points into inches, for every kernel the CPU
+ * supports; colored by brightness through a palette if `is_colored`.
+ */
+static void convert(benchmark::State &state, const ProfileSet *set,
+                    ConvertKernel kernel, bool is_colored)
+{
+  const ConvertKernel previous = get_convert_kernel();
+  if (!set_convert_kernel(kernel)) {
+    state.SkipWithError("kernel not supported");
+    return;
+  }
+  std::vector<float> x(JS_PROFILE_DATA_LEN);
+  std::vector<float> y(JS_PROFILE_DATA_LEN);
+  std::vector<uint32_t> color(JS_PROFILE_DATA_LEN);
+  uint32_t palette[kBrightnessLevels];
+  for (uint32_t level = 0; level < kBrightnessLevels; level++) {
+    palette[level] = 0xFF000000u | (level * 0x010101u);
+  }
+  uint64_t points = 0;
+  size_t n = 0;
+  for (auto _ : state) {
+    const jsProfile &p = set->profiles[n];
+    if (is_colored) {
+      benchmark::DoNotOptimize(convert_profile(p, x.data(), y.data(),
+                                               color.data(), palette));
+    } else {
+      benchmark::DoNotOptimize(convert_profile(p, x.data(), y.data()));
+    }
+    benchmark::ClobberMemory();
+    points += p.data_len;
+    n = (n + 1) % set->profiles.size();
+  }
+  set_convert_kernel(previous);
+  state.SetItemsProcessed(points);
+  state.SetLabel(get_convert_kernel_name(kernel));
+}
+
+/**
+ * @brief Cropping profiles to the middle of the window with every kernel
+ * the CPU supports, through an aligned scan head's transform. Cropping is
+ * done in place, so it runs on a copy of the profiles; after the first pass
+ * the points outside are already invalid, which changes nothing about the
+ * work done.
+ */
+static void crop(benchmark::State &state, const ProfileSet *set,
+                 ConvertKernel kernel)
+{
+  const ConvertKernel previous = get_convert_kernel();
+  if (!set_convert_kernel(kernel)) {
+    state.SkipWithError("kernel not supported");
+    return;
+  }
+  std::vector<jsProfile> profiles = set->profiles;
+  PointTransform transform = make_alignment_transform(2.0, 1.0, -1.0);
+  PointRegion region;
+  region.left = -10.0f;
+  region.right = 10.0f;
+  region.bottom = -10.0f;
+  region.top = 10.0f;
+  uint64_t points = 0;
+  size_t n = 0;
+  for (auto _ : state) {
+    jsProfile &p = profiles[n];
+    benchmark::DoNotOptimize(crop_points(p.data, p.data_len, transform,
+                                         region));
+    benchmark::ClobberMemory();
+    points += p.data_len;
+    n = (n + 1) % profiles.size();
+  }
+  set_convert_kernel(previous);
+  state.SetItemsProcessed(points);
+  state.SetLabel(get_convert_kernel_name(kernel));
+}
+
+/**
+ * @brief Moving profiles through a receiver's ring, in batches the size of
+ * `state.range(0)`, from a producer thread to the consumer.
+ */
+static void ring(benchmark::State &state, const ProfileSet *set)
+{
+  const size_t batch = static_cast<size_t>(state.range(0));
+  SpscRing<jsProfile> profiles(256);
+  std::atomic<bool> is_running{true};
+  std::thread producer([&]() {
+    size_t n = 0;
+    while (is_running.load(std::memory_order_relaxed)) {
+      size_t count = 0;
+      jsProfile *slots = profiles.write_slots(count);
+      if (nullptr == slots) {
+        continue;
+      }
+      count = std::min(count, batch);
+      for (size_t i = 0; i < count; i++) {
+        const jsProfile &p = set->profiles[n];
+        std::memcpy(&slots[i], &p, offsetof(jsProfile, data));
+        std::memcpy(slots[i].data, p.data, p.data_len * sizeof(jsProfileData));
+        n = (n + 1) % set->profiles.size();
+      }
+      profiles.commit_write(count);
+    }
+  });
+
+  uint64_t count = 0;
+  for (auto _ : state) {
+    jsProfile *p = nullptr;
+    while (nullptr == (p = profiles.front())) {
+    }
+    benchmark::DoNotOptimize(p->data[p->data_len / 2].y);
+    profiles.pop();
+    count++;
+  }
+  is_running.store(false);
+  producer.join();
+  state.SetItemsProcessed(count);
+}
+
+/**
+ * @brief Publishing profiles to shared memory in batches the size of
+ * `state.range(0)` from a receiver thread, and reading them back out as
+ * another process would. The publisher never waits, so profiles the reader
+ * is too slow for are dropped rather than counted.
+ */
+static void shm(benchmark::State &state, const ProfileSet *set)
+{
+  const uint32_t batch = static_cast<uint32_t>(state.range(0));
+  std::vector<RecordingHeadHeader> heads(1);
+  std::memset(heads.data(), 0, sizeof(RecordingHeadHeader));
+  ShmPublisher publisher("scan_pipeline_bench", JS_DATA_FORMAT_XY_FULL_LM_FULL,
+                         200.0, heads);
+  ShmSubscriber subscriber("scan_pipeline_bench");
+  std::atomic<bool> is_running{true};
+  std::thread producer([&]() {
+    size_t n = 0;
+    while (is_running.load(std::memory_order_relaxed)) {
+      uint32_t count = std::min<uint32_t>(
+        batch, static_cast<uint32_t>(set->profiles.size() - n));
+      publisher.process(0, &set->profiles[n], count);
+      n = (n + count) % set->profiles.size();
+      // Leave the reader room to keep up, as the scan rate would.
+      while (is_running.load(std::memory_order_relaxed) &&
+             (256 < subscriber.get_available(0))) {
+      }
+    }
+  });
+
+  std::unique_ptr<jsProfile> profile = std::make_unique<jsProfile>();
+  uint64_t count = 0;
+  for (auto _ : state) {
+    while (0 == subscriber.read(0, profile.get(), 1)) {
+    }
+    benchmark::DoNotOptimize(profile->data[profile->data_len / 2].y);
+    count++;
+  }
+  is_running.store(false);
+  producer.join();
+  state.SetItemsProcessed(count);
+  state.counters["dropped"] =
+    static_cast<double>(subscriber.get_profiles_dropped());
+}
+
+/**
+ * @brief The analytics stage, run over batches of `state.range(0)` profiles
+ * as a receiver would.
+ */
+static void analytics(benchmark::State &state, const ProfileSet *set)
+{
+  const uint32_t batch = static_cast<uint32_t>(state.range(0));
+  ProfileAnalytics stage(1);
+  std::vector<jsProfile> profiles(batch);
+  for (uint32_t n = 0; n < batch; n++) {
+    profiles[n] = set->profiles[n % set->profiles.size()];
+  }
+  uint64_t points = 0;
+  for (uint32_t n = 0; n < batch; n++) {
+    points += profiles[n].data_len;
+  }
+
+  for (auto _ : state) {
+    stage.process(0, profiles.data(), batch);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(points * state.iterations());
+}
+
+/**
+ * @brief The screen-space decimator thinning out a converted profile's worth
+ * of points at a time, in view of a plot the GUI's size.
+ */
+static void decimate(benchmark::State &state, const ProfileSet *set)
+{
+  std::vector<float> x;
+  std::vector<float> y;
+  for (auto &p : set->profiles) {
+    size_t n = x.size();
+    x.resize(n + p.data_len);
+    y.resize(n + p.data_len);
+    x.resize(n + convert_profile(p, &x[n], &y[n]));
+    y.resize(x.size());
+  }
+  std::vector<float> x_out(x.size());
+  std::vector<float> y_out(y.size());
+
+  PointDecimator decimator;
+  decimator.set_view(-30.0, 30.0, -30.0, 30.0, kPlotWidthPx, kPlotHeightPx);
+  uint64_t points = 0;
+  for (auto _ : state) {
+    decimator.next_layer();
+    benchmark::DoNotOptimize(
+      decimator.filter(x.data(), y.data(), static_cast<uint32_t>(x.size()),
+                       x_out.data(), y_out.data()));
+    points += x.size();
+  }
+  state.SetItemsProcessed(points);
+}
+
+/**
+ * @brief The CPU work of one GUI frame for `state.range(0)` scan heads with
+ * `state.range(1)` profiles of history per camera: adding new profiles to
+ * the history, gathering the history within the point budget, aligning and
+ * decimating it, and converting the live profiles. The time per iteration
+ * is the time per frame, not counting the draw calls themselves.
+ */
+static void frame(benchmark::State &state, const ProfileSet *set)
+{
+  const uint32_t num_heads = static_cast<uint32_t>(state.range(0));
+  const uint32_t depth = static_cast<uint32_t>(state.range(1));
+  const uint32_t num_series = num_heads * kCamerasPerHead;
+  std::vector<ProfileHistory> histories;
+  for (uint32_t n = 0; n < num_series; n++) {
+    histories.emplace_back(depth);
+  }
+  size_t next = 0;
+  auto push = [&](ProfileHistory &history) {
+    history.push(set->profiles[next]);
+    next = (next + 1) % set->profiles.size();
+  };
+  for (auto &history : histories) {
+    for (uint32_t n = 0; n < depth; n++) {
+      push(history);
+    }
+  }
+
+  std::vector<float> x(kHistoryGatherLimit);
+  std::vector<float> y(kHistoryGatherLimit);
+  std::vector<float> x_out(kHistoryGatherLimit);
+  std::vector<float> y_out(kHistoryGatherLimit);
+  PointTransform transform = make_alignment_transform(2.0, 1.0, -1.0);
+  PointDecimator decimator;
+  uint64_t points = 0;
+
+  for (auto _ : state) {
+    for (auto &history : histories) {
+      for (uint32_t n = 0; n < kProfilesPerFrame; n++) {
+        push(history);
+      }
+    }
+
+    uint64_t total = 0;
+    for (auto &history : histories) {
+      total += history.get_point_count();
+    }
+    uint32_t stride = static_cast<uint32_t>(std::max<uint64_t>(
+      1, (total + kHistoryGatherLimit - 1) / kHistoryGatherLimit));
+    decimator.set_view(-30.0, 30.0, -30.0, 30.0, kPlotWidthPx, kPlotHeightPx);
+    uint64_t gathered = 0;
+    for (uint32_t band = kHistoryAlphaBands; band-- > 0;) {
+      uint32_t first_age = 1 + band * depth / kHistoryAlphaBands;
+      uint32_t last_age = 1 + (band + 1) * depth / kHistoryAlphaBands;
+      for (auto &history : histories) {
+        uint32_t max_points =
+          static_cast<uint32_t>(kHistoryGatherLimit - gathered);
+        uint32_t n = history.gather(first_age, last_age, stride, x.data(),
+                                    y.data(), max_points);
+        transform_points(x.data(), y.data(), n, transform);
+        gathered += n;
+        decimator.next_layer();
+        points += decimator.filter(x.data(), y.data(), n, x_out.data(),
+                                   y_out.data());
+      }
+    }
+
+    for (uint32_t n = 0; n < num_series; n++) {
+      const jsProfile &p = set->profiles[(next + n) % set->profiles.size()];
+      uint32_t count = convert_profile(p, x_out.data(), y_out.data());
+      transform_points(x_out.data(), y_out.data(), count, transform);
+      points += count;
+    }
+    benchmark::ClobberMemory();
+  }
+  // Points that would have been drawn.
+  state.SetItemsProcessed(points);
+}
+
+/**
+ * @brief Receiver threads for `state.range(0)` scan heads, each reading as
+ * fast as it can, with the benchmark thread draining their rings as the GUI
+ * does. Measures how many profiles make it through, and how many are
+ * dropped because the consumer couldn't keep up.
+ */
+static void receive(benchmark::State &state, const ProfileSet *set)
+{
+  const uint32_t num_heads = static_cast<uint32_t>(state.range(0));
+  EventLog events(num_heads);
+  std::vector<std::unique_ptr<LoopingSource>> sources;
+  std::vector<std::unique_ptr<HeadMetrics>> metrics;
+  std::vector<std::unique_ptr<ProfileReceiver>> receivers;
+  ProfileAnalytics stage(num_heads);
+  for (uint32_t id = 0; id < num_heads; id++) {
+    sources.emplace_back(std::make_unique<LoopingSource>(*set, id));
+    metrics.emplace_back(std::make_unique<HeadMetrics>());
+    receivers.emplace_back(std::make_unique<ProfileReceiver>(
+      *sources.back(), events, *metrics.back()));
+    receivers.back()->add_stage(&stage);
+    receivers.back()->start();
+  }
+
+  uint64_t consumed = 0;
+  for (auto _ : state) {
+    for (auto &receiver : receivers) {
+      auto &ring = receiver->get_profiles();
+      ProfileHandle p;
+      while (ring.try_pop(p)) {
+        benchmark::DoNotOptimize(p->data_len);
+        consumed++;
+      }
+    }
+  }
+  for (auto &receiver : receivers) {
+    receiver->stop();
+  }
+
+  uint64_t received = 0;
+  uint64_t dropped = 0;
+  for (auto &m : metrics) {
+    received += m->profiles_received.load();
+    dropped += m->profiles_dropped.load();
+  }
+  state.SetItemsProcessed(consumed);
+  state.counters["received"] =
+    benchmark::Counter(static_cast<double>(received),
+                       benchmark::Counter::kIsRate);
+  state.counters["dropped"] =
+    benchmark::Counter(static_cast<double>(dropped),
+                       benchmark::Counter::kIsRate);
+}
+
+static void register_benchmarks(const ProfileSet *set)
+{
+  const std::string prefix = set->name + "/";
+  const ConvertKernel kernels[] = {CONVERT_KERNEL_SCALAR, CONVERT_KERNEL_SSE2,
+                                   CONVERT_KERNEL_AVX2, CONVERT_KERNEL_NEON};
+  for (auto kernel : kernels) {
+    if (is_convert_kernel_supported(kernel)) {
+      benchmark::RegisterBenchmark(
+        (prefix + "convert/" + get_convert_kernel_name(kernel)).c_str(),
+        convert, set, kernel, false);
+      benchmark::RegisterBenchmark(
+        (prefix + "convert_color/" + get_convert_kernel_name(kernel)).c_str(),
+        convert, set, kernel, true);
+      benchmark::RegisterBenchmark(
+        (prefix + "crop/" + get_convert_kernel_name(kernel)).c_str(),
+        crop, set, kernel);
+    }
+  }
+  benchmark::RegisterBenchmark((prefix + "ring").c_str(), ring, set)
+    ->RangeMultiplier(4)->Range(1, 64)->UseRealTime();
+  benchmark::RegisterBenchmark((prefix + "shm").c_str(), shm, set)
+    ->RangeMultiplier(4)->Range(1, 64)->UseRealTime();
+  benchmark::RegisterBenchmark((prefix + "analytics").c_str(), analytics, set)
+    ->RangeMultiplier(4)->Range(1, 64);
+  benchmark::RegisterBenchmark((prefix + "decimate").c_str(), decimate, set);
+  benchmark::RegisterBenchmark((prefix + "frame").c_str(), frame, set)
+    ->ArgNames({"heads", "depth"})
+    ->ArgsProduct({{1, 2, 4, 8, 16}, {100, 1000}})
+    ->Unit(benchmark::kMillisecond);
+  benchmark::RegisterBenchmark((prefix + "receive").c_str(), receive, set)
+    ->ArgName("heads")
+    ->RangeMultiplier(2)->Range(1, 16)
+    ->MinTime(0.5)->UseRealTime();
+}
+
+int main(int argc, char *argv[])
+{
+  benchmark::Initialize(&argc, argv);
+
+  // Whatever Google Benchmark didn't recognize is ours.
+  std::string recording_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (("--recording" == arg) && (i + 1 < argc)) {
+      recording_path = argv[++i];
+    } else {
+      std::cout << "Usage: " << argv[0]
+                << " [--recording FILE] [benchmark options]" << std::endl;
+      return 1;
+    }
+  }
+
+  ProfileSet synthetic = make_synthetic_profiles(1024);
+  ProfileSet recorded;
+  register_benchmarks(&synthetic);
+  if (!recording_path.empty()) {
+    try {
+      recorded = load_recorded_profiles(recording_path);
+    } catch (std::exception &e) {
+      std::cout << "ERROR: " << e.what() << std::endl;
+      return 1;
+    }
+    if (recorded.profiles.empty()) {
+      std::cout << "ERROR: " << recording_path << " holds no profiles"
+                << std::endl;
+      return 1;
+    }
+    register_benchmarks(&recorded);
+  }
+
+  benchmark::AddCustomContext("convert_kernel",
+                              get_convert_kernel_name(get_convert_kernel()));
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "event_log.hpp"
+#include <chrono>
+#include <iostream>
+
+// How many recent events are kept for display.
+static const size_t kRecentEvents = 200;
+
+static uint64_t now_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+    .count();
+}
+
+EventLog::EventLog(uint32_t num_sources)
+{
+  for (uint32_t n = 0; n < num_sources; n++) {
+    sources.emplace_back(std::make_unique<Source>());
+  }
+  thread = std::thread(&EventLog::run, this);
+}
+
+EventLog::~EventLog()
+{
+  is_running.store(false);
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+void EventLog::record(uint32_t source, EventType type, int32_t value)
+{
+  if (source >= sources.size()) {
+    return;
+  }
+
+  Source &s = *sources[source];
+  s.counts[type].fetch_add(1, std::memory_order_relaxed);
+
+  Event *event = s.queue.write_slot();
+  if (nullptr != event) {
+    event->time_ns = now_ns();
+    event->source = source;
+    event->type = type;
+    event->value = value;
+    s.queue.commit_write();
+  }
+}
+
+void EventLog::count(uint32_t source, EventType type)
+{
+  if (source < sources.size()) {
+    sources[source]->counts[type].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+uint64_t EventLog::get_count(uint32_t source, EventType type) const
+{
+  if (source >= sources.size()) {
+    return 0;
+  }
+  return sources[source]->counts[type].load(std::memory_order_relaxed);
+}
+
+void EventLog::get_recent(std::vector<Event> &events) const
+{
+  std::lock_guard<std::mutex> lock(recent_mutex);
+  events.assign(recent.begin(), recent.end());
+}
+
+void EventLog::set_console_output(bool is_enabled, uint32_t max_lines_per_sec)
+{
+  console_rate.store(max_lines_per_sec);
+  is_console_enabled.store(is_enabled);
+}
+
+const char *EventLog::get_type_name(EventType type)
+{
+  switch (type) {
+  case EVENT_EMPTY_POLL:
+    return "no profiles available";
+  case EVENT_BACKLOG_OVERRUN:
+    return "too many profiles available";
+  case EVENT_PROFILES_DROPPED:
+    return "profiles dropped";
+  case EVENT_READ_FAILURE:
+    return "failed to get profiles";
+  case EVENT_RECOVERY_FAILURE:
+    return "failed to recover";
+  case EVENT_RECOVERED:
+    return "recovered";
+  case EVENT_TYPE_COUNT:
+    break;
+  }
+  return "unknown";
+}
+
+void EventLog::run()
+{
+  uint64_t window_start_ns = now_ns();
+  uint32_t lines_in_window = 0;
+  uint64_t suppressed = 0;
+
+  while (is_running.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    uint64_t now = now_ns();
+    if (now - window_start_ns >= 1000000000) {
+      if ((0 < suppressed) && is_console_enabled.load()) {
+        std::cout << "(" << suppressed << " more events not shown)"
+                  << std::endl;
+      }
+      window_start_ns = now;
+      lines_in_window = 0;
+      suppressed = 0;
+    }
+
+    for (auto &source : sources) {
+      while (Event *event = source->queue.front()) {
+        if (is_console_enabled.load()) {
+          if (lines_in_window < console_rate.load()) {
+            print(*event);
+            lines_in_window++;
+          } else {
+            suppressed++;
+          }
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(recent_mutex);
+          recent.push_back(*event);
+          if (recent.size() > kRecentEvents) {
+            recent.pop_front();
+          }
+        }
+        source->queue.pop();
+      }
+    }
+  }
+}
+
+void EventLog::print(const Event &event)
+{
+  std::cout << "scan head " << event.source << ": "
+            << get_type_name(event.type);
+  if (0 != event.value) {
+    std::cout << " (" << event.value << ")";
+  }
+  std::cout << std::endl;
+}
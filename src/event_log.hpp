@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file event_log.hpp
+ * @brief Low overhead, in-memory log of notable acquisition events.
+ *
+ * Writing to the console from the acquisition or render loop is slow; on
+ * Windows every `std::endl` is a synchronous flush that can take
+ * milliseconds. Instead, events are counted with atomics and queued into a
+ * lock-free ring per source. A background thread drains the rings into a
+ * short list of recent events for display and, only if asked to, echoes them
+ * to the console at a limited rate.
+ */
+#ifndef SCAN_GUI_EVENT_LOG_HPP
+#define SCAN_GUI_EVENT_LOG_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "spsc_ring.hpp"
+
+enum EventType {
+  // Waited for profiles, but none arrived before the timeout.
+  EVENT_EMPTY_POLL = 0,
+  // More profiles were waiting in the client API than expected.
+  EVENT_BACKLOG_OVERRUN,
+  // Profiles were read but thrown away because the consumer fell behind.
+  EVENT_PROFILES_DROPPED,
+  // A call into the client API to read profiles failed.
+  EVENT_READ_FAILURE,
+  // Trying to bring back a scan head that kept failing or stalling failed.
+  EVENT_RECOVERY_FAILURE,
+  // A scan head that kept failing or stalling is delivering again.
+  EVENT_RECOVERED,
+  EVENT_TYPE_COUNT
+};
+
+struct Event {
+  uint64_t time_ns;
+  uint32_t source;
+  EventType type;
+  int32_t value;
+};
+
+class EventLog {
+public:
+  /**
+   * @brief Creates a log for `num_sources` independent event sources, such
+   * as one per scan head. Each source may only be recorded to from a single
+   * thread at a time.
+   */
+  explicit EventLog(uint32_t num_sources);
+  ~EventLog();
+
+  EventLog(const EventLog &) = delete;
+  EventLog &operator=(const EventLog &) = delete;
+
+  /**
+   * @brief Counts an event and queues it for the background thread. Never
+   * blocks; if the queue is full, the event is counted but not queued.
+   *
+   * @param value Event specific detail, such as an error code or a number of
+   * profiles.
+   */
+  void record(uint32_t source, EventType type, int32_t value = 0);
+
+  /**
+   * @brief Only counts an event, for those too frequent and too routine to
+   * list among the recent events, like empty polls; an idle scan head would
+   * otherwise push everything else out of the list within seconds.
+   */
+  void count(uint32_t source, EventType type);
+
+  uint64_t get_count(uint32_t source, EventType type) const;
+
+  uint32_t get_num_sources() const
+  {
+    return static_cast<uint32_t>(sources.size());
+  }
+
+  /**
+   * @brief Copies the most recent events, oldest first.
+   */
+  void get_recent(std::vector<Event> &events) const;
+
+  /**
+   * @brief Enables echoing events to the console, printing at most
+   * `max_lines_per_sec` lines per second. Events beyond that are summarized.
+   */
+  void set_console_output(bool is_enabled, uint32_t max_lines_per_sec = 5);
+
+  bool is_console_output() const
+  {
+    return is_console_enabled.load(std::memory_order_relaxed);
+  }
+
+  static const char *get_type_name(EventType type);
+
+private:
+  struct Source {
+    Source() : queue(256) {}
+    std::atomic<uint64_t> counts[EVENT_TYPE_COUNT] = {};
+    SpscRing<Event> queue;
+  };
+
+  void run();
+  void print(const Event &event);
+
+  std::vector<std::unique_ptr<Source>> sources;
+  std::deque<Event> recent;
+  mutable std::mutex recent_mutex;
+  std::atomic<bool> is_console_enabled{false};
+  std::atomic<uint32_t> console_rate{5};
+  std::atomic<bool> is_running{true};
+  std::thread thread;
+};
+
+#endif
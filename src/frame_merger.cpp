@@ -0,0 +1,306 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "frame_merger.hpp"
+#include <algorithm>
+
+// Frames the reorder buffer holds on top of a batch's worth, for the other
+// scan heads to still be on the frames before it.
+static const uint32_t kSpareFrames = 4;
+// A frame missing the profile of a camera that hasn't delivered anything
+// for this many scan periods is dropped; a little more than the one period
+// between profiles, for the receivers' scheduling.
+static const uint64_t kSilentPeriods = 2;
+static const uint64_t kMinSilentNs = 5000000;
+// A camera that hasn't delivered anything for this many scan periods is no
+// longer waited for at all, and frames complete without it.
+static const uint64_t kForgetPeriods = 20;
+static const uint64_t kMinForgetNs = 20000000;
+
+FrameMerger::FrameMerger(uint32_t num_heads, double scan_rate_hz,
+                         uint32_t max_batch)
+  : num_heads(num_heads),
+    pending(max_batch + kSpareFrames),
+    cameras(num_heads * kCamerasPerHead)
+{
+  for (auto &frame : pending) {
+    frame.profiles.resize(num_heads * kCamerasPerHead);
+  }
+  reset(scan_rate_hz);
+}
+
+uint32_t FrameMerger::get_held_profiles() const
+{
+  // Every frame waiting, plus the three of the triple buffer.
+  return (static_cast<uint32_t>(pending.size()) + 3) * kCamerasPerHead;
+}
+
+void FrameMerger::reset(double scan_rate_hz)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &frame : pending) {
+    for (auto &profile : frame.profiles) {
+      profile.reset();
+    }
+    frame.is_open = false;
+  }
+  open_count = 0;
+  is_closed_valid = false;
+  // Every camera is waited for until it has been quiet for a while, so that
+  // the first frames aren't published before the slower cameras start.
+  for (auto &camera : cameras) {
+    camera = Camera();
+    camera.is_expected = true;
+  }
+  expected_count = static_cast<uint32_t>(cameras.size());
+  has_arrival = false;
+  period_ns = (0.0 < scan_rate_hz) ?
+                static_cast<uint64_t>(1.0e9 / scan_rate_hz) :
+                0;
+}
+
+void FrameMerger::add(uint32_t id, const ProfileHandle *profiles,
+                      uint32_t count)
+{
+  if (!is_enabled.load(std::memory_order_relaxed) || (num_heads <= id)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  // Taken under the lock, so that it never goes back between receivers.
+  uint64_t now_ns = get_time_ns();
+  if (!has_arrival || (get_forget_ns() < now_ns - last_arrival_ns)) {
+    // Nothing arrived for a while, as when a replay was paused, so none of
+    // the cameras has been any quieter than the others.
+    for (auto &c : cameras) {
+      c.last_arrival_ns = now_ns;
+    }
+    has_arrival = true;
+  }
+  last_arrival_ns = now_ns;
+  for (uint32_t n = 0; n < count; n++) {
+    uint32_t camera = static_cast<uint32_t>(profiles[n]->camera);
+    if (camera < kCamerasPerHead) {
+      add_profile(id * kCamerasPerHead + camera, profiles[n], now_ns);
+    }
+  }
+  expire(now_ns);
+}
+
+void FrameMerger::add_profile(uint32_t index, const ProfileHandle &profile,
+                              uint64_t now_ns)
+{
+  const uint32_t sequence_number = profile->sequence_number;
+  const uint64_t timestamp_ns = profile->timestamp_ns;
+  Camera &camera = cameras[index];
+  if (camera.has_sequence) {
+    // Sequence numbers wrap around, so they are compared by difference. A
+    // camera going back means scanning started over, as when a replay
+    // loops.
+    if (0 <= static_cast<int32_t>(camera.last_sequence - sequence_number)) {
+      close_all(now_ns);
+      for (auto &c : cameras) {
+        c.has_sequence = false;
+      }
+      is_closed_valid = false;
+    } else {
+      close_skipped(index, camera.last_sequence + 1, sequence_number, now_ns);
+    }
+  }
+  camera.has_sequence = true;
+  camera.last_sequence = sequence_number;
+
+  camera.last_arrival_ns = now_ns;
+  if (!camera.is_expected) {
+    camera.is_expected = true;
+    expected_count++;
+  }
+
+  const uint32_t depth = static_cast<uint32_t>(pending.size());
+  Pending *frame = &pending[sequence_number % depth];
+  if (!frame->is_open || (sequence_number != frame->sequence_number)) {
+    if (is_closed_valid &&
+        (0 <= static_cast<int32_t>(newest_closed - sequence_number))) {
+      profiles_late.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    if (frame->is_open) {
+      if (0 < static_cast<int32_t>(frame->sequence_number -
+                                   sequence_number)) {
+        // Its frame was dropped to make room for a newer one.
+        profiles_late.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      // Make room by dropping the frame a whole buffer older.
+      close(*frame, false, now_ns);
+    }
+    frame->is_open = true;
+    frame->sequence_number = sequence_number;
+    frame->timestamp_ns = timestamp_ns;
+    frame->first_ns = now_ns;
+    frame->count = 0;
+    open_count++;
+    if (max_depth.load(std::memory_order_relaxed) < open_count) {
+      max_depth.store(open_count, std::memory_order_relaxed);
+    }
+  }
+
+  if (!frame->profiles[index]) {
+    frame->count++;
+  }
+  frame->profiles[index] = profile;
+  frame->timestamp_ns = std::min(frame->timestamp_ns, timestamp_ns);
+  if (frame->count < expected_count) {
+    return;
+  }
+
+  // Every camera has moved past the older frames, so whatever they are
+  // missing is never going to arrive.
+  close_older(sequence_number, now_ns);
+  close(*frame, true, now_ns);
+}
+
+void FrameMerger::close(Pending &frame, bool is_complete, uint64_t now_ns)
+{
+  if (is_complete) {
+    // Each of the three buffers grows to size once, the first time it is
+    // published.
+    MergedFrame &out = frames.back();
+    out.profiles.resize(frame.profiles.size());
+    out.sequence_number = frame.sequence_number;
+    out.timestamp_ns = frame.timestamp_ns;
+    for (size_t n = 0; n < frame.profiles.size(); n++) {
+      out.profiles[n] = std::move(frame.profiles[n]);
+    }
+    frames.publish();
+    frames_merged.fetch_add(1, std::memory_order_relaxed);
+    wait_time_ns.record(now_ns - frame.first_ns);
+    if (period_ns < now_ns - frame.first_ns) {
+      frames_slow.fetch_add(1, std::memory_order_relaxed);
+    }
+  } else {
+    for (auto &profile : frame.profiles) {
+      profile.reset();
+    }
+    frames_incomplete.fetch_add(1, std::memory_order_relaxed);
+  }
+  frame.is_open = false;
+  open_count--;
+  if (!is_closed_valid ||
+      (0 < static_cast<int32_t>(frame.sequence_number - newest_closed))) {
+    newest_closed = frame.sequence_number;
+    is_closed_valid = true;
+  }
+}
+
+void FrameMerger::close_skipped(uint32_t index, uint32_t from, uint32_t to,
+                                uint64_t now_ns)
+{
+  // Camera `index` went from `from - 1` straight to `to`, without a profile
+  // for the frames in between. Usually there are none.
+  if (static_cast<uint32_t>(pending.size()) < to - from) {
+    for (auto &frame : pending) {
+      if (frame.is_open && !frame.profiles[index] &&
+          (0 > static_cast<int32_t>(frame.sequence_number - to))) {
+        close(frame, false, now_ns);
+      }
+    }
+    return;
+  }
+  for (uint32_t sequence_number = from; sequence_number != to;
+       sequence_number++) {
+    Pending &frame = pending[sequence_number % pending.size()];
+    if (frame.is_open && (sequence_number == frame.sequence_number) &&
+        !frame.profiles[index]) {
+      close(frame, false, now_ns);
+    }
+  }
+}
+
+void FrameMerger::close_older(uint32_t sequence_number, uint64_t now_ns)
+{
+  for (auto &frame : pending) {
+    if (frame.is_open && (0 > static_cast<int32_t>(frame.sequence_number -
+                                                   sequence_number))) {
+      close(frame, false, now_ns);
+    }
+  }
+}
+
+void FrameMerger::close_all(uint64_t now_ns)
+{
+  for (auto &frame : pending) {
+    if (frame.is_open) {
+      close(frame, false, now_ns);
+    }
+  }
+}
+
+uint64_t FrameMerger::get_forget_ns() const
+{
+  return std::max(kForgetPeriods * period_ns, kMinForgetNs);
+}
+
+void FrameMerger::expire(uint64_t now_ns)
+{
+  // Only whether a camera's receiver is still delivering counts, not how
+  // far ahead the others are: one catching up hands over a whole batch of
+  // newer profiles at once, while the others' profiles of the same scans
+  // are still on their way.
+  const uint64_t silent_ns = std::max(kSilentPeriods * period_ns,
+                                      kMinSilentNs);
+  const uint64_t forget_ns = get_forget_ns();
+  bool is_forgotten = false;
+  bool is_silent = false;
+  for (auto &camera : cameras) {
+    if (!camera.is_expected || (now_ns - camera.last_arrival_ns <= silent_ns)) {
+      continue;
+    }
+    if (forget_ns < now_ns - camera.last_arrival_ns) {
+      camera.is_expected = false;
+      expected_count--;
+      is_forgotten = true;
+    } else {
+      is_silent = true;
+    }
+  }
+
+  if (is_forgotten) {
+    // The frames that were only waiting for a forgotten camera are
+    // complete now; publish the newest of them.
+    Pending *newest = nullptr;
+    for (auto &frame : pending) {
+      if (frame.is_open && (expected_count <= frame.count) &&
+          ((nullptr == newest) ||
+           (0 < static_cast<int32_t>(frame.sequence_number -
+                                     newest->sequence_number)))) {
+        newest = &frame;
+      }
+    }
+    if (nullptr != newest) {
+      close_older(newest->sequence_number, now_ns);
+      close(*newest, true, now_ns);
+    }
+  }
+  if (!is_silent) {
+    return;
+  }
+
+  // Frames aren't held back for a camera that has gone quiet.
+  for (auto &frame : pending) {
+    if (!frame.is_open) {
+      continue;
+    }
+    for (size_t n = 0; n < cameras.size(); n++) {
+      const Camera &camera = cameras[n];
+      if (camera.is_expected && !frame.profiles[n] &&
+          (silent_ns < now_ns - camera.last_arrival_ns)) {
+        close(frame, false, now_ns);
+        break;
+      }
+    }
+  }
+}
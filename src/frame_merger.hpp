@@ -0,0 +1,215 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file frame_merger.hpp
+ * @brief Groups the profiles all scan heads took at the same scan into
+ * frames.
+ *
+ * Every receiver drains its scan head on its own, so the newest profiles of
+ * different scan heads are usually from different scans; with a log moving
+ * past, the live view then shows its sides at different positions. The
+ * merger collects the profiles of every camera taken at one scan, matched by
+ * sequence number, which the scan system starts together on every scan
+ * head, and only hands out a frame once it has all of them.
+ *
+ * Profiles come in from the receiver threads and wait in a reorder buffer of
+ * frames, indexed by sequence number. A frame is published the moment its
+ * last profile arrives. Every camera delivers its profiles in order, so once
+ * a camera has delivered a later profile, a frame still missing its profile
+ * is never going to complete and is dropped, as are any older than a frame
+ * that completed. A camera that has delivered nothing for two scan periods,
+ * or 5 ms at high scan rates, isn't waited for either, so a camera that
+ * stops holds frames back by no more than that; after twenty periods,
+ * frames complete without it.
+ *
+ * A frame is held back by less than a scan period only while the receivers
+ * keep up. One catching up hands over a whole batch at once, running that
+ * many frames ahead of the others, and its frames then wait for the others
+ * to catch up too, up to a batch's worth of scan periods, rather than being
+ * dropped; the buffer has room for that many frames. The Metrics window
+ * shows how many frames waited longer than a period. Profiles that arrive
+ * for a frame that was dropped or already published are late, and dropped
+ * as well. The frames hold handles to the receivers' pools, none of the
+ * profiles are copied.
+ */
+#ifndef SCAN_GUI_FRAME_MERGER_HPP
+#define SCAN_GUI_FRAME_MERGER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "metrics.hpp"
+#include "profile_pool.hpp"
+#include "profile_receiver.hpp"
+#include "triple_buffer.hpp"
+
+/**
+ * @brief The profiles of every camera from one scan.
+ */
+struct MergedFrame {
+  uint32_t sequence_number = 0;
+  // Earliest timestamp of the frame's profiles.
+  uint64_t timestamp_ns = 0;
+  // Indexed by `scan_head_id * kCamerasPerHead + camera`; empty for cameras
+  // that aren't delivering profiles.
+  std::vector<ProfileHandle> profiles;
+};
+
+class FrameMerger {
+public:
+  /**
+   * @param max_batch Most profiles a receiver reads at once, the size of
+   * `BatchReadConfig::max_batch`; the buffer holds that many frames and a
+   * few more before the oldest is dropped to make room for another.
+   */
+  FrameMerger(uint32_t num_heads, double scan_rate_hz, uint32_t max_batch);
+
+  FrameMerger(const FrameMerger &) = delete;
+  FrameMerger &operator=(const FrameMerger &) = delete;
+
+  /**
+   * @brief Most profiles from a single receiver the merger can hold on to
+   * at once, for sizing the receivers' pools.
+   */
+  uint32_t get_held_profiles() const;
+
+  /**
+   * @brief Turns merging on or off; while off, `add` returns right away.
+   */
+  void set_enabled(bool is_enabled)
+  {
+    this->is_enabled.store(is_enabled, std::memory_order_relaxed);
+  }
+
+  bool get_enabled() const
+  {
+    return is_enabled.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Drops every frame waiting and forgets which cameras deliver
+   * profiles, for when scanning starts over. No receiver may be adding
+   * meanwhile.
+   */
+  void reset(double scan_rate_hz);
+
+  /**
+   * @brief Adds profiles of scan head `id`. Called from that scan head's
+   * receiver thread; the receivers of different scan heads call it
+   * concurrently.
+   */
+  void add(uint32_t id, const ProfileHandle *profiles, uint32_t count);
+
+  /**
+   * @brief The most recent complete frame. Only a single consumer thread
+   * may read from it.
+   */
+  TripleBuffer<MergedFrame> &get_frames()
+  {
+    return frames;
+  }
+
+  uint64_t get_frames_merged() const
+  {
+    return frames_merged.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Frames dropped because a profile never arrived.
+   */
+  uint64_t get_frames_incomplete() const
+  {
+    return frames_incomplete.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Frames published more than a scan period after their first
+   * profile arrived.
+   */
+  uint64_t get_frames_slow() const
+  {
+    return frames_slow.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Profiles dropped because their frame was already done with.
+   */
+  uint64_t get_profiles_late() const
+  {
+    return profiles_late.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Most frames that were waiting at once since the previous call.
+   */
+  uint32_t take_max_depth()
+  {
+    return max_depth.exchange(0, std::memory_order_relaxed);
+  }
+
+  // Time from a frame's first profile arriving to its last.
+  Histogram wait_time_ns;
+
+private:
+  struct Pending {
+    bool is_open = false;
+    uint32_t sequence_number = 0;
+    uint64_t timestamp_ns = 0;
+    uint64_t first_ns = 0;
+    uint32_t count = 0;
+    std::vector<ProfileHandle> profiles;
+  };
+
+  struct Camera {
+    // Once a camera has been quiet for long enough, it is no longer waited
+    // for. Frames are complete once every camera waited for has a profile
+    // in them.
+    bool is_expected = false;
+    bool has_sequence = false;
+    uint32_t last_sequence = 0;
+    // When its receiver last handed over a profile.
+    uint64_t last_arrival_ns = 0;
+  };
+
+  void add_profile(uint32_t index, const ProfileHandle &profile,
+                   uint64_t now_ns);
+  void close(Pending &frame, bool is_complete, uint64_t now_ns);
+  void close_skipped(uint32_t index, uint32_t from, uint32_t to,
+                     uint64_t now_ns);
+  void close_older(uint32_t sequence_number, uint64_t now_ns);
+  void close_all(uint64_t now_ns);
+  uint64_t get_forget_ns() const;
+  void expire(uint64_t now_ns);
+
+  const uint32_t num_heads;
+  std::atomic<bool> is_enabled{false};
+  std::mutex mutex;
+  uint64_t period_ns = 0;
+  // Reorder buffer of frames waiting for profiles, a frame at
+  // `sequence_number % pending.size()`.
+  std::vector<Pending> pending;
+  uint32_t open_count = 0;
+  // Newest frame published or dropped; profiles of it or older are late.
+  uint32_t newest_closed = 0;
+  bool is_closed_valid = false;
+  std::vector<Camera> cameras;
+  uint32_t expected_count = 0;
+  // When any receiver last handed over profiles.
+  uint64_t last_arrival_ns = 0;
+  bool has_arrival = false;
+  TripleBuffer<MergedFrame> frames;
+  std::atomic<uint64_t> frames_merged{0};
+  std::atomic<uint64_t> frames_incomplete{0};
+  std::atomic<uint64_t> frames_slow{0};
+  std::atomic<uint64_t> profiles_late{0};
+  std::atomic<uint32_t> max_depth{0};
+};
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "frame_pacer.hpp"
+#include <chrono>
+#include <thread>
+#include <GLFW/glfw3.h>
+#include "metrics.hpp"
+
+// Even with nothing new, a frame is drawn this often so that things like
+// connection status and clocks stay current.
+static const double kIdleRedrawS = 0.25;
+// How long frames keep being drawn after input.
+static const uint64_t kInputActiveNs = 250000000;
+
+void FramePacer::process(uint32_t, const jsProfile *, uint32_t)
+{
+  notify();
+}
+
+void FramePacer::notify()
+{
+  // Only the first notification after a frame posts an event, so that busy
+  // receivers don't flood the event queue.
+  if (!has_news.exchange(true, std::memory_order_acq_rel)) {
+    glfwPostEmptyEvent();
+  }
+}
+
+void FramePacer::wait()
+{
+  // Hold off until the frame interval has passed. Input that comes in
+  // meanwhile waits in the event queue for the next frame.
+  if (0.0 < max_fps) {
+    uint64_t interval_ns = static_cast<uint64_t>(1.0e9 / max_fps);
+    uint64_t now_ns = get_time_ns();
+    if (now_ns < last_frame_ns + interval_ns) {
+      std::this_thread::sleep_for(
+        std::chrono::nanoseconds(last_frame_ns + interval_ns - now_ns));
+    }
+  }
+
+  if (is_idle_throttling && !has_news.load(std::memory_order_acquire) &&
+      (get_time_ns() >= active_until_ns)) {
+    // Nothing to draw. Sleep until the receivers have new profiles, the
+    // user does something, or it's time for an idle redraw; the first two
+    // post an event, which ends the wait early.
+    uint64_t start_ns = get_time_ns();
+    glfwWaitEventsTimeout(kIdleRedrawS);
+    uint64_t waited_ns = get_time_ns() - start_ns;
+    if (!has_news.load(std::memory_order_acquire) &&
+        (waited_ns < static_cast<uint64_t>(kIdleRedrawS * 1.0e9))) {
+      active_until_ns = get_time_ns() + kInputActiveNs;
+    }
+  }
+
+  has_news.store(false, std::memory_order_release);
+  last_frame_ns = get_time_ns();
+  frame_count++;
+}
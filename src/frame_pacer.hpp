@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file frame_pacer.hpp
+ * @brief Decides when the GUI draws its next frame.
+ *
+ * Left to itself, the application draws frames back to back, keeping a core
+ * busy even when there is nothing new to show. The pacer instead holds the
+ * GUI thread back until there is a reason to draw: the receivers have new
+ * profiles, the user did something, or a while has passed. Frames are also
+ * capped at a maximum rate instead of relying on vsync, so that many
+ * instances open at once leave the CPU and GPU to the receiver threads.
+ *
+ * The pacer runs as a receiver stage to learn about new profiles, and wakes
+ * the GUI thread by posting an empty event to GLFW, which also wakes up for
+ * input.
+ */
+#ifndef SCAN_GUI_FRAME_PACER_HPP
+#define SCAN_GUI_FRAME_PACER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <joescan_pinchot.h>
+#include "profile_stage.hpp"
+
+class FramePacer : public ProfileStage {
+public:
+  /**
+   * @brief Notes that there are new profiles to draw. Called on the
+   * receiver threads.
+   */
+  void process(uint32_t id, const jsProfile *profiles,
+               uint32_t count) override;
+
+  const char *get_stage_name() const override
+  {
+    return "pace";
+  }
+
+  /**
+   * @brief Asks for a frame to be drawn from any thread, for changes the
+   * pacer doesn't otherwise learn about.
+   */
+  void notify();
+
+  /**
+   * @brief Blocks the GUI thread until the next frame is due. Called once
+   * per frame, before anything is drawn.
+   */
+  void wait();
+
+  /**
+   * @brief Caps the frame rate; zero draws frames as fast as they come.
+   */
+  void set_max_fps(double fps)
+  {
+    max_fps = (0.0 < fps) ? fps : 0.0;
+  }
+
+  double get_max_fps() const
+  {
+    return max_fps;
+  }
+
+  /**
+   * @brief With idle throttling, frames are only drawn when there is
+   * something new to show; otherwise every frame is drawn, up to the
+   * maximum rate.
+   */
+  void set_idle_throttling(bool is_enabled)
+  {
+    is_idle_throttling = is_enabled;
+  }
+
+  bool is_idle_throttling_enabled() const
+  {
+    return is_idle_throttling;
+  }
+
+  /**
+   * @brief Number of frames drawn so far.
+   */
+  uint64_t get_frame_count() const
+  {
+    return frame_count;
+  }
+
+private:
+  std::atomic<bool> has_news{false};
+  double max_fps = 60.0;
+  bool is_idle_throttling = true;
+  uint64_t last_frame_ns = 0;
+  // Frames keep being drawn until then after input, so that ImGui gets to
+  // act on it and finish whatever it started.
+  uint64_t active_until_ns = 0;
+  uint64_t frame_count = 0;
+};
+
+#endif
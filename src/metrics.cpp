@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "metrics.hpp"
+
+uint32_t Histogram::get_bucket(uint64_t value)
+{
+  // Values below kSubBuckets get a bucket each; above that, the bucket is the
+  // position of the highest set bit plus the next three bits below it.
+  if (value < kSubBuckets) {
+    return static_cast<uint32_t>(value);
+  }
+  uint32_t msb = 63;
+  while (0 == (value >> msb)) {
+    msb--;
+  }
+  uint32_t sub = static_cast<uint32_t>(value >> (msb - 3)) & (kSubBuckets - 1);
+  return (msb - 2) * kSubBuckets + sub;
+}
+
+uint64_t Histogram::get_bucket_value(uint32_t bucket)
+{
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  uint32_t msb = bucket / kSubBuckets + 2;
+  uint64_t sub = bucket % kSubBuckets;
+  // Report the middle of the bucket's range.
+  uint64_t low = (kSubBuckets + sub) << (msb - 3);
+  return low + ((1ULL << (msb - 3)) >> 1);
+}
+
+void Histogram::record(uint64_t value)
+{
+  counts[get_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t current = max.load(std::memory_order_relaxed);
+  while ((value > current) &&
+         !max.compare_exchange_weak(current, value,
+                                    std::memory_order_relaxed)) {
+  }
+}
+
+Histogram::Summary Histogram::take_interval()
+{
+  uint64_t interval[kBuckets];
+  Summary summary;
+
+  for (uint32_t n = 0; n < kBuckets; n++) {
+    uint64_t c = counts[n].load(std::memory_order_relaxed);
+    interval[n] = c - previous[n];
+    previous[n] = c;
+    summary.count += interval[n];
+  }
+  summary.max = max.exchange(0, std::memory_order_relaxed);
+  if (0 == summary.count) {
+    return summary;
+  }
+
+  uint64_t p50_rank = (summary.count + 1) / 2;
+  uint64_t p99_rank = summary.count - summary.count / 100;
+  uint64_t seen = 0;
+  bool has_p50 = false;
+  for (uint32_t n = 0; n < kBuckets; n++) {
+    seen += interval[n];
+    if (!has_p50 && (seen >= p50_rank)) {
+      summary.p50 = get_bucket_value(n);
+      has_p50 = true;
+    }
+    if (seen >= p99_rank) {
+      summary.p99 = get_bucket_value(n);
+      break;
+    }
+  }
+
+  // Bucket midpoints can overshoot the true maximum.
+  if (summary.p99 > summary.max) {
+    summary.p99 = summary.max;
+  }
+  if (summary.p50 > summary.max) {
+    summary.p50 = summary.max;
+  }
+  return summary;
+}
+
+void WindowedMin::update(int64_t sample, uint64_t now_ns)
+{
+  if (now_ns - window_start_ns >= window_ns) {
+    previous = current;
+    has_previous = has_current;
+    has_current = false;
+    window_start_ns = now_ns;
+  }
+  if (!has_current || (sample < current)) {
+    current = sample;
+    has_current = true;
+  }
+
+  int64_t m = current;
+  if (has_previous && (previous < m)) {
+    m = previous;
+  }
+  value.store(m, std::memory_order_relaxed);
+  has_value.store(true, std::memory_order_relaxed);
+}
+
+ScrollingSeries::ScrollingSeries(uint32_t capacity) : capacity(capacity)
+{
+  time.reserve(capacity);
+  value.reserve(capacity);
+}
+
+void ScrollingSeries::add(float t, float v)
+{
+  if (time.size() < capacity) {
+    time.push_back(t);
+    value.push_back(v);
+  } else {
+    time[offset] = t;
+    value[offset] = v;
+    offset = (offset + 1) % capacity;
+  }
+}
@@ -0,0 +1,196 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file metrics.hpp
+ * @brief Low overhead throughput and timing instrumentation.
+ *
+ * Recording a sample is a handful of relaxed atomic operations, so the
+ * metrics can stay enabled on the acquisition threads at full scan rate. A
+ * single reader, normally the GUI, periodically summarizes what has been
+ * recorded since it last looked.
+ */
+#ifndef SCAN_GUI_METRICS_HPP
+#define SCAN_GUI_METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Returns the host's monotonic clock in nanoseconds.
+ */
+inline uint64_t get_time_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+    .count();
+}
+
+/**
+ * @brief Histogram of durations or other non-negative values, bucketed
+ * logarithmically with eight buckets per power of two; percentiles are
+ * accurate to within about 10%. Any number of threads may record, but only
+ * one may call `take_interval`.
+ */
+class Histogram {
+public:
+  struct Summary {
+    uint64_t count = 0;
+    uint64_t p50 = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+  };
+
+  void record(uint64_t value);
+
+  /**
+   * @brief Summarizes the values recorded since the previous call.
+   */
+  Summary take_interval();
+
+private:
+  static const uint32_t kSubBuckets = 8;
+  static const uint32_t kBuckets = 64 * kSubBuckets;
+
+  static uint32_t get_bucket(uint64_t value);
+  static uint64_t get_bucket_value(uint32_t bucket);
+
+  std::atomic<uint64_t> counts[kBuckets] = {};
+  std::atomic<uint64_t> max{0};
+  // Reader side copy of the counts at the previous call to `take_interval`.
+  uint64_t previous[kBuckets] = {};
+};
+
+/**
+ * @brief Measures the time from construction to destruction into a
+ * histogram.
+ */
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Histogram &histogram)
+    : histogram(histogram),
+      start_ns(get_time_ns())
+  {
+  }
+
+  ~ScopedTimer()
+  {
+    histogram.record(get_time_ns() - start_ns);
+  }
+
+private:
+  Histogram &histogram;
+  uint64_t start_ns;
+};
+
+/**
+ * @brief Tracks the smallest value seen over a sliding window of roughly
+ * `window_ns`, by keeping the minimum of the current and previous window.
+ * Only a single thread may call `update`.
+ */
+class WindowedMin {
+public:
+  explicit WindowedMin(uint64_t window_ns) : window_ns(window_ns) {}
+
+  void update(int64_t value, uint64_t now_ns);
+
+  int64_t get() const
+  {
+    return value.load(std::memory_order_relaxed);
+  }
+
+  bool is_valid() const
+  {
+    return has_value.load(std::memory_order_relaxed);
+  }
+
+private:
+  uint64_t window_ns;
+  uint64_t window_start_ns = 0;
+  int64_t current = 0;
+  int64_t previous = 0;
+  bool has_current = false;
+  bool has_previous = false;
+  std::atomic<int64_t> value{0};
+  std::atomic<bool> has_value{false};
+};
+
+// Receiver stages timed on their own; any beyond these aren't timed.
+static const uint32_t kMaxTimedStages = 4;
+
+/**
+ * @brief Instrumentation for a single scan head's acquisition path.
+ */
+struct HeadMetrics {
+  std::atomic<uint64_t> profiles_received{0};
+  std::atomic<uint64_t> profiles_dropped{0};
+  // Points carried by the profiles received; unlike the profile count this
+  // shows what the data format costs.
+  std::atomic<uint64_t> points_received{0};
+  // Profiles waiting in the client API at the last poll.
+  std::atomic<int32_t> queue_depth{0};
+  // Time spent inside `jsScanHeadGetProfiles`.
+  Histogram read_time_ns;
+  // Time spent cropping profiles to the region of interest, per batch.
+  Histogram crop_time_ns;
+  // Time the GUI spends converting profiles into the persistence history
+  // and the waterfall.
+  Histogram convert_time_ns;
+  // Time spent in each of the receiver's processing stages, per batch, in
+  // the order they were added.
+  Histogram stage_time_ns[kMaxTimedStages];
+  // Sensor timestamp to screen, relative to the lowest transport delay seen.
+  Histogram latency_ns;
+  // Host receive time minus sensor timestamp. The scan head's clock isn't
+  // synchronized to the host, so the minimum over time is used as the
+  // baseline for latency.
+  WindowedMin clock_offset_ns{10000000000ULL};
+};
+
+/**
+ * @brief Fixed size buffer of (time, value) samples for rolling line plots.
+ * Once full, new samples overwrite the oldest ones.
+ */
+class ScrollingSeries {
+public:
+  explicit ScrollingSeries(uint32_t capacity = 240);
+
+  void add(float time, float value);
+
+  const float *get_time() const
+  {
+    return time.data();
+  }
+
+  const float *get_value() const
+  {
+    return value.data();
+  }
+
+  /**
+   * @brief Index of the oldest sample, for passing as ImPlot's offset.
+   */
+  int get_offset() const
+  {
+    return static_cast<int>(offset);
+  }
+
+  int get_size() const
+  {
+    return static_cast<int>(time.size());
+  }
+
+private:
+  uint32_t capacity;
+  uint32_t offset = 0;
+  std::vector<float> time;
+  std::vector<float> value;
+};
+
+#endif
@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "net_socket.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Buffers handed to the operating system per call; Linux allows 1024.
+static const uint32_t kMaxBuffersPerSend = 64;
+
+bool net_init()
+{
+#if defined(_WIN32)
+  WSADATA data;
+  return 0 == WSAStartup(MAKEWORD(2, 2), &data);
+#else
+  return true;
+#endif
+}
+
+/**
+ * @brief Profiles are sent as soon as they are ready; waiting to fill whole
+ * packets would only add latency.
+ */
+static void set_no_delay(net_socket_t socket)
+{
+  int one = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY,
+             reinterpret_cast<const char *>(&one), sizeof(one));
+}
+
+net_socket_t net_listen(uint16_t port)
+{
+  net_socket_t listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (kInvalidSocket == listener) {
+    return kInvalidSocket;
+  }
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR,
+             reinterpret_cast<const char *>(&one), sizeof(one));
+
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if ((0 != bind(listener, reinterpret_cast<const sockaddr *>(&addr),
+                 sizeof(addr))) ||
+      (0 != listen(listener, SOMAXCONN))) {
+    net_close(listener);
+    return kInvalidSocket;
+  }
+  return listener;
+}
+
+net_socket_t net_accept(net_socket_t listener, uint32_t timeout_ms)
+{
+  fd_set set;
+  FD_ZERO(&set);
+  FD_SET(listener, &set);
+  timeval timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+  // The first argument is ignored by Winsock.
+  if (0 >= select(static_cast<int>(listener) + 1, &set, nullptr, nullptr,
+                  &timeout)) {
+    return kInvalidSocket;
+  }
+
+  net_socket_t socket = accept(listener, nullptr, nullptr);
+  if (kInvalidSocket != socket) {
+    set_no_delay(socket);
+  }
+  return socket;
+}
+
+net_socket_t net_connect(const std::string &host, uint16_t port)
+{
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  addrinfo *results = nullptr;
+  std::string service = std::to_string(port);
+  if (0 != getaddrinfo(host.c_str(), service.c_str(), &hints, &results)) {
+    return kInvalidSocket;
+  }
+
+  net_socket_t connected = kInvalidSocket;
+  for (addrinfo *a = results; nullptr != a; a = a->ai_next) {
+    net_socket_t s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (kInvalidSocket == s) {
+      continue;
+    }
+    if (0 == connect(s, a->ai_addr, static_cast<int>(a->ai_addrlen))) {
+      connected = s;
+      break;
+    }
+    net_close(s);
+  }
+  freeaddrinfo(results);
+
+  if (kInvalidSocket != connected) {
+    set_no_delay(connected);
+  }
+  return connected;
+}
+
+bool net_send(net_socket_t socket, const NetBuffer *buffers, uint32_t count)
+{
+  // Whatever part of the buffers a call didn't get to is sent by the next.
+  size_t skip = 0;
+  while (0 < count) {
+    uint32_t n = std::min(count, kMaxBuffersPerSend);
+#if defined(_WIN32)
+    WSABUF bufs[kMaxBuffersPerSend];
+    for (uint32_t k = 0; k < n; k++) {
+      bufs[k].buf = const_cast<char *>(
+        static_cast<const char *>(buffers[k].data) + ((0 == k) ? skip : 0));
+      bufs[k].len = static_cast<ULONG>(buffers[k].size - ((0 == k) ? skip : 0));
+    }
+    DWORD sent = 0;
+    if (0 != WSASend(socket, bufs, n, &sent, 0, nullptr, nullptr)) {
+      return false;
+    }
+    size_t remaining = sent;
+#else
+    iovec bufs[kMaxBuffersPerSend];
+    for (uint32_t k = 0; k < n; k++) {
+      bufs[k].iov_base = const_cast<char *>(
+        static_cast<const char *>(buffers[k].data) + ((0 == k) ? skip : 0));
+      bufs[k].iov_len = buffers[k].size - ((0 == k) ? skip : 0);
+    }
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = bufs;
+    msg.msg_iovlen = n;
+    // A viewer going away must not take the whole process down with it.
+#if defined(MSG_NOSIGNAL)
+    ssize_t sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+#else
+    ssize_t sent = sendmsg(socket, &msg, 0);
+#endif
+    if (0 > sent) {
+      return false;
+    }
+    size_t remaining = static_cast<size_t>(sent);
+#endif
+
+    while ((0 < count) && (buffers->size - skip <= remaining)) {
+      remaining -= buffers->size - skip;
+      skip = 0;
+      buffers++;
+      count--;
+    }
+    skip += remaining;
+  }
+  return true;
+}
+
+bool net_receive(net_socket_t socket, void *data, size_t size)
+{
+  char *dst = static_cast<char *>(data);
+  while (0 < size) {
+    int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+    auto got = recv(socket, dst, chunk, 0);
+    if (0 >= got) {
+      return false;
+    }
+    dst += got;
+    size -= static_cast<size_t>(got);
+  }
+  return true;
+}
+
+void net_shutdown(net_socket_t socket)
+{
+#if defined(_WIN32)
+  shutdown(socket, SD_BOTH);
+#else
+  shutdown(socket, SHUT_RDWR);
+#endif
+}
+
+void net_close(net_socket_t socket)
+{
+#if defined(_WIN32)
+  closesocket(socket);
+#else
+  close(socket);
+#endif
+}
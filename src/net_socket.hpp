@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file net_socket.hpp
+ * @brief The little of BSD sockets and Winsock the profile stream needs.
+ *
+ * Both are close enough that a handful of functions cover the difference:
+ * opening and closing sockets, and sending and receiving whole buffers.
+ * Sending takes a list of buffers, gathered by the operating system, so data
+ * can go out straight from where it already is.
+ */
+#ifndef SCAN_GUI_NET_SOCKET_HPP
+#define SCAN_GUI_NET_SOCKET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(_WIN32)
+typedef uintptr_t net_socket_t;
+static const net_socket_t kInvalidSocket = ~net_socket_t(0);
+#else
+typedef int net_socket_t;
+static const net_socket_t kInvalidSocket = -1;
+#endif
+
+/**
+ * @brief One of the buffers `net_send` gathers from.
+ */
+struct NetBuffer {
+  const void *data;
+  size_t size;
+};
+
+/**
+ * @brief Sets up the socket library; needed once before any other call on
+ * Windows, and harmless elsewhere.
+ *
+ * @return `false` if sockets can't be used.
+ */
+bool net_init();
+
+/**
+ * @brief Opens a socket listening for connections on `port`, on every
+ * interface.
+ *
+ * @return The socket, or `kInvalidSocket` on failure.
+ */
+net_socket_t net_listen(uint16_t port);
+
+/**
+ * @brief Waits up to `timeout_ms` for a connection on a listening socket.
+ *
+ * @return The connected socket, or `kInvalidSocket` if none came in.
+ */
+net_socket_t net_accept(net_socket_t listener, uint32_t timeout_ms);
+
+/**
+ * @brief Connects to `host` on `port`.
+ *
+ * @return The connected socket, or `kInvalidSocket` on failure.
+ */
+net_socket_t net_connect(const std::string &host, uint16_t port);
+
+/**
+ * @brief Sends every byte of `count` buffers, in order.
+ *
+ * @return `false` if the connection failed or was closed.
+ */
+bool net_send(net_socket_t socket, const NetBuffer *buffers, uint32_t count);
+
+/**
+ * @brief Receives exactly `size` bytes.
+ *
+ * @return `false` if the connection failed or was closed first.
+ */
+bool net_receive(net_socket_t socket, void *data, size_t size);
+
+/**
+ * @brief Stops any send or receive in progress on another thread, which
+ * then fails; the socket still has to be closed.
+ */
+void net_shutdown(net_socket_t socket);
+
+void net_close(net_socket_t socket);
+
+#endif
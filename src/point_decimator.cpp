@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "point_decimator.hpp"
+#include <algorithm>
+
+void PointDecimator::set_view(double x_min, double x_max, double y_min,
+                              double y_max, uint32_t width_px,
+                              uint32_t height_px, uint32_t cell_px)
+{
+  if (0 == cell_px) {
+    cell_px = 1;
+  }
+  width = std::max<uint32_t>(1, width_px / cell_px);
+  height = std::max<uint32_t>(1, height_px / cell_px);
+
+  // Only grows, so resizing the plot doesn't cause allocations every frame.
+  size_t num_cells = static_cast<size_t>(width) * height;
+  if (cells.size() < num_cells) {
+    cells.assign(num_cells, 0);
+    layer = 0;
+  }
+
+  double x_range = x_max - x_min;
+  double y_range = y_max - y_min;
+  this->x_min = static_cast<float>(x_min);
+  this->y_min = static_cast<float>(y_min);
+  x_scale = (0.0 < x_range) ? static_cast<float>(width / x_range) : 0.0f;
+  y_scale = (0.0 < y_range) ? static_cast<float>(height / y_range) : 0.0f;
+  in_view_count = 0;
+
+  next_layer();
+}
+
+void PointDecimator::next_layer()
+{
+  layer++;
+  if (0 == layer) {
+    // The layer counter wrapped; cells from 65535 layers ago would otherwise
+    // appear occupied.
+    std::fill(cells.begin(), cells.end(), 0);
+    layer = 1;
+  }
+}
+
+uint32_t PointDecimator::filter(const float *x_in, const float *y_in,
+                                uint32_t count, float *x_out, float *y_out)
+{
+  const float w = static_cast<float>(width);
+  const float h = static_cast<float>(height);
+  uint32_t n = 0;
+  uint64_t in_view = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    float fx = (x_in[i] - x_min) * x_scale;
+    float fy = (y_in[i] - y_min) * y_scale;
+    // Written so that NaN coordinates also count as outside the view.
+    if (!((0.0f <= fx) && (fx < w) && (0.0f <= fy) && (fy < h))) {
+      continue;
+    }
+    in_view++;
+
+    size_t cell = static_cast<size_t>(static_cast<uint32_t>(fy)) * width +
+                  static_cast<uint32_t>(fx);
+    if (layer == cells[cell]) {
+      continue;
+    }
+    cells[cell] = layer;
+    x_out[n] = x_in[i];
+    y_out[n] = y_in[i];
+    n++;
+  }
+
+  in_view_count += in_view;
+  return n;
+}
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file point_decimator.hpp
+ * @brief Screen-space decimation of point clouds before plotting.
+ *
+ * Drawing more points than there are pixels only costs time; most of them
+ * land on top of each other. The decimator overlays the visible plot area
+ * with a grid of pixel-sized cells and keeps only the first point that falls
+ * into each cell, discarding points outside the view entirely. Because the
+ * grid follows the plot limits, zooming in automatically lets more detail
+ * through.
+ */
+#ifndef SCAN_GUI_POINT_DECIMATOR_HPP
+#define SCAN_GUI_POINT_DECIMATOR_HPP
+
+#include <cstdint>
+#include <vector>
+
+class PointDecimator {
+public:
+  /**
+   * @brief Sets the visible region and its size on screen. This also starts
+   * a new layer and resets the in-view count.
+   *
+   * @param cell_px Size of a grid cell in pixels; larger cells decimate more.
+   */
+  void set_view(double x_min, double x_max, double y_min, double y_max,
+                uint32_t width_px, uint32_t height_px, uint32_t cell_px = 1);
+
+  /**
+   * @brief Empties the grid. Points drawn in different styles, such as
+   * different series or opacities, should each get their own layer so that
+   * one doesn't hide the other.
+   */
+  void next_layer();
+
+  /**
+   * @brief Copies the points that land in a still unoccupied cell of the
+   * current layer to the output arrays. The output may alias the input.
+   *
+   * @return Number of points written to the output arrays.
+   */
+  uint32_t filter(const float *x_in, const float *y_in, uint32_t count,
+                  float *x_out, float *y_out);
+
+  /**
+   * @brief Number of points passed to `filter` since `set_view` that were
+   * inside the view, whether or not their cell was already occupied.
+   */
+  uint64_t get_in_view_count() const
+  {
+    return in_view_count;
+  }
+
+private:
+  // Rather than clearing the grid for every layer, each cell records the
+  // layer that last occupied it.
+  std::vector<uint16_t> cells;
+  uint16_t layer = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  float x_min = 0.0f;
+  float y_min = 0.0f;
+  float x_scale = 0.0f;
+  float y_scale = 0.0f;
+  uint64_t in_view_count = 0;
+};
+
+#endif
@@ -0,0 +1,309 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "point_renderer.hpp"
+#include <cstring>
+#include <iostream>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <imgui.h>
+#include <implot.h>
+
+// `glBufferStorage` is only part of OpenGL 4.4 and newer, so it is looked up
+// at runtime rather than relying on the loader having been generated with it.
+typedef void(APIENTRY *BufferStorageFn)(GLenum target, GLsizeiptr size,
+                                        const void *data, GLbitfield flags);
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+static const char *kVertexShader = R"(
+#version 330 core
+layout(location = 0) in float x;
+layout(location = 1) in float y;
+layout(location = 2) in vec4 color;
+uniform vec4 transform;
+uniform float point_size;
+out vec4 frag_color;
+void main() {
+  gl_Position = vec4(vec2(x, y) * transform.xy + transform.zw, 0.0, 1.0);
+  gl_PointSize = point_size;
+  frag_color = color;
+}
+)";
+
+static const char *kFragmentShader = R"(
+#version 330 core
+in vec4 frag_color;
+out vec4 out_color;
+void main() {
+  out_color = frag_color;
+}
+)";
+
+static GLuint compile_shader(GLenum type, const char *source)
+{
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, nullptr);
+  glCompileShader(shader);
+
+  GLint ok = 0;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+  if (!ok) {
+    char log[512];
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    std::cout << "point renderer shader failed: " << log << std::endl;
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+PointRenderer::PointRenderer(uint32_t max_points) : max_points(max_points)
+{
+}
+
+PointRenderer::~PointRenderer()
+{
+  release();
+}
+
+bool PointRenderer::init()
+{
+  GLuint vs = compile_shader(GL_VERTEX_SHADER, kVertexShader);
+  GLuint fs = compile_shader(GL_FRAGMENT_SHADER, kFragmentShader);
+  if ((0 == vs) || (0 == fs)) {
+    return false;
+  }
+
+  program = glCreateProgram();
+  glAttachShader(program, vs);
+  glAttachShader(program, fs);
+  glLinkProgram(program);
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  GLint ok = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &ok);
+  if (!ok) {
+    std::cout << "point renderer shader link failed" << std::endl;
+    return false;
+  }
+  transform_location = glGetUniformLocation(program, "transform");
+  point_size_location = glGetUniformLocation(program, "point_size");
+
+  // Each region holds the X, Y and color arrays back to back. Keeping them
+  // as separate arrays lets the conversion kernel and history write their
+  // float columns straight into the buffer.
+  const GLsizeiptr region_bytes = static_cast<GLsizeiptr>(max_points) * 12;
+  const GLsizeiptr total_bytes = region_bytes * kRegions;
+
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+  auto buffer_storage = reinterpret_cast<BufferStorageFn>(
+    glfwGetProcAddress("glBufferStorage"));
+  if (nullptr != buffer_storage) {
+    const GLbitfield flags =
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    buffer_storage(GL_ARRAY_BUFFER, total_bytes, nullptr, flags);
+    mapped = static_cast<uint8_t *>(
+      glMapBufferRange(GL_ARRAY_BUFFER, 0, total_bytes, flags));
+  }
+
+  if (nullptr != mapped) {
+    is_persistent_mapped = true;
+  } else {
+    // Buffer storage is immutable once allocated, so start over with a
+    // regular buffer if mapping failed after it was created.
+    if (nullptr != buffer_storage) {
+      glDeleteBuffers(1, &vbo);
+      glGenBuffers(1, &vbo);
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    }
+    glBufferData(GL_ARRAY_BUFFER, region_bytes, nullptr, GL_STREAM_DRAW);
+    staging.resize(region_bytes);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  return true;
+}
+
+void PointRenderer::release()
+{
+  if (!is_initialized) {
+    return;
+  }
+
+  for (auto &fence : fences) {
+    if (nullptr != fence) {
+      glDeleteSync(static_cast<GLsync>(fence));
+      fence = nullptr;
+    }
+  }
+  if (nullptr != mapped) {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    mapped = nullptr;
+  }
+  glDeleteBuffers(1, &vbo);
+  glDeleteVertexArrays(1, &vao);
+  glDeleteProgram(program);
+  is_initialized = false;
+}
+
+bool PointRenderer::begin_frame()
+{
+  if (is_failed) {
+    return false;
+  }
+  if (!is_initialized) {
+    is_initialized = true;
+    if (!init()) {
+      is_failed = true;
+      return false;
+    }
+  }
+
+  count = 0;
+  uint8_t *base = nullptr;
+  if (is_persistent_mapped) {
+    region = (region + 1) % kRegions;
+
+    // Wait until the GPU has finished drawing from this region the last time
+    // it was used. With three regions in flight this almost never blocks.
+    GLsync fence = static_cast<GLsync>(fences[region]);
+    if (nullptr != fence) {
+      glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+      glDeleteSync(fence);
+      fences[region] = nullptr;
+    }
+    base = mapped + static_cast<size_t>(region) * max_points * 12;
+  } else {
+    base = staging.data();
+  }
+
+  x_out = reinterpret_cast<float *>(base);
+  y_out = reinterpret_cast<float *>(base + static_cast<size_t>(max_points) * 4);
+  color_out =
+    reinterpret_cast<uint32_t *>(base + static_cast<size_t>(max_points) * 8);
+  return true;
+}
+
+void PointRenderer::draw(float point_size)
+{
+  if (!is_initialized || is_failed || (0 == count)) {
+    return;
+  }
+
+  // Work out the mapping from plot coordinates to normalized device
+  // coordinates now, while ImPlot still knows the plot's limits and position.
+  ImPlotLimits limits = ImPlot::GetPlotLimits();
+  ImVec2 pos = ImPlot::GetPlotPos();
+  ImVec2 size = ImPlot::GetPlotSize();
+  ImVec2 display = ImGui::GetIO().DisplaySize;
+  double x_range = limits.X.Max - limits.X.Min;
+  double y_range = limits.Y.Max - limits.Y.Min;
+  if ((0.0 >= x_range) || (0.0 >= y_range) || (0.0f >= display.x) ||
+      (0.0f >= display.y)) {
+    return;
+  }
+
+  double sx = size.x / x_range;
+  double sy = size.y / y_range;
+  DrawState &state = states[region];
+  state.renderer = this;
+  state.region = region;
+  state.count = count;
+  state.point_size = point_size;
+  state.scale[0] = static_cast<float>(2.0 * sx / display.x);
+  state.scale[1] = static_cast<float>(2.0 * sy / display.y);
+  state.offset[0] =
+    static_cast<float>(2.0 * (pos.x - limits.X.Min * sx) / display.x - 1.0);
+  state.offset[1] =
+    static_cast<float>(1.0 - 2.0 * (pos.y + limits.Y.Max * sy) / display.y);
+
+  ImDrawList *draw_list = ImPlot::GetPlotDrawList();
+  draw_list->AddCallback(draw_callback, &state);
+  draw_list->AddCallback(ImDrawCallback_ResetRenderState, nullptr);
+}
+
+void PointRenderer::draw_callback(const ImDrawList *, const ImDrawCmd *cmd)
+{
+  const DrawState *state = static_cast<const DrawState *>(cmd->UserCallbackData);
+  float clip_rect[4] = {cmd->ClipRect.x, cmd->ClipRect.y, cmd->ClipRect.z,
+                        cmd->ClipRect.w};
+  state->renderer->draw_region(*state, clip_rect);
+}
+
+void PointRenderer::draw_region(const DrawState &state,
+                                const float clip_rect[4])
+{
+  const size_t region_bytes = static_cast<size_t>(max_points) * 12;
+  size_t base = 0;
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  if (is_persistent_mapped) {
+    base = state.region * region_bytes;
+  } else {
+    // Orphan the old storage so the driver doesn't stall on a draw that may
+    // still be using it, then upload only the part of each array in use.
+    glBufferData(GL_ARRAY_BUFFER, region_bytes, nullptr, GL_STREAM_DRAW);
+    const size_t n = state.count;
+    glBufferSubData(GL_ARRAY_BUFFER, 0, n * 4, staging.data());
+    glBufferSubData(GL_ARRAY_BUFFER, max_points * 4, n * 4,
+                    staging.data() + max_points * 4);
+    glBufferSubData(GL_ARRAY_BUFFER, max_points * 8, n * 4,
+                    staging.data() + max_points * 8);
+  }
+
+  glBindVertexArray(vao);
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0,
+                        reinterpret_cast<void *>(base));
+  glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0,
+                        reinterpret_cast<void *>(base + max_points * 4));
+  glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0,
+                        reinterpret_cast<void *>(base + max_points * 8));
+
+  // ImGui doesn't apply the clip rectangle for callbacks, so do it here to
+  // keep points inside the plot area. The rectangle is in window coordinates
+  // with the origin at the top left, while the scissor box is in framebuffer
+  // pixels from the bottom left.
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const ImGuiIO &io = ImGui::GetIO();
+  float fb_x = io.DisplayFramebufferScale.x;
+  float fb_y = io.DisplayFramebufferScale.y;
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(static_cast<GLint>(clip_rect[0] * fb_x),
+            static_cast<GLint>(viewport[3] - clip_rect[3] * fb_y),
+            static_cast<GLsizei>((clip_rect[2] - clip_rect[0]) * fb_x),
+            static_cast<GLsizei>((clip_rect[3] - clip_rect[1]) * fb_y));
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glEnable(GL_PROGRAM_POINT_SIZE);
+  glUseProgram(program);
+  glUniform4f(transform_location, state.scale[0], state.scale[1],
+              state.offset[0], state.offset[1]);
+  glUniform1f(point_size_location, state.point_size * fb_x);
+  glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(state.count));
+  glDisable(GL_PROGRAM_POINT_SIZE);
+
+  if (is_persistent_mapped) {
+    fences[state.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
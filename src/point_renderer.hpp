@@ -0,0 +1,150 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file point_renderer.hpp
+ * @brief Draws large point clouds on the GPU inside an ImPlot plot.
+ *
+ * ImPlot builds the vertices for every scatter marker on the CPU, which
+ * becomes the bottleneck once hundreds of thousands of points are drawn per
+ * frame. This renderer instead has the caller write point positions and
+ * colors straight into a mapped OpenGL vertex buffer, then draws them all as
+ * `GL_POINTS` with a single draw call from an ImGui draw callback. ImPlot
+ * still draws the axes, grid and legend around them.
+ */
+#ifndef SCAN_GUI_POINT_RENDERER_HPP
+#define SCAN_GUI_POINT_RENDERER_HPP
+
+#include <cstdint>
+#include <vector>
+
+struct ImDrawList;
+struct ImDrawCmd;
+
+class PointRenderer {
+public:
+  /**
+   * @brief Creates a renderer able to draw up to `max_points` per frame. No
+   * OpenGL resources are created until the first call to `begin_frame`.
+   */
+  explicit PointRenderer(uint32_t max_points = 1 << 20);
+  ~PointRenderer();
+
+  PointRenderer(const PointRenderer &) = delete;
+  PointRenderer &operator=(const PointRenderer &) = delete;
+
+  /**
+   * @brief Starts collecting points for a new frame. Must be called from the
+   * thread that owns the OpenGL context, i.e. from `Application::update`.
+   *
+   * @return `false` if the OpenGL resources could not be created.
+   */
+  bool begin_frame();
+
+  /**
+   * @brief Where the caller writes the next points of this frame. Up to
+   * `get_available` entries may be written to each array before calling
+   * `commit`.
+   */
+  float *get_x()
+  {
+    return x_out + count;
+  }
+
+  float *get_y()
+  {
+    return y_out + count;
+  }
+
+  uint32_t *get_color()
+  {
+    return color_out + count;
+  }
+
+  uint32_t get_available() const
+  {
+    return max_points - count;
+  }
+
+  /**
+   * @brief Accepts `n` points written through the arrays above.
+   */
+  void commit(uint32_t n)
+  {
+    count += n;
+  }
+
+  /**
+   * @brief Number of points collected so far this frame.
+   */
+  uint32_t get_count() const
+  {
+    return count;
+  }
+
+  /**
+   * @brief Queues the collected points to be drawn into the current ImPlot
+   * plot. Must be called between `ImPlot::BeginPlot` and `ImPlot::EndPlot`.
+   *
+   * @param point_size Diameter of each point in pixels.
+   */
+  void draw(float point_size = 2.0f);
+
+  /**
+   * @brief Whether the vertex buffer is persistently mapped, which needs
+   * OpenGL 4.4 or `ARB_buffer_storage`; otherwise the points are uploaded
+   * with `glBufferSubData` each frame.
+   */
+  bool is_persistent() const
+  {
+    return is_persistent_mapped;
+  }
+
+private:
+  // The buffer is split into regions that are cycled through frame by frame,
+  // so the CPU fills one region while the GPU may still read the others.
+  static const uint32_t kRegions = 3;
+
+  // Everything the draw callback needs, captured when `draw` is called; the
+  // callback itself only runs later when ImGui renders the frame.
+  struct DrawState {
+    PointRenderer *renderer;
+    uint32_t region;
+    uint32_t count;
+    float point_size;
+    float scale[2];
+    float offset[2];
+  };
+
+  bool init();
+  void release();
+  void draw_region(const DrawState &state, const float clip_rect[4]);
+  static void draw_callback(const ImDrawList *parent_list, const ImDrawCmd *cmd);
+
+  uint32_t max_points;
+  uint32_t count = 0;
+  uint32_t region = 0;
+  float *x_out = nullptr;
+  float *y_out = nullptr;
+  uint32_t *color_out = nullptr;
+
+  bool is_initialized = false;
+  bool is_failed = false;
+  bool is_persistent_mapped = false;
+  uint32_t program = 0;
+  uint32_t vao = 0;
+  uint32_t vbo = 0;
+  int32_t transform_location = -1;
+  int32_t point_size_location = -1;
+  uint8_t *mapped = nullptr;
+  // Stand-in for the mapped buffer when persistent mapping isn't available.
+  std::vector<uint8_t> staging;
+  void *fences[kRegions] = {nullptr};
+  DrawState states[kRegions];
+};
+
+#endif
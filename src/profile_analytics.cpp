@@ -0,0 +1,349 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_analytics.hpp"
+#include <algorithm>
+#include "profile_convert.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define SCAN_GUI_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SCAN_GUI_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(SCAN_GUI_HAVE_X86_SIMD) && !defined(_MSC_VER)
+#define SCAN_GUI_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SCAN_GUI_TARGET_AVX2
+#endif
+
+static const int32_t kMaxValue = std::numeric_limits<int32_t>::max();
+static const int32_t kMinValue = std::numeric_limits<int32_t>::min();
+
+static inline bool is_valid(const jsProfileData &p)
+{
+  return (JS_PROFILE_DATA_INVALID_XY != p.x) &&
+         (JS_PROFILE_DATA_INVALID_XY != p.y);
+}
+
+/**
+ * @brief Scalar reduction of points `[begin, end)` into `s`.
+ */
+static void reduce_range(const jsProfileData *points, uint32_t begin,
+                         uint32_t end, ProfileStats &s)
+{
+  for (uint32_t i = begin; i < end; i++) {
+    const jsProfileData &p = points[i];
+    if (!is_valid(p)) {
+      continue;
+    }
+    s.valid_count++;
+    s.min_x = std::min(s.min_x, p.x);
+    s.max_x = std::max(s.max_x, p.x);
+    s.min_y = std::min(s.min_y, p.y);
+    s.max_y = std::max(s.max_y, p.y);
+    s.min_brightness = std::min(s.min_brightness, p.brightness);
+    s.max_brightness = std::max(s.max_brightness, p.brightness);
+    s.brightness_sum += static_cast<uint32_t>(p.brightness);
+  }
+}
+
+// The SIMD kernels keep a running minimum, maximum and sum in every lane,
+// with invalid points replaced by values that can't change the result, and
+// only combine the lanes once at the end. Brightness sums are kept in 32
+// bits per lane, which is plenty for the points of a single profile.
+
+/**
+ * @brief Partial results of a SIMD kernel, one per lane.
+ */
+struct Lanes {
+  int32_t min_x[8];
+  int32_t max_x[8];
+  int32_t min_y[8];
+  int32_t max_y[8];
+  int32_t min_brightness[8];
+  int32_t max_brightness[8];
+  uint32_t brightness_sum[8];
+  uint32_t valid_count[8];
+};
+
+static void fold_lanes(const Lanes &l, uint32_t lanes, ProfileStats &s)
+{
+  for (uint32_t n = 0; n < lanes; n++) {
+    s.valid_count += l.valid_count[n];
+    s.min_x = std::min(s.min_x, l.min_x[n]);
+    s.max_x = std::max(s.max_x, l.max_x[n]);
+    s.min_y = std::min(s.min_y, l.min_y[n]);
+    s.max_y = std::max(s.max_y, l.max_y[n]);
+    s.min_brightness = std::min(s.min_brightness, l.min_brightness[n]);
+    s.max_brightness = std::max(s.max_brightness, l.max_brightness[n]);
+    s.brightness_sum += l.brightness_sum[n];
+  }
+}
+
+static void reduce_scalar(const jsProfileData *points, uint32_t count,
+                          ProfileStats &s)
+{
+  reduce_range(points, 0, count, s);
+}
+
+#if defined(SCAN_GUI_HAVE_X86_SIMD)
+// SSE2 has no 32-bit integer minimum or maximum, so they are built from a
+// compare and a select.
+static inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i min_sse2(__m128i a, __m128i b)
+{
+  return select_sse2(_mm_cmpgt_epi32(a, b), b, a);
+}
+
+static inline __m128i max_sse2(__m128i a, __m128i b)
+{
+  return select_sse2(_mm_cmpgt_epi32(a, b), a, b);
+}
+
+static void reduce_sse2(const jsProfileData *points, uint32_t count,
+                        ProfileStats &s)
+{
+  const __m128i invalid = _mm_set1_epi32(JS_PROFILE_DATA_INVALID_XY);
+  const __m128i hi = _mm_set1_epi32(kMaxValue);
+  const __m128i lo = _mm_set1_epi32(kMinValue);
+  const __m128i one = _mm_set1_epi32(1);
+  __m128i min_x = hi, max_x = lo, min_y = hi, max_y = lo;
+  __m128i min_b = hi, max_b = lo;
+  __m128i sum_b = _mm_setzero_si128();
+  __m128i valid = _mm_setzero_si128();
+  uint32_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    const jsProfileData *p = points + i;
+    __m128i vx = _mm_setr_epi32(p[0].x, p[1].x, p[2].x, p[3].x);
+    __m128i vy = _mm_setr_epi32(p[0].y, p[1].y, p[2].y, p[3].y);
+    __m128i vb = _mm_setr_epi32(p[0].brightness, p[1].brightness,
+                                p[2].brightness, p[3].brightness);
+    __m128i bad = _mm_or_si128(_mm_cmpeq_epi32(vx, invalid),
+                               _mm_cmpeq_epi32(vy, invalid));
+    min_x = min_sse2(min_x, select_sse2(bad, hi, vx));
+    max_x = max_sse2(max_x, select_sse2(bad, lo, vx));
+    min_y = min_sse2(min_y, select_sse2(bad, hi, vy));
+    max_y = max_sse2(max_y, select_sse2(bad, lo, vy));
+    min_b = min_sse2(min_b, select_sse2(bad, hi, vb));
+    max_b = max_sse2(max_b, select_sse2(bad, lo, vb));
+    sum_b = _mm_add_epi32(sum_b, _mm_andnot_si128(bad, vb));
+    valid = _mm_add_epi32(valid, _mm_andnot_si128(bad, one));
+  }
+
+  Lanes l;
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(l.min_x), min_x);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(l.max_x), max_x);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(l.min_y), min_y);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(l.max_y), max_y);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(l.min_brightness), min_b);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(l.max_brightness), max_b);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(l.brightness_sum), sum_b);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(l.valid_count), valid);
+  fold_lanes(l, 4, s);
+  reduce_range(points, i, count, s);
+}
+
+SCAN_GUI_TARGET_AVX2
+static void reduce_avx2(const jsProfileData *points, uint32_t count,
+                        ProfileStats &s)
+{
+  // Same gather pattern as the AVX2 conversion kernel; see there.
+  const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  const __m256i invalid = _mm256_set1_epi32(JS_PROFILE_DATA_INVALID_XY);
+  const __m256i hi = _mm256_set1_epi32(kMaxValue);
+  const __m256i lo = _mm256_set1_epi32(kMinValue);
+  const __m256i one = _mm256_set1_epi32(1);
+  const int *base = reinterpret_cast<const int *>(points);
+  __m256i min_x = hi, max_x = lo, min_y = hi, max_y = lo;
+  __m256i min_b = hi, max_b = lo;
+  __m256i sum_b = _mm256_setzero_si256();
+  __m256i valid = _mm256_setzero_si256();
+  uint32_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    const int *p = base + i * 3;
+    __m256i vx = _mm256_i32gather_epi32(p, stride, 4);
+    __m256i vy = _mm256_i32gather_epi32(p + 1, stride, 4);
+    __m256i vb = _mm256_i32gather_epi32(p + 2, stride, 4);
+    __m256i bad = _mm256_or_si256(_mm256_cmpeq_epi32(vx, invalid),
+                                  _mm256_cmpeq_epi32(vy, invalid));
+    min_x = _mm256_min_epi32(min_x, _mm256_blendv_epi8(vx, hi, bad));
+    max_x = _mm256_max_epi32(max_x, _mm256_blendv_epi8(vx, lo, bad));
+    min_y = _mm256_min_epi32(min_y, _mm256_blendv_epi8(vy, hi, bad));
+    max_y = _mm256_max_epi32(max_y, _mm256_blendv_epi8(vy, lo, bad));
+    min_b = _mm256_min_epi32(min_b, _mm256_blendv_epi8(vb, hi, bad));
+    max_b = _mm256_max_epi32(max_b, _mm256_blendv_epi8(vb, lo, bad));
+    sum_b = _mm256_add_epi32(sum_b, _mm256_andnot_si256(bad, vb));
+    valid = _mm256_add_epi32(valid, _mm256_andnot_si256(bad, one));
+  }
+
+  Lanes l;
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(l.min_x), min_x);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(l.max_x), max_x);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(l.min_y), min_y);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(l.max_y), max_y);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(l.min_brightness), min_b);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(l.max_brightness), max_b);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(l.brightness_sum), sum_b);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(l.valid_count), valid);
+  fold_lanes(l, 8, s);
+  reduce_range(points, i, count, s);
+}
+#endif
+
+#if defined(SCAN_GUI_HAVE_NEON)
+static void reduce_neon(const jsProfileData *points, uint32_t count,
+                        ProfileStats &s)
+{
+  const int32x4_t hi = vdupq_n_s32(kMaxValue);
+  const int32x4_t lo = vdupq_n_s32(kMinValue);
+  const int32x4_t invalid = vdupq_n_s32(JS_PROFILE_DATA_INVALID_XY);
+  const uint32x4_t one = vdupq_n_u32(1);
+  const int32_t *base = reinterpret_cast<const int32_t *>(points);
+  int32x4_t min_x = hi, max_x = lo, min_y = hi, max_y = lo;
+  int32x4_t min_b = hi, max_b = lo;
+  uint32x4_t sum_b = vdupq_n_u32(0);
+  uint32x4_t valid = vdupq_n_u32(0);
+  uint32_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    int32x4x3_t v = vld3q_s32(base + i * 3);
+    uint32x4_t bad = vorrq_u32(vceqq_s32(v.val[0], invalid),
+                               vceqq_s32(v.val[1], invalid));
+    min_x = vminq_s32(min_x, vbslq_s32(bad, hi, v.val[0]));
+    max_x = vmaxq_s32(max_x, vbslq_s32(bad, lo, v.val[0]));
+    min_y = vminq_s32(min_y, vbslq_s32(bad, hi, v.val[1]));
+    max_y = vmaxq_s32(max_y, vbslq_s32(bad, lo, v.val[1]));
+    min_b = vminq_s32(min_b, vbslq_s32(bad, hi, v.val[2]));
+    max_b = vmaxq_s32(max_b, vbslq_s32(bad, lo, v.val[2]));
+    sum_b = vaddq_u32(sum_b, vbicq_u32(vreinterpretq_u32_s32(v.val[2]), bad));
+    valid = vaddq_u32(valid, vbicq_u32(one, bad));
+  }
+
+  Lanes l;
+  vst1q_s32(l.min_x, min_x);
+  vst1q_s32(l.max_x, max_x);
+  vst1q_s32(l.min_y, min_y);
+  vst1q_s32(l.max_y, max_y);
+  vst1q_s32(l.min_brightness, min_b);
+  vst1q_s32(l.max_brightness, max_b);
+  vst1q_u32(l.brightness_sum, sum_b);
+  vst1q_u32(l.valid_count, valid);
+  fold_lanes(l, 4, s);
+  reduce_range(points, i, count, s);
+}
+#endif
+
+static void reduce(const jsProfileData *points, uint32_t count,
+                   ProfileStats &s)
+{
+  switch (get_convert_kernel()) {
+#if defined(SCAN_GUI_HAVE_X86_SIMD)
+  case CONVERT_KERNEL_AVX2:
+    reduce_avx2(points, count, s);
+    break;
+  case CONVERT_KERNEL_SSE2:
+    reduce_sse2(points, count, s);
+    break;
+#elif defined(SCAN_GUI_HAVE_NEON)
+  case CONVERT_KERNEL_NEON:
+    reduce_neon(points, count, s);
+    break;
+#endif
+  default:
+    reduce_scalar(points, count, s);
+    break;
+  }
+}
+
+ProfileStats analyze_points(const jsProfileData *points, uint32_t count)
+{
+  ProfileStats s;
+  reduce(points, count, s);
+
+  // With the maximum known, finding the point it belongs to is a search
+  // that usually stops well before the end.
+  if (0 < s.valid_count) {
+    for (uint32_t i = 0; i < count; i++) {
+      if ((s.max_y == points[i].y) && is_valid(points[i])) {
+        s.highest = points[i];
+        break;
+      }
+    }
+  }
+  return s;
+}
+
+void merge_stats(ProfileStats &dst, const ProfileStats &src)
+{
+  if (0 == src.valid_count) {
+    return;
+  }
+  if ((0 == dst.valid_count) || (src.max_y > dst.max_y)) {
+    dst.highest = src.highest;
+  }
+  dst.valid_count += src.valid_count;
+  dst.min_x = std::min(dst.min_x, src.min_x);
+  dst.max_x = std::max(dst.max_x, src.max_x);
+  dst.min_y = std::min(dst.min_y, src.min_y);
+  dst.max_y = std::max(dst.max_y, src.max_y);
+  dst.min_brightness = std::min(dst.min_brightness, src.min_brightness);
+  dst.max_brightness = std::max(dst.max_brightness, src.max_brightness);
+  dst.brightness_sum += src.brightness_sum;
+}
+
+ProfileAnalytics::ProfileAnalytics(uint32_t num_heads)
+{
+  for (uint32_t id = 0; id < num_heads; id++) {
+    heads.emplace_back(std::make_unique<Head>());
+  }
+}
+
+void ProfileAnalytics::process(uint32_t id, const jsProfile *profiles,
+                               uint32_t count)
+{
+  if (id >= heads.size()) {
+    return;
+  }
+
+  // Every profile is analyzed, not only the newest of each camera, so the
+  // cost seen in the metrics is that of keeping up with the full scan rate.
+  Head &head = *heads[id];
+  uint64_t timestamp_ns = 0;
+  for (uint32_t n = 0; n < count; n++) {
+    const jsProfile &p = profiles[n];
+    uint32_t camera = static_cast<uint32_t>(p.camera);
+    if (camera >= kCamerasPerHead) {
+      continue;
+    }
+    uint32_t len = std::min<uint32_t>(p.data_len, JS_PROFILE_DATA_LEN);
+    head.cameras[camera] = analyze_points(p.data, len);
+    timestamp_ns = std::max(timestamp_ns, p.timestamp_ns);
+  }
+  head.profiles_analyzed += count;
+  if (0 == timestamp_ns) {
+    return;
+  }
+
+  HeadAnalytics &results = head.results.back();
+  results.stats = ProfileStats();
+  for (uint32_t camera = 0; camera < kCamerasPerHead; camera++) {
+    merge_stats(results.stats, head.cameras[camera]);
+  }
+  results.timestamp_ns = timestamp_ns;
+  results.profiles_analyzed = head.profiles_analyzed;
+  head.results.publish();
+}
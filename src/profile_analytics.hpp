@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_analytics.hpp
+ * @brief Per profile measurements: extents, highest point and brightness.
+ *
+ * The statistics are computed with a single pass over the profile data,
+ * reducing X, Y and brightness in SIMD registers and only going back to the
+ * individual points to locate the highest one. The kernel follows the one
+ * selected for `convert_points`, so switching kernels there compares both.
+ */
+#ifndef SCAN_GUI_PROFILE_ANALYTICS_HPP
+#define SCAN_GUI_PROFILE_ANALYTICS_HPP
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "profile_receiver.hpp"
+#include "profile_stage.hpp"
+#include "triple_buffer.hpp"
+
+/**
+ * @brief Statistics over the valid points of one or more profiles, in the
+ * client API's units. Extents and brightness limits are only meaningful if
+ * `valid_count` isn't zero.
+ */
+struct ProfileStats {
+  uint32_t valid_count = 0;
+  int32_t min_x = std::numeric_limits<int32_t>::max();
+  int32_t max_x = std::numeric_limits<int32_t>::min();
+  int32_t min_y = std::numeric_limits<int32_t>::max();
+  int32_t max_y = std::numeric_limits<int32_t>::min();
+  int32_t min_brightness = std::numeric_limits<int32_t>::max();
+  int32_t max_brightness = std::numeric_limits<int32_t>::min();
+  uint64_t brightness_sum = 0;
+  // The point with the greatest Y; the first one if there are several.
+  jsProfileData highest = {0, 0, 0};
+
+  double get_mean_brightness() const
+  {
+    return (0 < valid_count) ?
+             static_cast<double>(brightness_sum) / valid_count :
+             0.0;
+  }
+};
+
+/**
+ * @brief Computes the statistics of `count` profile points. Points where
+ * either X or Y hold `JS_PROFILE_DATA_INVALID_XY` are left out.
+ */
+ProfileStats analyze_points(const jsProfileData *points, uint32_t count);
+
+/**
+ * @brief Combines the statistics of another set of points into `dst`.
+ */
+void merge_stats(ProfileStats &dst, const ProfileStats &src);
+
+/**
+ * @brief The most recent statistics of a scan head.
+ */
+struct HeadAnalytics {
+  // Merged over the newest profile from each camera, so it describes the
+  // head's last complete view of the object.
+  ProfileStats stats;
+  uint64_t timestamp_ns = 0;
+  uint64_t profiles_analyzed = 0;
+};
+
+/**
+ * @brief Receiver stage that analyzes every profile received and publishes
+ * the results of each scan head for the GUI to pick up.
+ */
+class ProfileAnalytics : public ProfileStage {
+public:
+  explicit ProfileAnalytics(uint32_t num_heads);
+
+  void process(uint32_t id, const jsProfile *profiles,
+               uint32_t count) override;
+
+  const char *get_stage_name() const override
+  {
+    return "analyze";
+  }
+
+  /**
+   * @brief Latest results of scan head `id`. Only a single consumer thread
+   * may read from it.
+   */
+  TripleBuffer<HeadAnalytics> &get_results(uint32_t id)
+  {
+    return heads[id]->results;
+  }
+
+private:
+  struct Head {
+    ProfileStats cameras[kCamerasPerHead];
+    uint64_t profiles_analyzed = 0;
+    TripleBuffer<HeadAnalytics> results;
+  };
+
+  std::vector<std::unique_ptr<Head>> heads;
+};
+
+#endif
@@ -0,0 +1,411 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_codec.hpp"
+#include <algorithm>
+#include <cstring>
+#include "recording_format.hpp"
+
+// Number of values bit packed together with the same width.
+static const uint32_t kPackBlock = 32;
+
+static inline uint32_t zigzag(int32_t v)
+{
+  return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+  return static_cast<int32_t>((v >> 1) ^ (0u - (v & 1)));
+}
+
+static inline uint64_t zigzag64(int64_t v)
+{
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+static inline int64_t unzigzag64(uint64_t v)
+{
+  return static_cast<int64_t>((v >> 1) ^ (0ull - (v & 1)));
+}
+
+// Residuals are computed with wrapping arithmetic so that any pair of values,
+// including the invalid point markers, round trips exactly.
+static inline uint32_t residual(int32_t value, int32_t prediction)
+{
+  return zigzag(static_cast<int32_t>(static_cast<uint32_t>(value) -
+                                     static_cast<uint32_t>(prediction)));
+}
+
+static inline int32_t restore(uint32_t residual, int32_t prediction)
+{
+  return static_cast<int32_t>(static_cast<uint32_t>(prediction) +
+                              static_cast<uint32_t>(unzigzag(residual)));
+}
+
+namespace {
+
+struct Writer {
+  uint8_t *p;
+  uint8_t *begin;
+  uint8_t *end;
+  bool is_ok = true;
+
+  Writer(uint8_t *out, size_t capacity) : p(out), begin(out), end(out + capacity)
+  {
+  }
+
+  bool reserve(size_t n)
+  {
+    is_ok = is_ok && (static_cast<size_t>(end - p) >= n);
+    return is_ok;
+  }
+
+  void varint(uint64_t v)
+  {
+    if (!reserve(10)) {
+      return;
+    }
+    while (0x80 <= v) {
+      *p++ = static_cast<uint8_t>(v) | 0x80;
+      v >>= 7;
+    }
+    *p++ = static_cast<uint8_t>(v);
+  }
+
+  void bytes(const uint8_t *src, size_t n)
+  {
+    if (reserve(n)) {
+      std::memcpy(p, src, n);
+      p += n;
+    }
+  }
+
+  void pack(const uint32_t *v, uint32_t n)
+  {
+    for (uint32_t i = 0; i < n; i += kPackBlock) {
+      uint32_t m = std::min(kPackBlock, n - i);
+      uint32_t all = 0;
+      for (uint32_t j = 0; j < m; j++) {
+        all |= v[i + j];
+      }
+      uint32_t width = 0;
+      while ((width < 32) && (0 != (all >> width))) {
+        width++;
+      }
+      if (!reserve(1 + (m * width + 7) / 8)) {
+        return;
+      }
+
+      *p++ = static_cast<uint8_t>(width);
+      uint64_t acc = 0;
+      uint32_t bits = 0;
+      for (uint32_t j = 0; j < m; j++) {
+        acc |= static_cast<uint64_t>(v[i + j]) << bits;
+        bits += width;
+        while (8 <= bits) {
+          *p++ = static_cast<uint8_t>(acc);
+          acc >>= 8;
+          bits -= 8;
+        }
+      }
+      if (0 < bits) {
+        *p++ = static_cast<uint8_t>(acc);
+      }
+    }
+  }
+};
+
+struct Reader {
+  const uint8_t *p;
+  const uint8_t *end;
+  bool is_ok = true;
+
+  Reader(const uint8_t *in, size_t size) : p(in), end(in + size) {}
+
+  bool has(size_t n)
+  {
+    is_ok = is_ok && (static_cast<size_t>(end - p) >= n);
+    return is_ok;
+  }
+
+  uint64_t varint()
+  {
+    uint64_t v = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+      if (!has(1)) {
+        return 0;
+      }
+      uint8_t b = *p++;
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (0 == (b & 0x80)) {
+        return v;
+      }
+    }
+    is_ok = false;
+    return 0;
+  }
+
+  uint32_t varint32()
+  {
+    return static_cast<uint32_t>(varint());
+  }
+
+  void bytes(uint8_t *dst, size_t n)
+  {
+    if (has(n)) {
+      std::memcpy(dst, p, n);
+      p += n;
+    }
+  }
+
+  void unpack(uint32_t *v, uint32_t n)
+  {
+    for (uint32_t i = 0; i < n; i += kPackBlock) {
+      uint32_t m = std::min(kPackBlock, n - i);
+      if (!has(1)) {
+        return;
+      }
+      uint32_t width = *p++;
+      if ((32 < width) || !has((m * width + 7) / 8)) {
+        is_ok = false;
+        return;
+      }
+
+      const uint64_t mask = (1ull << width) - 1;
+      uint64_t acc = 0;
+      uint32_t bits = 0;
+      for (uint32_t j = 0; j < m; j++) {
+        while (bits < width) {
+          acc |= static_cast<uint64_t>(*p++) << bits;
+          bits += 8;
+        }
+        v[i + j] = static_cast<uint32_t>(acc & mask);
+        acc >>= width;
+        bits -= width;
+      }
+    }
+  }
+};
+
+} // namespace
+
+ChunkCodec::ChunkCodec()
+{
+  for (auto &ref : references) {
+    ref.x.resize(JS_PROFILE_DATA_LEN);
+    ref.y.resize(JS_PROFILE_DATA_LEN);
+    ref.brightness.resize(JS_PROFILE_DATA_LEN);
+    ref.is_valid.resize(JS_PROFILE_DATA_LEN);
+  }
+  x_residuals.resize(JS_PROFILE_DATA_LEN);
+  y_residuals.resize(JS_PROFILE_DATA_LEN);
+  brightness_residuals.resize(JS_PROFILE_DATA_LEN);
+  valid.resize((JS_PROFILE_DATA_LEN + 7) / 8);
+  points.resize(JS_PROFILE_DATA_LEN);
+}
+
+void ChunkCodec::reset()
+{
+  for (auto &ref : references) {
+    ref.len = 0;
+  }
+}
+
+ChunkCodec::Reference *ChunkCodec::get_reference(uint32_t camera)
+{
+  return (camera < kMaxCameras) ? &references[camera] : nullptr;
+}
+
+size_t ChunkCodec::encode(const uint8_t *raw, size_t raw_size,
+                          uint32_t profile_count, uint8_t *out,
+                          size_t capacity)
+{
+  reset();
+  Writer w(out, capacity);
+  uint64_t prev_timestamp = 0;
+  uint32_t prev_sequence = 0;
+  size_t offset = 0;
+
+  for (uint32_t n = 0; (n < profile_count) && w.is_ok; n++) {
+    RecordingProfileHeader hdr;
+    if (offset + sizeof(hdr) > raw_size) {
+      return 0;
+    }
+    std::memcpy(&hdr, raw + offset, sizeof(hdr));
+    const uint32_t len = hdr.data_len;
+    const size_t size = sizeof(hdr) + len * sizeof(jsProfileData);
+    if ((JS_PROFILE_DATA_LEN < len) || (offset + size > raw_size)) {
+      return 0;
+    }
+    std::memcpy(points.data(), raw + offset + sizeof(hdr),
+                len * sizeof(jsProfileData));
+    offset += size;
+
+    w.varint(hdr.scan_head_id);
+    w.varint(hdr.camera);
+    w.varint(hdr.laser);
+    w.varint(hdr.flags);
+    w.varint(zigzag64(static_cast<int64_t>(hdr.timestamp_ns - prev_timestamp)));
+    w.varint(zigzag(static_cast<int32_t>(hdr.sequence_number - prev_sequence)));
+    w.varint(hdr.laser_on_time_us);
+    w.varint(static_cast<uint32_t>(hdr.format));
+    w.varint(hdr.packets_received);
+    w.varint(hdr.packets_expected);
+    w.varint(len);
+    prev_timestamp = hdr.timestamp_ns;
+    prev_sequence = hdr.sequence_number;
+
+    Reference *ref = get_reference(hdr.camera);
+    const uint32_t ref_len = (nullptr != ref) ? ref->len : 0;
+    const size_t valid_bytes = (len + 7) / 8;
+    std::fill(valid.begin(), valid.begin() + valid_bytes, 0);
+    uint32_t num_valid = 0;
+    int32_t last_x = 0;
+    int32_t last_y = 0;
+    int32_t last_brightness = 0;
+    for (uint32_t i = 0; i < len; i++) {
+      const jsProfileData &p = points[i];
+      const bool has_ref = (i < ref_len);
+      // Only points with neither coordinate measured count as invalid, so
+      // that anything else is reproduced exactly.
+      const bool is_valid = !((JS_PROFILE_DATA_INVALID_XY == p.x) &&
+                              (JS_PROFILE_DATA_INVALID_XY == p.y));
+      if (is_valid) {
+        valid[i >> 3] |= static_cast<uint8_t>(1 << (i & 7));
+        int32_t px = last_x;
+        int32_t py = last_y;
+        if (has_ref && ref->is_valid[i]) {
+          px = ref->x[i];
+          py = ref->y[i];
+        }
+        x_residuals[num_valid] = residual(p.x, px);
+        y_residuals[num_valid] = residual(p.y, py);
+        num_valid++;
+        last_x = p.x;
+        last_y = p.y;
+      }
+      int32_t pb = has_ref ? ref->brightness[i] : last_brightness;
+      brightness_residuals[i] = residual(p.brightness, pb);
+      last_brightness = p.brightness;
+    }
+
+    w.bytes(valid.data(), valid_bytes);
+    w.pack(x_residuals.data(), num_valid);
+    w.pack(y_residuals.data(), num_valid);
+    w.pack(brightness_residuals.data(), len);
+
+    if (nullptr != ref) {
+      ref->len = len;
+      for (uint32_t i = 0; i < len; i++) {
+        ref->x[i] = points[i].x;
+        ref->y[i] = points[i].y;
+        ref->brightness[i] = points[i].brightness;
+        ref->is_valid[i] = (valid[i >> 3] >> (i & 7)) & 1;
+      }
+    }
+  }
+
+  if (!w.is_ok || (offset != raw_size)) {
+    return 0;
+  }
+  return static_cast<size_t>(w.p - w.begin);
+}
+
+bool ChunkCodec::decode(const uint8_t *in, size_t size, uint32_t profile_count,
+                        uint8_t *raw, size_t raw_size)
+{
+  reset();
+  Reader r(in, size);
+  uint64_t prev_timestamp = 0;
+  uint32_t prev_sequence = 0;
+  size_t offset = 0;
+
+  for (uint32_t n = 0; (n < profile_count) && r.is_ok; n++) {
+    RecordingProfileHeader hdr;
+    hdr.scan_head_id = r.varint32();
+    hdr.camera = r.varint32();
+    hdr.laser = r.varint32();
+    hdr.flags = r.varint32();
+    hdr.timestamp_ns = prev_timestamp + unzigzag64(r.varint());
+    hdr.sequence_number = prev_sequence + unzigzag(r.varint32());
+    hdr.laser_on_time_us = r.varint32();
+    hdr.format = static_cast<int32_t>(r.varint32());
+    hdr.packets_received = r.varint32();
+    hdr.packets_expected = r.varint32();
+    hdr.data_len = r.varint32();
+    prev_timestamp = hdr.timestamp_ns;
+    prev_sequence = hdr.sequence_number;
+
+    const uint32_t len = hdr.data_len;
+    const size_t out_size = sizeof(hdr) + len * sizeof(jsProfileData);
+    if (!r.is_ok || (JS_PROFILE_DATA_LEN < len) ||
+        (offset + out_size > raw_size)) {
+      return false;
+    }
+
+    const size_t valid_bytes = (len + 7) / 8;
+    r.bytes(valid.data(), valid_bytes);
+    uint32_t num_valid = 0;
+    for (uint32_t i = 0; (i < len) && r.is_ok; i++) {
+      num_valid += (valid[i >> 3] >> (i & 7)) & 1;
+    }
+    r.unpack(x_residuals.data(), num_valid);
+    r.unpack(y_residuals.data(), num_valid);
+    r.unpack(brightness_residuals.data(), len);
+    if (!r.is_ok) {
+      return false;
+    }
+
+    Reference *ref = get_reference(hdr.camera);
+    const uint32_t ref_len = (nullptr != ref) ? ref->len : 0;
+    uint32_t v = 0;
+    int32_t last_x = 0;
+    int32_t last_y = 0;
+    int32_t last_brightness = 0;
+    for (uint32_t i = 0; i < len; i++) {
+      jsProfileData &p = points[i];
+      const bool has_ref = (i < ref_len);
+      if ((valid[i >> 3] >> (i & 7)) & 1) {
+        int32_t px = last_x;
+        int32_t py = last_y;
+        if (has_ref && ref->is_valid[i]) {
+          px = ref->x[i];
+          py = ref->y[i];
+        }
+        p.x = restore(x_residuals[v], px);
+        p.y = restore(y_residuals[v], py);
+        v++;
+        last_x = p.x;
+        last_y = p.y;
+      } else {
+        p.x = JS_PROFILE_DATA_INVALID_XY;
+        p.y = JS_PROFILE_DATA_INVALID_XY;
+      }
+      int32_t pb = has_ref ? ref->brightness[i] : last_brightness;
+      p.brightness = restore(brightness_residuals[i], pb);
+      last_brightness = p.brightness;
+    }
+
+    if (nullptr != ref) {
+      ref->len = len;
+      for (uint32_t i = 0; i < len; i++) {
+        ref->x[i] = points[i].x;
+        ref->y[i] = points[i].y;
+        ref->brightness[i] = points[i].brightness;
+        ref->is_valid[i] = (valid[i >> 3] >> (i & 7)) & 1;
+      }
+    }
+
+    std::memcpy(raw + offset, &hdr, sizeof(hdr));
+    std::memcpy(raw + offset + sizeof(hdr), points.data(),
+                len * sizeof(jsProfileData));
+    offset += out_size;
+  }
+
+  return r.is_ok && (offset == raw_size) && (r.p == r.end);
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_codec.hpp
+ * @brief Lossless compression of recording chunks.
+ *
+ * Points of a profile are indexed by camera column, so a point usually lands
+ * close to where the same point was in the camera's previous profile. Each
+ * coordinate and brightness is therefore stored as its difference from that
+ * prediction, falling back to the previous point of the same profile where
+ * the previous profile has no valid point. The differences are zigzag
+ * encoded and bit packed in blocks of 32 values, each block using only as
+ * many bits as its largest value needs.
+ *
+ * The codec state is reset at the start of every chunk, so each chunk can be
+ * decoded on its own; this keeps seeking through a recording cheap.
+ */
+#ifndef SCAN_GUI_PROFILE_CODEC_HPP
+#define SCAN_GUI_PROFILE_CODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <joescan_pinchot.h>
+
+class ChunkCodec {
+public:
+  ChunkCodec();
+
+  /**
+   * @brief Compresses the payload of a chunk, i.e. `profile_count`
+   * serialized profiles.
+   *
+   * @return Size of the compressed payload, or zero if it didn't fit in
+   * `capacity` bytes, in which case the chunk is better stored as is.
+   */
+  size_t encode(const uint8_t *raw, size_t raw_size, uint32_t profile_count,
+                uint8_t *out, size_t capacity);
+
+  /**
+   * @brief Restores a payload compressed by `encode`.
+   *
+   * @return `false` if the compressed data is corrupt or doesn't decode to
+   * exactly `raw_size` bytes.
+   */
+  bool decode(const uint8_t *in, size_t size, uint32_t profile_count,
+              uint8_t *raw, size_t raw_size);
+
+private:
+  // Cameras whose previous profile is tracked for prediction; profiles from
+  // any others are predicted from within the profile only.
+  static const uint32_t kMaxCameras = 4;
+
+  struct Reference {
+    uint32_t len = 0;
+    std::vector<int32_t> x;
+    std::vector<int32_t> y;
+    std::vector<int32_t> brightness;
+    std::vector<uint8_t> is_valid;
+  };
+
+  void reset();
+  Reference *get_reference(uint32_t camera);
+
+  Reference references[kMaxCameras];
+  // Scratch space for the residuals of a single profile.
+  std::vector<uint32_t> x_residuals;
+  std::vector<uint32_t> y_residuals;
+  std::vector<uint32_t> brightness_residuals;
+  std::vector<uint8_t> valid;
+  std::vector<jsProfileData> points;
+};
+
+#endif
@@ -0,0 +1,766 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_convert.hpp"
+#include <atomic>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define SCAN_GUI_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SCAN_GUI_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit AVX2 instructions in functions that ask for them;
+// MSVC allows the intrinsics anywhere.
+#if defined(SCAN_GUI_HAVE_X86_SIMD) && !defined(_MSC_VER)
+#define SCAN_GUI_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SCAN_GUI_TARGET_AVX2
+#endif
+
+// Multiplying by the reciprocal is considerably cheaper than dividing, and
+// vectorizes well.
+static const float kInchesPerUnitFloat = 1.0f / 1000.0f;
+
+static inline double to_inches(int32_t v, double *)
+{
+  return static_cast<double>(v) * kInchesPerUnit;
+}
+
+static inline float to_inches(int32_t v, float *)
+{
+  return static_cast<float>(v) * kInchesPerUnitFloat;
+}
+
+// The kernels are written once for both ways of passing brightness on: as
+// a column of floats, which can also be left out, or as a packed color per
+// point, looked up in a palette.
+
+struct BrightnessColumn {
+  float *out;
+
+  bool is_wanted() const
+  {
+    return nullptr != out;
+  }
+
+  void put(uint32_t n, int32_t brightness) const
+  {
+    out[n] = static_cast<float>(brightness);
+  }
+};
+
+struct BrightnessColor {
+  uint32_t *out;
+  const uint32_t *palette;
+
+  bool is_wanted() const
+  {
+    return true;
+  }
+
+  // Only the low byte indexes the palette, so that whatever an invalid point
+  // holds can't read outside of it.
+  void put(uint32_t n, int32_t brightness) const
+  {
+    out[n] = palette[brightness & 0xFF];
+  }
+};
+
+/**
+ * @brief Scalar conversion of points `[begin, end)`, appending to the output
+ * columns at index `n`. Every point is written out, but the output index only
+ * advances for valid points; this keeps the loop free of branches.
+ */
+template <typename T, typename B>
+static inline uint32_t convert_range(const jsProfileData *points,
+                                     uint32_t begin, uint32_t end, T *x, T *y,
+                                     const B &brightness, uint32_t n)
+{
+  for (uint32_t i = begin; i < end; i++) {
+    const jsProfileData &p = points[i];
+    x[n] = to_inches(p.x, x);
+    y[n] = to_inches(p.y, y);
+    if (brightness.is_wanted()) {
+      brightness.put(n, p.brightness);
+    }
+    n += (JS_PROFILE_DATA_INVALID_XY != p.x) &
+         (JS_PROFILE_DATA_INVALID_XY != p.y);
+  }
+  return n;
+}
+
+template <typename T, typename B>
+static uint32_t convert_scalar(const jsProfileData *points, uint32_t count,
+                               T *x, T *y, const B &brightness)
+{
+  return convert_range(points, 0, count, x, y, brightness, 0);
+}
+
+// The SIMD kernels below all work the same way: load a block of points,
+// compare X and Y against the invalid sentinel, then either store the whole
+// converted block (all valid), skip it (all invalid) or fall back to the
+// scalar loop for that block. Invalid points in a profile tend to come in
+// long runs where the laser line leaves the field of view, so mixed blocks
+// are comparatively rare.
+
+#if defined(SCAN_GUI_HAVE_X86_SIMD)
+static inline void store_sse2(double *dst, __m128i v)
+{
+  const __m128d scale = _mm_set1_pd(kInchesPerUnit);
+  _mm_storeu_pd(dst, _mm_mul_pd(_mm_cvtepi32_pd(v), scale));
+  _mm_storeu_pd(dst + 2,
+                _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(v, v)), scale));
+}
+
+static inline void store_sse2(float *dst, __m128i v)
+{
+  const __m128 scale = _mm_set1_ps(kInchesPerUnitFloat);
+  _mm_storeu_ps(dst, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+}
+
+static inline void put_sse2(const BrightnessColumn &brightness, uint32_t n,
+                            const jsProfileData *p)
+{
+  __m128i vb = _mm_setr_epi32(p[0].brightness, p[1].brightness,
+                              p[2].brightness, p[3].brightness);
+  _mm_storeu_ps(brightness.out + n, _mm_cvtepi32_ps(vb));
+}
+
+// SSE2 has no gather, so the palette is looked up one point at a time.
+static inline void put_sse2(const BrightnessColor &brightness, uint32_t n,
+                            const jsProfileData *p)
+{
+  for (uint32_t k = 0; k < 4; k++) {
+    brightness.put(n + k, p[k].brightness);
+  }
+}
+
+template <typename T, typename B>
+static uint32_t convert_sse2(const jsProfileData *points, uint32_t count,
+                             T *x, T *y, const B &brightness)
+{
+  const __m128i invalid = _mm_set1_epi32(JS_PROFILE_DATA_INVALID_XY);
+  uint32_t n = 0;
+  uint32_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    const jsProfileData *p = points + i;
+    __m128i vx = _mm_setr_epi32(p[0].x, p[1].x, p[2].x, p[3].x);
+    __m128i vy = _mm_setr_epi32(p[0].y, p[1].y, p[2].y, p[3].y);
+    __m128i bad = _mm_or_si128(_mm_cmpeq_epi32(vx, invalid),
+                               _mm_cmpeq_epi32(vy, invalid));
+    int bad_mask = _mm_movemask_ps(_mm_castsi128_ps(bad));
+
+    if (0 == bad_mask) {
+      store_sse2(x + n, vx);
+      store_sse2(y + n, vy);
+      if (brightness.is_wanted()) {
+        put_sse2(brightness, n, p);
+      }
+      n += 4;
+    } else if (0xF != bad_mask) {
+      n = convert_range(points, i, i + 4, x, y, brightness, n);
+    }
+  }
+
+  return convert_range(points, i, count, x, y, brightness, n);
+}
+
+SCAN_GUI_TARGET_AVX2
+static inline void store_avx2(double *dst, __m256i v)
+{
+  const __m256d scale = _mm256_set1_pd(kInchesPerUnit);
+  __m128i lo = _mm256_castsi256_si128(v);
+  __m128i hi = _mm256_extracti128_si256(v, 1);
+  _mm256_storeu_pd(dst, _mm256_mul_pd(_mm256_cvtepi32_pd(lo), scale));
+  _mm256_storeu_pd(dst + 4, _mm256_mul_pd(_mm256_cvtepi32_pd(hi), scale));
+}
+
+SCAN_GUI_TARGET_AVX2
+static inline void store_avx2(float *dst, __m256i v)
+{
+  const __m256 scale = _mm256_set1_ps(kInchesPerUnitFloat);
+  _mm256_storeu_ps(dst, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+}
+
+SCAN_GUI_TARGET_AVX2
+static inline void put_avx2(const BrightnessColumn &brightness, uint32_t n,
+                            const int *p, __m256i stride)
+{
+  __m256i vb = _mm256_i32gather_epi32(p + 2, stride, 4);
+  _mm256_storeu_ps(brightness.out + n, _mm256_cvtepi32_ps(vb));
+}
+
+// The brightness values gathered from the points index straight into a
+// second gather from the palette.
+SCAN_GUI_TARGET_AVX2
+static inline void put_avx2(const BrightnessColor &brightness, uint32_t n,
+                            const int *p, __m256i stride)
+{
+  const __m256i mask = _mm256_set1_epi32(0xFF);
+  __m256i vb = _mm256_and_si256(_mm256_i32gather_epi32(p + 2, stride, 4),
+                                mask);
+  __m256i vc = _mm256_i32gather_epi32(
+    reinterpret_cast<const int *>(brightness.palette), vb, 4);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(brightness.out + n), vc);
+}
+
+template <typename T, typename B>
+SCAN_GUI_TARGET_AVX2
+static uint32_t convert_avx2(const jsProfileData *points, uint32_t count,
+                             T *x, T *y, const B &brightness)
+{
+  // `jsProfileData` is three 32-bit integers, so the X, Y and brightness
+  // fields of eight consecutive points sit at a stride of three integers.
+  const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  const __m256i invalid = _mm256_set1_epi32(JS_PROFILE_DATA_INVALID_XY);
+  const int *base = reinterpret_cast<const int *>(points);
+  uint32_t n = 0;
+  uint32_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    const int *p = base + i * 3;
+    __m256i vx = _mm256_i32gather_epi32(p, stride, 4);
+    __m256i vy = _mm256_i32gather_epi32(p + 1, stride, 4);
+    __m256i bad = _mm256_or_si256(_mm256_cmpeq_epi32(vx, invalid),
+                                  _mm256_cmpeq_epi32(vy, invalid));
+    int bad_mask = _mm256_movemask_ps(_mm256_castsi256_ps(bad));
+
+    if (0 == bad_mask) {
+      store_avx2(x + n, vx);
+      store_avx2(y + n, vy);
+      if (brightness.is_wanted()) {
+        put_avx2(brightness, n, p, stride);
+      }
+      n += 8;
+    } else if (0xFF != bad_mask) {
+      n = convert_range(points, i, i + 8, x, y, brightness, n);
+    }
+  }
+
+  return convert_range(points, i, count, x, y, brightness, n);
+}
+
+static bool cpu_has_avx2()
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  // AVX2 needs both the CPU feature and the OS saving the YMM registers.
+  __cpuid(info, 1);
+  bool has_osxsave = (info[2] & (1 << 27)) != 0;
+  bool has_avx = (info[2] & (1 << 28)) != 0;
+  if (!has_osxsave || !has_avx || (_xgetbv(0) & 0x6) != 0x6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#if defined(SCAN_GUI_HAVE_NEON)
+static inline void store_neon(double *dst, int32x4_t v)
+{
+  const float64x2_t scale = vdupq_n_f64(kInchesPerUnit);
+  vst1q_f64(dst, vmulq_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(v))), scale));
+  vst1q_f64(dst + 2,
+            vmulq_f64(vcvtq_f64_s64(vmovl_s32(vget_high_s32(v))), scale));
+}
+
+static inline void store_neon(float *dst, int32x4_t v)
+{
+  vst1q_f32(dst, vmulq_n_f32(vcvtq_f32_s32(v), kInchesPerUnitFloat));
+}
+
+static inline void put_neon(const BrightnessColumn &brightness, uint32_t n,
+                            int32x4_t vb)
+{
+  vst1q_f32(brightness.out + n, vcvtq_f32_s32(vb));
+}
+
+// NEON has no gather, so the palette is looked up one point at a time.
+static inline void put_neon(const BrightnessColor &brightness, uint32_t n,
+                            int32x4_t vb)
+{
+  int32_t b[4];
+  vst1q_s32(b, vb);
+  for (uint32_t k = 0; k < 4; k++) {
+    brightness.put(n + k, b[k]);
+  }
+}
+
+template <typename T, typename B>
+static uint32_t convert_neon(const jsProfileData *points, uint32_t count,
+                             T *x, T *y, const B &brightness)
+{
+  const int32x4_t invalid = vdupq_n_s32(JS_PROFILE_DATA_INVALID_XY);
+  const int32_t *base = reinterpret_cast<const int32_t *>(points);
+  uint32_t n = 0;
+  uint32_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    // A three-way deinterleaving load splits X, Y and brightness for free.
+    int32x4x3_t v = vld3q_s32(base + i * 3);
+    uint32x4_t bad = vorrq_u32(vceqq_s32(v.val[0], invalid),
+                               vceqq_s32(v.val[1], invalid));
+    uint32_t num_bad = vaddvq_u32(vshrq_n_u32(bad, 31));
+
+    if (0 == num_bad) {
+      store_neon(x + n, v.val[0]);
+      store_neon(y + n, v.val[1]);
+      if (brightness.is_wanted()) {
+        put_neon(brightness, n, v.val[2]);
+      }
+      n += 4;
+    } else if (4 != num_bad) {
+      n = convert_range(points, i, i + 4, x, y, brightness, n);
+    }
+  }
+
+  return convert_range(points, i, count, x, y, brightness, n);
+}
+#endif
+
+// The transform kernels work on the converted columns, which are already
+// laid out one coordinate per array, so they are plain vertical arithmetic
+// with no shuffling. Each point costs four multiplies and four adds.
+
+static void transform_range(float *x, float *y, uint32_t begin, uint32_t end,
+                            const PointTransform &t)
+{
+  for (uint32_t i = begin; i < end; i++) {
+    t.apply(x[i], y[i]);
+  }
+}
+
+#if defined(SCAN_GUI_HAVE_X86_SIMD)
+static void transform_sse2(float *x, float *y, uint32_t count,
+                           const PointTransform &t)
+{
+  const __m128 xx = _mm_set1_ps(t.xx), xy = _mm_set1_ps(t.xy);
+  const __m128 yx = _mm_set1_ps(t.yx), yy = _mm_set1_ps(t.yy);
+  const __m128 tx = _mm_set1_ps(t.tx), ty = _mm_set1_ps(t.ty);
+  uint32_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 vx = _mm_loadu_ps(x + i);
+    __m128 vy = _mm_loadu_ps(y + i);
+    __m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xx, vx), _mm_mul_ps(xy, vy)),
+                          tx);
+    __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(yx, vx), _mm_mul_ps(yy, vy)),
+                          ty);
+    _mm_storeu_ps(x + i, u);
+    _mm_storeu_ps(y + i, v);
+  }
+
+  transform_range(x, y, i, count, t);
+}
+
+SCAN_GUI_TARGET_AVX2
+static void transform_avx2(float *x, float *y, uint32_t count,
+                           const PointTransform &t)
+{
+  const __m256 xx = _mm256_set1_ps(t.xx), xy = _mm256_set1_ps(t.xy);
+  const __m256 yx = _mm256_set1_ps(t.yx), yy = _mm256_set1_ps(t.yy);
+  const __m256 tx = _mm256_set1_ps(t.tx), ty = _mm256_set1_ps(t.ty);
+  uint32_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256 vx = _mm256_loadu_ps(x + i);
+    __m256 vy = _mm256_loadu_ps(y + i);
+    __m256 u = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(xx, vx), _mm256_mul_ps(xy, vy)), tx);
+    __m256 v = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(yx, vx), _mm256_mul_ps(yy, vy)), ty);
+    _mm256_storeu_ps(x + i, u);
+    _mm256_storeu_ps(y + i, v);
+  }
+
+  transform_range(x, y, i, count, t);
+}
+#endif
+
+#if defined(SCAN_GUI_HAVE_NEON)
+static void transform_neon(float *x, float *y, uint32_t count,
+                           const PointTransform &t)
+{
+  const float32x4_t tx = vdupq_n_f32(t.tx), ty = vdupq_n_f32(t.ty);
+  uint32_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    float32x4_t vx = vld1q_f32(x + i);
+    float32x4_t vy = vld1q_f32(y + i);
+    float32x4_t u = vmlaq_n_f32(vmlaq_n_f32(tx, vx, t.xx), vy, t.xy);
+    float32x4_t v = vmlaq_n_f32(vmlaq_n_f32(ty, vx, t.yx), vy, t.yy);
+    vst1q_f32(x + i, u);
+    vst1q_f32(y + i, v);
+  }
+
+  transform_range(x, y, i, count, t);
+}
+#endif
+
+// The crop kernels test each point against the region and overwrite the
+// ones outside of it, along with any already invalid, with the invalid
+// sentinel. The test itself is done without branches; like the conversion
+// kernels, the SIMD ones only write back blocks that aren't kept whole.
+// Points are transformed for the test only and keep the client API's units.
+
+static uint32_t crop_range(jsProfileData *points, uint32_t begin,
+                           uint32_t end, const PointTransform &t,
+                           const PointRegion &r, uint32_t last)
+{
+  for (uint32_t i = begin; i < end; i++) {
+    jsProfileData &p = points[i];
+    float x = static_cast<float>(p.x);
+    float y = static_cast<float>(p.y);
+    t.apply(x, y);
+    bool is_kept = (JS_PROFILE_DATA_INVALID_XY != p.x) &
+                   (JS_PROFILE_DATA_INVALID_XY != p.y) & (r.left <= x) &
+                   (x <= r.right) & (r.bottom <= y) & (y <= r.top);
+    p.x = is_kept ? p.x : JS_PROFILE_DATA_INVALID_XY;
+    p.y = is_kept ? p.y : JS_PROFILE_DATA_INVALID_XY;
+    last = is_kept ? i + 1 : last;
+  }
+  return last;
+}
+
+#if defined(SCAN_GUI_HAVE_X86_SIMD)
+/**
+ * @brief Writes back a block of `size` points starting at point `i`, keeping
+ * those whose bit is set in `keep_mask`.
+ */
+static inline uint32_t crop_block(jsProfileData *p, uint32_t i,
+                                  uint32_t size, int keep_mask, uint32_t last)
+{
+  for (uint32_t k = 0; k < size; k++) {
+    bool is_kept = 0 != (keep_mask & (1 << k));
+    p[k].x = is_kept ? p[k].x : JS_PROFILE_DATA_INVALID_XY;
+    p[k].y = is_kept ? p[k].y : JS_PROFILE_DATA_INVALID_XY;
+    last = is_kept ? i + k + 1 : last;
+  }
+  return last;
+}
+
+static uint32_t crop_sse2(jsProfileData *points, uint32_t count,
+                          const PointTransform &t, const PointRegion &r)
+{
+  const __m128i invalid = _mm_set1_epi32(JS_PROFILE_DATA_INVALID_XY);
+  const __m128 xx = _mm_set1_ps(t.xx), xy = _mm_set1_ps(t.xy);
+  const __m128 yx = _mm_set1_ps(t.yx), yy = _mm_set1_ps(t.yy);
+  const __m128 tx = _mm_set1_ps(t.tx), ty = _mm_set1_ps(t.ty);
+  const __m128 left = _mm_set1_ps(r.left), right = _mm_set1_ps(r.right);
+  const __m128 bottom = _mm_set1_ps(r.bottom), top = _mm_set1_ps(r.top);
+  uint32_t last = 0;
+  uint32_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    jsProfileData *p = points + i;
+    __m128i vx = _mm_setr_epi32(p[0].x, p[1].x, p[2].x, p[3].x);
+    __m128i vy = _mm_setr_epi32(p[0].y, p[1].y, p[2].y, p[3].y);
+    __m128 fx = _mm_cvtepi32_ps(vx);
+    __m128 fy = _mm_cvtepi32_ps(vy);
+    __m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xx, fx), _mm_mul_ps(xy, fy)),
+                          tx);
+    __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(yx, fx), _mm_mul_ps(yy, fy)),
+                          ty);
+    __m128 inside = _mm_and_ps(
+      _mm_and_ps(_mm_cmple_ps(left, u), _mm_cmple_ps(u, right)),
+      _mm_and_ps(_mm_cmple_ps(bottom, v), _mm_cmple_ps(v, top)));
+    __m128i bad = _mm_or_si128(_mm_cmpeq_epi32(vx, invalid),
+                               _mm_cmpeq_epi32(vy, invalid));
+    int keep_mask = _mm_movemask_ps(
+      _mm_andnot_ps(_mm_castsi128_ps(bad), inside));
+
+    if (0xF == keep_mask) {
+      last = i + 4;
+    } else {
+      last = crop_block(p, i, 4, keep_mask, last);
+    }
+  }
+
+  return crop_range(points, i, count, t, r, last);
+}
+
+SCAN_GUI_TARGET_AVX2
+static uint32_t crop_avx2(jsProfileData *points, uint32_t count,
+                          const PointTransform &t, const PointRegion &r)
+{
+  const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  const __m256i invalid = _mm256_set1_epi32(JS_PROFILE_DATA_INVALID_XY);
+  const __m256 xx = _mm256_set1_ps(t.xx), xy = _mm256_set1_ps(t.xy);
+  const __m256 yx = _mm256_set1_ps(t.yx), yy = _mm256_set1_ps(t.yy);
+  const __m256 tx = _mm256_set1_ps(t.tx), ty = _mm256_set1_ps(t.ty);
+  const __m256 left = _mm256_set1_ps(r.left);
+  const __m256 right = _mm256_set1_ps(r.right);
+  const __m256 bottom = _mm256_set1_ps(r.bottom);
+  const __m256 top = _mm256_set1_ps(r.top);
+  const int *base = reinterpret_cast<const int *>(points);
+  uint32_t last = 0;
+  uint32_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    const int *p = base + i * 3;
+    __m256i vx = _mm256_i32gather_epi32(p, stride, 4);
+    __m256i vy = _mm256_i32gather_epi32(p + 1, stride, 4);
+    __m256 fx = _mm256_cvtepi32_ps(vx);
+    __m256 fy = _mm256_cvtepi32_ps(vy);
+    __m256 u = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(xx, fx), _mm256_mul_ps(xy, fy)), tx);
+    __m256 v = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(yx, fx), _mm256_mul_ps(yy, fy)), ty);
+    __m256 inside = _mm256_and_ps(
+      _mm256_and_ps(_mm256_cmp_ps(left, u, _CMP_LE_OQ),
+                    _mm256_cmp_ps(u, right, _CMP_LE_OQ)),
+      _mm256_and_ps(_mm256_cmp_ps(bottom, v, _CMP_LE_OQ),
+                    _mm256_cmp_ps(v, top, _CMP_LE_OQ)));
+    __m256i bad = _mm256_or_si256(_mm256_cmpeq_epi32(vx, invalid),
+                                  _mm256_cmpeq_epi32(vy, invalid));
+    int keep_mask = _mm256_movemask_ps(
+      _mm256_andnot_ps(_mm256_castsi256_ps(bad), inside));
+
+    if (0xFF == keep_mask) {
+      last = i + 8;
+    } else {
+      last = crop_block(points + i, i, 8, keep_mask, last);
+    }
+  }
+
+  return crop_range(points, i, count, t, r, last);
+}
+#endif
+
+#if defined(SCAN_GUI_HAVE_NEON)
+static uint32_t crop_neon(jsProfileData *points, uint32_t count,
+                          const PointTransform &t, const PointRegion &r)
+{
+  static const uint32_t kLaneBits[4] = {1, 2, 4, 8};
+  const uint32x4_t lane_bits = vld1q_u32(kLaneBits);
+  const int32x4_t invalid = vdupq_n_s32(JS_PROFILE_DATA_INVALID_XY);
+  const float32x4_t tx = vdupq_n_f32(t.tx), ty = vdupq_n_f32(t.ty);
+  const float32x4_t left = vdupq_n_f32(r.left), right = vdupq_n_f32(r.right);
+  const float32x4_t bottom = vdupq_n_f32(r.bottom);
+  const float32x4_t top = vdupq_n_f32(r.top);
+  int32_t *base = reinterpret_cast<int32_t *>(points);
+  uint32_t last = 0;
+  uint32_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    int32x4x3_t p = vld3q_s32(base + i * 3);
+    float32x4_t fx = vcvtq_f32_s32(p.val[0]);
+    float32x4_t fy = vcvtq_f32_s32(p.val[1]);
+    float32x4_t u = vmlaq_n_f32(vmlaq_n_f32(tx, fx, t.xx), fy, t.xy);
+    float32x4_t v = vmlaq_n_f32(vmlaq_n_f32(ty, fx, t.yx), fy, t.yy);
+    uint32x4_t inside = vandq_u32(
+      vandq_u32(vcleq_f32(left, u), vcleq_f32(u, right)),
+      vandq_u32(vcleq_f32(bottom, v), vcleq_f32(v, top)));
+    uint32x4_t bad = vorrq_u32(vceqq_s32(p.val[0], invalid),
+                               vceqq_s32(p.val[1], invalid));
+    uint32x4_t keep = vbicq_u32(inside, bad);
+    uint32_t keep_mask = vaddvq_u32(vandq_u32(keep, lane_bits));
+
+    if (0xF == keep_mask) {
+      last = i + 4;
+      continue;
+    }
+    // The block is stored back interleaved, just as it was loaded.
+    p.val[0] = vbslq_s32(keep, p.val[0], invalid);
+    p.val[1] = vbslq_s32(keep, p.val[1], invalid);
+    vst3q_s32(base + i * 3, p);
+    for (uint32_t k = 0; k < 4; k++) {
+      last = (0 != (keep_mask & (1u << k))) ? i + k + 1 : last;
+    }
+  }
+
+  return crop_range(points, i, count, t, r, last);
+}
+#endif
+
+static ConvertKernel best_kernel()
+{
+#if defined(SCAN_GUI_HAVE_X86_SIMD)
+  return cpu_has_avx2() ? CONVERT_KERNEL_AVX2 : CONVERT_KERNEL_SSE2;
+#elif defined(SCAN_GUI_HAVE_NEON)
+  return CONVERT_KERNEL_NEON;
+#else
+  return CONVERT_KERNEL_SCALAR;
+#endif
+}
+
+static std::atomic<int> current_kernel(best_kernel());
+
+template <typename T, typename B>
+static uint32_t dispatch(const jsProfileData *points, uint32_t count, T *x,
+                         T *y, const B &brightness)
+{
+  switch (current_kernel.load(std::memory_order_relaxed)) {
+#if defined(SCAN_GUI_HAVE_X86_SIMD)
+  case CONVERT_KERNEL_AVX2:
+    return convert_avx2(points, count, x, y, brightness);
+  case CONVERT_KERNEL_SSE2:
+    return convert_sse2(points, count, x, y, brightness);
+#elif defined(SCAN_GUI_HAVE_NEON)
+  case CONVERT_KERNEL_NEON:
+    return convert_neon(points, count, x, y, brightness);
+#endif
+  default:
+    return convert_scalar(points, count, x, y, brightness);
+  }
+}
+
+uint32_t convert_points(const jsProfileData *points, uint32_t count,
+                        double *x, double *y, float *brightness)
+{
+  return dispatch(points, count, x, y, BrightnessColumn{brightness});
+}
+
+uint32_t convert_points(const jsProfileData *points, uint32_t count,
+                        float *x, float *y, float *brightness)
+{
+  return dispatch(points, count, x, y, BrightnessColumn{brightness});
+}
+
+uint32_t convert_points(const jsProfileData *points, uint32_t count,
+                        float *x, float *y, uint32_t *color,
+                        const uint32_t *palette)
+{
+  return dispatch(points, count, x, y, BrightnessColor{color, palette});
+}
+
+PointTransform make_alignment_transform(double roll_deg, double shift_x,
+                                        double shift_y,
+                                        bool is_cable_downstream)
+{
+  const double kPi = 3.14159265358979323846;
+  double c = std::cos(roll_deg * kPi / 180.0);
+  double s = std::sin(roll_deg * kPi / 180.0);
+  double flip = is_cable_downstream ? -1.0 : 1.0;
+
+  PointTransform t;
+  t.xx = static_cast<float>(c * flip);
+  t.xy = static_cast<float>(-s);
+  t.tx = static_cast<float>(shift_x);
+  t.yx = static_cast<float>(s * flip);
+  t.yy = static_cast<float>(c);
+  t.ty = static_cast<float>(shift_y);
+  return t;
+}
+
+void transform_points(float *x, float *y, uint32_t count,
+                      const PointTransform &transform)
+{
+  if (transform.is_identity()) {
+    return;
+  }
+
+  switch (current_kernel.load(std::memory_order_relaxed)) {
+#if defined(SCAN_GUI_HAVE_X86_SIMD)
+  case CONVERT_KERNEL_AVX2:
+    transform_avx2(x, y, count, transform);
+    break;
+  case CONVERT_KERNEL_SSE2:
+    transform_sse2(x, y, count, transform);
+    break;
+#elif defined(SCAN_GUI_HAVE_NEON)
+  case CONVERT_KERNEL_NEON:
+    transform_neon(x, y, count, transform);
+    break;
+#endif
+  default:
+    transform_range(x, y, 0, count, transform);
+    break;
+  }
+}
+
+uint32_t crop_points(jsProfileData *points, uint32_t count,
+                     const PointTransform &transform,
+                     const PointRegion &region)
+{
+  // Folding the conversion to inches into the transform saves a multiply
+  // per coordinate.
+  PointTransform t = transform;
+  t.xx *= kInchesPerUnitFloat;
+  t.xy *= kInchesPerUnitFloat;
+  t.yx *= kInchesPerUnitFloat;
+  t.yy *= kInchesPerUnitFloat;
+
+  switch (current_kernel.load(std::memory_order_relaxed)) {
+#if defined(SCAN_GUI_HAVE_X86_SIMD)
+  case CONVERT_KERNEL_AVX2:
+    return crop_avx2(points, count, t, region);
+  case CONVERT_KERNEL_SSE2:
+    return crop_sse2(points, count, t, region);
+#elif defined(SCAN_GUI_HAVE_NEON)
+  case CONVERT_KERNEL_NEON:
+    return crop_neon(points, count, t, region);
+#endif
+  default:
+    return crop_range(points, 0, count, t, region, 0);
+  }
+}
+
+ConvertKernel get_convert_kernel()
+{
+  return static_cast<ConvertKernel>(current_kernel.load());
+}
+
+bool set_convert_kernel(ConvertKernel kernel)
+{
+  if (!is_convert_kernel_supported(kernel)) {
+    return false;
+  }
+  current_kernel.store(kernel);
+  return true;
+}
+
+bool is_convert_kernel_supported(ConvertKernel kernel)
+{
+  switch (kernel) {
+  case CONVERT_KERNEL_SCALAR:
+    return true;
+#if defined(SCAN_GUI_HAVE_X86_SIMD)
+  case CONVERT_KERNEL_SSE2:
+    return true;
+  case CONVERT_KERNEL_AVX2:
+    return cpu_has_avx2();
+#elif defined(SCAN_GUI_HAVE_NEON)
+  case CONVERT_KERNEL_NEON:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+const char *get_convert_kernel_name(ConvertKernel kernel)
+{
+  switch (kernel) {
+  case CONVERT_KERNEL_SCALAR:
+    return "scalar";
+  case CONVERT_KERNEL_SSE2:
+    return "SSE2";
+  case CONVERT_KERNEL_AVX2:
+    return "AVX2";
+  case CONVERT_KERNEL_NEON:
+    return "NEON";
+  }
+  return "unknown";
+}
@@ -0,0 +1,209 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_convert.hpp
+ * @brief Conversion of raw profile data into plottable columns.
+ *
+ * Profile data arrives from the client API as an array of `jsProfileData`
+ * structures holding X, Y and brightness as integers in thousandths of an
+ * inch. Plotting wants separate arrays of X and Y in inches. The functions
+ * here perform that conversion, dropping invalid points along the way, and
+ * can then move the points into the scan system's coordinate frame or crop
+ * them to a region of it, using the widest SIMD instruction set available on
+ * the CPU the program is running on.
+ */
+#ifndef SCAN_GUI_PROFILE_CONVERT_HPP
+#define SCAN_GUI_PROFILE_CONVERT_HPP
+
+#include <cstdint>
+#include <joescan_pinchot.h>
+
+/**
+ * @brief Profile data is in thousandths of an inch; multiplying by this
+ * converts it to inches.
+ */
+static const double kInchesPerUnit = 1.0 / 1000.0;
+
+/**
+ * @brief The implementations of the conversion kernel. Which ones are
+ * available depends on the architecture the program was built for and the
+ * CPU it is running on.
+ */
+enum ConvertKernel {
+  CONVERT_KERNEL_SCALAR = 0,
+  CONVERT_KERNEL_SSE2,
+  CONVERT_KERNEL_AVX2,
+  CONVERT_KERNEL_NEON,
+};
+
+/**
+ * @brief Converts profile points from the client API's units into inches,
+ * writing X, Y and brightness out as separate columns. Points where either X
+ * or Y hold `JS_PROFILE_DATA_INVALID_XY` are skipped, so the columns only
+ * ever contain valid measurements.
+ *
+ * @param points Profile points to convert.
+ * @param count Number of points in `points`.
+ * @param x Output column of X values; must hold at least `count` elements.
+ * @param y Output column of Y values; must hold at least `count` elements.
+ * @param brightness Optional output column of brightness values; must hold
+ * at least `count` elements unless `nullptr`.
+ * @return Number of valid points written to the output columns.
+ */
+uint32_t convert_points(const jsProfileData *points, uint32_t count,
+                        double *x, double *y, float *brightness = nullptr);
+uint32_t convert_points(const jsProfileData *points, uint32_t count,
+                        float *x, float *y, float *brightness = nullptr);
+
+/**
+ * @brief Number of entries in a brightness palette; brightness goes from 0
+ * to 255.
+ */
+static const uint32_t kBrightnessLevels = 256;
+
+/**
+ * @brief Like `convert_points`, but colors each point by its brightness
+ * instead of writing the brightness out, so points can be drawn colored
+ * without another pass over them.
+ *
+ * @param color Output column of packed RGBA colors; must hold at least
+ * `count` elements.
+ * @param palette Color of each brightness, `kBrightnessLevels` entries.
+ * @return Number of valid points written to the output columns.
+ */
+uint32_t convert_points(const jsProfileData *points, uint32_t count,
+                        float *x, float *y, uint32_t *color,
+                        const uint32_t *palette);
+
+/**
+ * @brief Convenience wrapper for converting all of the points in a profile.
+ */
+template <typename T>
+inline uint32_t convert_profile(const jsProfile &profile, T *x, T *y,
+                                float *brightness = nullptr)
+{
+  return convert_points(profile.data, profile.data_len, x, y, brightness);
+}
+
+inline uint32_t convert_profile(const jsProfile &profile, float *x, float *y,
+                                uint32_t *color, const uint32_t *palette)
+{
+  return convert_points(profile.data, profile.data_len, x, y, color, palette);
+}
+
+/**
+ * @brief A 2D affine transform of converted points, in inches. Used to map
+ * each scan head's points into a common coordinate frame for the whole scan
+ * system.
+ */
+struct PointTransform {
+  float xx = 1.0f;
+  float xy = 0.0f;
+  float tx = 0.0f;
+  float yx = 0.0f;
+  float yy = 1.0f;
+  float ty = 0.0f;
+
+  bool is_identity() const
+  {
+    return (1.0f == xx) && (0.0f == xy) && (0.0f == tx) && (0.0f == yx) &&
+           (1.0f == yy) && (0.0f == ty);
+  }
+
+  void apply(float &x, float &y) const
+  {
+    float u = xx * x + xy * y + tx;
+    float v = yx * x + yy * y + ty;
+    x = u;
+    y = v;
+  }
+
+  /**
+   * @brief The transform undoing this one; alignment transforms are always
+   * invertible.
+   */
+  PointTransform inverse() const
+  {
+    float det = xx * yy - xy * yx;
+    PointTransform t;
+    t.xx = yy / det;
+    t.xy = -xy / det;
+    t.yx = -yx / det;
+    t.yy = xx / det;
+    t.tx = -(t.xx * tx + t.xy * ty);
+    t.ty = -(t.yx * tx + t.yy * ty);
+    return t;
+  }
+};
+
+/**
+ * @brief An axis aligned rectangle of converted points, in inches.
+ */
+struct PointRegion {
+  float left = 0.0f;
+  float right = 0.0f;
+  float bottom = 0.0f;
+  float top = 0.0f;
+
+  bool contains(float x, float y) const
+  {
+    return (left <= x) && (x <= right) && (bottom <= y) && (y <= top);
+  }
+};
+
+/**
+ * @brief Builds the transform equivalent to `jsScanHeadSetAlignment`: points
+ * are mirrored in X if the cable is downstream, rotated by `roll_deg`
+ * counterclockwise, then shifted.
+ */
+PointTransform make_alignment_transform(double roll_deg, double shift_x,
+                                        double shift_y,
+                                        bool is_cable_downstream = false);
+
+/**
+ * @brief Applies a transform in place to `count` converted points, using the
+ * same kernel as `convert_points`.
+ */
+void transform_points(float *x, float *y, uint32_t count,
+                      const PointTransform &transform);
+
+/**
+ * @brief Marks every point outside of `region` invalid, in place, so that
+ * nothing after it has to look at those points again. The points are still
+ * in the client API's units; `transform` takes them, once in inches, into
+ * the frame the region is in. Uses the same kernel as `convert_points`.
+ *
+ * @return One past the last point left valid, or zero if none are.
+ */
+uint32_t crop_points(jsProfileData *points, uint32_t count,
+                     const PointTransform &transform,
+                     const PointRegion &region);
+
+/**
+ * @brief Returns the kernel currently used by `convert_points`. By default
+ * this is the fastest one supported by the CPU.
+ */
+ConvertKernel get_convert_kernel();
+
+/**
+ * @brief Selects the kernel used by `convert_points`, for example to compare
+ * the SIMD implementations against the scalar one.
+ *
+ * @return `true` if the kernel is supported, otherwise `false` and the
+ * current kernel is left unchanged.
+ */
+bool set_convert_kernel(ConvertKernel kernel);
+
+/**
+ * @brief Checks if a kernel can run on this CPU.
+ */
+bool is_convert_kernel_supported(ConvertKernel kernel);
+
+const char *get_convert_kernel_name(ConvertKernel kernel);
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_history.hpp"
+#include <algorithm>
+#include "profile_convert.hpp"
+
+ProfileHistory::ProfileHistory(uint32_t capacity)
+  : x_data(static_cast<size_t>(capacity) * JS_PROFILE_DATA_LEN),
+    y_data(static_cast<size_t>(capacity) * JS_PROFILE_DATA_LEN),
+    lengths(capacity, 0)
+{
+}
+
+void ProfileHistory::push(const jsProfile &profile)
+{
+  if (lengths.empty()) {
+    return;
+  }
+
+  uint32_t slot = (0 == count) ? 0 : (newest + 1) % capacity();
+  size_t offset = static_cast<size_t>(slot) * JS_PROFILE_DATA_LEN;
+  uint32_t len = (JS_PROFILE_DATA_LEN < profile.data_len) ?
+                   JS_PROFILE_DATA_LEN : profile.data_len;
+
+  point_count -= lengths[slot];
+  lengths[slot] = convert_points(profile.data, len, &x_data[offset],
+                                 &y_data[offset]);
+  point_count += lengths[slot];
+
+  newest = slot;
+  if (count < capacity()) {
+    count++;
+  }
+}
+
+void ProfileHistory::clear()
+{
+  std::fill(lengths.begin(), lengths.end(), 0);
+  newest = 0;
+  count = 0;
+  point_count = 0;
+}
+
+uint32_t ProfileHistory::gather(uint32_t first_age, uint32_t last_age,
+                                uint32_t stride, float *x, float *y,
+                                uint32_t max_points) const
+{
+  if (last_age > count) {
+    last_age = count;
+  }
+  if (0 == stride) {
+    stride = 1;
+  }
+
+  uint32_t n = 0;
+  for (uint32_t age = first_age; age < last_age; age++) {
+    uint32_t slot = (newest + capacity() - age) % capacity();
+    size_t offset = static_cast<size_t>(slot) * JS_PROFILE_DATA_LEN;
+    const float *src_x = &x_data[offset];
+    const float *src_y = &y_data[offset];
+
+    // Stagger the starting point by age so that decimating by a stride
+    // doesn't keep picking the same positions along every profile.
+    for (uint32_t i = age % stride; i < lengths[slot]; i += stride) {
+      if (n == max_points) {
+        return n;
+      }
+      x[n] = src_x[i];
+      y[n] = src_y[i];
+      n++;
+    }
+  }
+
+  return n;
+}
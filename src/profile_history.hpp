@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_history.hpp
+ * @brief Fixed capacity history of the most recent profiles from a camera.
+ *
+ * Profiles are converted to inches as they are added and stored in columns
+ * allocated once up front, so adding to the history never allocates memory.
+ * When the history is full, the oldest profile is overwritten.
+ */
+#ifndef SCAN_GUI_PROFILE_HISTORY_HPP
+#define SCAN_GUI_PROFILE_HISTORY_HPP
+
+#include <cstdint>
+#include <vector>
+#include <joescan_pinchot.h>
+
+class ProfileHistory {
+public:
+  /**
+   * @brief Creates a history holding at most `capacity` profiles.
+   */
+  explicit ProfileHistory(uint32_t capacity = 0);
+
+  /**
+   * @brief Converts a profile and adds it as the newest in the history.
+   */
+  void push(const jsProfile &profile);
+
+  void clear();
+
+  /**
+   * @brief Number of profiles currently held.
+   */
+  uint32_t size() const
+  {
+    return count;
+  }
+
+  uint32_t capacity() const
+  {
+    return static_cast<uint32_t>(lengths.size());
+  }
+
+  /**
+   * @brief Total number of valid points across all held profiles.
+   */
+  uint64_t get_point_count() const
+  {
+    return point_count;
+  }
+
+  /**
+   * @brief Copies every `stride`th point of the profiles with an age in
+   * `[first_age, last_age)` into the output arrays, age zero being the newest
+   * profile.
+   *
+   * @param x Output array of X values.
+   * @param y Output array of Y values.
+   * @param max_points Size of the output arrays; gathering stops once full.
+   * @return Number of points written.
+   */
+  uint32_t gather(uint32_t first_age, uint32_t last_age, uint32_t stride,
+                  float *x, float *y, uint32_t max_points) const;
+
+private:
+  std::vector<float> x_data;
+  std::vector<float> y_data;
+  std::vector<uint32_t> lengths;
+  uint32_t newest = 0;
+  uint32_t count = 0;
+  uint64_t point_count = 0;
+};
+
+#endif
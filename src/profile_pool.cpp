@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_pool.hpp"
+#include <cstddef>
+#include <cstring>
+
+static const uintptr_t kCacheLine = 64;
+
+ProfileHandle::ProfileHandle(const ProfileHandle &other)
+  : pool(other.pool), profile(other.profile)
+{
+  if (nullptr != profile) {
+    pool->retain(profile);
+  }
+}
+
+ProfileHandle::ProfileHandle(ProfileHandle &&other) noexcept
+  : pool(other.pool), profile(other.profile)
+{
+  other.pool = nullptr;
+  other.profile = nullptr;
+}
+
+ProfileHandle &ProfileHandle::operator=(const ProfileHandle &other)
+{
+  if (profile != other.profile) {
+    if (nullptr != other.profile) {
+      other.pool->retain(other.profile);
+    }
+    reset();
+    pool = other.pool;
+    profile = other.profile;
+  }
+  return *this;
+}
+
+ProfileHandle &ProfileHandle::operator=(ProfileHandle &&other) noexcept
+{
+  if (this != &other) {
+    reset();
+    pool = other.pool;
+    profile = other.profile;
+    other.pool = nullptr;
+    other.profile = nullptr;
+  }
+  return *this;
+}
+
+void ProfileHandle::reset()
+{
+  if (nullptr != profile) {
+    pool->release(profile);
+    pool = nullptr;
+    profile = nullptr;
+  }
+}
+
+ProfilePool::ProfilePool(uint32_t capacity)
+  : slot_count((0 < capacity) ? capacity : 1),
+    storage(new uint8_t[slot_count * sizeof(jsProfile) + kCacheLine]),
+    refs(new RefCount[slot_count]),
+    free_count(slot_count)
+{
+  uintptr_t p = reinterpret_cast<uintptr_t>(storage.get());
+  p = (p + kCacheLine - 1) & ~(kCacheLine - 1);
+  profiles = reinterpret_cast<jsProfile *>(p);
+  // Only the headers; the points are always written before they are read.
+  for (uint32_t n = 0; n < slot_count; n++) {
+    std::memset(&profiles[n], 0, offsetof(jsProfile, data));
+  }
+}
+
+jsProfile *ProfilePool::acquire(uint32_t max_count, uint32_t &count)
+{
+  count = 0;
+  if (0 == max_count) {
+    return nullptr;
+  }
+
+  // Find the first free slot from the cursor on, then take as many free
+  // slots after it as are wanted, up to the end of the storage.
+  uint32_t first = cursor;
+  uint32_t checked = 0;
+  while (0 != refs[first].count.load(std::memory_order_acquire)) {
+    if (++checked == slot_count) {
+      return nullptr;
+    }
+    first = (first + 1 == slot_count) ? 0 : first + 1;
+  }
+  uint32_t end = first;
+  while ((end < slot_count) && (end - first < max_count) &&
+         (0 == refs[end].count.load(std::memory_order_acquire))) {
+    // Nobody else takes slots from the pool, so a free slot stays free.
+    refs[end].count.store(1, std::memory_order_relaxed);
+    end++;
+  }
+
+  count = end - first;
+  cursor = (end == slot_count) ? 0 : end;
+  free_count.fetch_sub(count, std::memory_order_relaxed);
+  return &profiles[first];
+}
+
+void ProfilePool::release(jsProfile *profile)
+{
+  RefCount &r = refs[profile - profiles];
+  if (1 == r.count.fetch_sub(1, std::memory_order_acq_rel)) {
+    free_count.fetch_add(1, std::memory_order_relaxed);
+  }
+}
@@ -0,0 +1,163 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_pool.hpp
+ * @brief Fixed pool of profiles shared through reference counted handles.
+ *
+ * A profile read by a receiver goes to several places at once: the ring the
+ * GUI drains, the latest profile of its camera for the live view, and the
+ * receiver stages. Rather than each keeping its own copy of a profile that
+ * is over 17 kB, they share one slot of a pool through handles, and the slot
+ * goes back to the pool when the last handle to it is dropped. The pool is
+ * allocated once up front, so nothing is allocated once profiles flow.
+ *
+ * Slots are handed out in runs that are contiguous in memory, so that a
+ * receiver can still read a whole batch of profiles into them with a single
+ * call to the client API. The pool's storage starts on a cache line, with
+ * the slots packed back to back so that a run is a plain `jsProfile` array;
+ * the reference counts are kept apart from the profiles, one per cache
+ * line, so that releasing a slot on one thread doesn't disturb another
+ * thread reading its neighbour.
+ */
+#ifndef SCAN_GUI_PROFILE_POOL_HPP
+#define SCAN_GUI_PROFILE_POOL_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <joescan_pinchot.h>
+
+class ProfilePool;
+
+/**
+ * @brief Shared ownership of one profile in a `ProfilePool`. Copying a
+ * handle adds a reference, destroying or resetting it drops one; neither
+ * ever allocates. Any thread may use handles, but a profile must not be
+ * written to once it is shared.
+ */
+class ProfileHandle {
+public:
+  ProfileHandle() = default;
+  ProfileHandle(const ProfileHandle &other);
+  ProfileHandle(ProfileHandle &&other) noexcept;
+  ProfileHandle &operator=(const ProfileHandle &other);
+  ProfileHandle &operator=(ProfileHandle &&other) noexcept;
+
+  ~ProfileHandle()
+  {
+    reset();
+  }
+
+  /**
+   * @brief Drops this handle's reference, leaving it empty.
+   */
+  void reset();
+
+  jsProfile *get() const
+  {
+    return profile;
+  }
+
+  jsProfile &operator*() const
+  {
+    return *profile;
+  }
+
+  jsProfile *operator->() const
+  {
+    return profile;
+  }
+
+  explicit operator bool() const
+  {
+    return nullptr != profile;
+  }
+
+private:
+  friend class ProfilePool;
+
+  ProfileHandle(ProfilePool *pool, jsProfile *profile)
+    : pool(pool), profile(profile)
+  {
+  }
+
+  ProfilePool *pool = nullptr;
+  jsProfile *profile = nullptr;
+};
+
+class ProfilePool {
+public:
+  /**
+   * @brief Allocates a pool of `capacity` profiles.
+   */
+  explicit ProfilePool(uint32_t capacity);
+
+  ProfilePool(const ProfilePool &) = delete;
+  ProfilePool &operator=(const ProfilePool &) = delete;
+
+  /**
+   * @brief Claims up to `max_count` free slots that are contiguous in
+   * memory, for reading profiles into. Only a single thread may acquire from
+   * a pool; any thread may release.
+   *
+   * @param count Set to the number of slots claimed, zero if none are free.
+   * @return Pointer to the first slot claimed, or `nullptr` if none are
+   * free.
+   */
+  jsProfile *acquire(uint32_t max_count, uint32_t &count);
+
+  /**
+   * @brief Turns the claim on a slot returned by `acquire` into a handle.
+   */
+  ProfileHandle adopt(jsProfile *profile)
+  {
+    return ProfileHandle(this, profile);
+  }
+
+  /**
+   * @brief Gives a slot that was claimed by `acquire` back unused.
+   */
+  void release(jsProfile *profile);
+
+  uint32_t capacity() const
+  {
+    return slot_count;
+  }
+
+  /**
+   * @brief Number of slots that aren't in use; approximate while other
+   * threads hold handles.
+   */
+  uint32_t get_free_count() const
+  {
+    return free_count.load(std::memory_order_relaxed);
+  }
+
+private:
+  friend class ProfileHandle;
+
+  struct alignas(64) RefCount {
+    std::atomic<uint32_t> count{0};
+  };
+
+  void retain(jsProfile *profile)
+  {
+    refs[profile - profiles].count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const uint32_t slot_count;
+  std::unique_ptr<uint8_t[]> storage;
+  jsProfile *profiles = nullptr;
+  std::unique_ptr<RefCount[]> refs;
+  // Where the next search for free slots starts. Slots mostly come back in
+  // the order they were handed out, so this tends to already be free.
+  uint32_t cursor = 0;
+  std::atomic<uint32_t> free_count;
+};
+
+#endif
@@ -0,0 +1,361 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_receiver.hpp"
+#include <algorithm>
+#include <chrono>
+#include "frame_merger.hpp"
+#include "region_filter.hpp"
+
+// How long the receiver thread blocks in the API waiting for new profiles
+// before checking whether it has been asked to stop.
+static const uint32_t kWaitTimeoutUs = 100000;
+// More profiles than this waiting in the client API means the receiver isn't
+// keeping up with the scan rate.
+static const int32_t kBacklogWarning = 100;
+// Room in the pool for the consumer to hold on to a few profiles of its own.
+static const uint32_t kSpareProfiles = 8;
+// Failed reads in a row after which the source is recovered.
+static const uint32_t kFailuresBeforeRecovery = 5;
+// Without profiles for this long a scan head counts as stalled, and a while
+// after that as lost and in need of recovery.
+static const uint64_t kStallTimeoutNs = 1000000000;
+static const uint64_t kRecoverTimeoutNs = 5000000000;
+// Wait after the first failed recovery attempt; it doubles with every
+// attempt after that, up to the maximum.
+static const auto kRecoveryDelay = std::chrono::milliseconds(100);
+static const auto kMaxRecoveryDelay = std::chrono::milliseconds(5000);
+
+/**
+ * @brief Enough profiles for every slot of the ring, every buffer of the
+ * latest profiles, a batch being read and the consumer to hold on to one at
+ * the same time, so that the pool doesn't run dry in normal operation.
+ */
+static uint32_t get_pool_capacity(size_t ring_capacity,
+                                  const BatchReadConfig &config,
+                                  uint32_t held_profiles)
+{
+  size_t ring = 1;
+  while (ring < ring_capacity) {
+    ring <<= 1;
+  }
+  uint32_t batch = std::max({1u, config.min_batch, config.max_batch});
+  return static_cast<uint32_t>(ring) + 3 * kCamerasPerHead + batch +
+         kSpareProfiles + held_profiles;
+}
+
+ProfileReceiver::ProfileReceiver(ProfileSource &source, EventLog &events,
+                                 HeadMetrics &metrics,
+                                 BatchReadConfig batch_config,
+                                 size_t ring_capacity,
+                                 uint32_t held_profiles)
+  : source(source),
+    id(source.get_id()),
+    events(events),
+    metrics(metrics),
+    batch_config(batch_config),
+    pool(get_pool_capacity(ring_capacity, batch_config, held_profiles)),
+    profiles(ring_capacity)
+{
+  if (0 == this->batch_config.min_batch) {
+    this->batch_config.min_batch = 1;
+  }
+  if (this->batch_config.max_batch < this->batch_config.min_batch) {
+    this->batch_config.max_batch = this->batch_config.min_batch;
+  }
+  batch.resize(this->batch_config.max_batch);
+  overflow.resize(this->batch_config.max_batch);
+  batch_size.store(this->batch_config.min_batch);
+}
+
+ProfileReceiver::~ProfileReceiver()
+{
+  stop();
+}
+
+void ProfileReceiver::start()
+{
+  if (is_running.exchange(true)) {
+    return;
+  }
+  thread = std::thread(&ProfileReceiver::run, this);
+}
+
+void ProfileReceiver::stop()
+{
+  is_running.store(false);
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+void ProfileReceiver::run()
+{
+  health.store(HEAD_HEALTH_OK, std::memory_order_relaxed);
+  uint32_t failures = 0;
+  // Stalls are timed from the last profile, or the last recovery if that was
+  // more recent, so a source that is merely quiet isn't recovered over and
+  // over.
+  uint64_t last_profile_ns = get_time_ns();
+  uint64_t last_recovery_ns = last_profile_ns;
+
+  while (is_running.load(std::memory_order_relaxed)) {
+    if (nullptr != recorder) {
+      recorder->poll(id);
+    }
+
+    int32_t r = source.wait_until_available(1, kWaitTimeoutUs);
+    if (0 > r) {
+      events.record(id, EVENT_READ_FAILURE, r);
+      if (handle_failure(r, failures)) {
+        last_recovery_ns = get_time_ns();
+      }
+      continue;
+    }
+
+    metrics.queue_depth.store(r, std::memory_order_relaxed);
+    if (0 == r) {
+      events.count(id, EVENT_EMPTY_POLL);
+      uint64_t now_ns = get_time_ns();
+      if (source.is_idle()) {
+        // Stalls are timed from when it next has profiles to deliver.
+        last_profile_ns = now_ns;
+        health.store(HEAD_HEALTH_OK, std::memory_order_relaxed);
+        continue;
+      }
+      if (kRecoverTimeoutNs <= now_ns - std::max(last_profile_ns,
+                                                 last_recovery_ns)) {
+        recover();
+        last_recovery_ns = get_time_ns();
+      }
+      if (kStallTimeoutNs <= now_ns - last_profile_ns) {
+        health.store(HEAD_HEALTH_STALLED, std::memory_order_relaxed);
+      }
+      continue;
+    } else if (kBacklogWarning < r) {
+      events.record(id, EVENT_BACKLOG_OVERRUN, r);
+    }
+
+    // Let the batch size follow the backlog: grow it while profiles are
+    // piling up faster than we take them, shrink it once we've caught up.
+    uint32_t available = static_cast<uint32_t>(r);
+    uint32_t batch = batch_size.load(std::memory_order_relaxed);
+    if (available > batch) {
+      batch = std::min(batch * 2, batch_config.max_batch);
+    } else if (available < batch / 4) {
+      batch = std::max(batch / 2, batch_config.min_batch);
+    }
+    batch_size.store(batch, std::memory_order_relaxed);
+
+    while (0 < available) {
+      int32_t got = read_batch(std::min(available, batch));
+      if (0 > got) {
+        if (handle_failure(got, failures)) {
+          last_recovery_ns = get_time_ns();
+        }
+        break;
+      } else if (0 == got) {
+        break;
+      }
+      failures = 0;
+      last_profile_ns = get_time_ns();
+      health.store(HEAD_HEALTH_OK, std::memory_order_relaxed);
+      available -= std::min(available, static_cast<uint32_t>(got));
+    }
+  }
+}
+
+/**
+ * @brief Counts a failed read, recovering the source once too many have
+ * failed in a row.
+ *
+ * @return Whether the source was recovered.
+ */
+bool ProfileReceiver::handle_failure(int32_t error, uint32_t &failures)
+{
+  last_error.store(error, std::memory_order_relaxed);
+  if (kFailuresBeforeRecovery <= ++failures) {
+    failures = 0;
+    recover();
+    return true;
+  }
+  health.store(HEAD_HEALTH_FAILING, std::memory_order_relaxed);
+  // Don't spin on a scan head that is reporting errors.
+  sleep_while_running(std::chrono::milliseconds(10));
+  return false;
+}
+
+/**
+ * @brief Keeps asking the source to recover, backing off between attempts,
+ * until it does or the receiver is stopped.
+ */
+void ProfileReceiver::recover()
+{
+  health.store(HEAD_HEALTH_RECOVERING, std::memory_order_relaxed);
+  auto delay = kRecoveryDelay;
+  for (int32_t attempt = 1; is_running.load(std::memory_order_relaxed);
+       attempt++) {
+    int32_t r = source.recover();
+    if (0 <= r) {
+      recoveries.fetch_add(1, std::memory_order_relaxed);
+      events.record(id, EVENT_RECOVERED, attempt);
+      // Healthy again only once profiles actually arrive.
+      health.store(HEAD_HEALTH_STALLED, std::memory_order_relaxed);
+      return;
+    }
+    last_error.store(r, std::memory_order_relaxed);
+    events.record(id, EVENT_RECOVERY_FAILURE, r);
+    sleep_while_running(delay);
+    delay = std::min(delay * 2, kMaxRecoveryDelay);
+  }
+}
+
+/**
+ * @brief Sleeps in short steps, so that stopping the receiver is never held
+ * up by a long wait.
+ */
+void ProfileReceiver::sleep_while_running(std::chrono::milliseconds duration)
+{
+  const auto step = std::chrono::milliseconds(10);
+  while ((0 < duration.count()) &&
+         is_running.load(std::memory_order_relaxed)) {
+    std::this_thread::sleep_for(std::min(duration, step));
+    duration -= step;
+  }
+}
+
+int32_t ProfileReceiver::read_batch(uint32_t max_profiles)
+{
+  // Read straight into a run of pool slots, so the profiles are never copied
+  // again on their way to the consumers.
+  uint32_t count = 0;
+  jsProfile *slots = pool.acquire(std::min<uint32_t>(max_profiles,
+                                                     static_cast<uint32_t>(
+                                                       batch.size())),
+                                  count);
+  const bool is_overflow = (nullptr == slots);
+  if (is_overflow) {
+    slots = overflow.data();
+    count = std::min<uint32_t>(max_profiles,
+                               static_cast<uint32_t>(overflow.size()));
+  }
+
+  uint64_t start_ns = get_time_ns();
+  int32_t got = source.get_profiles(slots, count);
+  uint64_t end_ns = get_time_ns();
+  metrics.read_time_ns.record(end_ns - start_ns);
+  const uint32_t used = (0 < got) ? static_cast<uint32_t>(got) : 0;
+  if (!is_overflow) {
+    for (uint32_t n = 0; n < used; n++) {
+      batch[n] = pool.adopt(&slots[n]);
+    }
+    for (uint32_t n = used; n < count; n++) {
+      pool.release(&slots[n]);
+    }
+  }
+  if (0 > got) {
+    events.record(id, EVENT_READ_FAILURE, got);
+    return got;
+  }
+
+  metrics.profiles_received.fetch_add(got, std::memory_order_relaxed);
+  uint64_t points = 0;
+  for (int32_t n = 0; n < got; n++) {
+    int64_t offset = static_cast<int64_t>(end_ns) -
+                     static_cast<int64_t>(slots[n].timestamp_ns);
+    metrics.clock_offset_ns.update(offset, end_ns);
+    points += slots[n].data_len;
+  }
+  metrics.points_received.fetch_add(points, std::memory_order_relaxed);
+
+  // Points outside the region of interest are gone before the profiles are
+  // shared with anything.
+  if ((nullptr != filter) && (0 < got)) {
+    ScopedTimer timer(metrics.crop_time_ns);
+    filter->apply(id, slots, static_cast<uint32_t>(got));
+  }
+
+  // Even profiles that get dropped from the ring are still good enough to
+  // show as the current view, to analyze and to record.
+  if (!is_overflow) {
+    publish_latest(got);
+    if (nullptr != merger) {
+      merger->add(id, batch.data(), used);
+    }
+  }
+  for (size_t n = 0; (0 < got) && (n < stages.size()); n++) {
+    if (n < kMaxTimedStages) {
+      ScopedTimer timer(metrics.stage_time_ns[n]);
+      stages[n]->process(id, slots, static_cast<uint32_t>(got));
+    } else {
+      stages[n]->process(id, slots, static_cast<uint32_t>(got));
+    }
+  }
+  if (nullptr != recorder) {
+    recorder->add(id, slots, got);
+  }
+
+  // Whatever doesn't fit in the ring is dropped, its slots going straight
+  // back to the pool unless the latest profiles still hold on to them.
+  uint32_t pushed = 0;
+  if (!is_overflow) {
+    while (pushed < used) {
+      ProfileHandle *slot = profiles.write_slot();
+      if (nullptr == slot) {
+        break;
+      }
+      *slot = std::move(batch[pushed++]);
+      profiles.commit_write();
+    }
+    for (uint32_t n = pushed; n < used; n++) {
+      batch[n].reset();
+    }
+  }
+  if (pushed < used) {
+    events.record(id, EVENT_PROFILES_DROPPED,
+                  static_cast<int32_t>(used - pushed));
+    metrics.profiles_dropped.fetch_add(used - pushed,
+                                       std::memory_order_relaxed);
+  }
+
+  return got;
+}
+
+const char *ProfileReceiver::get_health_name(HeadHealth health)
+{
+  switch (health) {
+  case HEAD_HEALTH_OK:
+    return "ok";
+  case HEAD_HEALTH_STALLED:
+    return "stalled";
+  case HEAD_HEALTH_FAILING:
+    return "failing";
+  case HEAD_HEALTH_RECOVERING:
+    return "recovering";
+  }
+  return "unknown";
+}
+
+void ProfileReceiver::publish_latest(int32_t count)
+{
+  const ProfileHandle *newest[kCamerasPerHead] = {nullptr};
+  for (int32_t n = 0; n < count; n++) {
+    uint32_t camera = static_cast<uint32_t>(batch[n]->camera);
+    if (camera < kCamerasPerHead) {
+      newest[camera] = &batch[n];
+    }
+  }
+
+  // Sharing the profile is all it takes; the handle keeps it from going
+  // back to the pool for as long as it is the latest.
+  for (uint32_t camera = 0; camera < kCamerasPerHead; camera++) {
+    if (nullptr != newest[camera]) {
+      latest[camera].back() = *newest[camera];
+      latest[camera].publish();
+    }
+  }
+}
@@ -0,0 +1,239 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_receiver.hpp
+ * @brief Background thread that continuously drains profiles from a scan head.
+ *
+ * Each scan head gets its own receiver. The receiver thread blocks on its
+ * profile source, normally the client API, waiting for new profiles and
+ * reads them straight into slots of its profile pool. From there they are
+ * shared, not copied, with a lock-free ring, from which the GUI picks them
+ * up at its own pace, and with the latest profile of each camera. This way
+ * a slow frame never causes profiles to back up inside the scan head.
+ */
+#ifndef SCAN_GUI_PROFILE_RECEIVER_HPP
+#define SCAN_GUI_PROFILE_RECEIVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "event_log.hpp"
+#include "metrics.hpp"
+#include "profile_pool.hpp"
+#include "profile_recorder.hpp"
+#include "profile_source.hpp"
+#include "profile_stage.hpp"
+#include "spsc_ring.hpp"
+#include "triple_buffer.hpp"
+
+// Number of cameras on each scan head.
+static const uint32_t kCamerasPerHead = 2;
+
+class FrameMerger;
+class RegionFilter;
+
+/**
+ * @brief Controls how many profiles the receiver pulls out of the client API
+ * with each call to `jsScanHeadGetProfiles`. The batch size starts at
+ * `min_batch` and doubles whenever more profiles are waiting than the current
+ * batch can hold, shrinking again once the backlog has been worked off.
+ */
+struct BatchReadConfig {
+  uint32_t min_batch = 1;
+  uint32_t max_batch = 64;
+};
+
+/**
+ * @brief How well a receiver is getting profiles from its source. A scan
+ * head in trouble only ever holds up its own receiver; the others keep
+ * reading at full rate.
+ */
+enum HeadHealth {
+  // Profiles are arriving.
+  HEAD_HEALTH_OK = 0,
+  // No profiles have arrived for a while, though nothing failed.
+  HEAD_HEALTH_STALLED,
+  // Reading profiles failed the last time it was tried.
+  HEAD_HEALTH_FAILING,
+  // The source kept failing or stalling; the receiver is trying to bring it
+  // back, waiting longer after every attempt that fails.
+  HEAD_HEALTH_RECOVERING,
+};
+
+class ProfileReceiver {
+public:
+  /**
+   * @brief Creates a receiver for a scan head. The receiver thread is not
+   * started until `start` is called.
+   *
+   * @param source Where to read the scan head's profiles from; must outlive
+   * the receiver.
+   * @param events Log that receives this scan head's events, using the scan
+   * head's ID as the source.
+   * @param metrics Instrumentation updated as profiles are received.
+   * @param batch_config Limits on the number of profiles read per API call.
+   * @param ring_capacity Number of profiles that can be buffered between the
+   * receiver and the consumer before profiles are dropped.
+   * @param held_profiles Number of profiles the consumer may keep handles to
+   * after taking them out of the ring, on top of a few; the pool is sized to
+   * match.
+   */
+  ProfileReceiver(ProfileSource &source, EventLog &events,
+                  HeadMetrics &metrics,
+                  BatchReadConfig batch_config = BatchReadConfig(),
+                  size_t ring_capacity = 256, uint32_t held_profiles = 0);
+  ~ProfileReceiver();
+
+  ProfileReceiver(const ProfileReceiver &) = delete;
+  ProfileReceiver &operator=(const ProfileReceiver &) = delete;
+
+  /**
+   * @brief Passes every profile read from now on to a recorder as well, using
+   * the scan head's ID as the source. Must be called before `start`.
+   */
+  void set_recorder(ProfileRecorder *recorder)
+  {
+    this->recorder = recorder;
+  }
+
+  /**
+   * @brief Crops every profile read from now on to the filter's region,
+   * before anything else gets to see it. Must be called before `start`; the
+   * filter must outlive the receiver.
+   */
+  void set_filter(RegionFilter *filter)
+  {
+    this->filter = filter;
+  }
+
+  /**
+   * @brief Passes every profile read from now on to a merger as well, to
+   * group it with the other scan heads' profiles of the same scan. Must be
+   * called before `start`; the merger has to be destroyed before the
+   * receiver, since it holds on to profiles from its pool.
+   */
+  void set_merger(FrameMerger *merger)
+  {
+    this->merger = merger;
+  }
+
+  /**
+   * @brief Runs a stage on every batch read from now on, after any stages
+   * added before it. Must be called before `start`; the stage must outlive
+   * the receiver. The first `kMaxTimedStages` stages are timed into the
+   * matching `HeadMetrics::stage_time_ns`.
+   */
+  void add_stage(ProfileStage *stage)
+  {
+    stages.push_back(stage);
+  }
+
+  const std::vector<ProfileStage *> &get_stages() const
+  {
+    return stages;
+  }
+
+  void start();
+  void stop();
+
+  ProfileSource &get_source() const
+  {
+    return source;
+  }
+
+  /**
+   * @brief The ring the receiver publishes profiles into. Only a single
+   * consumer thread may read from it, and should take profiles out with
+   * `try_pop` so that their slots go back to the pool once done with.
+   */
+  SpscRing<ProfileHandle> &get_profiles()
+  {
+    return profiles;
+  }
+
+  /**
+   * @brief The most recent profile seen from a camera, for consumers that
+   * only ever display the newest data. Only a single consumer thread may read
+   * from it.
+   */
+  TripleBuffer<ProfileHandle> &get_latest(uint32_t camera)
+  {
+    return latest[camera];
+  }
+
+  /**
+   * @brief The batch size the receiver has currently settled on.
+   */
+  uint32_t get_batch_size() const
+  {
+    return batch_size.load(std::memory_order_relaxed);
+  }
+
+  HeadHealth get_health() const
+  {
+    return static_cast<HeadHealth>(health.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * @brief Negative `jsError` value of the most recent failure, if any.
+   */
+  int32_t get_last_error() const
+  {
+    return last_error.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Number of times the source was brought back.
+   */
+  uint32_t get_recoveries() const
+  {
+    return recoveries.load(std::memory_order_relaxed);
+  }
+
+  static const char *get_health_name(HeadHealth health);
+
+private:
+  void run();
+  bool handle_failure(int32_t error, uint32_t &failures);
+  void recover();
+  void sleep_while_running(std::chrono::milliseconds duration);
+  int32_t read_batch(uint32_t max_profiles);
+  void publish_latest(int32_t count);
+
+  ProfileSource &source;
+  uint32_t id;
+  EventLog &events;
+  HeadMetrics &metrics;
+  ProfileRecorder *recorder = nullptr;
+  RegionFilter *filter = nullptr;
+  FrameMerger *merger = nullptr;
+  std::vector<ProfileStage *> stages;
+  BatchReadConfig batch_config;
+  // Declared ahead of everything holding handles to its profiles, so that it
+  // outlives them.
+  ProfilePool pool;
+  // Handles to the batch being read.
+  std::vector<ProfileHandle> batch;
+  SpscRing<ProfileHandle> profiles;
+  // Should the pool ever run dry, profiles still have to be read out of the
+  // client API so the scan head doesn't back up; they land here and are
+  // lost.
+  std::vector<jsProfile> overflow;
+  TripleBuffer<ProfileHandle> latest[kCamerasPerHead];
+  std::thread thread;
+  std::atomic<bool> is_running{false};
+  std::atomic<uint32_t> batch_size{1};
+  std::atomic<int32_t> health{HEAD_HEALTH_OK};
+  std::atomic<int32_t> last_error{0};
+  std::atomic<uint32_t> recoveries{0};
+};
+
+#endif
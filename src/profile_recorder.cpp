@@ -0,0 +1,433 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_recorder.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// How long `stop` waits for the sources to hand over their last profiles.
+static const auto kFlushTimeout = std::chrono::seconds(1);
+
+static uint8_t *align_pointer(uint8_t *p)
+{
+  uintptr_t v = reinterpret_cast<uintptr_t>(p);
+  v = (v + kRecordingAlignment - 1) & ~uintptr_t(kRecordingAlignment - 1);
+  return reinterpret_cast<uint8_t *>(v);
+}
+
+/**
+ * @brief Write-only file, optionally opened to bypass the page cache. With
+ * unbuffered I/O, every write must start at an aligned offset, from an
+ * aligned buffer, with an aligned size; all writes from the recorder are
+ * whole chunks, which meet these requirements.
+ */
+class ProfileRecorder::File {
+public:
+  File(const std::string &path, bool is_unbuffered)
+  {
+#ifdef _WIN32
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+    if (is_unbuffered) {
+      handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr,
+                           CREATE_ALWAYS, flags | FILE_FLAG_NO_BUFFERING,
+                           nullptr);
+      unbuffered = (INVALID_HANDLE_VALUE != handle);
+    }
+    if (INVALID_HANDLE_VALUE == handle) {
+      handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr,
+                           CREATE_ALWAYS, flags, nullptr);
+    }
+    if (INVALID_HANDLE_VALUE == handle) {
+      throw std::runtime_error("failed to create " + path);
+    }
+#else
+    const int mode = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (is_unbuffered) {
+      // Not every file system supports direct I/O (tmpfs doesn't, for one),
+      // in which case the open fails with EINVAL.
+      fd = open(path.c_str(), mode | O_DIRECT, 0644);
+      unbuffered = (0 <= fd);
+    }
+#endif
+    if (0 > fd) {
+      fd = open(path.c_str(), mode, 0644);
+    }
+    if (0 > fd) {
+      throw std::runtime_error("failed to create " + path + ": " +
+                               std::strerror(errno));
+    }
+#if defined(__APPLE__)
+    // macOS has no O_DIRECT, but can be told not to cache the file.
+    if (is_unbuffered) {
+      unbuffered = (-1 != fcntl(fd, F_NOCACHE, 1));
+    }
+#endif
+#endif
+  }
+
+  ~File()
+  {
+#ifdef _WIN32
+    CloseHandle(handle);
+#else
+    close(fd);
+#endif
+  }
+
+  File(const File &) = delete;
+  File &operator=(const File &) = delete;
+
+  bool is_unbuffered() const
+  {
+    return unbuffered;
+  }
+
+  bool write(const uint8_t *data, size_t size)
+  {
+    while (0 < size) {
+#ifdef _WIN32
+      DWORD written = 0;
+      if (!WriteFile(handle, data, static_cast<DWORD>(size), &written,
+                     nullptr)) {
+        return false;
+      }
+#else
+      ssize_t written = ::write(fd, data, size);
+      if (0 > written) {
+        if (EINTR == errno) {
+          continue;
+        }
+        return false;
+      }
+#endif
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+private:
+#ifdef _WIN32
+  HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+  int fd = -1;
+#endif
+  bool unbuffered = false;
+};
+
+ProfileRecorder::ProfileRecorder(uint32_t num_sources, size_t block_size,
+                                 uint32_t blocks_per_source)
+  : block_size(recording_align(block_size))
+{
+  if (2 > blocks_per_source) {
+    blocks_per_source = 2;
+  }
+
+  for (uint32_t id = 0; id < num_sources; id++) {
+    auto s = std::make_unique<Source>(blocks_per_source);
+    s->blocks.resize(blocks_per_source);
+    for (auto &block : s->blocks) {
+      storage.emplace_back(new uint8_t[this->block_size + kRecordingAlignment]);
+      block.data = align_pointer(storage.back().get());
+      block.source = id;
+      s->free.try_push(&block);
+    }
+    sources.emplace_back(std::move(s));
+  }
+}
+
+ProfileRecorder::~ProfileRecorder()
+{
+  stop();
+}
+
+void ProfileRecorder::start(const std::string &path,
+                            const std::vector<RecordingHeadHeader> &heads,
+                            jsDataFormat data_format, double scan_rate_hz,
+                            const RecordingOptions &options)
+{
+  if (is_active.load()) {
+    stop();
+  }
+
+  file = std::make_unique<File>(path, options.is_unbuffered);
+  this->path = path;
+  this->options = options;
+  is_file_unbuffered = file->is_unbuffered();
+
+  // The header is padded out to alignment like everything else, so the
+  // chunks that follow stay aligned.
+  const size_t header_size = static_cast<size_t>(recording_align(
+    sizeof(RecordingFileHeader) + heads.size() * sizeof(RecordingHeadHeader)));
+  std::unique_ptr<uint8_t[]> buffer(
+    new uint8_t[header_size + kRecordingAlignment]);
+  uint8_t *header = align_pointer(buffer.get());
+  std::memset(header, 0, header_size);
+
+  RecordingFileHeader file_header;
+  std::memset(&file_header, 0, sizeof(file_header));
+  std::memcpy(file_header.magic, kRecordingMagic, sizeof(kRecordingMagic));
+  file_header.version = kRecordingVersion;
+  file_header.header_size = static_cast<uint32_t>(header_size);
+  file_header.num_heads = static_cast<uint32_t>(heads.size());
+  file_header.data_format = static_cast<int32_t>(data_format);
+  file_header.scan_rate_hz = scan_rate_hz;
+  file_header.start_time_ns =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch())
+      .count();
+  std::memcpy(header, &file_header, sizeof(file_header));
+  if (!heads.empty()) {
+    std::memcpy(header + sizeof(file_header), heads.data(),
+                heads.size() * sizeof(RecordingHeadHeader));
+  }
+  if (!file->write(header, header_size)) {
+    file.reset();
+    throw std::runtime_error("failed to write header to " + path);
+  }
+
+  bytes_written.store(header_size);
+  raw_bytes_written.store(header_size);
+  profiles_written.store(0);
+  profiles_dropped.store(0);
+  is_write_failed.store(false);
+  session.fetch_add(1);
+
+  is_writing.store(true);
+  uint32_t num_threads = std::max<uint32_t>(1, options.num_threads);
+  for (uint32_t n = 0; n < num_threads; n++) {
+    auto writer = std::make_unique<Writer>();
+    if (options.is_compressed) {
+      writer->storage.reset(new uint8_t[block_size + kRecordingAlignment]);
+      writer->out = align_pointer(writer->storage.get());
+    }
+    writers.emplace_back(std::move(writer));
+  }
+  for (auto &writer : writers) {
+    writer->thread = std::thread(&ProfileRecorder::run, this, std::ref(*writer));
+  }
+  is_active.store(true, std::memory_order_release);
+}
+
+void ProfileRecorder::stop()
+{
+  if (!is_active.exchange(false)) {
+    return;
+  }
+
+  // Ask every source to hand over what it has buffered so far. A source
+  // that doesn't answer in time, because its receiver has stopped for
+  // example, loses its partly filled block.
+  uint32_t request = flush_request.fetch_add(1) + 1;
+  auto deadline = std::chrono::steady_clock::now() + kFlushTimeout;
+  for (auto &s : sources) {
+    while ((request != s->flush_ack.load(std::memory_order_acquire)) &&
+           (std::chrono::steady_clock::now() < deadline)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  is_writing.store(false);
+  wake.notify_all();
+  for (auto &writer : writers) {
+    writer->thread.join();
+  }
+  writers.clear();
+  file.reset();
+}
+
+void ProfileRecorder::reset_block(Block &block, uint32_t block_session)
+{
+  block.size = sizeof(RecordingChunkHeader);
+  block.profile_count = 0;
+  block.session = block_session;
+  block.first_timestamp_ns = 0;
+  block.last_timestamp_ns = 0;
+}
+
+void ProfileRecorder::hand_over(Source &s)
+{
+  if ((nullptr == s.current) || (0 == s.current->profile_count)) {
+    return;
+  }
+  // The full ring has room for every block the source owns, so this can't
+  // fail.
+  s.full.try_push(s.current);
+  s.current = nullptr;
+  wake.notify_one();
+}
+
+void ProfileRecorder::add(uint32_t source, const jsProfile *profiles,
+                          int32_t count)
+{
+  if ((source >= sources.size()) ||
+      !is_active.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  Source &s = *sources[source];
+  const uint32_t current_session = session.load(std::memory_order_relaxed);
+  if ((nullptr != s.current) && (current_session != s.current->session)) {
+    // Left over from a recording that stopped before we could flush.
+    reset_block(*s.current, current_session);
+  }
+
+  for (int32_t n = 0; n < count; n++) {
+    const jsProfile &profile = profiles[n];
+    const size_t size = recording_profile_size(profile);
+    if ((nullptr != s.current) && (s.current->size + size > block_size)) {
+      hand_over(s);
+    }
+    if (nullptr == s.current) {
+      Block **free = s.free.front();
+      if (nullptr == free) {
+        // The writer is behind; drop rather than wait for it.
+        profiles_dropped.fetch_add(count - n, std::memory_order_relaxed);
+        return;
+      }
+      s.current = *free;
+      s.free.pop();
+      reset_block(*s.current, current_session);
+    }
+
+    Block &block = *s.current;
+    recording_write_profile(block.data + block.size, profile);
+    block.size += size;
+    if (0 == block.profile_count) {
+      block.first_timestamp_ns = profile.timestamp_ns;
+    }
+    block.last_timestamp_ns = profile.timestamp_ns;
+    block.profile_count++;
+  }
+}
+
+void ProfileRecorder::poll(uint32_t source)
+{
+  if (source >= sources.size()) {
+    return;
+  }
+
+  Source &s = *sources[source];
+  uint32_t request = flush_request.load(std::memory_order_acquire);
+  if (request != s.flush_seen) {
+    s.flush_seen = request;
+    hand_over(s);
+    s.flush_ack.store(request, std::memory_order_release);
+  }
+}
+
+void ProfileRecorder::run(Writer &writer)
+{
+  while (true) {
+    // Check before draining, so that everything handed over before `stop`
+    // cleared the flag still makes it into the file.
+    bool is_last = !is_writing.load(std::memory_order_acquire);
+    bool did_write = write_full_blocks(writer);
+    if (is_last) {
+      break;
+    }
+    if (!did_write) {
+      std::unique_lock<std::mutex> lock(wake_mutex);
+      wake.wait_for(lock, std::chrono::milliseconds(10));
+    }
+  }
+}
+
+bool ProfileRecorder::write_full_blocks(Writer &writer)
+{
+  bool did_write = false;
+  const uint32_t current_session = session.load(std::memory_order_relaxed);
+  for (auto &s : sources) {
+    // Another writer is already working through this source's blocks; when
+    // it is done, it will have taken every block handed over until then.
+    if (s->is_claimed.exchange(true, std::memory_order_acquire)) {
+      continue;
+    }
+    while (Block **full = s->full.front()) {
+      Block *block = *full;
+      s->full.pop();
+      if (current_session == block->session) {
+        write_block(writer, *block);
+        did_write = true;
+      }
+      s->free.try_push(block);
+    }
+    s->is_claimed.store(false, std::memory_order_release);
+  }
+  return did_write;
+}
+
+void ProfileRecorder::write_block(Writer &writer, Block &block)
+{
+  if (is_write_failed.load(std::memory_order_relaxed)) {
+    profiles_dropped.fetch_add(block.profile_count, std::memory_order_relaxed);
+    return;
+  }
+
+  const uint32_t raw_size =
+    static_cast<uint32_t>(block.size - sizeof(RecordingChunkHeader));
+  RecordingChunkHeader header;
+  header.magic = kRecordingChunkMagic;
+  header.flags = 0;
+  header.scan_head_id = block.source;
+  header.profile_count = block.profile_count;
+  header.payload_size = raw_size;
+  header.raw_payload_size = raw_size;
+  header.first_timestamp_ns = block.first_timestamp_ns;
+  header.last_timestamp_ns = block.last_timestamp_ns;
+
+  // Compressed chunks are only kept if they actually came out smaller.
+  uint8_t *chunk = block.data;
+  if (nullptr != writer.out) {
+    uint8_t *payload = writer.out + sizeof(header);
+    size_t packed = writer.codec.encode(block.data + sizeof(header), raw_size,
+                                        block.profile_count, payload,
+                                        raw_size);
+    if ((0 < packed) && (packed < raw_size)) {
+      header.flags |= kRecordingChunkPacked;
+      header.payload_size = static_cast<uint32_t>(packed);
+      chunk = writer.out;
+    }
+  }
+  std::memcpy(chunk, &header, sizeof(header));
+
+  const size_t size = sizeof(header) + header.payload_size;
+  const size_t chunk_size = static_cast<size_t>(recording_align(size));
+  std::memset(chunk + size, 0, chunk_size - size);
+  bool is_ok = false;
+  {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    is_ok = file->write(chunk, chunk_size);
+  }
+  if (!is_ok) {
+    is_write_failed.store(true);
+    profiles_dropped.fetch_add(block.profile_count, std::memory_order_relaxed);
+    return;
+  }
+  bytes_written.fetch_add(chunk_size, std::memory_order_relaxed);
+  raw_bytes_written.fetch_add(recording_align(block.size),
+                              std::memory_order_relaxed);
+  profiles_written.fetch_add(block.profile_count, std::memory_order_relaxed);
+}
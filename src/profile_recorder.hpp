@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_recorder.hpp
+ * @brief Streams every received profile to a recording file on disk.
+ *
+ * Each source, normally a scan head receiver thread, serializes its profiles
+ * into a large block of memory that it owns. Once a block is full it is
+ * handed to a pool of writer threads through a lock-free ring and the source
+ * carries on with the next free block, so acquisition never waits on the
+ * disk. If the disk falls so far behind that a source runs out of free
+ * blocks, profiles are counted as dropped from the recording instead.
+ *
+ * Writer threads optionally compress each block before writing it. A source's
+ * blocks are only ever taken by one writer at a time so its chunks stay in
+ * order in the file, while blocks from different sources are compressed in
+ * parallel.
+ *
+ * See `recording_format.hpp` for the layout of the file.
+ */
+#ifndef SCAN_GUI_PROFILE_RECORDER_HPP
+#define SCAN_GUI_PROFILE_RECORDER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "profile_codec.hpp"
+#include "recording_format.hpp"
+#include "spsc_ring.hpp"
+
+struct RecordingOptions {
+  // Bypass the operating system's page cache, with `O_DIRECT` or
+  // `FILE_FLAG_NO_BUFFERING`. Falls back to buffered writes if the file
+  // system doesn't support it.
+  bool is_unbuffered = true;
+  // Compress chunks with `ChunkCodec`, typically to a fifth of their size.
+  bool is_compressed = false;
+  // Writer threads; with compression, more threads let more scan heads be
+  // compressed at once.
+  uint32_t num_threads = 1;
+};
+
+class ProfileRecorder {
+public:
+  /**
+   * @brief Creates a recorder for `num_sources` sources, such as one per scan
+   * head. All memory for the blocks is allocated here, up front.
+   *
+   * @param num_sources Number of independent sources passing in profiles.
+   * @param block_size Size in bytes of each block; also the largest chunk
+   * written to the file.
+   * @param blocks_per_source Blocks owned by each source. With two, one block
+   * is filled while the other is written; a third absorbs disk stalls.
+   */
+  ProfileRecorder(uint32_t num_sources, size_t block_size = 4 << 20,
+                  uint32_t blocks_per_source = 3);
+  ~ProfileRecorder();
+
+  ProfileRecorder(const ProfileRecorder &) = delete;
+  ProfileRecorder &operator=(const ProfileRecorder &) = delete;
+
+  /**
+   * @brief Creates the recording file, writes its header and starts the
+   * writer threads. Profiles passed to `add` from here on are recorded.
+   *
+   * @param path File to create; an existing file is overwritten.
+   * @param heads Description of each scan head in the system.
+   * @param data_format Data format the scan heads are scanning with.
+   * @param scan_rate_hz Rate the scan heads are scanning at.
+   * @param options How the recording is written.
+   * @throws std::runtime_error if the file can't be created.
+   */
+  void start(const std::string &path,
+             const std::vector<RecordingHeadHeader> &heads,
+             jsDataFormat data_format, double scan_rate_hz,
+             const RecordingOptions &options = RecordingOptions());
+
+  /**
+   * @brief Stops recording. Waits for each source to hand over the profiles
+   * it has buffered, for up to a second, then finishes writing and closes
+   * the file.
+   */
+  void stop();
+
+  bool is_recording() const
+  {
+    return is_active.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Source side; records profiles if a recording is in progress.
+   * Never blocks.
+   */
+  void add(uint32_t source, const jsProfile *profiles, int32_t count);
+
+  /**
+   * @brief Source side; must be called regularly, even when there are no new
+   * profiles, so that a source can hand over its partly filled block when
+   * recording stops.
+   */
+  void poll(uint32_t source);
+
+  uint64_t get_bytes_written() const
+  {
+    return bytes_written.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Size the chunks written so far would have had uncompressed.
+   */
+  uint64_t get_raw_bytes_written() const
+  {
+    return raw_bytes_written.load(std::memory_order_relaxed);
+  }
+
+  uint64_t get_profiles_written() const
+  {
+    return profiles_written.load(std::memory_order_relaxed);
+  }
+
+  uint64_t get_profiles_dropped() const
+  {
+    return profiles_dropped.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Whether the current recording bypasses the page cache.
+   */
+  bool is_unbuffered() const
+  {
+    return is_file_unbuffered;
+  }
+
+  bool is_compressed() const
+  {
+    return options.is_compressed;
+  }
+
+  /**
+   * @brief Whether writing to the file failed; once it has, the rest of the
+   * recording is dropped.
+   */
+  bool has_write_error() const
+  {
+    return is_write_failed.load(std::memory_order_relaxed);
+  }
+
+  const std::string &get_path() const
+  {
+    return path;
+  }
+
+private:
+  struct Block {
+    // Aligned for unbuffered I/O; the first bytes hold the chunk header.
+    uint8_t *data = nullptr;
+    uint32_t source = 0;
+    size_t size = 0;
+    uint32_t profile_count = 0;
+    // Recording the block belongs to, so stale blocks from a recording that
+    // was stopped before its source could flush are never written to a new
+    // recording.
+    uint32_t session = 0;
+    uint64_t first_timestamp_ns = 0;
+    uint64_t last_timestamp_ns = 0;
+  };
+
+  struct Source {
+    explicit Source(uint32_t num_blocks) : free(num_blocks), full(num_blocks) {}
+    std::vector<Block> blocks;
+    // Empty blocks going to the source and filled blocks coming back.
+    SpscRing<Block *> free;
+    SpscRing<Block *> full;
+    // Only accessed by the source thread.
+    Block *current = nullptr;
+    uint32_t flush_seen = 0;
+    std::atomic<uint32_t> flush_ack{0};
+    // Held by the writer thread currently taking blocks from this source.
+    std::atomic<bool> is_claimed{false};
+  };
+
+  struct Writer {
+    std::thread thread;
+    // Compressed chunks are built here, aligned like the blocks.
+    std::unique_ptr<uint8_t[]> storage;
+    uint8_t *out = nullptr;
+    ChunkCodec codec;
+  };
+
+  class File;
+
+  void reset_block(Block &block, uint32_t block_session);
+  void hand_over(Source &s);
+  void run(Writer &writer);
+  bool write_full_blocks(Writer &writer);
+  void write_block(Writer &writer, Block &block);
+
+  size_t block_size;
+  std::vector<std::unique_ptr<uint8_t[]>> storage;
+  std::vector<std::unique_ptr<Source>> sources;
+  std::unique_ptr<File> file;
+  std::mutex file_mutex;
+  std::string path;
+  RecordingOptions options;
+  bool is_file_unbuffered = false;
+
+  std::atomic<bool> is_active{false};
+  std::atomic<uint32_t> session{0};
+  std::atomic<uint32_t> flush_request{0};
+  std::atomic<bool> is_writing{false};
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+  std::vector<std::unique_ptr<Writer>> writers;
+
+  std::atomic<uint64_t> bytes_written{0};
+  std::atomic<uint64_t> raw_bytes_written{0};
+  std::atomic<uint64_t> profiles_written{0};
+  std::atomic<uint64_t> profiles_dropped{0};
+  std::atomic<bool> is_write_failed{false};
+};
+
+#endif
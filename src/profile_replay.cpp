@@ -0,0 +1,540 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_replay.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include "metrics.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Longest a source sleeps at once while waiting for profiles to come due, so
+// that it notices seeks and speed changes promptly.
+static const uint64_t kMaxSleepNs = 10000000;
+// Upper bound on how far ahead a source looks when counting the profiles
+// that are due.
+static const uint32_t kMaxCountAhead = 1024;
+
+RecordingReader::RecordingReader(const std::string &path)
+{
+  map(path);
+  try {
+    index();
+  } catch (...) {
+    unmap();
+    throw;
+  }
+}
+
+RecordingReader::~RecordingReader()
+{
+  unmap();
+}
+
+void RecordingReader::map(const std::string &path)
+{
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (INVALID_HANDLE_VALUE == file) {
+    throw std::runtime_error("failed to open " + path);
+  }
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || (0 == file_size.QuadPart)) {
+    CloseHandle(file);
+    throw std::runtime_error("failed to read size of " + path);
+  }
+  HANDLE mapping =
+    CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (nullptr == mapping) {
+    CloseHandle(file);
+    throw std::runtime_error("failed to map " + path);
+  }
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (nullptr == view) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    throw std::runtime_error("failed to map " + path);
+  }
+  file_handle = file;
+  mapping_handle = mapping;
+  data = static_cast<const uint8_t *>(view);
+  size = static_cast<uint64_t>(file_size.QuadPart);
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (0 > fd) {
+    throw std::runtime_error("failed to open " + path);
+  }
+  struct stat st;
+  if ((0 != fstat(fd, &st)) || (0 == st.st_size)) {
+    close(fd);
+    throw std::runtime_error("failed to read size of " + path);
+  }
+  void *view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file.
+  close(fd);
+  if (MAP_FAILED == view) {
+    throw std::runtime_error("failed to map " + path);
+  }
+  data = static_cast<const uint8_t *>(view);
+  size = static_cast<uint64_t>(st.st_size);
+#endif
+}
+
+void RecordingReader::unmap()
+{
+  if (nullptr == data) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(data);
+  CloseHandle(static_cast<HANDLE>(mapping_handle));
+  CloseHandle(static_cast<HANDLE>(file_handle));
+#else
+  munmap(const_cast<uint8_t *>(data), static_cast<size_t>(size));
+#endif
+  data = nullptr;
+}
+
+void RecordingReader::index()
+{
+  if (size < sizeof(header)) {
+    throw std::runtime_error("file is too small to be a recording");
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (0 != std::memcmp(header.magic, kRecordingMagic,
+                       sizeof(kRecordingMagic))) {
+    throw std::runtime_error("file is not a recording");
+  }
+  if (kRecordingVersion != header.version) {
+    throw std::runtime_error("unsupported recording version " +
+                             std::to_string(header.version));
+  }
+  uint64_t heads_size =
+    static_cast<uint64_t>(header.num_heads) * sizeof(RecordingHeadHeader);
+  if ((header.header_size > size) ||
+      (sizeof(header) + heads_size > header.header_size)) {
+    throw std::runtime_error("recording header is corrupt");
+  }
+
+  heads.resize(header.num_heads);
+  uint32_t max_id = 0;
+  for (uint32_t n = 0; n < header.num_heads; n++) {
+    std::memcpy(&heads[n], data + sizeof(header) + n * sizeof(heads[n]),
+                sizeof(heads[n]));
+    max_id = std::max(max_id, heads[n].id);
+  }
+  chunks.resize(header.num_heads ? max_id + 1 : 0);
+
+  // Only the chunk headers are touched here, about one page in every block,
+  // so indexing stays fast however large the recording is.
+  first_timestamp_ns = std::numeric_limits<uint64_t>::max();
+  last_timestamp_ns = 0;
+  uint64_t offset = header.header_size;
+  while (offset + sizeof(RecordingChunkHeader) <= size) {
+    RecordingChunkHeader ch;
+    std::memcpy(&ch, data + offset, sizeof(ch));
+    uint64_t end = offset + sizeof(ch) + ch.payload_size;
+    if ((kRecordingChunkMagic != ch.magic) || (end > size)) {
+      break;
+    }
+    const bool is_packed = (0 != (ch.flags & kRecordingChunkPacked));
+
+    if (0 < ch.profile_count) {
+      if (ch.scan_head_id >= chunks.size()) {
+        chunks.resize(ch.scan_head_id + 1);
+      }
+      Chunk chunk;
+      chunk.payload = data + offset + sizeof(ch);
+      chunk.payload_size = ch.payload_size;
+      chunk.raw_payload_size = is_packed ? ch.raw_payload_size :
+                                           ch.payload_size;
+      chunk.flags = ch.flags;
+      chunk.profile_count = ch.profile_count;
+      chunk.first_timestamp_ns = ch.first_timestamp_ns;
+      chunk.last_timestamp_ns = ch.last_timestamp_ns;
+      chunks[ch.scan_head_id].push_back(chunk);
+      first_timestamp_ns = std::min(first_timestamp_ns, ch.first_timestamp_ns);
+      last_timestamp_ns = std::max(last_timestamp_ns, ch.last_timestamp_ns);
+      profile_count += ch.profile_count;
+    }
+    offset += recording_align(sizeof(ch) + ch.payload_size);
+  }
+
+  if (0 == profile_count) {
+    first_timestamp_ns = 0;
+  }
+}
+
+const std::vector<RecordingReader::Chunk> &
+RecordingReader::get_chunks(uint32_t id) const
+{
+  static const std::vector<Chunk> empty;
+  return (id < chunks.size()) ? chunks[id] : empty;
+}
+
+ReplayClock::ReplayClock(uint64_t first_timestamp_ns,
+                         uint64_t last_timestamp_ns)
+  : first_ns(first_timestamp_ns),
+    last_ns(last_timestamp_ns),
+    base_timestamp_ns(first_timestamp_ns),
+    base_wall_ns(get_time_ns()),
+    seek_target_ns(first_timestamp_ns),
+    reported_ns(first_timestamp_ns)
+{
+}
+
+uint64_t ReplayClock::time_locked(uint64_t now_ns)
+{
+  if (is_max) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  if (is_pause) {
+    return base_timestamp_ns;
+  }
+
+  uint64_t t = base_timestamp_ns +
+               static_cast<uint64_t>((now_ns - base_wall_ns) * speed);
+  if ((t > last_ns) && is_loop) {
+    base_timestamp_ns = first_ns;
+    base_wall_ns = now_ns;
+    seek_target_ns = first_ns;
+    seek_count.fetch_add(1, std::memory_order_release);
+    t = first_ns;
+  }
+  return t;
+}
+
+void ReplayClock::rebase_locked(uint64_t now_ns)
+{
+  // Carry on from the current position so changing speed never jumps.
+  uint64_t t = is_max ? reported_ns.load(std::memory_order_relaxed) :
+                        time_locked(now_ns);
+  base_timestamp_ns = std::min(t, last_ns);
+  base_wall_ns = now_ns;
+}
+
+void ReplayClock::set_speed(double speed)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  rebase_locked(get_time_ns());
+  this->speed = (0.0 < speed) ? speed : 1.0;
+}
+
+double ReplayClock::get_speed() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return speed;
+}
+
+void ReplayClock::set_max_speed(bool is_max_speed)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  rebase_locked(get_time_ns());
+  is_max = is_max_speed;
+}
+
+bool ReplayClock::is_max_speed() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return is_max;
+}
+
+void ReplayClock::set_paused(bool is_paused)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  rebase_locked(get_time_ns());
+  is_pause = is_paused;
+}
+
+bool ReplayClock::is_paused() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return is_pause;
+}
+
+void ReplayClock::set_looping(bool is_looping)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  is_loop = is_looping;
+}
+
+bool ReplayClock::is_looping() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return is_loop;
+}
+
+void ReplayClock::seek(uint64_t timestamp_ns)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  timestamp_ns = std::max(first_ns, std::min(timestamp_ns, last_ns));
+  base_timestamp_ns = timestamp_ns;
+  base_wall_ns = get_time_ns();
+  seek_target_ns = timestamp_ns;
+  reported_ns.store(timestamp_ns, std::memory_order_relaxed);
+  seek_count.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t ReplayClock::get_seek_target_ns() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return seek_target_ns;
+}
+
+uint64_t ReplayClock::get_due_ns()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return time_locked(get_time_ns());
+}
+
+uint64_t ReplayClock::get_wait_ns(uint64_t timestamp_ns)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (is_max) {
+    return 0;
+  }
+  if (is_pause) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  uint64_t t = time_locked(get_time_ns());
+  if (timestamp_ns <= t) {
+    return 0;
+  }
+  return static_cast<uint64_t>((timestamp_ns - t) / speed);
+}
+
+uint64_t ReplayClock::get_position_ns()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (is_max) {
+    return reported_ns.load(std::memory_order_relaxed);
+  }
+  return std::min(time_locked(get_time_ns()), last_ns);
+}
+
+ReplaySource::ReplaySource(const RecordingReader &reader, ReplayClock &clock,
+                           uint32_t id)
+  : chunks(reader.get_chunks(id)), clock(clock), id(id)
+{
+  seek_count = clock.get_seek_count();
+  seek(clock.get_seek_target_ns());
+}
+
+bool ReplaySource::is_at_end() const
+{
+  return cursor.chunk >= chunks.size();
+}
+
+const uint8_t *ReplaySource::get_payload(size_t chunk, uint32_t &size)
+{
+  const RecordingReader::Chunk &ch = chunks[chunk];
+  if (0 == (ch.flags & kRecordingChunkPacked)) {
+    size = ch.payload_size;
+    return ch.payload;
+  }
+
+  for (auto &d : decoded) {
+    if (chunk == d.chunk) {
+      size = d.size;
+      return d.data.data();
+    }
+  }
+
+  // Reuse whichever buffer doesn't hold the cursor's chunk. A chunk that
+  // fails to decode is treated as empty, so the replay skips over it.
+  Decoded &d = (cursor.chunk == decoded[0].chunk) ? decoded[1] : decoded[0];
+  d.chunk = chunk;
+  d.data.resize(ch.raw_payload_size);
+  d.size = codec.decode(ch.payload, ch.payload_size, ch.profile_count,
+                        d.data.data(), ch.raw_payload_size) ?
+             ch.raw_payload_size :
+             0;
+  size = d.size;
+  return d.data.data();
+}
+
+uint64_t ReplaySource::peek_timestamp(const Cursor &c)
+{
+  uint32_t size = 0;
+  RecordingProfileHeader hdr;
+  std::memcpy(&hdr, get_payload(c.chunk, size) + c.offset, sizeof(hdr));
+  return hdr.timestamp_ns;
+}
+
+void ReplaySource::advance(Cursor &c)
+{
+  uint32_t size = 0;
+  RecordingProfileHeader hdr;
+  std::memcpy(&hdr, get_payload(c.chunk, size) + c.offset, sizeof(hdr));
+  c.offset += static_cast<uint32_t>(sizeof(hdr) +
+                                    hdr.data_len * sizeof(jsProfileData));
+  c.index++;
+  settle(c);
+}
+
+void ReplaySource::settle(Cursor &c)
+{
+  // Move on to the next chunk at the end of this one, or if the next profile
+  // wouldn't fit inside it, which only happens if the chunk is corrupt.
+  while (c.chunk < chunks.size()) {
+    uint32_t size = 0;
+    const uint8_t *payload = get_payload(c.chunk, size);
+    bool is_valid = (c.index < chunks[c.chunk].profile_count) &&
+                    (c.offset + sizeof(RecordingProfileHeader) <= size);
+    if (is_valid) {
+      RecordingProfileHeader hdr;
+      std::memcpy(&hdr, payload + c.offset, sizeof(hdr));
+      is_valid = (c.offset + sizeof(hdr) +
+                    uint64_t(hdr.data_len) * sizeof(jsProfileData) <=
+                  size);
+    }
+    if (is_valid) {
+      break;
+    }
+    c.chunk++;
+    c.index = 0;
+    c.offset = 0;
+  }
+}
+
+void ReplaySource::seek(uint64_t timestamp_ns)
+{
+  // Skip straight to the first chunk that reaches the target time, using
+  // the index, then walk the few profiles inside it.
+  auto it = std::lower_bound(
+    chunks.begin(), chunks.end(), timestamp_ns,
+    [](const RecordingReader::Chunk &c, uint64_t t) {
+      return c.last_timestamp_ns < t;
+    });
+  cursor.chunk = static_cast<size_t>(it - chunks.begin());
+  cursor.index = 0;
+  cursor.offset = 0;
+  settle(cursor);
+  while (!is_at_end() && (peek_timestamp(cursor) < timestamp_ns)) {
+    advance(cursor);
+  }
+}
+
+void ReplaySource::sync_with_clock()
+{
+  uint32_t count = clock.get_seek_count();
+  if (count != seek_count) {
+    seek_count = count;
+    seek(clock.get_seek_target_ns());
+  }
+}
+
+uint32_t ReplaySource::count_due(uint64_t due_ns, uint32_t limit)
+{
+  // Walk the rest of the cursor's chunk, which is decoded already; stepping
+  // off its end decodes the next one, which is read next anyway. The chunks
+  // after that are counted from the index, as decoding them here would only
+  // push out the one the cursor moves into next.
+  Cursor c = cursor;
+  uint32_t n = 0;
+  while ((n < limit) && (c.chunk == cursor.chunk) &&
+         (peek_timestamp(c) <= due_ns)) {
+    advance(c);
+    n++;
+  }
+  if (c.chunk == cursor.chunk) {
+    return n;
+  }
+  for (size_t k = c.chunk; (n < limit) && (k < chunks.size()); k++) {
+    const RecordingReader::Chunk &ch = chunks[k];
+    uint32_t left = ch.profile_count - ((k == c.chunk) ? c.index : 0);
+    if (due_ns < ch.last_timestamp_ns) {
+      // Only some of this chunk is due, and without decoding it, only its
+      // first profile is known to be.
+      if ((ch.first_timestamp_ns <= due_ns) && (0 < left)) {
+        n++;
+      }
+      break;
+    }
+    n += left;
+  }
+  return std::min(n, limit);
+}
+
+int32_t ReplaySource::wait_until_available(uint32_t count,
+                                           uint32_t timeout_us)
+{
+  const uint64_t deadline = get_time_ns() + timeout_us * 1000ull;
+  const uint32_t limit = std::max(count, kMaxCountAhead);
+  while (true) {
+    sync_with_clock();
+    uint32_t n = 0;
+    if (is_at_end()) {
+      // At max speed there is no clock to wrap around, so each source starts
+      // over by itself.
+      if (clock.is_max_speed() && clock.is_looping() && !chunks.empty()) {
+        seek(clock.get_first_timestamp_ns());
+        continue;
+      }
+    } else {
+      n = count_due(clock.get_due_ns(), limit);
+      if (n >= count) {
+        return static_cast<int32_t>(n);
+      }
+    }
+
+    uint64_t now = get_time_ns();
+    if (now >= deadline) {
+      return static_cast<int32_t>(n);
+    }
+    uint64_t wait = deadline - now;
+    if (!is_at_end()) {
+      wait = std::min(wait, clock.get_wait_ns(peek_timestamp(cursor)));
+    }
+    wait = std::max<uint64_t>(1000, std::min(wait, kMaxSleepNs));
+    std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+  }
+}
+
+bool ReplaySource::is_idle()
+{
+  // Paused, or done with a recording that doesn't loop.
+  return clock.is_paused() || (is_at_end() && !clock.is_looping());
+}
+
+int32_t ReplaySource::get_profiles(jsProfile *profiles, uint32_t max_profiles)
+{
+  const uint64_t due_ns = clock.get_due_ns();
+  uint32_t n = 0;
+  while ((n < max_profiles) && !is_at_end() &&
+         (peek_timestamp(cursor) <= due_ns)) {
+    uint32_t size = 0;
+    const uint8_t *payload = get_payload(cursor.chunk, size);
+    recording_read_profile(payload + cursor.offset, profiles[n]);
+    advance(cursor);
+    n++;
+  }
+  if (0 < n) {
+    clock.report_position(profiles[n - 1].timestamp_ns);
+  }
+  return static_cast<int32_t>(n);
+}
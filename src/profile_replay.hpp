@@ -0,0 +1,270 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_replay.hpp
+ * @brief Plays back recordings in place of live scan heads.
+ *
+ * The recording is memory mapped rather than read, so opening even a multi
+ * gigabyte file only costs a walk over its chunk headers to build an index;
+ * the operating system pages profile data in as the replay reaches it. Each
+ * scan head in the recording becomes a `ReplaySource` feeding a regular
+ * receiver, and all of them follow a shared `ReplayClock` that sets the
+ * playback speed and position. Compressed chunks are decoded one at a time,
+ * as the replay reaches them.
+ */
+#ifndef SCAN_GUI_PROFILE_REPLAY_HPP
+#define SCAN_GUI_PROFILE_REPLAY_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "profile_codec.hpp"
+#include "profile_source.hpp"
+#include "recording_format.hpp"
+
+/**
+ * @brief Read-only, memory mapped view of a recording file.
+ */
+class RecordingReader {
+public:
+  struct Chunk {
+    const uint8_t *payload;
+    uint32_t payload_size;
+    // Size of the payload once decompressed, for chunks flagged with
+    // `kRecordingChunkPacked`; same as `payload_size` otherwise.
+    uint32_t raw_payload_size;
+    uint32_t flags;
+    uint32_t profile_count;
+    uint64_t first_timestamp_ns;
+    uint64_t last_timestamp_ns;
+  };
+
+  /**
+   * @brief Maps a recording and indexes its chunks. A recording that was cut
+   * short is read up to its last complete chunk.
+   *
+   * @throws std::runtime_error if the file can't be mapped or isn't a
+   * recording.
+   */
+  explicit RecordingReader(const std::string &path);
+  ~RecordingReader();
+
+  RecordingReader(const RecordingReader &) = delete;
+  RecordingReader &operator=(const RecordingReader &) = delete;
+
+  const RecordingFileHeader &get_header() const
+  {
+    return header;
+  }
+
+  const std::vector<RecordingHeadHeader> &get_heads() const
+  {
+    return heads;
+  }
+
+  /**
+   * @brief The chunks of a scan head, in the order they were recorded.
+   */
+  const std::vector<Chunk> &get_chunks(uint32_t id) const;
+
+  /**
+   * @brief Timestamp of the earliest and latest profile in the recording.
+   */
+  uint64_t get_first_timestamp_ns() const
+  {
+    return first_timestamp_ns;
+  }
+
+  uint64_t get_last_timestamp_ns() const
+  {
+    return last_timestamp_ns;
+  }
+
+  uint64_t get_profile_count() const
+  {
+    return profile_count;
+  }
+
+private:
+  void map(const std::string &path);
+  void unmap();
+  void index();
+
+  const uint8_t *data = nullptr;
+  uint64_t size = 0;
+#ifdef _WIN32
+  void *file_handle = nullptr;
+  void *mapping_handle = nullptr;
+#endif
+
+  RecordingFileHeader header;
+  std::vector<RecordingHeadHeader> heads;
+  std::vector<std::vector<Chunk>> chunks;
+  uint64_t first_timestamp_ns = 0;
+  uint64_t last_timestamp_ns = 0;
+  uint64_t profile_count = 0;
+};
+
+/**
+ * @brief Maps wall clock time to recording time for every source of a
+ * replay. Any thread may use it.
+ */
+class ReplayClock {
+public:
+  ReplayClock(uint64_t first_timestamp_ns, uint64_t last_timestamp_ns);
+
+  /**
+   * @brief Plays back at `speed` times real time.
+   */
+  void set_speed(double speed);
+  double get_speed() const;
+
+  /**
+   * @brief Plays back as fast as the pipeline can take profiles, ignoring
+   * the speed. Useful for measuring the throughput of the whole pipeline.
+   */
+  void set_max_speed(bool is_max_speed);
+  bool is_max_speed() const;
+
+  void set_paused(bool is_paused);
+  bool is_paused() const;
+
+  /**
+   * @brief Starts over from the beginning once the end is reached.
+   */
+  void set_looping(bool is_looping);
+  bool is_looping() const;
+
+  /**
+   * @brief Jumps to a point in the recording; every source picks up from
+   * there on its next read.
+   */
+  void seek(uint64_t timestamp_ns);
+
+  /**
+   * @brief Incremented on every seek, so that sources can tell when they
+   * have to reposition themselves.
+   */
+  uint32_t get_seek_count() const
+  {
+    return seek_count.load(std::memory_order_acquire);
+  }
+
+  uint64_t get_seek_target_ns() const;
+
+  /**
+   * @brief Recording time that profiles are due up to. At max speed,
+   * everything is due.
+   */
+  uint64_t get_due_ns();
+
+  /**
+   * @brief Wall clock nanoseconds until recording time `timestamp_ns` comes
+   * due, if it hasn't already.
+   */
+  uint64_t get_wait_ns(uint64_t timestamp_ns);
+
+  /**
+   * @brief Where playback is, for display; at max speed this is the newest
+   * profile any source has delivered.
+   */
+  uint64_t get_position_ns();
+
+  /**
+   * @brief Called by the sources with the timestamp of the newest profile
+   * they deliver.
+   */
+  void report_position(uint64_t timestamp_ns)
+  {
+    reported_ns.store(timestamp_ns, std::memory_order_relaxed);
+  }
+
+  uint64_t get_first_timestamp_ns() const
+  {
+    return first_ns;
+  }
+
+  uint64_t get_last_timestamp_ns() const
+  {
+    return last_ns;
+  }
+
+private:
+  uint64_t time_locked(uint64_t now_ns);
+  void rebase_locked(uint64_t now_ns);
+
+  const uint64_t first_ns;
+  const uint64_t last_ns;
+  mutable std::mutex mutex;
+  uint64_t base_timestamp_ns;
+  uint64_t base_wall_ns;
+  uint64_t seek_target_ns;
+  double speed = 1.0;
+  bool is_max = false;
+  bool is_pause = false;
+  bool is_loop = false;
+  std::atomic<uint32_t> seek_count{0};
+  std::atomic<uint64_t> reported_ns{0};
+};
+
+/**
+ * @brief Profiles of one scan head from a recording, delivered as the
+ * replay clock brings them due.
+ */
+class ReplaySource : public ProfileSource {
+public:
+  ReplaySource(const RecordingReader &reader, ReplayClock &clock,
+               uint32_t id);
+
+  uint32_t get_id() const override
+  {
+    return id;
+  }
+
+  int32_t wait_until_available(uint32_t count, uint32_t timeout_us) override;
+  int32_t get_profiles(jsProfile *profiles, uint32_t max_profiles) override;
+  bool is_idle() override;
+
+private:
+  // Position of the next profile to deliver.
+  struct Cursor {
+    size_t chunk = 0;
+    uint32_t index = 0;
+    uint32_t offset = 0;
+  };
+
+  // A decompressed chunk; two are kept so that looking ahead into the next
+  // chunk doesn't throw away the one the cursor is in.
+  struct Decoded {
+    size_t chunk = SIZE_MAX;
+    uint32_t size = 0;
+    std::vector<uint8_t> data;
+  };
+
+  void sync_with_clock();
+  void seek(uint64_t timestamp_ns);
+  bool is_at_end() const;
+  const uint8_t *get_payload(size_t chunk, uint32_t &size);
+  uint64_t peek_timestamp(const Cursor &c);
+  void advance(Cursor &c);
+  void settle(Cursor &c);
+  uint32_t count_due(uint64_t due_ns, uint32_t limit);
+
+  const std::vector<RecordingReader::Chunk> &chunks;
+  ReplayClock &clock;
+  uint32_t id;
+  uint32_t seek_count = 0;
+  Cursor cursor;
+  ChunkCodec codec;
+  Decoded decoded[2];
+};
+
+#endif
@@ -0,0 +1,242 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_server.hpp"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+// Viewers served at once; more are turned away.
+static const uint32_t kMaxClients = 4;
+// Profiles queued per viewer before the oldest are dropped; at 200 Hz and
+// two cameras this is a little over a tenth of a second of profiles.
+static const uint32_t kClientQueueDepth = 64;
+// Profiles a viewer's thread takes off its queue and sends at once.
+static const uint32_t kSendBatch = 16;
+// How often the accept thread checks whether it has been asked to stop.
+static const uint32_t kAcceptTimeoutMs = 250;
+
+ProfileServer::ProfileServer(const StreamHeader &header,
+                             const std::vector<RecordingHeadHeader> &heads,
+                             uint32_t point_stride)
+  : point_stride(std::max(point_stride, 1u))
+{
+  StreamHeader h = header;
+  std::memcpy(h.magic, kStreamMagic, sizeof(h.magic));
+  h.version = kStreamVersion;
+  h.num_heads = static_cast<uint32_t>(heads.size());
+  h.point_stride = this->point_stride;
+  this->header.resize(sizeof(h) + heads.size() * sizeof(RecordingHeadHeader));
+  std::memcpy(this->header.data(), &h, sizeof(h));
+  if (!heads.empty()) {
+    std::memcpy(this->header.data() + sizeof(h), heads.data(),
+                heads.size() * sizeof(RecordingHeadHeader));
+  }
+}
+
+ProfileServer::~ProfileServer()
+{
+  stop();
+}
+
+uint32_t ProfileServer::get_held_profiles()
+{
+  // A full queue, plus a batch being sent, for every viewer.
+  return kMaxClients * (kClientQueueDepth + kSendBatch);
+}
+
+void ProfileServer::start(uint16_t port)
+{
+  if (!net_init()) {
+    throw std::runtime_error("failed to initialize sockets");
+  }
+  listener = net_listen(port);
+  if (kInvalidSocket == listener) {
+    throw std::runtime_error("failed to listen on port " +
+                             std::to_string(port));
+  }
+  is_stopping = false;
+  accept_thread = std::thread(&ProfileServer::accept_clients, this);
+}
+
+void ProfileServer::stop()
+{
+  is_stopping = true;
+  if (accept_thread.joinable()) {
+    accept_thread.join();
+  }
+  if (kInvalidSocket != listener) {
+    net_close(listener);
+    listener = kInvalidSocket;
+  }
+
+  std::lock_guard<std::mutex> lock(clients_mutex);
+  for (auto &client : clients) {
+    {
+      std::lock_guard<std::mutex> client_lock(client->mutex);
+      client->is_stopping = true;
+    }
+    client->wake.notify_one();
+    // Unblocks a send stuck on a viewer that stopped reading.
+    net_shutdown(client->socket);
+    client->thread.join();
+    net_close(client->socket);
+  }
+  clients.clear();
+}
+
+uint32_t ProfileServer::get_client_count() const
+{
+  std::lock_guard<std::mutex> lock(clients_mutex);
+  return static_cast<uint32_t>(clients.size());
+}
+
+void ProfileServer::publish(const ProfileHandle &profile)
+{
+  std::lock_guard<std::mutex> lock(clients_mutex);
+  for (auto &client : clients) {
+    if (client->is_done.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> client_lock(client->mutex);
+      // Sharing the profile only adds a reference. When the queue is full,
+      // the newest profile takes the place of the oldest.
+      if (kClientQueueDepth == client->count) {
+        client->queue[client->first] = profile;
+        client->first = (client->first + 1) % kClientQueueDepth;
+        profiles_dropped.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        uint32_t n = (client->first + client->count) % kClientQueueDepth;
+        client->queue[n] = profile;
+        client->count++;
+      }
+    }
+    client->wake.notify_one();
+  }
+}
+
+void ProfileServer::reap_clients()
+{
+  std::lock_guard<std::mutex> lock(clients_mutex);
+  for (auto it = clients.begin(); it != clients.end();) {
+    Client &client = **it;
+    if (!client.is_done.load()) {
+      ++it;
+      continue;
+    }
+    client.thread.join();
+    net_close(client.socket);
+    it = clients.erase(it);
+    std::cout << "viewer disconnected" << std::endl;
+  }
+}
+
+void ProfileServer::accept_clients()
+{
+  while (!is_stopping) {
+    net_socket_t socket = net_accept(listener, kAcceptTimeoutMs);
+    reap_clients();
+    if (kInvalidSocket == socket) {
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    if (kMaxClients <= clients.size()) {
+      std::cout << "turned a viewer away, already serving " << kMaxClients
+                << std::endl;
+      net_close(socket);
+      continue;
+    }
+    auto client = std::make_unique<Client>();
+    client->socket = socket;
+    client->queue.resize(kClientQueueDepth);
+    client->thread = std::thread(&ProfileServer::send_profiles, this,
+                                 std::ref(*client));
+    clients.push_back(std::move(client));
+    std::cout << "viewer connected, " << clients.size() << " now"
+              << std::endl;
+  }
+}
+
+bool ProfileServer::send_header(net_socket_t socket)
+{
+  NetBuffer buffer = {header.data(), header.size()};
+  return net_send(socket, &buffer, 1);
+}
+
+void ProfileServer::send_profiles(Client &client)
+{
+  // Everything a batch needs is allocated before the first profile is sent.
+  std::vector<ProfileHandle> batch(kSendBatch);
+  std::vector<RecordingProfileHeader> headers(kSendBatch);
+  std::vector<NetBuffer> buffers(2 * kSendBatch);
+  std::vector<jsProfileData> points;
+  if (1 < point_stride) {
+    points.resize(kSendBatch * JS_PROFILE_DATA_LEN);
+  }
+
+  bool is_ok = send_header(client.socket);
+  while (is_ok) {
+    uint32_t count = 0;
+    {
+      std::unique_lock<std::mutex> lock(client.mutex);
+      client.wake.wait(lock, [&client] {
+        return client.is_stopping || (0 < client.count);
+      });
+      if (client.is_stopping) {
+        break;
+      }
+      count = std::min(client.count, kSendBatch);
+      for (uint32_t n = 0; n < count; n++) {
+        batch[n] = std::move(client.queue[client.first]);
+        client.first = (client.first + 1) % kClientQueueDepth;
+      }
+      client.count -= count;
+    }
+
+    // Full profiles go out straight from the pool; subsampled ones are
+    // gathered into scratch space first.
+    for (uint32_t n = 0; n < count; n++) {
+      const jsProfile &profile = *batch[n];
+      uint32_t len = std::min<uint32_t>(profile.data_len, JS_PROFILE_DATA_LEN);
+      const jsProfileData *data = profile.data;
+      if (1 < point_stride) {
+        jsProfileData *dst = &points[n * JS_PROFILE_DATA_LEN];
+        uint32_t k = 0;
+        for (uint32_t i = 0; i < len; i += point_stride) {
+          dst[k++] = profile.data[i];
+        }
+        len = k;
+        data = dst;
+      }
+      headers[n] = recording_make_header(profile);
+      headers[n].data_len = len;
+      buffers[2 * n] = {&headers[n], sizeof(RecordingProfileHeader)};
+      buffers[2 * n + 1] = {data, len * sizeof(jsProfileData)};
+    }
+    is_ok = net_send(client.socket, buffers.data(), 2 * count);
+    for (uint32_t n = 0; n < count; n++) {
+      batch[n].reset();
+    }
+    if (is_ok) {
+      profiles_sent.fetch_add(count, std::memory_order_relaxed);
+    }
+  }
+
+  // Let go of whatever is still queued, so it goes back to the pools.
+  {
+    std::lock_guard<std::mutex> lock(client.mutex);
+    for (auto &profile : client.queue) {
+      profile.reset();
+    }
+    client.count = 0;
+  }
+  client.is_done = true;
+}
@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_server.hpp
+ * @brief Streams profiles to remote viewers over TCP.
+ *
+ * Every viewer that connects gets its own queue of profiles and its own
+ * thread sending them, so a slow viewer or a slow network only ever holds up
+ * that one viewer. Its queue is bounded; once it is full, the oldest profile
+ * waiting is dropped to make room for the newest, the same trade the live
+ * view makes. Acquisition never waits on a viewer.
+ *
+ * Queues hold handles to the receivers' pools rather than copies, and full
+ * profiles are sent straight out of the pool, header and points gathered by
+ * the operating system in one call. Each receiver's pool has to have room
+ * for the profiles the viewers hold on to; see `get_held_profiles`.
+ */
+#ifndef SCAN_GUI_PROFILE_SERVER_HPP
+#define SCAN_GUI_PROFILE_SERVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "net_socket.hpp"
+#include "profile_pool.hpp"
+#include "profile_stream.hpp"
+
+class ProfileServer {
+public:
+  /**
+   * @param header Sent to every viewer as it connects, together with
+   * `heads`; `num_heads` and `point_stride` are filled in here.
+   * @param point_stride Every how many points of a profile to send; one
+   * sends full profiles without copying them.
+   */
+  ProfileServer(const StreamHeader &header,
+                const std::vector<RecordingHeadHeader> &heads,
+                uint32_t point_stride = 1);
+  ~ProfileServer();
+
+  ProfileServer(const ProfileServer &) = delete;
+  ProfileServer &operator=(const ProfileServer &) = delete;
+
+  /**
+   * @brief Starts accepting viewers on `port`.
+   *
+   * @throws std::runtime_error if the port can't be listened on.
+   */
+  void start(uint16_t port);
+
+  /**
+   * @brief Disconnects every viewer and stops accepting new ones.
+   */
+  void stop();
+
+  /**
+   * @brief Queues a profile for every viewer connected. Only one thread may
+   * publish.
+   */
+  void publish(const ProfileHandle &profile);
+
+  /**
+   * @brief Most profiles from a single receiver the viewers can hold on to
+   * at once, for sizing the receivers' pools.
+   */
+  static uint32_t get_held_profiles();
+
+  uint32_t get_client_count() const;
+
+  uint64_t get_profiles_sent() const
+  {
+    return profiles_sent.load(std::memory_order_relaxed);
+  }
+
+  uint64_t get_profiles_dropped() const
+  {
+    return profiles_dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Client {
+    net_socket_t socket = kInvalidSocket;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    // Fixed ring of queued profiles, oldest at `first`.
+    std::vector<ProfileHandle> queue;
+    uint32_t first = 0;
+    uint32_t count = 0;
+    bool is_stopping = false;
+    std::atomic<bool> is_done{false};
+  };
+
+  void accept_clients();
+  void send_profiles(Client &client);
+  bool send_header(net_socket_t socket);
+  void reap_clients();
+
+  std::vector<uint8_t> header;
+  uint32_t point_stride;
+  net_socket_t listener = kInvalidSocket;
+  std::thread accept_thread;
+  std::atomic<bool> is_stopping{false};
+  mutable std::mutex clients_mutex;
+  std::vector<std::unique_ptr<Client>> clients;
+  std::atomic<uint64_t> profiles_sent{0};
+  std::atomic<uint64_t> profiles_dropped{0};
+};
+
+#endif
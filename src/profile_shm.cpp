@@ -0,0 +1,447 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_shm.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Rings and slots start on their own cache lines, so that no two scan heads'
+// writers ever share one.
+static const uint64_t kCacheLineSize = 64;
+
+static uint64_t align_to_cache_line(uint64_t size)
+{
+  return (size + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+}
+
+/**
+ * @brief Name of the region as the operating system knows it.
+ */
+static std::string get_os_name(const std::string &name)
+{
+#ifdef _WIN32
+  return "Local\\" + name;
+#else
+  return "/" + name;
+#endif
+}
+
+static uint32_t get_process_id()
+{
+#ifdef _WIN32
+  return static_cast<uint32_t>(GetCurrentProcessId());
+#else
+  return static_cast<uint32_t>(getpid());
+#endif
+}
+
+static bool is_process_running(uint32_t pid)
+{
+#ifdef _WIN32
+  HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE,
+                               static_cast<DWORD>(pid));
+  if (nullptr == process) {
+    return ERROR_ACCESS_DENIED == GetLastError();
+  }
+  DWORD exit_code = 0;
+  bool is_running = GetExitCodeProcess(process, &exit_code) &&
+                    (STILL_ACTIVE == exit_code);
+  CloseHandle(process);
+  return is_running;
+#else
+  return (0 == kill(static_cast<pid_t>(pid), 0)) || (EPERM == errno);
+#endif
+}
+
+/**
+ * @brief Frees the entries of readers that exited without giving them back,
+ * as when they crashed, so that they neither use up the table nor hold back
+ * the lag with a cursor that no longer moves.
+ */
+static void release_dead_consumers(ShmFileHeader &header)
+{
+  for (auto &consumer : header.consumers) {
+    uint32_t pid = consumer.load(std::memory_order_relaxed);
+    if ((0 != pid) && !is_process_running(pid)) {
+      consumer.compare_exchange_strong(pid, 0);
+    }
+  }
+}
+
+/**
+ * @brief Finds a scan head's ring inside a mapped region.
+ */
+static ShmRingHeader &find_ring(uint8_t *data, const ShmFileHeader &header,
+                                uint32_t id)
+{
+  return *reinterpret_cast<ShmRingHeader *>(data + header.ring_offset +
+                                            id * header.ring_size);
+}
+
+/**
+ * @brief Finds slot `n` of a ring; the ring wraps around.
+ */
+static uint8_t *find_slot(ShmRingHeader &ring, const ShmFileHeader &header,
+                          uint64_t n)
+{
+  uint8_t *slots = reinterpret_cast<uint8_t *>(&ring) +
+                   align_to_cache_line(sizeof(ShmRingHeader));
+  return slots + (n & (header.slot_count - 1)) * header.slot_size;
+}
+
+ShmPublisher::ShmPublisher(const std::string &name, jsDataFormat data_format,
+                           double scan_rate_hz,
+                           const std::vector<RecordingHeadHeader> &heads,
+                           uint32_t slot_count)
+  : name(name)
+{
+  uint32_t num_slots = 2;
+  while (num_slots < slot_count) {
+    num_slots *= 2;
+  }
+  uint32_t num_heads = static_cast<uint32_t>(heads.size());
+  uint64_t slot_size = align_to_cache_line(
+    sizeof(ShmSlotHeader) + JS_PROFILE_DATA_LEN * sizeof(jsProfileData));
+  uint64_t ring_offset = align_to_cache_line(
+    sizeof(ShmFileHeader) + num_heads * sizeof(RecordingHeadHeader));
+  uint64_t ring_size =
+    align_to_cache_line(sizeof(ShmRingHeader)) + num_slots * slot_size;
+  size = ring_offset + num_heads * ring_size;
+
+  // The region starts out zeroed on every platform.
+  std::string os_name = get_os_name(name);
+#ifdef _WIN32
+  HANDLE mapping = CreateFileMappingA(
+    INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+    static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), os_name.c_str());
+  if (nullptr == mapping) {
+    throw std::runtime_error("failed to create shared memory " + name);
+  }
+  if (ERROR_ALREADY_EXISTS == GetLastError()) {
+    CloseHandle(mapping);
+    throw std::runtime_error("shared memory " + name + " is already in use");
+  }
+  void *view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  if (nullptr == view) {
+    CloseHandle(mapping);
+    throw std::runtime_error("failed to map shared memory " + name);
+  }
+  mapping_handle = mapping;
+#else
+  // A region left behind by a publisher that crashed is replaced; readers
+  // still mapping the old one just see it stop changing.
+  shm_unlink(os_name.c_str());
+  int fd = shm_open(os_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+  if (0 > fd) {
+    throw std::runtime_error("failed to create shared memory " + name);
+  }
+  void *view = MAP_FAILED;
+  if (0 == ftruncate(fd, static_cast<off_t>(size))) {
+    view = mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (MAP_FAILED == view) {
+    shm_unlink(os_name.c_str());
+    throw std::runtime_error("failed to map shared memory " + name);
+  }
+#endif
+  data = static_cast<uint8_t *>(view);
+
+  header = new (data) ShmFileHeader();
+  header->version = kShmVersion;
+  header->num_heads = num_heads;
+  header->data_format = static_cast<int32_t>(data_format);
+  header->slot_count = num_slots;
+  header->slot_size = slot_size;
+  header->ring_offset = ring_offset;
+  header->ring_size = ring_size;
+  header->scan_rate_hz = scan_rate_hz;
+  if (!heads.empty()) {
+    std::memcpy(data + sizeof(ShmFileHeader), heads.data(),
+                heads.size() * sizeof(RecordingHeadHeader));
+  }
+  for (uint32_t id = 0; id < num_heads; id++) {
+    ShmRingHeader &ring = *new (&find_ring(data, *header, id)) ShmRingHeader();
+    for (uint32_t n = 0; n < num_slots; n++) {
+      new (find_slot(ring, *header, n)) ShmSlotHeader();
+    }
+  }
+  // Readers only trust the rest of the header once the magic is there.
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(header->magic, kShmMagic, sizeof(kShmMagic));
+}
+
+ShmPublisher::~ShmPublisher()
+{
+  header->is_closed.store(1, std::memory_order_release);
+#ifdef _WIN32
+  // The region itself goes away once the last reader closes it too.
+  UnmapViewOfFile(data);
+  CloseHandle(static_cast<HANDLE>(mapping_handle));
+#else
+  munmap(data, static_cast<size_t>(size));
+  shm_unlink(get_os_name(name).c_str());
+#endif
+}
+
+ShmRingHeader &ShmPublisher::get_ring(uint32_t id) const
+{
+  return find_ring(data, *header, id);
+}
+
+void ShmPublisher::process(uint32_t id, const jsProfile *profiles,
+                           uint32_t count)
+{
+  if (header->num_heads <= id) {
+    return;
+  }
+  ShmRingHeader &ring = get_ring(id);
+  uint64_t n = ring.write_count.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; i < count; i++) {
+    const jsProfile &profile = profiles[i];
+    uint8_t *slot_data = find_slot(ring, *header, n);
+    ShmSlotHeader &slot = *reinterpret_cast<ShmSlotHeader *>(slot_data);
+    uint32_t len = std::min<uint32_t>(profile.data_len, JS_PROFILE_DATA_LEN);
+
+    // An odd sequence number tells readers the slot is changing under them.
+    slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.profile = recording_make_header(profile);
+    slot.profile.data_len = len;
+    std::memcpy(slot_data + sizeof(ShmSlotHeader), profile.data,
+                len * sizeof(jsProfileData));
+    slot.sequence.store(2 * (n + 1), std::memory_order_release);
+    n++;
+  }
+  ring.write_count.store(n, std::memory_order_release);
+}
+
+uint32_t ShmPublisher::get_consumer_count() const
+{
+  release_dead_consumers(*header);
+  uint32_t count = 0;
+  for (auto &consumer : header->consumers) {
+    if (0 != consumer.load(std::memory_order_relaxed)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+uint64_t ShmPublisher::get_max_lag() const
+{
+  release_dead_consumers(*header);
+  uint64_t lag = 0;
+  for (uint32_t id = 0; id < header->num_heads; id++) {
+    ShmRingHeader &ring = get_ring(id);
+    uint64_t written = ring.write_count.load(std::memory_order_relaxed);
+    for (uint32_t c = 0; c < kShmMaxConsumers; c++) {
+      if (0 == header->consumers[c].load(std::memory_order_relaxed)) {
+        continue;
+      }
+      uint64_t cursor = ring.cursors[c].load(std::memory_order_relaxed);
+      if (cursor < written) {
+        lag = std::max(lag, written - cursor);
+      }
+    }
+  }
+  return lag;
+}
+
+uint64_t ShmPublisher::get_profiles_published() const
+{
+  uint64_t total = 0;
+  for (uint32_t id = 0; id < header->num_heads; id++) {
+    total += get_ring(id).write_count.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+ShmSubscriber::ShmSubscriber(const std::string &name)
+{
+  std::string os_name = get_os_name(name);
+#ifdef _WIN32
+  HANDLE mapping =
+    OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, os_name.c_str());
+  if (nullptr == mapping) {
+    throw std::runtime_error("failed to open shared memory " + name);
+  }
+  void *view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  MEMORY_BASIC_INFORMATION info;
+  if ((nullptr == view) || (0 == VirtualQuery(view, &info, sizeof(info)))) {
+    if (nullptr != view) {
+      UnmapViewOfFile(view);
+    }
+    CloseHandle(mapping);
+    throw std::runtime_error("failed to map shared memory " + name);
+  }
+  mapping_handle = mapping;
+  size = static_cast<uint64_t>(info.RegionSize);
+#else
+  int fd = shm_open(os_name.c_str(), O_RDWR, 0);
+  if (0 > fd) {
+    throw std::runtime_error("failed to open shared memory " + name);
+  }
+  struct stat st;
+  void *view = MAP_FAILED;
+  if (0 == fstat(fd, &st)) {
+    size = static_cast<uint64_t>(st.st_size);
+    view = mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (MAP_FAILED == view) {
+    throw std::runtime_error("failed to map shared memory " + name);
+  }
+#endif
+  data = static_cast<uint8_t *>(view);
+  header = reinterpret_cast<ShmFileHeader *>(data);
+
+  bool is_valid = (sizeof(ShmFileHeader) <= size) &&
+                  (0 == std::memcmp(header->magic, kShmMagic,
+                                    sizeof(kShmMagic)));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t min_slot_size =
+    sizeof(ShmSlotHeader) + JS_PROFILE_DATA_LEN * sizeof(jsProfileData);
+  is_valid = is_valid && (kShmVersion == header->version) &&
+             (0 != header->slot_count) &&
+             (0 == (header->slot_count & (header->slot_count - 1))) &&
+             (min_slot_size <= header->slot_size) &&
+             (header->ring_offset + header->num_heads * header->ring_size <=
+              size);
+
+  // Claim the first free reader entry.
+  uint32_t pid = std::max<uint32_t>(get_process_id(), 1);
+  if (is_valid) {
+    release_dead_consumers(*header);
+  }
+  bool is_claimed = false;
+  for (uint32_t c = 0; is_valid && !is_claimed && (c < kShmMaxConsumers);
+       c++) {
+    uint32_t expected = 0;
+    if (header->consumers[c].compare_exchange_strong(expected, pid)) {
+      consumer = c;
+      is_claimed = true;
+    }
+  }
+  if (!is_claimed) {
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(static_cast<HANDLE>(mapping_handle));
+#else
+    munmap(data, static_cast<size_t>(size));
+#endif
+    throw std::runtime_error(
+      is_valid ? "shared memory " + name + " has no free reader entries" :
+                 "shared memory " + name + " doesn't hold profiles");
+  }
+
+  heads = reinterpret_cast<const RecordingHeadHeader *>(
+    data + sizeof(ShmFileHeader));
+  for (uint32_t id = 0; id < header->num_heads; id++) {
+    ShmRingHeader &ring = get_ring(id);
+    ring.cursors[consumer].store(
+      ring.write_count.load(std::memory_order_acquire),
+      std::memory_order_relaxed);
+  }
+}
+
+ShmSubscriber::~ShmSubscriber()
+{
+  header->consumers[consumer].store(0, std::memory_order_release);
+#ifdef _WIN32
+  UnmapViewOfFile(data);
+  CloseHandle(static_cast<HANDLE>(mapping_handle));
+#else
+  munmap(data, static_cast<size_t>(size));
+#endif
+}
+
+ShmRingHeader &ShmSubscriber::get_ring(uint32_t id) const
+{
+  return find_ring(data, *header, id);
+}
+
+uint64_t ShmSubscriber::get_available(uint32_t id) const
+{
+  if (header->num_heads <= id) {
+    return 0;
+  }
+  ShmRingHeader &ring = get_ring(id);
+  uint64_t written = ring.write_count.load(std::memory_order_acquire);
+  uint64_t cursor = ring.cursors[consumer].load(std::memory_order_relaxed);
+  return std::min<uint64_t>(written - cursor, header->slot_count);
+}
+
+uint32_t ShmSubscriber::read(uint32_t id, jsProfile *profiles,
+                             uint32_t max_profiles)
+{
+  if (header->num_heads <= id) {
+    return 0;
+  }
+  ShmRingHeader &ring = get_ring(id);
+  uint64_t cursor = ring.cursors[consumer].load(std::memory_order_relaxed);
+  uint32_t n = 0;
+  while (n < max_profiles) {
+    uint64_t written = ring.write_count.load(std::memory_order_acquire);
+    if (written <= cursor) {
+      break;
+    }
+    // Profiles further back than the ring holds are gone already.
+    if (header->slot_count < written - cursor) {
+      profiles_dropped += written - header->slot_count - cursor;
+      cursor = written - header->slot_count;
+    }
+
+    const uint8_t *slot_data = find_slot(ring, *header, cursor);
+    const ShmSlotHeader &slot =
+      *reinterpret_cast<const ShmSlotHeader *>(slot_data);
+    const uint64_t expected = 2 * (cursor + 1);
+    bool is_read = false;
+    if (expected == slot.sequence.load(std::memory_order_acquire)) {
+      // The header's length is limited to what a profile holds, so a torn
+      // read can't overrun `dst` before it is caught below.
+      RecordingProfileHeader hdr;
+      std::memcpy(&hdr, &slot.profile, sizeof(hdr));
+      jsProfile &dst = profiles[n];
+      recording_apply_header(hdr, dst);
+      std::memcpy(dst.data, slot_data + sizeof(ShmSlotHeader),
+                  dst.data_len * sizeof(jsProfileData));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      is_read = (expected == slot.sequence.load(std::memory_order_relaxed));
+    }
+    // A profile overwritten before or while it was read is skipped.
+    if (is_read) {
+      n++;
+    } else {
+      profiles_dropped++;
+    }
+    cursor++;
+  }
+  ring.cursors[consumer].store(cursor, std::memory_order_relaxed);
+  return n;
+}
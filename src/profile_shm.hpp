@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_shm.hpp
+ * @brief Publishes profiles to other processes through shared memory.
+ *
+ * The publisher runs as a receiver stage, copying every profile straight out
+ * of its receiver's pool into a ring of slots in a named shared memory
+ * region, one ring per scan head. Any process on the same machine can open
+ * the region with a `ShmSubscriber` and read the profiles at memory speed,
+ * without opening the scan heads itself or going through a socket.
+ *
+ * Every ring has a single writer, its scan head's receiver thread, and never
+ * waits for its readers. Each slot is guarded by a sequence number in the
+ * manner of a seqlock: it is odd while the slot is being written and encodes
+ * which profile the slot holds once it is even again. A reader copies a
+ * profile out, then checks that the sequence number hasn't changed; if it
+ * has, the writer lapped the reader and the reader skips ahead to the oldest
+ * profile still in the ring. Readers claim one of `kShmMaxConsumers` entries
+ * in the region and keep their read position in it, which shows how far
+ * behind each one is.
+ *
+ * The region is laid out as a `ShmFileHeader`, `num_heads`
+ * `RecordingHeadHeader`s and then, at `ring_offset` and every `ring_size`
+ * bytes after it, each scan head's `ShmRingHeader` followed by `slot_count`
+ * slots of `slot_size` bytes. A slot is a `ShmSlotHeader` followed by up to
+ * `JS_PROFILE_DATA_LEN` `jsProfileData` points. Only processes on the same
+ * machine share the region, so values are in its native byte order.
+ */
+#ifndef SCAN_GUI_PROFILE_SHM_HPP
+#define SCAN_GUI_PROFILE_SHM_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "profile_stage.hpp"
+#include "recording_format.hpp"
+
+static const char kShmMagic[8] = {'J', 'S', 'S', 'H', 'A', 'R', 'E', 'D'};
+static const uint32_t kShmVersion = 1;
+// Processes that can read the region at the same time.
+static const uint32_t kShmMaxConsumers = 8;
+
+// The atomics are shared between processes, which only works when they
+// don't fall back on a lock.
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "64 bit atomics must be lock free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "32 bit atomics must be lock free");
+
+struct ShmFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_heads;
+  // Data format and scan rate when the region was created; every profile
+  // carries its own format in case it changes later.
+  int32_t data_format;
+  // Slots in each ring; always a power of two.
+  uint32_t slot_count;
+  uint64_t slot_size;
+  uint64_t ring_offset;
+  uint64_t ring_size;
+  double scan_rate_hz;
+  // Set once the publisher is gone; readers should open the region again.
+  std::atomic<uint32_t> is_closed;
+  // Process ID of each reader, zero for a free entry.
+  std::atomic<uint32_t> consumers[kShmMaxConsumers];
+};
+
+struct ShmRingHeader {
+  // Profiles written to the ring so far.
+  alignas(64) std::atomic<uint64_t> write_count;
+  // Next profile each reader will read, indexed like `consumers`.
+  alignas(64) std::atomic<uint64_t> cursors[kShmMaxConsumers];
+};
+
+struct ShmSlotHeader {
+  // Odd while being written; `2 * (n + 1)` once it holds profile `n`.
+  std::atomic<uint64_t> sequence;
+  RecordingProfileHeader profile;
+};
+
+/**
+ * @brief Creates the region, replacing any left behind, and writes every
+ * profile it is handed as a receiver stage to it.
+ */
+class ShmPublisher : public ProfileStage {
+public:
+  /**
+   * @param name Name of the region; other processes open it by this name.
+   * @param slot_count Profiles each scan head's ring holds, rounded up to a
+   * power of two.
+   *
+   * @throws std::runtime_error if the region can't be created.
+   */
+  ShmPublisher(const std::string &name, jsDataFormat data_format,
+               double scan_rate_hz,
+               const std::vector<RecordingHeadHeader> &heads,
+               uint32_t slot_count = 512);
+  ~ShmPublisher();
+
+  ShmPublisher(const ShmPublisher &) = delete;
+  ShmPublisher &operator=(const ShmPublisher &) = delete;
+
+  void process(uint32_t id, const jsProfile *profiles,
+               uint32_t count) override;
+
+  const char *get_stage_name() const override
+  {
+    return "share";
+  }
+
+  const std::string &get_name() const
+  {
+    return name;
+  }
+
+  uint32_t get_consumer_count() const;
+
+  /**
+   * @brief Most profiles of any scan head a reader has yet to read.
+   */
+  uint64_t get_max_lag() const;
+
+  uint64_t get_profiles_published() const;
+
+private:
+  ShmRingHeader &get_ring(uint32_t id) const;
+
+  std::string name;
+  uint8_t *data = nullptr;
+  uint64_t size = 0;
+#ifdef _WIN32
+  void *mapping_handle = nullptr;
+#endif
+  ShmFileHeader *header = nullptr;
+};
+
+/**
+ * @brief Reads the profiles of a `ShmPublisher` from another process.
+ *
+ * Meant to be copied into other applications along with this header; it
+ * only needs the Pinchot headers. A single thread may read at a time.
+ */
+class ShmSubscriber {
+public:
+  /**
+   * @brief Opens the region and claims a reader entry in it, starting from
+   * the newest profile of every scan head.
+   *
+   * @throws std::runtime_error if the region doesn't exist, isn't a profile
+   * region or all reader entries are taken.
+   */
+  explicit ShmSubscriber(const std::string &name);
+  ~ShmSubscriber();
+
+  ShmSubscriber(const ShmSubscriber &) = delete;
+  ShmSubscriber &operator=(const ShmSubscriber &) = delete;
+
+  uint32_t get_num_heads() const
+  {
+    return header->num_heads;
+  }
+
+  jsDataFormat get_data_format() const
+  {
+    return static_cast<jsDataFormat>(header->data_format);
+  }
+
+  double get_scan_rate_hz() const
+  {
+    return header->scan_rate_hz;
+  }
+
+  const RecordingHeadHeader &get_head(uint32_t id) const
+  {
+    return heads[id];
+  }
+
+  /**
+   * @brief Whether the publisher has gone away; no more profiles will
+   * arrive.
+   */
+  bool is_closed() const
+  {
+    return 0 != header->is_closed.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Number of profiles of a scan head waiting to be read.
+   */
+  uint64_t get_available(uint32_t id) const;
+
+  /**
+   * @brief Copies out up to `max_profiles` of a scan head's profiles, oldest
+   * first. Only the points each profile holds are copied.
+   *
+   * @return Number of profiles read.
+   */
+  uint32_t read(uint32_t id, jsProfile *profiles, uint32_t max_profiles);
+
+  /**
+   * @brief Profiles the publisher overwrote before they were read.
+   */
+  uint64_t get_profiles_dropped() const
+  {
+    return profiles_dropped;
+  }
+
+private:
+  ShmRingHeader &get_ring(uint32_t id) const;
+
+  uint8_t *data = nullptr;
+  uint64_t size = 0;
+#ifdef _WIN32
+  void *mapping_handle = nullptr;
+#endif
+  ShmFileHeader *header = nullptr;
+  const RecordingHeadHeader *heads = nullptr;
+  uint32_t consumer = 0;
+  uint64_t profiles_dropped = 0;
+};
+
+#endif
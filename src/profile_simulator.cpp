@@ -0,0 +1,313 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "profile_simulator.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include "metrics.hpp"
+#include "scan_config.hpp"
+
+static const double kPi = 3.14159265358979;
+// Steps per turn of the log; one step per scan, so at 200 Hz a turn takes
+// about two and a half seconds.
+static const uint32_t kFramesPerTurn = 512;
+// Points around the log's outline that its surface is traced from.
+static const uint32_t kOutlineSamples = 2048;
+// Log radius, and how far to either side of its center a scan head sees, in
+// thousandths of an inch.
+static const double kLogRadius = 8000.0;
+static const double kFieldHalfWidth = 12000.0;
+// How far each camera's view reaches past the center line, as a fraction of
+// the field; the two views overlap in the middle.
+static const double kCameraOverlap = 0.2;
+// Measurement noise, in thousandths of an inch either way.
+static const int32_t kNoise = 8;
+// About every this many profiles, a run of points goes missing, as if the
+// laser line were hidden by bark or debris.
+static const uint32_t kDropoutInterval = 3;
+static const uint32_t kMaxDropoutLength = 64;
+// About one in this many profiles doesn't make it to the host at all.
+static const uint32_t kLostFrameInterval = 500;
+// Highest scan rate the simulated scan heads allow.
+static const double kMaxScanRateHz = 4000.0;
+// Profiles a simulated scan head buffers before it starts to overwrite the
+// oldest ones, as the client API does when it isn't read from quickly enough.
+static const uint64_t kMaxQueuedProfiles = 1000;
+// Longest a source sleeps at once while waiting for profiles to come due.
+static const uint64_t kMaxSleepNs = 10000000;
+
+/**
+ * @brief Small, fast and above all repeatable random numbers.
+ */
+class Random {
+public:
+  uint32_t next()
+  {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+  }
+
+  int32_t next(int32_t min, int32_t max)
+  {
+    return min + static_cast<int32_t>(next() % (max - min + 1));
+  }
+
+private:
+  uint32_t state = 12345;
+};
+
+/**
+ * @brief Every how many points of a full resolution profile a data format
+ * keeps, or zero if it isn't a format the simulator knows.
+ */
+static uint32_t get_point_stride(jsDataFormat format)
+{
+  switch (format) {
+  case JS_DATA_FORMAT_XY_FULL_LM_FULL:
+  case JS_DATA_FORMAT_XY_FULL:
+    return 1;
+  case JS_DATA_FORMAT_XY_HALF_LM_HALF:
+  case JS_DATA_FORMAT_XY_HALF:
+    return 2;
+  case JS_DATA_FORMAT_XY_QUARTER_LM_QUARTER:
+  case JS_DATA_FORMAT_XY_QUARTER:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @brief Distance from the log's center to its surface at angle `a`; a
+ * little out of round, like a real log.
+ */
+static double get_log_radius(double a)
+{
+  return kLogRadius * (1.0 + 0.06 * std::cos(2.0 * a) +
+                       0.03 * std::sin(3.0 * a + 1.0) +
+                       0.015 * std::cos(7.0 * a));
+}
+
+ProfileSimulator::ProfileSimulator(uint32_t num_heads)
+  : num_heads((0 < num_heads) ? num_heads : 1)
+{
+}
+
+int32_t ProfileSimulator::start_scanning(double rate_hz, jsDataFormat format)
+{
+  if ((0.0 >= rate_hz) || (kMaxScanRateHz < rate_hz) ||
+      (0 == get_point_stride(format))) {
+    return JS_ERROR_INVALID_ARGUMENT;
+  }
+  if (frames.empty() || (format != this->format)) {
+    this->format = format;
+    generate();
+  }
+  this->rate_hz = rate_hz;
+  start_ns = get_time_ns();
+  generation.fetch_add(1, std::memory_order_release);
+  return 0;
+}
+
+double ProfileSimulator::get_max_scan_rate() const
+{
+  return kMaxScanRateHz;
+}
+
+double ProfileSimulator::get_roll_deg(uint32_t id) const
+{
+  uint32_t step = id * kFramesPerTurn / num_heads;
+  return 360.0 * step / kFramesPerTurn;
+}
+
+void ProfileSimulator::generate()
+{
+  const uint32_t stride = get_point_stride(format);
+  const uint32_t len = JS_PROFILE_DATA_LEN / stride;
+  const bool is_brightness = has_brightness(format);
+  frames.resize(kFramesPerTurn);
+  Random random;
+
+  // The log's outline, traced once and then rotated for every frame.
+  std::vector<double> outline_x(kOutlineSamples + 1);
+  std::vector<double> outline_y(kOutlineSamples + 1);
+  for (uint32_t k = 0; k <= kOutlineSamples; k++) {
+    double a = 2.0 * kPi * k / kOutlineSamples;
+    double r = get_log_radius(a);
+    outline_x[k] = r * std::cos(a);
+    outline_y[k] = r * std::sin(a);
+  }
+
+  std::vector<double> surface(len);
+  std::vector<double> slope(len);
+  for (uint32_t f = 0; f < kFramesPerTurn; f++) {
+    Frame &frame = frames[f];
+    frame.is_dropped = (0 == random.next() % kLostFrameInterval);
+    double turn = 2.0 * kPi * f / kFramesPerTurn;
+    double c = std::cos(turn);
+    double s = std::sin(turn);
+
+    for (uint32_t camera = 0; camera < kCamerasPerHead; camera++) {
+      // Camera 0 sees the left side and camera 1 the right.
+      double x_min = (0 == camera) ? -kFieldHalfWidth :
+                                     -kCameraOverlap * kFieldHalfWidth;
+      double x_max = (0 == camera) ? kCameraOverlap * kFieldHalfWidth :
+                                     kFieldHalfWidth;
+      double step = (x_max - x_min) / (len - 1);
+
+      // The scan head looks down on the log, so for every point of the
+      // profile the highest part of the outline above it is what it sees.
+      std::fill(surface.begin(), surface.end(),
+                -std::numeric_limits<double>::infinity());
+      for (uint32_t k = 0; k < kOutlineSamples; k++) {
+        double x0 = c * outline_x[k] - s * outline_y[k];
+        double y0 = s * outline_x[k] + c * outline_y[k];
+        double x1 = c * outline_x[k + 1] - s * outline_y[k + 1];
+        double y1 = s * outline_x[k + 1] + c * outline_y[k + 1];
+        if (x1 < x0) {
+          std::swap(x0, x1);
+          std::swap(y0, y1);
+        }
+        double first = std::ceil((x0 - x_min) / step);
+        double last = std::floor((x1 - x_min) / step);
+        first = std::max(first, 0.0);
+        last = std::min(last, static_cast<double>(len - 1));
+        double dy = (x1 > x0) ? (y1 - y0) / (x1 - x0) : 0.0;
+        for (double i = first; i <= last; i++) {
+          uint32_t n = static_cast<uint32_t>(i);
+          double y = y0 + (x_min + i * step - x0) * dy;
+          if (y > surface[n]) {
+            surface[n] = y;
+            slope[n] = dy;
+          }
+        }
+      }
+
+      jsProfile &p = frame.profiles[camera];
+      std::memset(&p, 0, offsetof(jsProfile, data));
+      p.camera = static_cast<decltype(p.camera)>(camera);
+      p.format = format;
+      p.data_len = len;
+      p.packets_received = 1;
+      p.packets_expected = 1;
+      uint32_t dropout_start = len;
+      uint32_t dropout_end = len;
+      if (0 == random.next() % kDropoutInterval) {
+        dropout_start = random.next() % len;
+        dropout_end = dropout_start + 1 + random.next() % kMaxDropoutLength;
+      }
+      for (uint32_t n = 0; n < len; n++) {
+        jsProfileData &d = p.data[n];
+        if (std::isinf(surface[n]) ||
+            ((dropout_start <= n) && (n < dropout_end))) {
+          d.x = JS_PROFILE_DATA_INVALID_XY;
+          d.y = JS_PROFILE_DATA_INVALID_XY;
+          d.brightness = JS_PROFILE_DATA_INVALID_BRIGHTNESS;
+          continue;
+        }
+        d.x = static_cast<int32_t>(x_min + n * step);
+        d.y = static_cast<int32_t>(surface[n]) + random.next(-kNoise, kNoise);
+        // Surfaces facing the scan head reflect the most light back.
+        d.brightness = JS_PROFILE_DATA_INVALID_BRIGHTNESS;
+        if (is_brightness) {
+          double facing = 1.0 / (1.0 + slope[n] * slope[n]);
+          d.brightness = std::min(255, std::max(1, static_cast<int32_t>(
+                                                     40.0 + 180.0 * facing) +
+                                                     random.next(-10, 10)));
+        }
+      }
+    }
+  }
+}
+
+SimulatedSource::SimulatedSource(const ProfileSimulator &simulator,
+                                 uint32_t id)
+  : simulator(simulator),
+    id(id),
+    first_frame((kFramesPerTurn - id * kFramesPerTurn /
+                                    simulator.get_num_heads()) %
+                kFramesPerTurn)
+{
+}
+
+uint64_t SimulatedSource::count_available()
+{
+  uint32_t g = simulator.generation.load(std::memory_order_acquire);
+  if (g != generation) {
+    generation = g;
+    delivered = 0;
+  }
+  if (0.0 >= simulator.rate_hz) {
+    return 0;
+  }
+
+  // Both cameras take a profile at every scan.
+  uint64_t elapsed_ns = get_time_ns() - simulator.start_ns;
+  uint64_t scans = static_cast<uint64_t>(elapsed_ns * simulator.rate_hz /
+                                         1.0e9) + 1;
+  uint64_t due = scans * kCamerasPerHead;
+  if (due - delivered > kMaxQueuedProfiles) {
+    delivered = due - kMaxQueuedProfiles;
+  }
+  return due - delivered;
+}
+
+int32_t SimulatedSource::wait_until_available(uint32_t count,
+                                              uint32_t timeout_us)
+{
+  const uint64_t deadline = get_time_ns() + timeout_us * 1000ull;
+  while (true) {
+    uint64_t available = count_available();
+    uint64_t now = get_time_ns();
+    if ((available >= count) || (now >= deadline) ||
+        (0.0 >= simulator.rate_hz)) {
+      return static_cast<int32_t>(available);
+    }
+
+    // Sleep until enough profiles have come due.
+    uint64_t scan = (delivered + count - 1) / kCamerasPerHead;
+    uint64_t due_ns = simulator.start_ns +
+                      static_cast<uint64_t>(scan * 1.0e9 / simulator.rate_hz);
+    uint64_t wait = std::min(deadline, std::max(due_ns, now)) - now;
+    wait = std::max<uint64_t>(1000, std::min(wait, kMaxSleepNs));
+    std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+  }
+}
+
+int32_t SimulatedSource::get_profiles(jsProfile *profiles,
+                                      uint32_t max_profiles)
+{
+  const double period_ns = 1.0e9 / simulator.rate_hz;
+  uint64_t available = count_available();
+  uint32_t n = 0;
+  while ((n < max_profiles) && (0 < available)) {
+    uint64_t scan = delivered / kCamerasPerHead;
+    uint32_t camera = static_cast<uint32_t>(delivered % kCamerasPerHead);
+    delivered++;
+    available--;
+    const ProfileSimulator::Frame &frame =
+      simulator.frames[(first_frame + scan) % kFramesPerTurn];
+    if (frame.is_dropped) {
+      continue;
+    }
+
+    const jsProfile &src = frame.profiles[camera];
+    jsProfile &dst = profiles[n++];
+    std::memcpy(&dst, &src, offsetof(jsProfile, data));
+    std::memcpy(dst.data, src.data, src.data_len * sizeof(jsProfileData));
+    dst.scan_head_id = id;
+    dst.timestamp_ns =
+      simulator.start_ns + static_cast<uint64_t>(scan * period_ns);
+    dst.sequence_number = static_cast<uint32_t>(scan);
+  }
+  return static_cast<int32_t>(n);
+}
@@ -0,0 +1,126 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_simulator.hpp
+ * @brief Simulated scan heads for load testing without hardware.
+ *
+ * The simulator stands in for a scan system of any number of scan heads,
+ * arranged evenly around a log that slowly rotates in front of them. Each of
+ * its sources delivers profiles of the log's surface, with noise and the
+ * occasional dropout, at the scan rate and in the data format of a real scan
+ * system, through the same interface the receivers read live scan heads
+ * with.
+ *
+ * So that generating profiles never becomes the bottleneck, every profile of
+ * a full turn of the log is computed up front; delivering one is then just a
+ * copy. Since every scan head sees the same log from a different angle, all
+ * of them share one table, each starting at a different point of the turn.
+ */
+#ifndef SCAN_GUI_PROFILE_SIMULATOR_HPP
+#define SCAN_GUI_PROFILE_SIMULATOR_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "profile_receiver.hpp"
+#include "profile_source.hpp"
+
+// Serial number of the first simulated scan head; the others follow in order.
+static const uint32_t kSimulatedSerialBase = 90000;
+
+class ProfileSimulator {
+public:
+  /**
+   * @param num_heads Number of scan heads placed around the log.
+   */
+  explicit ProfileSimulator(uint32_t num_heads);
+
+  ProfileSimulator(const ProfileSimulator &) = delete;
+  ProfileSimulator &operator=(const ProfileSimulator &) = delete;
+
+  /**
+   * @brief Starts scanning over at a new scan rate and data format,
+   * regenerating the profiles. No source may be read from meanwhile.
+   *
+   * @return Zero on success, otherwise `JS_ERROR_INVALID_ARGUMENT`.
+   */
+  int32_t start_scanning(double rate_hz, jsDataFormat format);
+
+  uint32_t get_num_heads() const
+  {
+    return num_heads;
+  }
+
+  /**
+   * @brief The highest scan rate the simulated scan heads allow.
+   */
+  double get_max_scan_rate() const;
+
+  /**
+   * @brief Angle of a scan head around the log, in degrees counterclockwise.
+   * Used as its roll, this aligns its profiles into a common frame in which
+   * the scan heads together see the whole log.
+   */
+  double get_roll_deg(uint32_t id) const;
+
+private:
+  friend class SimulatedSource;
+
+  struct Frame {
+    jsProfile profiles[kCamerasPerHead];
+    // Lost on the way to the host, as if a packet had gone missing.
+    bool is_dropped;
+  };
+
+  void generate();
+
+  const uint32_t num_heads;
+  double rate_hz = 0.0;
+  jsDataFormat format = JS_DATA_FORMAT_XY_FULL_LM_FULL;
+  // Profiles of both cameras for every step of a turn of the log.
+  std::vector<Frame> frames;
+  uint64_t start_ns = 0;
+  // Incremented whenever scanning starts over, so that the sources can tell.
+  std::atomic<uint32_t> generation{0};
+};
+
+/**
+ * @brief Profiles of one simulated scan head.
+ */
+class SimulatedSource : public ProfileSource {
+public:
+  SimulatedSource(const ProfileSimulator &simulator, uint32_t id);
+
+  uint32_t get_id() const override
+  {
+    return id;
+  }
+
+  int32_t wait_until_available(uint32_t count, uint32_t timeout_us) override;
+  int32_t get_profiles(jsProfile *profiles, uint32_t max_profiles) override;
+
+  bool is_idle() override
+  {
+    // Not scanning yet.
+    return 0.0 >= simulator.rate_hz;
+  }
+
+private:
+  uint64_t count_available();
+
+  const ProfileSimulator &simulator;
+  uint32_t id;
+  // Offset into the simulator's frames; this is the scan head's angle.
+  uint32_t first_frame;
+  uint32_t generation = UINT32_MAX;
+  // Profiles delivered or dropped since scanning started.
+  uint64_t delivered = 0;
+};
+
+#endif
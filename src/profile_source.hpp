@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_source.hpp
+ * @brief Where a receiver gets its profiles from.
+ *
+ * The receiver threads don't talk to the client API directly, but through
+ * this interface, which mirrors the client API calls they need. A live
+ * scan head is one implementation; others, such as replaying a recording,
+ * can then drive the exact same pipeline without any hardware attached.
+ */
+#ifndef SCAN_GUI_PROFILE_SOURCE_HPP
+#define SCAN_GUI_PROFILE_SOURCE_HPP
+
+#include <cstdint>
+#include <joescan_pinchot.h>
+
+class ProfileSource {
+public:
+  virtual ~ProfileSource() = default;
+
+  /**
+   * @brief Unique ID of the scan head the profiles come from, starting at
+   * zero; used to index per scan head data throughout the application.
+   */
+  virtual uint32_t get_id() const = 0;
+
+  /**
+   * @brief Blocks until at least `count` profiles are available or until
+   * `timeout_us` has passed, as `jsScanHeadWaitUntilProfilesAvailable`.
+   *
+   * @return The number of profiles available, or negative `jsError` value.
+   */
+  virtual int32_t wait_until_available(uint32_t count,
+                                       uint32_t timeout_us) = 0;
+
+  /**
+   * @brief Reads up to `max_profiles` profiles, as `jsScanHeadGetProfiles`.
+   *
+   * @return The number of profiles read, or negative `jsError` value.
+   */
+  virtual int32_t get_profiles(jsProfile *profiles, uint32_t max_profiles) = 0;
+
+  /**
+   * @brief Tries to get profiles flowing again after reading kept failing or
+   * none arrived for a while. Called from the receiver thread, again and
+   * again with a growing delay in between for as long as it fails.
+   *
+   * @return Zero or positive once profiles can be read again, negative
+   * `jsError` value otherwise.
+   */
+  virtual int32_t recover()
+  {
+    return 0;
+  }
+
+  /**
+   * @brief Whether the source has no profiles to deliver because it isn't
+   * meant to right now, like a paused replay. A quiet source that is idle
+   * isn't stalled, and isn't recovered. Called from the receiver thread.
+   */
+  virtual bool is_idle()
+  {
+    return false;
+  }
+};
+
+/**
+ * @brief Profiles from a live scan head, through the client API.
+ */
+class ScanHeadSource : public ProfileSource {
+public:
+  explicit ScanHeadSource(jsScanHead scan_head)
+    : scan_head(scan_head), id(jsScanHeadGetId(scan_head))
+  {
+  }
+
+  uint32_t get_id() const override
+  {
+    return id;
+  }
+
+  int32_t wait_until_available(uint32_t count, uint32_t timeout_us) override
+  {
+    return jsScanHeadWaitUntilProfilesAvailable(scan_head, count, timeout_us);
+  }
+
+  int32_t get_profiles(jsProfile *profiles, uint32_t max_profiles) override
+  {
+    return jsScanHeadGetProfiles(scan_head, profiles, max_profiles);
+  }
+
+  int32_t recover() override
+  {
+    // The client API can't reconnect a single scan head while the others
+    // keep scanning; all that can be done is to wait for its connection to
+    // come back, leaving the other scan heads alone.
+    return jsScanHeadIsConnected(scan_head) ? 0 : JS_ERROR_NOT_CONNECTED;
+  }
+
+  jsScanHead get_scan_head() const
+  {
+    return scan_head;
+  }
+
+private:
+  jsScanHead scan_head;
+  uint32_t id;
+};
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_stage.hpp
+ * @brief Processing that runs on every batch of profiles as it is received.
+ *
+ * Stages are called on the receiver threads once a batch has been read from
+ * its source, cropped, and handed to the live view and the frame merger, but
+ * before it is recorded or pushed into the ring. Each scan head has its own
+ * receiver, so the work spreads across all heads in parallel, and sees every
+ * profile at the full scan rate rather than only the ones the GUI gets
+ * around to drawing.
+ */
+#ifndef SCAN_GUI_PROFILE_STAGE_HPP
+#define SCAN_GUI_PROFILE_STAGE_HPP
+
+#include <cstdint>
+#include <joescan_pinchot.h>
+
+class ProfileStage {
+public:
+  virtual ~ProfileStage() = default;
+
+  /**
+   * @brief Processes a batch of profiles from one scan head. Called from the
+   * receiver thread of scan head `id` only, but the receivers of different
+   * scan heads call it concurrently. Must not block, or the receiver falls
+   * behind.
+   */
+  virtual void process(uint32_t id, const jsProfile *profiles,
+                       uint32_t count) = 0;
+
+  /**
+   * @brief Short name of the stage, for labeling its timing.
+   */
+  virtual const char *get_stage_name() const = 0;
+};
+
+#endif
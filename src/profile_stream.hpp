@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file profile_stream.hpp
+ * @brief Layout of the profile stream a server sends to its viewers.
+ *
+ * A viewer connecting over TCP is first sent a `StreamHeader` describing the
+ * scan system, followed by one `RecordingHeadHeader` per scan head, exactly
+ * as at the start of a recording. The rest of the stream is profiles, each a
+ * `RecordingProfileHeader` followed by `data_len` `jsProfileData` points,
+ * again the same as inside a recording chunk. There is no other framing; the
+ * profile header says how long each profile is. Like a recording, values
+ * are in the server's native byte order, which `recording_format.hpp`
+ * checks is little endian.
+ *
+ * TCP keeps every viewer's profiles in order and complete, which UDP
+ * multicast wouldn't: a full resolution profile is larger than a datagram.
+ */
+#ifndef SCAN_GUI_PROFILE_STREAM_HPP
+#define SCAN_GUI_PROFILE_STREAM_HPP
+
+#include <cstdint>
+#include "recording_format.hpp"
+
+static const char kStreamMagic[8] = {'J', 'S', 'S', 'T', 'R', 'E', 'A', 'M'};
+static const uint32_t kStreamVersion = 1;
+static const uint16_t kStreamDefaultPort = 12350;
+
+struct StreamHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_heads;
+  int32_t data_format;
+  // Every how many points of a profile the server sends; one for all.
+  uint32_t point_stride;
+  double scan_rate_hz;
+};
+
+static_assert(sizeof(StreamHeader) == 32, "unexpected padding");
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file recording_format.hpp
+ * @brief Layout of profile recording files.
+ *
+ * A recording starts with a file header describing the scan system, followed
+ * by one header per scan head with its serial number, window and
+ * configuration. The rest of the file is a sequence of chunks, each holding
+ * profiles from a single scan head. Every chunk begins on a multiple of
+ * `kRecordingAlignment` so the file can be written with unbuffered I/O, and
+ * the chunk header gives the size of its payload so a reader can find all of
+ * the chunks without decoding any profiles.
+ *
+ * Inside a chunk, each profile is stored as a `RecordingProfileHeader`
+ * followed by `data_len` `jsProfileData` points. Only the points a profile
+ * actually holds are written. Chunks flagged with `kRecordingChunkPacked`
+ * hold this same payload compressed by `ChunkCodec`.
+ *
+ * Headers and points are copied to the file as they are in memory, so
+ * values are in the writer's native byte order. That is little endian on
+ * every platform this builds for, which is checked below, so a recording
+ * reads back the same on any of them.
+ */
+#ifndef SCAN_GUI_RECORDING_FORMAT_HPP
+#define SCAN_GUI_RECORDING_FORMAT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <joescan_pinchot.h>
+
+// MSVC only targets little endian platforms and doesn't define these.
+#if defined(__BYTE_ORDER__)
+static_assert(__ORDER_LITTLE_ENDIAN__ == __BYTE_ORDER__,
+              "recordings are written in native byte order, which has to be "
+              "little endian");
+#endif
+
+static const char kRecordingMagic[8] = {'J', 'S', 'P', 'R', 'O', 'F', 'I',
+                                        'L'};
+static const uint32_t kRecordingVersion = 1;
+static const uint32_t kRecordingChunkMagic = 0x4b4e4843; // "CHNK"
+// Chunk flag for payloads compressed with `ChunkCodec`.
+static const uint32_t kRecordingChunkPacked = 1 << 0;
+// Chunks and the file header are padded to this; it satisfies the alignment
+// unbuffered I/O requires on all common disks and file systems.
+static const uint32_t kRecordingAlignment = 4096;
+
+struct RecordingFileHeader {
+  char magic[8];
+  uint32_t version;
+  // Size of this header plus the scan head headers, padded to alignment;
+  // the first chunk starts here.
+  uint32_t header_size;
+  uint32_t num_heads;
+  int32_t data_format;
+  double scan_rate_hz;
+  uint64_t start_time_ns;
+};
+
+struct RecordingHeadHeader {
+  uint32_t serial;
+  uint32_t id;
+  double window_top;
+  double window_bottom;
+  double window_left;
+  double window_right;
+  jsScanHeadConfiguration config;
+};
+
+struct RecordingChunkHeader {
+  uint32_t magic;
+  uint32_t flags;
+  uint32_t scan_head_id;
+  uint32_t profile_count;
+  // Bytes of profile data following this header, not including padding.
+  uint32_t payload_size;
+  // Size of the payload once decompressed; same as `payload_size` for
+  // chunks that aren't compressed.
+  uint32_t raw_payload_size;
+  uint64_t first_timestamp_ns;
+  uint64_t last_timestamp_ns;
+};
+
+struct RecordingProfileHeader {
+  uint32_t scan_head_id;
+  uint32_t camera;
+  uint32_t laser;
+  uint32_t flags;
+  uint64_t timestamp_ns;
+  uint32_t sequence_number;
+  uint32_t laser_on_time_us;
+  int32_t format;
+  uint32_t packets_received;
+  uint32_t packets_expected;
+  uint32_t data_len;
+};
+
+static_assert(sizeof(RecordingChunkHeader) == 40, "unexpected padding");
+static_assert(sizeof(RecordingProfileHeader) == 48, "unexpected padding");
+static_assert(sizeof(jsProfileData) == 12, "unexpected jsProfileData size");
+
+/**
+ * @brief Rounds a size up to a multiple of `kRecordingAlignment`.
+ */
+inline uint64_t recording_align(uint64_t size)
+{
+  return (size + kRecordingAlignment - 1) & ~uint64_t(kRecordingAlignment - 1);
+}
+
+/**
+ * @brief Number of bytes a profile takes up inside a chunk.
+ */
+inline size_t recording_profile_size(const jsProfile &profile)
+{
+  return sizeof(RecordingProfileHeader) +
+         profile.data_len * sizeof(jsProfileData);
+}
+
+/**
+ * @brief The header a profile is serialized with, its points following.
+ */
+inline RecordingProfileHeader recording_make_header(const jsProfile &profile)
+{
+  RecordingProfileHeader hdr;
+  hdr.scan_head_id = profile.scan_head_id;
+  hdr.camera = static_cast<uint32_t>(profile.camera);
+  hdr.laser = static_cast<uint32_t>(profile.laser);
+  hdr.flags = profile.flags;
+  hdr.timestamp_ns = profile.timestamp_ns;
+  hdr.sequence_number = profile.sequence_number;
+  hdr.laser_on_time_us = profile.laser_on_time_us;
+  hdr.format = static_cast<int32_t>(profile.format);
+  hdr.packets_received = profile.packets_received;
+  hdr.packets_expected = profile.packets_expected;
+  hdr.data_len = profile.data_len;
+  return hdr;
+}
+
+/**
+ * @brief Serializes a profile to `dst`, which must have room for
+ * `recording_profile_size(profile)` bytes.
+ */
+inline void recording_write_profile(uint8_t *dst, const jsProfile &profile)
+{
+  RecordingProfileHeader hdr = recording_make_header(profile);
+  std::memcpy(dst, &hdr, sizeof(hdr));
+  std::memcpy(dst + sizeof(hdr), profile.data,
+              profile.data_len * sizeof(jsProfileData));
+}
+
+/**
+ * @brief Fills in a profile from its header, leaving its points as they
+ * were. `data_len` is limited to what a profile can hold.
+ */
+inline void recording_apply_header(const RecordingProfileHeader &hdr,
+                                   jsProfile &dst)
+{
+  dst.scan_head_id = hdr.scan_head_id;
+  dst.camera = static_cast<decltype(dst.camera)>(hdr.camera);
+  dst.laser = static_cast<decltype(dst.laser)>(hdr.laser);
+  dst.flags = hdr.flags;
+  dst.timestamp_ns = hdr.timestamp_ns;
+  dst.sequence_number = hdr.sequence_number;
+  dst.laser_on_time_us = hdr.laser_on_time_us;
+  dst.format = static_cast<jsDataFormat>(hdr.format);
+  dst.packets_received = hdr.packets_received;
+  dst.packets_expected = hdr.packets_expected;
+  dst.data_len = (hdr.data_len < JS_PROFILE_DATA_LEN) ? hdr.data_len :
+                                                        JS_PROFILE_DATA_LEN;
+}
+
+/**
+ * @brief Deserializes a profile written by `recording_write_profile`. Only
+ * the points the profile holds are copied; the rest of `dst.data` is left
+ * as it was.
+ *
+ * @return Number of bytes the profile took up inside the chunk.
+ */
+inline size_t recording_read_profile(const uint8_t *src, jsProfile &dst)
+{
+  RecordingProfileHeader hdr;
+  std::memcpy(&hdr, src, sizeof(hdr));
+  recording_apply_header(hdr, dst);
+  std::memcpy(dst.data, src + sizeof(hdr),
+              dst.data_len * sizeof(jsProfileData));
+  return sizeof(hdr) + hdr.data_len * sizeof(jsProfileData);
+}
+
+#endif
@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "region_filter.hpp"
+#include <algorithm>
+
+RegionFilter::RegionFilter(uint32_t num_heads) : transforms(num_heads)
+{
+}
+
+void RegionFilter::set_region(const PointRegion &region)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  this->region = region;
+  is_enabled.store(true, std::memory_order_relaxed);
+}
+
+void RegionFilter::clear_region()
+{
+  is_enabled.store(false, std::memory_order_relaxed);
+}
+
+bool RegionFilter::get_region(PointRegion &region) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  region = this->region;
+  return is_enabled.load(std::memory_order_relaxed);
+}
+
+void RegionFilter::set_transform(uint32_t id, const PointTransform &transform)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (id < transforms.size()) {
+    transforms[id] = transform;
+  }
+}
+
+void RegionFilter::apply(uint32_t id, jsProfile *profiles, uint32_t count)
+{
+  if (!is_enabled.load(std::memory_order_relaxed) ||
+      (transforms.size() <= id)) {
+    return;
+  }
+  PointRegion r;
+  PointTransform t;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    r = region;
+    t = transforms[id];
+  }
+
+  for (uint32_t n = 0; n < count; n++) {
+    jsProfile &profile = profiles[n];
+    uint32_t len = std::min<uint32_t>(profile.data_len, JS_PROFILE_DATA_LEN);
+    profile.data_len = crop_points(profile.data, len, t, r);
+  }
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file region_filter.hpp
+ * @brief Crops every profile to a region of interest as it is received.
+ *
+ * Often only part of a scan head's window matters. The filter runs on the
+ * receiver threads, right after a batch is read and before anything else
+ * sees it, and marks every point outside the region invalid in place with
+ * `crop_points`. Everything downstream, from the live view to recordings,
+ * shared memory and the profile stream, then skips those points as it does
+ * any other invalid point, and a profile's length is cut back to its last
+ * point left, so they don't even get copied.
+ *
+ * The region is in the scan system's coordinate frame, where it is drawn on
+ * the plot; each scan head's points are taken into it with the same
+ * alignment transform used to draw them.
+ */
+#ifndef SCAN_GUI_REGION_FILTER_HPP
+#define SCAN_GUI_REGION_FILTER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "profile_convert.hpp"
+
+class RegionFilter {
+public:
+  explicit RegionFilter(uint32_t num_heads);
+
+  RegionFilter(const RegionFilter &) = delete;
+  RegionFilter &operator=(const RegionFilter &) = delete;
+
+  /**
+   * @brief Crops to `region` from the next batch on; any thread may call it.
+   */
+  void set_region(const PointRegion &region);
+
+  /**
+   * @brief Stops cropping from the next batch on.
+   */
+  void clear_region();
+
+  /**
+   * @brief The region being cropped to, if any.
+   */
+  bool get_region(PointRegion &region) const;
+
+  /**
+   * @brief How the points of scan head `id` map into the scan system's
+   * coordinate frame; see `make_alignment_transform`.
+   */
+  void set_transform(uint32_t id, const PointTransform &transform);
+
+  /**
+   * @brief Crops a batch of profiles of scan head `id` in place. Called from
+   * that scan head's receiver thread.
+   */
+  void apply(uint32_t id, jsProfile *profiles, uint32_t count);
+
+private:
+  // Checked before taking the lock, so that nothing is locked while the
+  // filter is off.
+  std::atomic<bool> is_enabled{false};
+  mutable std::mutex mutex;
+  PointRegion region;
+  // Indexed by scan head ID.
+  std::vector<PointTransform> transforms;
+};
+
+#endif
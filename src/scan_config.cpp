@@ -0,0 +1,242 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "scan_config.hpp"
+#include <fstream>
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+
+using nlohmann::json;
+
+static const struct {
+  jsDataFormat format;
+  const char *name;
+} kDataFormats[] = {
+  {JS_DATA_FORMAT_XY_FULL_LM_FULL, "XY_FULL_LM_FULL"},
+  {JS_DATA_FORMAT_XY_HALF_LM_HALF, "XY_HALF_LM_HALF"},
+  {JS_DATA_FORMAT_XY_QUARTER_LM_QUARTER, "XY_QUARTER_LM_QUARTER"},
+  {JS_DATA_FORMAT_XY_FULL, "XY_FULL"},
+  {JS_DATA_FORMAT_XY_HALF, "XY_HALF"},
+  {JS_DATA_FORMAT_XY_QUARTER, "XY_QUARTER"},
+};
+
+/**
+ * @brief The same configuration settings used in the "Configure and Connect"
+ * example.
+ */
+static HeadConfig get_builtin_head()
+{
+  HeadConfig head;
+  jsScanHeadConfiguration &config = head.configuration;
+  config.scan_offset_us = 0;
+  config.camera_exposure_time_min_us = 10000;
+  config.camera_exposure_time_def_us = 47000;
+  config.camera_exposure_time_max_us = 900000;
+  config.laser_on_time_min_us = 100;
+  config.laser_on_time_def_us = 100;
+  config.laser_on_time_max_us = 1000;
+  config.laser_detection_threshold = 120;
+  config.saturation_threshold = 800;
+  config.saturation_percentage = 30;
+  return head;
+}
+
+/**
+ * @brief Overwrites `value` with `j[key]`, if there is one.
+ */
+template <typename T>
+static void read(const json &j, const char *key, T &value)
+{
+  auto it = j.find(key);
+  if (j.end() != it) {
+    value = it->get<T>();
+  }
+}
+
+static void read_configuration(const json &j, jsScanHeadConfiguration &c)
+{
+  read(j, "scan_offset_us", c.scan_offset_us);
+  read(j, "camera_exposure_time_min_us", c.camera_exposure_time_min_us);
+  read(j, "camera_exposure_time_def_us", c.camera_exposure_time_def_us);
+  read(j, "camera_exposure_time_max_us", c.camera_exposure_time_max_us);
+  read(j, "laser_on_time_min_us", c.laser_on_time_min_us);
+  read(j, "laser_on_time_def_us", c.laser_on_time_def_us);
+  read(j, "laser_on_time_max_us", c.laser_on_time_max_us);
+  read(j, "laser_detection_threshold", c.laser_detection_threshold);
+  read(j, "saturation_threshold", c.saturation_threshold);
+  read(j, "saturation_percentage", c.saturation_percentage);
+}
+
+static void read_head(const json &j, HeadConfig &head)
+{
+  auto it = j.find("configuration");
+  if (j.end() != it) {
+    read_configuration(*it, head.configuration);
+  }
+  it = j.find("window");
+  if (j.end() != it) {
+    read(*it, "top", head.window.top);
+    read(*it, "bottom", head.window.bottom);
+    read(*it, "left", head.window.left);
+    read(*it, "right", head.window.right);
+  }
+  it = j.find("alignment");
+  if (j.end() != it) {
+    read(*it, "roll_deg", head.alignment.roll_deg);
+    read(*it, "shift_x", head.alignment.shift_x);
+    read(*it, "shift_y", head.alignment.shift_y);
+    read(*it, "cable_downstream", head.alignment.is_cable_downstream);
+  }
+}
+
+HeadConfig ScanConfig::get_head(uint32_t serial) const
+{
+  for (auto &head : heads) {
+    if (serial == head.serial) {
+      return head;
+    }
+  }
+  HeadConfig head = defaults;
+  head.serial = serial;
+  return head;
+}
+
+RecordingHeadHeader make_head_info(uint32_t id, const HeadConfig &head)
+{
+  RecordingHeadHeader info;
+  info.serial = head.serial;
+  info.id = id;
+  info.window_top = head.window.top;
+  info.window_bottom = head.window.bottom;
+  info.window_left = head.window.left;
+  info.window_right = head.window.right;
+  info.config = head.configuration;
+  return info;
+}
+
+ScanConfig get_default_scan_config(const std::vector<uint32_t> &serials)
+{
+  ScanConfig config;
+  config.defaults = get_builtin_head();
+  for (size_t n = 0; n < serials.size(); n++) {
+    HeadConfig head = config.defaults;
+    head.serial = serials[n];
+    double window = (n % 2) ? 20.0 : 30.0;
+    head.window.top = window;
+    head.window.bottom = -window;
+    head.window.left = -window;
+    head.window.right = window;
+    config.heads.push_back(head);
+  }
+  return config;
+}
+
+ScanConfig load_scan_config(const std::string &path)
+{
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("failed to open " + path);
+  }
+
+  ScanConfig config;
+  config.defaults = get_builtin_head();
+  try {
+    json j = json::parse(file);
+    if (!j.is_object()) {
+      throw std::runtime_error("expected an object");
+    }
+
+    read(j, "scan_rate_hz", config.scan_rate_hz);
+    auto it = j.find("data_format");
+    if (j.end() != it) {
+      std::string name = it->get<std::string>();
+      config.data_format = find_data_format(name);
+      if (JS_DATA_FORMAT_INVALID == config.data_format) {
+        throw std::runtime_error("unknown data format " + name);
+      }
+    }
+    it = j.find("defaults");
+    if (j.end() != it) {
+      read_head(*it, config.defaults);
+    }
+    it = j.find("heads");
+    if (j.end() != it) {
+      for (auto &h : *it) {
+        HeadConfig head = config.defaults;
+        head.serial = h.at("serial").get<uint32_t>();
+        read_head(h, head);
+        config.heads.push_back(head);
+      }
+    }
+  } catch (json::exception &e) {
+    throw std::runtime_error(path + ": " + e.what());
+  } catch (std::runtime_error &e) {
+    throw std::runtime_error(path + ": " + e.what());
+  }
+
+  return config;
+}
+
+const char *get_data_format_name(jsDataFormat format)
+{
+  for (auto &f : kDataFormats) {
+    if (format == f.format) {
+      return f.name;
+    }
+  }
+  return "INVALID";
+}
+
+jsDataFormat find_data_format(const std::string &name)
+{
+  for (auto &f : kDataFormats) {
+    if (name == f.name) {
+      return f.format;
+    }
+  }
+  return JS_DATA_FORMAT_INVALID;
+}
+
+uint32_t get_data_format_count()
+{
+  return sizeof(kDataFormats) / sizeof(kDataFormats[0]);
+}
+
+jsDataFormat get_data_format(uint32_t index)
+{
+  if (get_data_format_count() <= index) {
+    return JS_DATA_FORMAT_INVALID;
+  }
+  return kDataFormats[index].format;
+}
+
+bool has_brightness(jsDataFormat format)
+{
+  return (JS_DATA_FORMAT_XY_FULL_LM_FULL == format) ||
+         (JS_DATA_FORMAT_XY_HALF_LM_HALF == format) ||
+         (JS_DATA_FORMAT_XY_QUARTER_LM_QUARTER == format);
+}
+
+jsDataFormat get_data_format(jsDataFormat format, bool is_brightness)
+{
+  switch (format) {
+  case JS_DATA_FORMAT_XY_FULL_LM_FULL:
+  case JS_DATA_FORMAT_XY_FULL:
+    return is_brightness ? JS_DATA_FORMAT_XY_FULL_LM_FULL :
+                           JS_DATA_FORMAT_XY_FULL;
+  case JS_DATA_FORMAT_XY_HALF_LM_HALF:
+  case JS_DATA_FORMAT_XY_HALF:
+    return is_brightness ? JS_DATA_FORMAT_XY_HALF_LM_HALF :
+                           JS_DATA_FORMAT_XY_HALF;
+  case JS_DATA_FORMAT_XY_QUARTER_LM_QUARTER:
+  case JS_DATA_FORMAT_XY_QUARTER:
+    return is_brightness ? JS_DATA_FORMAT_XY_QUARTER_LM_QUARTER :
+                           JS_DATA_FORMAT_XY_QUARTER;
+  default:
+    return format;
+  }
+}
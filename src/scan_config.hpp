@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file scan_config.hpp
+ * @brief Scan system settings loaded from a JSON file.
+ *
+ * The file gives the scan rate and data format of the whole system, along
+ * with the configuration, window and alignment of each scan head by serial
+ * number. Anything a scan head leaves out is taken from the file's
+ * `defaults`, and anything missing from those is the example's built in
+ * settings, so a file only needs to list what differs:
+ *
+ * ```json
+ * {
+ *   "scan_rate_hz": 400,
+ *   "data_format": "XY_HALF_LM_HALF",
+ *   "defaults": {
+ *     "configuration": { "laser_detection_threshold": 120 },
+ *     "window": { "top": 30, "bottom": -30, "left": -30, "right": 30 }
+ *   },
+ *   "heads": [
+ *     { "serial": 12345,
+ *       "alignment": { "roll_deg": 0, "shift_x": -12, "shift_y": 0 } },
+ *     { "serial": 12346,
+ *       "configuration": { "laser_on_time_max_us": 500 },
+ *       "alignment": { "roll_deg": 180, "shift_x": 12, "shift_y": 0,
+ *                      "cable_downstream": true } }
+ *   ]
+ * }
+ * ```
+ */
+#ifndef SCAN_GUI_SCAN_CONFIG_HPP
+#define SCAN_GUI_SCAN_CONFIG_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "recording_format.hpp"
+
+/**
+ * @brief Where a scan head sits in the scan system: the same parameters as
+ * `jsScanHeadSetAlignment`, but applied by the application when drawing, so
+ * that they can be adjusted while scanning.
+ */
+struct HeadAlignment {
+  float roll_deg = 0.0f;
+  float shift_x = 0.0f;
+  float shift_y = 0.0f;
+  bool is_cable_downstream = false;
+};
+
+/**
+ * @brief Rectangular scan window, in inches.
+ */
+struct HeadWindow {
+  double top = 30.0;
+  double bottom = -30.0;
+  double left = -30.0;
+  double right = 30.0;
+};
+
+struct HeadConfig {
+  uint32_t serial = 0;
+  jsScanHeadConfiguration configuration;
+  HeadWindow window;
+  HeadAlignment alignment;
+};
+
+struct ScanConfig {
+  double scan_rate_hz = 200.0;
+  jsDataFormat data_format = JS_DATA_FORMAT_XY_FULL_LM_FULL;
+  // Used for scan heads the file doesn't list.
+  HeadConfig defaults;
+  std::vector<HeadConfig> heads;
+
+  /**
+   * @brief The settings of a scan head, falling back to the defaults if the
+   * configuration doesn't list it.
+   */
+  HeadConfig get_head(uint32_t serial) const;
+};
+
+/**
+ * @brief How a scan head with ID `id` is set up, as written to the header
+ * of recordings.
+ */
+RecordingHeadHeader make_head_info(uint32_t id, const HeadConfig &head);
+
+/**
+ * @brief The settings used without a configuration file: the same
+ * configuration for every scan head, with windows alternating between 30
+ * and 20 inches to show that each head can be set up differently.
+ */
+ScanConfig get_default_scan_config(const std::vector<uint32_t> &serials);
+
+/**
+ * @brief Reads a configuration file.
+ *
+ * @throws std::runtime_error if the file can't be read, isn't valid JSON or
+ * holds a value of the wrong type.
+ */
+ScanConfig load_scan_config(const std::string &path);
+
+/**
+ * @brief Name of a data format as used in configuration files, such as
+ * "XY_FULL_LM_FULL".
+ */
+const char *get_data_format_name(jsDataFormat format);
+
+/**
+ * @brief Looks up a data format by name.
+ *
+ * @return The data format, or `JS_DATA_FORMAT_INVALID` if the name isn't
+ * known.
+ */
+jsDataFormat find_data_format(const std::string &name);
+
+/**
+ * @brief Number of data formats known by name; together with
+ * `get_data_format` this lists them, for choosing one in the GUI.
+ */
+uint32_t get_data_format_count();
+
+jsDataFormat get_data_format(uint32_t index);
+
+/**
+ * @brief Whether profiles in a data format carry brightness along with X and
+ * Y.
+ */
+bool has_brightness(jsDataFormat format);
+
+/**
+ * @brief The data format with the same resolution as `format`, with or
+ * without brightness; what to switch to when brightness is or isn't needed.
+ */
+jsDataFormat get_data_format(jsDataFormat format, bool is_brightness);
+
+#endif
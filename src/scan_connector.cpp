@@ -0,0 +1,324 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "scan_connector.hpp"
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+
+// How long each connection attempt waits for the scan heads to answer.
+static const int32_t kConnectTimeoutS = 5;
+// Wait between connection attempts; grows with every failed attempt.
+static const auto kRetryDelay = std::chrono::seconds(1);
+
+ScanConnector::ScanConnector(const ScanConfig &config,
+                             const std::vector<uint32_t> &serial_numbers,
+                             uint32_t max_attempts)
+  : config(config),
+    serial_numbers(serial_numbers),
+    max_attempts((0 < max_attempts) ? max_attempts : 1)
+{
+  status.heads.resize(serial_numbers.size());
+  for (size_t id = 0; id < serial_numbers.size(); id++) {
+    status.heads[id].serial = serial_numbers[id];
+  }
+}
+
+ScanConnector::~ScanConnector()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    is_cancelled = true;
+  }
+  wake.notify_all();
+  if (thread.joinable()) {
+    thread.join();
+  }
+  if ((nullptr != scan_system) && !is_released) {
+    close_scan_system(scan_system);
+  }
+}
+
+bool close_scan_system(jsScanSystem scan_system,
+                       std::chrono::milliseconds timeout)
+{
+  // The calls are made on a thread of their own, so that the wait for them
+  // can be given up on.
+  auto done = std::make_shared<std::promise<void>>();
+  std::future<void> is_done = done->get_future();
+  std::thread([scan_system, done]() {
+    if (jsScanSystemIsScanning(scan_system)) {
+      jsScanSystemStopScanning(scan_system);
+    }
+    if (jsScanSystemIsConnected(scan_system)) {
+      jsScanSystemDisconnect(scan_system);
+    }
+    jsScanSystemFree(scan_system);
+    done->set_value();
+  }).detach();
+  return std::future_status::ready == is_done.wait_for(timeout);
+}
+
+void ScanConnector::start()
+{
+  thread = std::thread(&ScanConnector::run, this);
+}
+
+ScanConnector::Status ScanConnector::get_status() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return status;
+}
+
+void ScanConnector::set_state(ConnectState state, const std::string &message)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  status.state = state;
+  status.message = message;
+}
+
+void ScanConnector::set_head_state(size_t id, HeadState state, int32_t error)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  status.heads[id].state = state;
+  status.heads[id].error = error;
+}
+
+bool ScanConnector::wait_for(std::chrono::milliseconds timeout)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  return !wake.wait_for(lock, timeout, [this] { return is_cancelled; });
+}
+
+void ScanConnector::run()
+{
+  int32_t r = 0;
+  try {
+    create_scan_heads(r);
+    configure_scan_heads(r);
+    connect(r);
+    start_scanning(r);
+    set_state(CONNECT_STATE_SCANNING, "scanning");
+  } catch (std::exception &e) {
+    std::lock_guard<std::mutex> lock(mutex);
+    status.state = CONNECT_STATE_FAILED;
+    status.message = e.what();
+    status.error = r;
+  }
+}
+
+void ScanConnector::create_scan_heads(int32_t &r)
+{
+  // First step is to create a scan manager to manage the scan heads.
+  scan_system = jsScanSystemCreate();
+  if (nullptr == scan_system) {
+    throw std::runtime_error("failed to create scan system");
+  }
+
+  // Create a scan head software object for each serial number passed in
+  // through the command line. We'll assign each one a unique ID starting at
+  // zero; we'll use this as an easy index for associating profile data with
+  // a given scan head. Creating a scan head changes the scan system, so this
+  // has to happen one scan head at a time, but it doesn't talk to the network
+  // and is quick.
+  for (uint32_t id = 0; id < serial_numbers.size(); id++) {
+    auto scan_head = jsScanSystemCreateScanHead(scan_system,
+                                                serial_numbers[id], id);
+    if (nullptr == scan_head) {
+      r = -1;
+      set_head_state(id, HEAD_STATE_FAILED);
+      throw std::runtime_error("failed to create scan head " +
+                               std::to_string(serial_numbers[id]));
+    }
+    scan_heads.emplace_back(scan_head);
+  }
+}
+
+/**
+ * @brief Applies a scan head's configuration and window.
+ *
+ * @return Zero on success, otherwise the negative `jsError` value of the
+ * first call that failed.
+ */
+static int32_t configure_scan_head(jsScanHead scan_head,
+                                   const HeadConfig &head)
+{
+  jsScanHeadConfiguration config = head.configuration;
+  int32_t r = jsScanHeadConfigure(scan_head, &config);
+  if (0 > r) {
+    return r;
+  }
+  r = jsScanHeadSetWindowRectangular(scan_head, head.window.top,
+                                     head.window.bottom, head.window.left,
+                                     head.window.right);
+  if (0 > r) {
+    return r;
+  }
+  // The scan heads report points in their own coordinates; alignment is
+  // applied by the application instead, so it can be changed live.
+  return jsScanHeadSetAlignment(scan_head, 0.0, 0.0, 0.0, false);
+}
+
+void ScanConnector::configure_scan_heads(int32_t &r)
+{
+  set_state(CONNECT_STATE_CONFIGURING, "configuring");
+
+  // Each scan head gets its settings from the configuration, by serial
+  // number. Configuring scan heads one after the other adds up with many of
+  // them, so they are all configured at the same time, each on its own
+  // thread; the client API allows this as long as every thread works on a
+  // different scan head.
+  std::vector<HeadConfig> configs;
+  std::vector<std::future<int32_t>> results;
+  for (auto serial : serial_numbers) {
+    configs.push_back(config.get_head(serial));
+  }
+  for (size_t id = 0; id < scan_heads.size(); id++) {
+    set_head_state(id, HEAD_STATE_CONFIGURING);
+    results.emplace_back(std::async(std::launch::async, configure_scan_head,
+                                    scan_heads[id], std::cref(configs[id])));
+  }
+  // Wait for all of them before reporting any failure, so that no thread
+  // is still using a scan head when we bail out.
+  for (size_t id = 0; id < results.size(); id++) {
+    int32_t result = results[id].get();
+    if (0 > result) {
+      set_head_state(id, HEAD_STATE_FAILED, result);
+      if (0 <= r) {
+        r = result;
+      }
+    } else {
+      set_head_state(id, HEAD_STATE_CONFIGURED);
+    }
+  }
+  if (0 > r) {
+    throw std::runtime_error("failed to configure scan heads");
+  }
+
+  // Keep track of how each scan head was set up, so that recordings can
+  // describe the system they came from.
+  for (uint32_t id = 0; id < configs.size(); id++) {
+    head_info.push_back(make_head_info(id, configs[id]));
+  }
+}
+
+void ScanConnector::connect(int32_t &r)
+{
+  const int32_t num_heads = static_cast<int32_t>(scan_heads.size());
+  for (uint32_t attempt = 1;; attempt++) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      status.state = CONNECT_STATE_CONNECTING;
+      status.attempt = attempt;
+      status.message = "connecting";
+      for (auto &head : status.heads) {
+        head.state = HEAD_STATE_CONNECTING;
+      }
+    }
+
+    // Now that the scan heads are configured, we'll connect to the heads. A
+    // negative result means something went wrong during the connection
+    // process itself and none of the scan heads are connected; otherwise it
+    // is the number of scan heads that did connect, and we can query the
+    // scan heads to determine which ones did.
+    r = jsScanSystemConnect(scan_system, kConnectTimeoutS);
+    int32_t connected = 0;
+    for (size_t id = 0; id < scan_heads.size(); id++) {
+      bool is_connected = (0 <= r) && jsScanHeadIsConnected(scan_heads[id]);
+      set_head_state(id, is_connected ? HEAD_STATE_CONNECTED :
+                                        HEAD_STATE_NOT_CONNECTED,
+                     is_connected ? 0 : r);
+      connected += is_connected ? 1 : 0;
+    }
+    if (num_heads == connected) {
+      r = 0;
+      return;
+    }
+
+    std::string message = std::to_string(connected) + " of " +
+                          std::to_string(num_heads) + " scan heads connected";
+    if (attempt >= max_attempts) {
+      throw std::runtime_error(message);
+    }
+
+    // The scan heads that did connect are disconnected again so that the
+    // next attempt starts over with the whole system.
+    if (0 < connected) {
+      jsScanSystemDisconnect(scan_system);
+    }
+    auto delay = kRetryDelay * attempt;
+    set_state(CONNECT_STATE_CONNECTING,
+              message + ", retrying in " + std::to_string(delay.count()) +
+                "s");
+    if (!wait_for(delay)) {
+      throw std::runtime_error("cancelled");
+    }
+  }
+}
+
+void ScanConnector::start_scanning(int32_t &r)
+{
+  // Once configured, we can then read the maximum scan rate supported by
+  // the scan system. This value depends on how all of the scan heads manged
+  // by the scan system are configured.
+  double max_scan_rate_hz = jsScanSystemGetMaxScanRate(scan_system);
+  if (max_scan_rate_hz <= 0.0) {
+    throw std::runtime_error("failed to read max scan rate");
+  }
+  if (config.scan_rate_hz > max_scan_rate_hz) {
+    throw std::runtime_error("scan rate " + std::to_string(config.scan_rate_hz) +
+                             " exceeds max scan rate of " +
+                             std::to_string(max_scan_rate_hz));
+  }
+
+  // To begin scanning on all of the scan heads, all we need to do is
+  // command the scan system to start scanning. This will cause all of the
+  // scan heads associated with it to begin scanning at the specified rate
+  // and data format.
+  r = jsScanSystemStartScanning(scan_system, config.scan_rate_hz,
+                                config.data_format);
+  if (0 > r) {
+    throw std::runtime_error("failed to start scanning");
+  }
+}
+
+const char *ScanConnector::get_state_name(ConnectState state)
+{
+  switch (state) {
+  case CONNECT_STATE_CONFIGURING:
+    return "configuring";
+  case CONNECT_STATE_CONNECTING:
+    return "connecting";
+  case CONNECT_STATE_SCANNING:
+    return "scanning";
+  case CONNECT_STATE_FAILED:
+    return "failed";
+  }
+  return "unknown";
+}
+
+const char *ScanConnector::get_state_name(HeadState state)
+{
+  switch (state) {
+  case HEAD_STATE_PENDING:
+    return "pending";
+  case HEAD_STATE_CONFIGURING:
+    return "configuring";
+  case HEAD_STATE_CONFIGURED:
+    return "configured";
+  case HEAD_STATE_CONNECTING:
+    return "connecting";
+  case HEAD_STATE_CONNECTED:
+    return "connected";
+  case HEAD_STATE_NOT_CONNECTED:
+    return "not connected";
+  case HEAD_STATE_FAILED:
+    return "failed";
+  }
+  return "unknown";
+}
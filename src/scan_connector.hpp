@@ -0,0 +1,167 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file scan_connector.hpp
+ * @brief Brings up a scan system in the background.
+ *
+ * Creating, configuring and connecting scan heads can take several seconds,
+ * more so with many of them, and used to hold up the GUI until it was done.
+ * The connector does all of it on its own thread instead, configuring every
+ * scan head at the same time, and reports its progress for the GUI to show
+ * as the window is already up. If only some of the scan heads connect, the
+ * connector disconnects and tries again rather than giving up.
+ */
+#ifndef SCAN_GUI_SCAN_CONNECTOR_HPP
+#define SCAN_GUI_SCAN_CONNECTOR_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "recording_format.hpp"
+#include "scan_config.hpp"
+
+enum ConnectState {
+  CONNECT_STATE_CONFIGURING = 0,
+  CONNECT_STATE_CONNECTING,
+  CONNECT_STATE_SCANNING,
+  CONNECT_STATE_FAILED,
+};
+
+enum HeadState {
+  HEAD_STATE_PENDING = 0,
+  HEAD_STATE_CONFIGURING,
+  HEAD_STATE_CONFIGURED,
+  HEAD_STATE_CONNECTING,
+  HEAD_STATE_CONNECTED,
+  HEAD_STATE_NOT_CONNECTED,
+  HEAD_STATE_FAILED,
+};
+
+class ScanConnector {
+public:
+  struct HeadStatus {
+    uint32_t serial = 0;
+    HeadState state = HEAD_STATE_PENDING;
+    // Negative `jsError` value of the call that failed, if any.
+    int32_t error = 0;
+  };
+
+  struct Status {
+    ConnectState state = CONNECT_STATE_CONFIGURING;
+    // Connection attempts made so far.
+    uint32_t attempt = 0;
+    std::string message;
+    int32_t error = 0;
+    // Indexed by scan head ID.
+    std::vector<HeadStatus> heads;
+  };
+
+  /**
+   * @param config Settings applied to the scan heads.
+   * @param serial_numbers Scan heads to connect to; each is given an ID
+   * matching its position.
+   * @param max_attempts Number of times connecting is tried before giving
+   * up.
+   */
+  ScanConnector(const ScanConfig &config,
+                const std::vector<uint32_t> &serial_numbers,
+                uint32_t max_attempts = 5);
+
+  /**
+   * @brief Cancels bringing up the scan system if it is still in progress,
+   * and frees it unless it was released.
+   */
+  ~ScanConnector();
+
+  ScanConnector(const ScanConnector &) = delete;
+  ScanConnector &operator=(const ScanConnector &) = delete;
+
+  void start();
+
+  /**
+   * @brief Copy of the current progress; any thread may call it.
+   */
+  Status get_status() const;
+
+  /**
+   * @brief The scan system, its scan heads and how they were set up. Only
+   * valid once the state has reached `CONNECT_STATE_SCANNING`.
+   */
+  jsScanSystem get_scan_system() const
+  {
+    return scan_system;
+  }
+
+  const std::vector<jsScanHead> &get_scan_heads() const
+  {
+    return scan_heads;
+  }
+
+  const std::vector<RecordingHeadHeader> &get_head_info() const
+  {
+    return head_info;
+  }
+
+  /**
+   * @brief Hands ownership of the scan system over to the caller, so that
+   * it keeps scanning after the connector is gone.
+   */
+  void release()
+  {
+    is_released = true;
+  }
+
+  static const char *get_state_name(ConnectState state);
+  static const char *get_state_name(HeadState state);
+
+private:
+  void run();
+  void create_scan_heads(int32_t &r);
+  void configure_scan_heads(int32_t &r);
+  void connect(int32_t &r);
+  void start_scanning(int32_t &r);
+  void set_state(ConnectState state, const std::string &message);
+  void set_head_state(size_t id, HeadState state, int32_t error = 0);
+  bool wait_for(std::chrono::milliseconds timeout);
+
+  const ScanConfig config;
+  const std::vector<uint32_t> serial_numbers;
+  const uint32_t max_attempts;
+  jsScanSystem scan_system = nullptr;
+  std::vector<jsScanHead> scan_heads;
+  std::vector<RecordingHeadHeader> head_info;
+  bool is_released = false;
+
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  Status status;
+  bool is_cancelled = false;
+  std::thread thread;
+};
+
+/**
+ * @brief Stops scanning, disconnects and frees a scan system, in that order,
+ * waiting at most `timeout` for the client API to get through it.
+ *
+ * Scan heads that are left scanning keep sending profiles until they notice
+ * nobody is listening, which holds up connecting to them again. Should the
+ * client API get stuck on the network, the rest of the shutdown carries on
+ * in the background rather than hold up the application.
+ *
+ * @return Whether the scan system was closed within the timeout.
+ */
+bool close_scan_system(jsScanSystem scan_system,
+                       std::chrono::milliseconds timeout =
+                         std::chrono::milliseconds(2000));
+
+#endif
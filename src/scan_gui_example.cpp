@@ -19,209 +19,1950 @@
 //#define MAHI_GUI_NO_CONSOLE
 #define MAHI_GUI_USE_DISCRETE_GPU
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
 #include <joescan_pinchot.h>
 #include <Mahi/Gui.hpp>
 #include <Mahi/Util.hpp>
 #include <implot.h>
+#include "profile_convert.hpp"
+#include "event_log.hpp"
+#include "frame_merger.hpp"
+#include "frame_pacer.hpp"
+#include "metrics.hpp"
+#include "point_decimator.hpp"
+#include "point_renderer.hpp"
+#include "profile_analytics.hpp"
+#include "profile_history.hpp"
+#include "profile_receiver.hpp"
+#include "profile_recorder.hpp"
+#include "profile_replay.hpp"
+#include "profile_shm.hpp"
+#include "profile_simulator.hpp"
+#include "profile_source.hpp"
+#include "region_filter.hpp"
+#include "scan_config.hpp"
+#include "scan_connector.hpp"
+#include "scan_server.hpp"
+#include "stream_client.hpp"
+#include "triple_buffer.hpp"
+#include "waterfall.hpp"
 
 using namespace mahi::gui;
 using namespace mahi::util;
 
 #define PI 3.14159265
 
+/**
+ * @brief Plot data for one camera of one scan head. The series is drawn
+ * straight out of the most recent profile its receiver published, or out of
+ * the most recent merged frame.
+ */
+struct ProfileSeries {
+  std::string label;
+  ImVec4 color;
+  uint32_t id = 0;
+  TripleBuffer<ProfileHandle> *latest = nullptr;
+  // The profile on screen.
+  ProfileHandle live;
+  // Color of the live points by brightness, when coloring by brightness.
+  uint32_t palette[kBrightnessLevels];
+  // Older profiles from this camera, drawn when persistence is enabled.
+  ProfileHistory history;
+};
+
+/**
+ * @brief Rolling view of a scan head's metrics, sampled periodically by the
+ * GUI for the metrics window.
+ */
+struct HeadMetricsView {
+  std::string label;
+  uint64_t last_received = 0;
+  uint64_t last_dropped = 0;
+  uint64_t last_points = 0;
+  double received_per_sec = 0.0;
+  double dropped_per_sec = 0.0;
+  double points_per_sec = 0.0;
+  Histogram::Summary read;
+  Histogram::Summary crop;
+  Histogram::Summary convert;
+  Histogram::Summary stages[kMaxTimedStages];
+  Histogram::Summary latency;
+  ScrollingSeries received_rate;
+  ScrollingSeries queue_depth;
+  ScrollingSeries latency_ms;
+};
+
+// Longest the client API may take to stop scanning and disconnect on exit.
+static const auto kShutdownTimeout = std::chrono::milliseconds(2000);
+
+// How often the metrics window samples new values.
+static const double kMetricsIntervalS = 0.5;
+
+// Number of profiles kept per camera for persistence mode; at 200 Hz this is
+// the last five seconds of data.
+static const uint32_t kHistoryDepth = 1000;
+// The history is drawn as this many layers of decreasing opacity by age.
+static const uint32_t kHistoryAlphaBands = 8;
+// Upper bound on the number of history points drawn per frame across all
+// series; older points are decimated to stay within it.
+static const uint32_t kHistoryPointBudget = 250000;
+// With level of detail enabled, up to this many history points are read per
+// frame and handed to the screen-space decimator.
+static const uint32_t kHistoryGatherLimit = 4 * kHistoryPointBudget;
+
+/**
+ * @brief ImPlot getter that reads points directly out of a `jsProfile`,
+ * scaling them to inches as they are plotted. Invalid points are returned as
+ * NaN, which ImPlot leaves undrawn.
+ */
+static ImPlotPoint profile_getter(void *data, int idx)
+{
+  const jsProfileData &p = static_cast<const jsProfile *>(data)->data[idx];
+  if ((JS_PROFILE_DATA_INVALID_XY == p.x) ||
+      (JS_PROFILE_DATA_INVALID_XY == p.y)) {
+    return ImPlotPoint(NAN, NAN);
+  }
+  return ImPlotPoint(p.x * kInchesPerUnit, p.y * kInchesPerUnit);
+}
+
+/**
+ * @brief What the application was asked to do on the command line.
+ */
+struct AppOptions {
+  // Serial numbers of the scan heads to connect to.
+  std::vector<uint32_t> serial_numbers;
+  // Scan system settings; see `scan_config.hpp`.
+  std::string config_path;
+  // Recording to play back instead of connecting to scan heads.
+  std::string replay_path;
+  double replay_speed = 1.0;
+  bool is_replay_max_speed = false;
+  bool is_replay_looping = false;
+  // Alignment of scan heads, by serial number.
+  std::map<uint32_t, HeadAlignment> alignments;
+  // Number of simulated scan heads to use instead of real ones.
+  uint32_t num_simulated_heads = 0;
+  // Server to view the profile stream of instead of scanning; see
+  // `scan_server.hpp`.
+  std::string connect_host;
+  uint16_t connect_port = kStreamDefaultPort;
+  // Shared memory to publish every profile to for other local processes;
+  // empty for none.
+  std::string shm_name;
+  // Frame rate cap; zero for none.
+  double max_fps = 60.0;
+};
+
 // Inherit from Application
 class MyApp : public Application {
 public:
-  double x_data[2][JS_PROFILE_DATA_LEN];
-  double y_data[2][JS_PROFILE_DATA_LEN];
-  int data_length[2] = {0};
+  // Indexed by `scan_head_id * kCamerasPerHead + camera`, using the unique
+  // IDs we assign to scan heads when creating them.
+  std::vector<ProfileSeries> series;
+  // Scratch space for gathering decimated history points into before plotting.
+  std::vector<float> history_x;
+  std::vector<float> history_y;
+  bool is_persistence_enabled = false;
+  int persistence_depth = static_cast<int>(kHistoryDepth);
+  // Thins the history out to what the plot can actually show.
+  PointDecimator decimator;
+  bool is_lod_enabled = true;
+  uint32_t lod_stride = 1;
+  // Draws points with OpenGL instead of ImPlot markers when enabled.
+  PointRenderer point_renderer;
+  bool is_gpu_points_enabled = false;
+  // Colors the live points on the GPU by their brightness.
+  bool is_brightness_color_enabled = false;
+  // Scans without brightness whenever nothing shows it, saving the bandwidth.
+  bool is_auto_data_format = false;
+  // Every scan head's profiles over time, one row per scan.
+  Waterfall waterfall;
+  bool is_waterfall_open = false;
 
+  ScanConfig scan_config;
+  std::vector<uint32_t> serial_numbers;
+  // Creates, configures and connects the scan heads in the background; it
+  // is done with once scanning has started.
+  std::unique_ptr<ScanConnector> connector;
+  ScanConnector::Status connect_status;
   jsScanSystem scan_system = nullptr;
   std::vector<jsScanHead> scan_heads;
-  jsProfile profile;
-  
+  jsDataFormat data_format = JS_DATA_FORMAT_XY_FULL_LM_FULL;
+  double scan_rate_hz = 200;
+  // Highest scan rate the scan heads allow with their current configuration.
+  double max_scan_rate_hz = 0.0;
+  // Data format and scan rate picked in the scan settings window; they only
+  // take effect once applied, since that restarts scanning.
+  int pending_data_format = JS_DATA_FORMAT_XY_FULL_LM_FULL;
+  float pending_scan_rate_hz = 200.0f;
+  std::string scan_settings_error;
+  std::string scan_settings_note;
+  // Set when the scan system couldn't be started again after stopping it
+  // to apply settings; the receivers stay paused until it is.
+  bool is_scan_stopped = false;
+  bool is_scan_settings_open = false;
+  // Serial, window and configuration of every scan head, indexed by ID; also
+  // written to the header of recording files.
+  std::vector<RecordingHeadHeader> head_info;
+  // When replaying, the recording and the clock its playback follows.
+  std::unique_ptr<RecordingReader> replay;
+  std::unique_ptr<ReplayClock> replay_clock;
+  float replay_speed = 1.0f;
+  // When simulating, the scan heads standing in for real ones.
+  std::unique_ptr<ProfileSimulator> simulator;
+  // When viewing a remote server, the stream the sources read from.
+  std::unique_ptr<StreamClient> stream;
+  // Alignment of every scan head, and the transform into the scan system's
+  // coordinate frame it works out to, indexed by ID.
+  std::vector<HeadAlignment> alignments;
+  std::vector<PointTransform> transforms;
+  // Alignments from the command line, by serial; these take precedence over
+  // the configuration.
+  std::map<uint32_t, HeadAlignment> alignment_overrides;
+  bool is_alignment_open = false;
+  // Where each receiver gets its profiles from, indexed by ID.
+  std::vector<std::unique_ptr<ProfileSource>> sources;
+  // One receiver thread per scan head drains profiles from its source
+  // continuously, independent of how long it takes to render a frame.
+  // Events from the receivers are collected here rather than printed, and
+  // shown in the diagnostics window. Declared ahead of the receivers so that
+  // it outlives them.
+  std::unique_ptr<EventLog> events;
+  std::vector<Event> recent_events;
+  bool is_diagnostics_open = false;
+  // Per scan head instrumentation, indexed by ID; also has to outlive the
+  // receivers that update it.
+  std::vector<std::unique_ptr<HeadMetrics>> head_metrics;
+  std::vector<HeadMetricsView> head_metrics_views;
+  Histogram plot_time_ns;
+  Histogram::Summary plot_time;
+  ScrollingSeries plot_time_p50_ms;
+  ScrollingSeries plot_time_p99_ms;
+  uint64_t start_ns = get_time_ns();
+  uint64_t last_metrics_ns = 0;
+  bool is_metrics_open = false;
+  // Writes every profile to disk while recording. The receivers feed it
+  // directly, so it too has to outlive them.
+  std::unique_ptr<ProfileRecorder> recorder;
+  bool is_unbuffered_recording = true;
+  bool is_compressed_recording = false;
+  std::string recording_error;
+  // Statistics computed over every profile on the receiver threads, and the
+  // latest results of each scan head, indexed by ID.
+  std::unique_ptr<ProfileAnalytics> analytics;
+  std::vector<HeadAnalytics> head_analytics;
+  // Throws out the points outside the region of interest on the receiver
+  // threads, before anything else sees them. The region is picked by
+  // dragging a query rectangle on the plot.
+  std::unique_ptr<RegionFilter> crop;
+  bool is_plot_queried = false;
+  ImPlotLimits plot_query;
+  // Narrows the scan windows down to the region as well, so the scan heads
+  // don't send what gets thrown out anyway.
+  bool is_window_narrowing = false;
+  std::string crop_error;
+  // Hands every profile to other processes on this machine, as another
+  // receiver stage.
+  std::string shm_name;
+  std::unique_ptr<ShmPublisher> shm;
+  bool is_analytics_overlay_enabled = true;
+  // Holds off drawing frames until there is something new to show; it too
+  // runs as a receiver stage.
+  FramePacer pacer;
+  uint64_t last_frame_count = 0;
+  double frames_per_sec = 0.0;
+  std::vector<std::unique_ptr<ProfileReceiver>> receivers;
+  // Groups the profiles of all scan heads by scan, so that the live view
+  // only shows profiles taken together. Declared after the receivers, since
+  // it holds on to profiles from their pools; it has to be gone before they
+  // are.
+  std::unique_ptr<FrameMerger> merger;
+  bool is_frame_merge_enabled = false;
+  uint64_t last_frames_merged = 0;
+  uint64_t last_frames_slow = 0;
+  double frames_merged_per_sec = 0.0;
+  // Share of the scans merged in the last interval that waited longer than
+  // a scan period.
+  double merge_slow_percent = 0.0;
+  uint32_t merge_depth = 0;
+  Histogram::Summary merge_wait;
+  // Why the scan system couldn't be brought up, shown in place of the plot.
+  std::string startup_error;
 
   // 640x480 px window
-  MyApp(std::vector<uint32_t> &serial_numbers) : Application() {
-    int32_t r = 0;
+  MyApp(const AppOptions &options) : Application() {
 
       
     ImGui::StyleColorsMahiDark3();
+    // Frames are paced by the application rather than by vsync.
+    set_vsync(false);
+    pacer.set_max_fps(options.max_fps);
     try {
-      // First step is to create a scan manager to manage the scan heads.
-      scan_system = jsScanSystemCreate();
-      if (nullptr == scan_system) {
-        throw std::runtime_error("failed to create scan system");
-      }
-
-      // Create a scan head software object for each serial number passed in
-      // through the command line. We'll assign each one a unique ID starting at
-      // zero; we'll use this as an easy index for associating profile data with
-      // a given scan head.
-      int32_t id = 0;
-      for (auto serial : serial_numbers) {
-        auto scan_head = jsScanSystemCreateScanHead(scan_system, serial, id);
-        if (nullptr == scan_head) {
-          throw std::runtime_error("failed to create scan_head");
+      // Without a configuration file, every scan head named on the command
+      // line gets the example's built in settings.
+      scan_config = options.config_path.empty() ?
+        get_default_scan_config(options.serial_numbers) :
+        load_scan_config(options.config_path);
+      alignment_overrides = options.alignments;
+      shm_name = options.shm_name;
+      serial_numbers = options.serial_numbers;
+      if (serial_numbers.empty()) {
+        for (auto &head : scan_config.heads) {
+          serial_numbers.push_back(head.serial);
+        }
+      }
+
+      if (0 < options.num_simulated_heads) {
+        start_simulator(options.num_simulated_heads);
+        start_pipeline();
+      } else if (!options.connect_host.empty()) {
+        open_stream(options);
+        start_pipeline();
+      } else if (options.replay_path.empty()) {
+        // The scan heads are brought up in the background so that the window
+        // appears right away; `update_connection` picks them up once they
+        // are scanning.
+        scan_rate_hz = scan_config.scan_rate_hz;
+        data_format = scan_config.data_format;
+        connect();
+      } else {
+        open_replay(options);
+        start_pipeline();
+      }
+    } catch (std::exception &e) {
+      // Rather than render whatever got set up before the failure, the
+      // window only shows what went wrong.
+      std::cout << "ERROR: " << e.what() << std::endl;
+      startup_error = e.what();
+      stop_pipeline();
+    }
+  }
+
+  /**
+   * @brief Shuts down in order: the receivers and the recording first, so
+   * that every profile they buffered is written, then the scan system, so
+   * that the scan heads stop sending and are ready for the next run.
+   */
+  ~MyApp()
+  {
+    stop_pipeline();
+    // Cancels bringing the scan system up, if that is still going on.
+    connector.reset();
+    if (nullptr != scan_system) {
+      bool is_closed = close_scan_system(scan_system, kShutdownTimeout);
+      scan_system = nullptr;
+      if (!is_closed) {
+        std::cout << "timed out stopping the scan heads" << std::endl;
+      }
+    }
+  }
+
+  /**
+   * @brief Stops every receiver and lets go of all the profiles held on to
+   * outside of them, while their pools are still around.
+   */
+  void stop_pipeline()
+  {
+    // Finish the recording while the receivers are still around to hand over
+    // the profiles they have buffered.
+    if (nullptr != recorder) {
+      recorder->stop();
+    }
+    for (auto &receiver : receivers) {
+      receiver->stop();
+    }
+    merger.reset();
+    for (auto &s : series) {
+      s.live.reset();
+    }
+  }
+
+  /**
+   * @brief Starts bringing up the scan system in the background.
+   */
+  void connect()
+  {
+    connector = std::make_unique<ScanConnector>(scan_config, serial_numbers);
+    connector->start();
+    connect_status = connector->get_status();
+  }
+
+  /**
+   * @brief Checks on the connector, and once the scan heads are scanning,
+   * takes them over and starts receiving their profiles.
+   */
+  void update_connection()
+  {
+    if (nullptr == connector) {
+      return;
+    }
+    connect_status = connector->get_status();
+    if (CONNECT_STATE_SCANNING != connect_status.state) {
+      return;
+    }
+
+    scan_system = connector->get_scan_system();
+    scan_heads = connector->get_scan_heads();
+    head_info = connector->get_head_info();
+    connector->release();
+    connector.reset();
+    max_scan_rate_hz = jsScanSystemGetMaxScanRate(scan_system);
+    pending_data_format = data_format;
+    pending_scan_rate_hz = static_cast<float>(scan_rate_hz);
+    std::cout << "scanning at " << scan_rate_hz << " Hz, "
+              << get_data_format_name(data_format) << std::endl;
+    std::cout << "profile conversion uses "
+              << get_convert_kernel_name(get_convert_kernel()) << std::endl;
+
+    // Each scan head's profiles are read through the client API.
+    for (auto scan_head : scan_heads) {
+      sources.emplace_back(std::make_unique<ScanHeadSource>(scan_head));
+    }
+    start_pipeline();
+  }
+
+  /**
+   * @brief Shows how far along bringing up the scan system is, per scan
+   * head, along with any errors.
+   */
+  void show_connection_status()
+  {
+    const ScanConnector::Status &s = connect_status;
+    ImGui::Text("%s (attempt %u): %s",
+                ScanConnector::get_state_name(s.state), s.attempt,
+                s.message.c_str());
+    for (auto &head : s.heads) {
+      const char *err_str = "";
+      if (0 > head.error) {
+        jsGetError(head.error, &err_str);
+      }
+      ImGui::Text("  %u: %s %s", head.serial,
+                  ScanConnector::get_state_name(head.state), err_str);
+    }
+    if (CONNECT_STATE_FAILED == s.state) {
+      if (0 > s.error) {
+        const char *err_str = nullptr;
+        jsGetError(s.error, &err_str);
+        ImGui::Text("jsError (%d): %s", s.error, err_str);
+      }
+      if (ImGui::Button("Retry")) {
+        connector.reset();
+        connect();
+      }
+    }
+  }
+
+  /**
+   * @brief Lists every scan head that isn't delivering profiles, along with
+   * the error it last reported.
+   */
+  void show_head_health()
+  {
+    for (auto &receiver : receivers) {
+      HeadHealth health = receiver->get_health();
+      if (HEAD_HEALTH_OK == health) {
+        continue;
+      }
+      uint32_t id = receiver->get_source().get_id();
+      const char *err_str = "";
+      int32_t error = receiver->get_last_error();
+      if ((0 > error) && (HEAD_HEALTH_STALLED != health)) {
+        jsGetError(error, &err_str);
+      }
+      ImGui::Text("Scan head %u: %s %s", head_info[id].serial,
+                  ProfileReceiver::get_health_name(health), err_str);
+    }
+  }
+
+  /**
+   * @brief Sets up alignment, plotting and instrumentation for the scan
+   * heads in `head_info`, then starts receiving from `sources`.
+   */
+  void start_pipeline()
+  {
+    alignments.resize(head_info.size());
+    transforms.resize(head_info.size());
+    for (uint32_t id = 0; id < head_info.size(); id++) {
+      uint32_t serial = head_info[id].serial;
+      alignments[id] = scan_config.get_head(serial).alignment;
+      auto it = alignment_overrides.find(serial);
+      if (alignment_overrides.end() != it) {
+        alignments[id] = it->second;
+      }
+      update_transform(id);
+    }
+    start_receivers();
+  }
+
+  /**
+   * @brief Starts simulated scan heads in place of live ones, at the scan
+   * rate and data format of the configuration. Each gets a source that
+   * generates its profiles.
+   *
+   * @throws std::runtime_error if the simulator doesn't accept the scan rate
+   * or data format.
+   */
+  void start_simulator(uint32_t num_heads)
+  {
+    simulator = std::make_unique<ProfileSimulator>(num_heads);
+    max_scan_rate_hz = simulator->get_max_scan_rate();
+    scan_rate_hz = std::min(scan_config.scan_rate_hz, max_scan_rate_hz);
+    data_format = scan_config.data_format;
+    if (0 > simulator->start_scanning(scan_rate_hz, data_format)) {
+      throw std::runtime_error("failed to start simulator");
+    }
+    pending_data_format = data_format;
+    pending_scan_rate_hz = static_cast<float>(scan_rate_hz);
+    std::cout << "simulating " << num_heads << " scan heads at "
+              << scan_rate_hz << " Hz, " << get_data_format_name(data_format)
+              << std::endl;
+
+    for (uint32_t id = 0; id < num_heads; id++) {
+      uint32_t serial = kSimulatedSerialBase + id;
+      HeadConfig head = scan_config.get_head(serial);
+      // Unless the configuration says otherwise, line the scan heads up the
+      // way the simulator placed them around the log.
+      bool is_listed = std::any_of(
+        scan_config.heads.begin(), scan_config.heads.end(),
+        [serial](const HeadConfig &h) { return serial == h.serial; });
+      if (!is_listed) {
+        head.alignment.roll_deg = static_cast<float>(simulator->get_roll_deg(id));
+        scan_config.heads.push_back(head);
+      }
+      head_info.push_back(make_head_info(id, head));
+      sources.emplace_back(std::make_unique<SimulatedSource>(*simulator, id));
+    }
+  }
+
+  /**
+   * @brief Connects to a server to view its profiles in place of live scan
+   * heads. Each scan head of the server gets a source reading the stream.
+   *
+   * @throws std::runtime_error if the server can't be reached.
+   */
+  void open_stream(const AppOptions &options)
+  {
+    stream = std::make_unique<StreamClient>(options.connect_host,
+                                            options.connect_port);
+    const StreamHeader &header = stream->get_header();
+    data_format = static_cast<jsDataFormat>(header.data_format);
+    scan_rate_hz = header.scan_rate_hz;
+    head_info = stream->get_heads();
+    std::cout << "viewing " << head_info.size() << " scan heads from "
+              << options.connect_host << ":" << options.connect_port
+              << ", every " << header.point_stride << " points" << std::endl;
+
+    for (auto &head : head_info) {
+      sources.emplace_back(std::make_unique<StreamSource>(*stream, head.id));
+    }
+    stream->start();
+  }
+
+  /**
+   * @brief Opens a recording to play back in place of live scan heads. Each
+   * scan head in the recording gets a source that replays its profiles.
+   *
+   * @throws std::runtime_error if the recording can't be opened.
+   */
+  void open_replay(const AppOptions &options)
+  {
+    replay = std::make_unique<RecordingReader>(options.replay_path);
+    const RecordingFileHeader &header = replay->get_header();
+    data_format = static_cast<jsDataFormat>(header.data_format);
+    scan_rate_hz = header.scan_rate_hz;
+    std::cout << "replaying " << replay->get_profile_count()
+              << " profiles from " << options.replay_path << std::endl;
+
+    replay_clock = std::make_unique<ReplayClock>(
+      replay->get_first_timestamp_ns(), replay->get_last_timestamp_ns());
+    replay_speed = static_cast<float>(options.replay_speed);
+    replay_clock->set_speed(options.replay_speed);
+    replay_clock->set_max_speed(options.is_replay_max_speed);
+    replay_clock->set_looping(options.is_replay_looping);
+
+    for (auto &head : replay->get_heads()) {
+      if (head_info.size() <= head.id) {
+        head_info.resize(head.id + 1);
+      }
+      head_info[head.id] = head;
+    }
+    for (auto &head : replay->get_heads()) {
+      sources.emplace_back(std::make_unique<ReplaySource>(
+        *replay, *replay_clock, head.id));
+    }
+  }
+
+  /**
+   * @brief Sets up plotting and instrumentation for every scan head, then
+   * spins up a receiver thread for each source.
+   */
+  void start_receivers()
+  {
+    // Set up a plot series for every camera of every scan head up front so
+    // that nothing is allocated while rendering frames.
+    uint32_t num_heads = static_cast<uint32_t>(head_info.size());
+    series.resize(num_heads * kCamerasPerHead);
+    for (uint32_t id = 0; id < num_heads; id++) {
+      for (uint32_t camera = 0; camera < kCamerasPerHead; camera++) {
+        auto &s = series[id * kCamerasPerHead + camera];
+        s.label = std::to_string(head_info[id].serial) + " Camera " +
+                  std::to_string(camera + 1);
+        s.color = series_color(id, camera);
+        make_brightness_palette(s.color, s.palette);
+        s.id = id;
+      }
+    }
+    resize_histories();
+    history_x.resize(kHistoryGatherLimit);
+    history_y.resize(kHistoryGatherLimit);
+    waterfall.resize(num_heads);
+    for (uint32_t id = 0; id < num_heads; id++) {
+      const RecordingHeadHeader &head = head_info[id];
+      waterfall.set_range(id, head.window_left, head.window_right,
+                          head.window_bottom, head.window_top);
+    }
+
+    // With scanning started, spin up a receiver thread for each scan head.
+    // From here on the GUI only ever reads profiles out of the receivers.
+    events = std::make_unique<EventLog>(num_heads);
+    for (uint32_t n = 0; n < num_heads; n++) {
+      head_metrics.emplace_back(std::make_unique<HeadMetrics>());
+    }
+    head_metrics_views.resize(num_heads);
+    recorder = std::make_unique<ProfileRecorder>(num_heads);
+    analytics = std::make_unique<ProfileAnalytics>(num_heads);
+    head_analytics.resize(num_heads);
+    for (uint32_t id = 0; id < num_heads; id++) {
+      head_metrics_views[id].label = std::to_string(head_info[id].serial);
+    }
+    if (!shm_name.empty()) {
+      try {
+        shm = std::make_unique<ShmPublisher>(shm_name, data_format,
+                                             scan_rate_hz, head_info);
+        std::cout << "publishing profiles to shared memory " << shm_name
+                  << std::endl;
+      } catch (std::exception &e) {
+        std::cout << "ERROR: " << e.what() << std::endl;
+      }
+    }
+    crop = std::make_unique<RegionFilter>(num_heads);
+    for (uint32_t id = 0; id < num_heads; id++) {
+      crop->set_transform(id, transforms[id]);
+    }
+    merger = std::make_unique<FrameMerger>(
+      num_heads, scan_rate_hz, BatchReadConfig().max_batch);
+    merger->set_enabled(is_frame_merge_enabled);
+    // On top of what the merger holds, every series keeps its live profile.
+    uint32_t held_profiles = merger->get_held_profiles() + kCamerasPerHead;
+    for (auto &source : sources) {
+      uint32_t id = source->get_id();
+      receivers.emplace_back(std::make_unique<ProfileReceiver>(
+        *source, *events, *head_metrics[id], BatchReadConfig(), 256,
+        held_profiles));
+      receivers.back()->set_recorder(recorder.get());
+      receivers.back()->set_filter(crop.get());
+      receivers.back()->set_merger(merger.get());
+      receivers.back()->add_stage(analytics.get());
+      receivers.back()->add_stage(&pacer);
+      if (nullptr != shm) {
+        receivers.back()->add_stage(shm.get());
+      }
+      for (uint32_t camera = 0; camera < kCamerasPerHead; camera++) {
+        auto &s = series[id * kCamerasPerHead + camera];
+        s.latest = &receivers.back()->get_latest(camera);
+      }
+      receivers.back()->start();
+    }
+  }
+    
+  /**
+   * @brief Picks a distinct hue for each scan head, with the second camera
+   * drawn in a darker shade of the same hue.
+   */
+  static ImVec4 series_color(uint32_t id, uint32_t camera)
+  {
+    static const ImVec4 palette[] = {
+      ImVec4(0.0f, 1.0f, 0.0f, 1.0f), ImVec4(0.0f, 0.6f, 1.0f, 1.0f),
+      ImVec4(1.0f, 0.5f, 0.0f, 1.0f), ImVec4(1.0f, 0.0f, 0.8f, 1.0f),
+      ImVec4(1.0f, 1.0f, 0.0f, 1.0f), ImVec4(0.0f, 1.0f, 1.0f, 1.0f),
+      ImVec4(1.0f, 0.2f, 0.2f, 1.0f), ImVec4(0.7f, 0.5f, 1.0f, 1.0f)};
+    const size_t num_colors = sizeof(palette) / sizeof(palette[0]);
+    ImVec4 c = palette[id % num_colors];
+    float shade = (0 == camera) ? 1.0f : 0.6f;
+    return ImVec4(c.x * shade, c.y * shade, c.z * shade, 1.0f);
+  }
+
+  /**
+   * @brief Shades a series' color by brightness, from a fifth of it for the
+   * darkest points up to all of it for the brightest.
+   */
+  static void make_brightness_palette(const ImVec4 &c, uint32_t *palette)
+  {
+    for (uint32_t level = 0; level < kBrightnessLevels; level++) {
+      float shade = 0.2f + 0.8f * level / (kBrightnessLevels - 1);
+      palette[level] = ImGui::ColorConvertFloat4ToU32(
+        ImVec4(c.x * shade, c.y * shade, c.z * shade, 1.0f));
+    }
+  }
+
+  /**
+   * @brief Allocates the histories of the series while persistence is on and
+   * frees them while it is off; at full depth, each takes about 12 MB.
+   */
+  void resize_histories()
+  {
+    for (auto &s : series) {
+      s.history = is_persistence_enabled ? ProfileHistory(kHistoryDepth) :
+                                           ProfileHistory();
+    }
+  }
+
+  /**
+   * @brief Draws the persistence history of every series as a point cloud
+   * that fades with age. The number of points drawn per frame stays within
+   * budget regardless of the number of scan heads or the history depth. When
+   * drawing on the GPU, the budget is whatever room the point renderer has
+   * left after the live profiles.
+   *
+   * Without level of detail, the history is decimated by a uniform stride to
+   * fit the budget. With level of detail, more points are taken and passed
+   * through the screen-space decimator, which bounds the points drawn by the
+   * plot's resolution instead. The stride is then adjusted frame to frame so
+   * that roughly a budget's worth of points falls inside the view; zooming in
+   * culls more points, lowering the stride and bringing in finer detail.
+   */
+  void plot_history(bool use_gpu)
+  {
+    uint32_t budget = kHistoryPointBudget;
+    if (use_gpu) {
+      uint32_t live = static_cast<uint32_t>(series.size()) * JS_PROFILE_DATA_LEN;
+      uint32_t available = point_renderer.get_available();
+      budget = (available > live) ? available - live : 0;
+    }
+    if (0 == budget) {
+      return;
+    }
+
+    uint32_t depth = static_cast<uint32_t>(persistence_depth);
+    uint64_t total = 0;
+    for (auto &s : series) {
+      // Approximate the points within the chosen depth from the average
+      // profile length rather than walking every profile.
+      uint32_t size = s.history.size();
+      if (0 < size) {
+        total += s.history.get_point_count() * std::min(depth, size) / size;
+      }
+    }
+
+    uint32_t stride = static_cast<uint32_t>((total + budget - 1) / budget);
+    uint64_t gather_limit = budget;
+    if (is_lod_enabled) {
+      uint32_t min_stride = static_cast<uint32_t>(
+        (total + kHistoryGatherLimit - 1) / kHistoryGatherLimit);
+      stride = std::max(min_stride, std::min(lod_stride, stride));
+      gather_limit = kHistoryGatherLimit;
+
+      ImPlotLimits limits = ImPlot::GetPlotLimits();
+      ImVec2 size = ImPlot::GetPlotSize();
+      decimator.set_view(limits.X.Min, limits.X.Max, limits.Y.Min,
+                         limits.Y.Max, static_cast<uint32_t>(size.x),
+                         static_cast<uint32_t>(size.y));
+    }
+    stride = std::max<uint32_t>(1, stride);
+
+    uint64_t gathered = 0;
+    // Draw the oldest band first so newer profiles end up on top.
+    for (uint32_t band = kHistoryAlphaBands; band-- > 0;) {
+      // Skip age zero, that profile is drawn as the live view.
+      uint32_t first_age = 1 + band * depth / kHistoryAlphaBands;
+      uint32_t last_age = 1 + (band + 1) * depth / kHistoryAlphaBands;
+      float alpha = 0.6f * (1.0f - static_cast<float>(band) / kHistoryAlphaBands);
+
+      for (auto &s : series) {
+        uint32_t max_points = static_cast<uint32_t>(std::min<uint64_t>(
+          gather_limit - gathered, history_x.size()));
+        if (use_gpu) {
+          max_points = std::min(max_points, point_renderer.get_available());
         }
-        scan_heads.emplace_back(scan_head);
-        id++;
-      }
-
-      // For this example application, we'll just use the same configuration
-      // settings we made use of in the "Configure and Connect" example. The
-      // only real difference here is that we will be applying this configuration
-      // to multiple scan heads, using a "for" loop to configure each scan head
-      // one after the other.
-      jsScanHeadConfiguration config;
-      config.scan_offset_us = 0;
-      config.camera_exposure_time_min_us = 10000;
-      config.camera_exposure_time_def_us = 47000;
-      config.camera_exposure_time_max_us = 900000;
-      config.laser_on_time_min_us = 100;
-      config.laser_on_time_def_us = 100;
-      config.laser_on_time_max_us = 1000;
-      config.laser_detection_threshold = 120;
-      config.saturation_threshold = 800;
-      config.saturation_percentage = 30;
-
-      for (auto scan_head : scan_heads) {
-        r = jsScanHeadConfigure(scan_head, &config);
-        if (0 > r) {
-          throw std::runtime_error("failed to set scan head configuration");
+        if (0 == max_points) {
+          break;
         }
 
-        // To illustrate that each scan head can be configured independently,
-        // we'll alternate between two different windows for each scan head. The
-        // other options we will leave the same only for the sake of convenience;
-        // these can be independently configured as needed.
-        uint32_t serial = jsScanHeadGetSerial(scan_head);
-        uint32_t id = jsScanHeadGetId(scan_head);
-        if (id % 2) {
-          std::cout << serial << ": scan window is 20, -20, -20, 20" << std::endl;
-          r = jsScanHeadSetWindowRectangular(scan_head, 20.0, -20.0, -20.0, 20.0);
-        } else {
-          std::cout << serial << ": scan window is 30, -30, -30, 30" << std::endl;
-          r = jsScanHeadSetWindowRectangular(scan_head, 30.0, -30.0, -30.0, 30.0);
+        // Points go straight to their destination unless they still have to
+        // pass through the decimator first.
+        float *x_out = use_gpu ? point_renderer.get_x() : history_x.data();
+        float *y_out = use_gpu ? point_renderer.get_y() : history_y.data();
+        float *x_in = is_lod_enabled ? history_x.data() : x_out;
+        float *y_in = is_lod_enabled ? history_y.data() : y_out;
+        uint32_t n = s.history.gather(first_age, last_age, stride, x_in, y_in,
+                                      max_points);
+        transform_points(x_in, y_in, n, transforms[s.id]);
+        gathered += n;
+        if (is_lod_enabled) {
+          decimator.next_layer();
+          n = decimator.filter(x_in, y_in, n, x_out, y_out);
         }
-        if (0 > r) {
-          throw std::runtime_error("failed to set window");
+        if (0 == n) {
+          continue;
         }
 
-        r = jsScanHeadSetAlignment(scan_head, 0.0, 0.0, 0.0, false);
-        if (0 > r) {
-          throw std::runtime_error("failed to set alignment");
+        ImVec4 fill(s.color.x, s.color.y, s.color.z, alpha);
+        if (use_gpu) {
+          uint32_t *color = point_renderer.get_color();
+          std::fill(color, color + n, ImGui::ColorConvertFloat4ToU32(fill));
+          point_renderer.commit(n);
+        } else {
+          // Plot under the same label as the live series so they share a
+          // legend entry and can be hidden together.
+          ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, 1, fill, 0, fill);
+          ImPlot::PlotScatter(s.label.c_str(), history_x.data(), history_y.data(), static_cast<int>(n));
         }
       }
+    }
 
-      // Now that the scan heads are configured, we'll connect to the heads.
-      r = jsScanSystemConnect(scan_system, 10);
-      if (0 > r) {
-        // This error condition indicates that something wrong happened during
-        // the connection process itself and should be understood by extension
-        // that none of the scan heads are connected.
-        throw std::runtime_error("failed to connect");
-      } else if (jsScanSystemGetNumberScanHeads(scan_system) != r) {
-        // On this error condition, connection was successful to some of the scan
-        // heads in the system. We can query the scan heads to determine which
-        // one successfully connected and which ones failed.
-        for (auto scan_head : scan_heads) {
-          if (false == jsScanHeadIsConnected(scan_head)) {
-            uint32_t serial = jsScanHeadGetSerial(scan_head);
-            std::cout << serial << " is NOT connected" << std::endl;
-          }
+    if (is_lod_enabled) {
+      // Aim for about a budget's worth of points inside the view next frame.
+      uint64_t in_view = decimator.get_in_view_count();
+      uint64_t next = static_cast<uint64_t>(stride) * in_view / budget;
+      lod_stride = static_cast<uint32_t>(std::max<uint64_t>(1, next));
+    }
+  }
+
+  /**
+   * @brief A new profile is about to go on screen; measures how long it took
+   * to get here from when the scan head took it.
+   */
+  void record_latency(const ProfileSeries &s, uint64_t now_ns)
+  {
+    HeadMetrics &m = *head_metrics[s.id];
+    if (!s.live || !m.clock_offset_ns.is_valid()) {
+      return;
+    }
+    int64_t age = static_cast<int64_t>(now_ns) -
+                  static_cast<int64_t>(s.live->timestamp_ns);
+    int64_t latency = age - m.clock_offset_ns.get();
+    m.latency_ns.record((0 < latency) ? static_cast<uint64_t>(latency) : 0);
+  }
+
+  /**
+   * @brief Outlines the region profiles are cropped to, if any.
+   */
+  void plot_crop_region()
+  {
+    PointRegion r;
+    if ((nullptr == crop) || !crop->get_region(r)) {
+      return;
+    }
+    float xs[5] = {r.left, r.right, r.right, r.left, r.left};
+    float ys[5] = {r.bottom, r.bottom, r.top, r.top, r.bottom};
+    ImPlot::SetNextLineStyle(ImVec4(1.0f, 1.0f, 1.0f, 0.8f));
+    ImPlot::PlotLine("Crop", xs, ys, 5);
+  }
+
+  /**
+   * @brief Converts the live profile of a series into the point renderer's
+   * buffer, for drawing on the GPU.
+   */
+  void add_live_points(const ProfileSeries &s)
+  {
+    const ProfileHandle &profile = s.live;
+    if (!profile || (point_renderer.get_available() < JS_PROFILE_DATA_LEN)) {
+      return;
+    }
+    uint32_t *color = point_renderer.get_color();
+    uint32_t n = 0;
+    if (is_brightness_color_enabled) {
+      // The palette is applied as the points are converted.
+      n = convert_profile(*profile, point_renderer.get_x(),
+                          point_renderer.get_y(), color, s.palette);
+    } else {
+      n = convert_profile(*profile, point_renderer.get_x(),
+                          point_renderer.get_y());
+      std::fill(color, color + n, ImGui::ColorConvertFloat4ToU32(s.color));
+    }
+    transform_points(point_renderer.get_x(), point_renderer.get_y(), n,
+                     transforms[s.id]);
+    point_renderer.commit(n);
+  }
+
+  /**
+   * @brief Starts recording to a new file named after the current time, or
+   * stops the recording in progress.
+   */
+  void toggle_recording()
+  {
+    if (nullptr == recorder) {
+      return;
+    }
+    if (recorder->is_recording()) {
+      recorder->stop();
+      return;
+    }
+
+    char name[64];
+    std::time_t now = std::time(nullptr);
+    std::strftime(name, sizeof(name), "scan_%Y%m%d_%H%M%S.bin",
+                  std::localtime(&now));
+    // Compression costs CPU time, so it gets spread over a few writers.
+    RecordingOptions recording_options;
+    recording_options.is_unbuffered = is_unbuffered_recording;
+    recording_options.is_compressed = is_compressed_recording;
+    if (is_compressed_recording) {
+      recording_options.num_threads =
+        std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
+    }
+    try {
+      recorder->start(name, head_info, data_format, scan_rate_hz,
+                      recording_options);
+      recording_error.clear();
+    } catch (std::exception &e) {
+      recording_error = e.what();
+    }
+  }
+
+  /**
+   * @brief Shows the position in the recording being replayed, along with
+   * controls for seeking and the playback speed.
+   */
+  void show_replay_controls()
+  {
+    uint64_t first_ns = replay_clock->get_first_timestamp_ns();
+    uint64_t last_ns = replay_clock->get_last_timestamp_ns();
+    float duration_s = static_cast<float>((last_ns - first_ns) / 1.0e9);
+    float position_s =
+      static_cast<float>((replay_clock->get_position_ns() - first_ns) / 1.0e9);
+
+    ImGui::PushItemWidth(600);
+    if (ImGui::SliderFloat("Position [s]", &position_s, 0.0f, duration_s,
+                           "%.2f")) {
+      replay_clock->seek(first_ns + static_cast<uint64_t>(position_s * 1.0e9));
+      // Older profiles would only get mixed up with those after the seek.
+      for (auto &s : series) {
+        s.history.clear();
+      }
+    }
+    ImGui::PopItemWidth();
+
+    bool is_paused = replay_clock->is_paused();
+    if (ImGui::Checkbox("Pause", &is_paused)) {
+      replay_clock->set_paused(is_paused);
+    }
+    ImGui::SameLine();
+    bool is_looping = replay_clock->is_looping();
+    if (ImGui::Checkbox("Loop", &is_looping)) {
+      replay_clock->set_looping(is_looping);
+    }
+    ImGui::SameLine();
+    bool is_max_speed = replay_clock->is_max_speed();
+    if (ImGui::Checkbox("As Fast As Possible", &is_max_speed)) {
+      replay_clock->set_max_speed(is_max_speed);
+    }
+    if (!is_max_speed) {
+      ImGui::SameLine();
+      ImGui::PushItemWidth(200);
+      if (ImGui::SliderFloat("Speed", &replay_speed, 0.1f, 16.0f, "%.1fx")) {
+        replay_clock->set_speed(replay_speed);
+      }
+      ImGui::PopItemWidth();
+    }
+  }
+
+  /**
+   * @brief Shows the event counters of every scan head along with the most
+   * recent events.
+   */
+  void show_diagnostics()
+  {
+    ImGui::SetNextWindowSize(ImVec2(500, 400), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Diagnostics", &is_diagnostics_open)) {
+      ImGui::End();
+      return;
+    }
+    if (nullptr == events) {
+      ImGui::Text("Not scanning");
+      ImGui::End();
+      return;
+    }
+
+    bool is_console = events->is_console_output();
+    if (ImGui::Checkbox("Echo events to console", &is_console)) {
+      events->set_console_output(is_console);
+    }
+    ImGui::Separator();
+
+    ImGui::Columns(EVENT_TYPE_COUNT + 2, "counters");
+    ImGui::Text("Scan Head");
+    ImGui::NextColumn();
+    ImGui::Text("Health");
+    ImGui::NextColumn();
+    for (int t = 0; t < EVENT_TYPE_COUNT; t++) {
+      ImGui::TextUnformatted(EventLog::get_type_name(static_cast<EventType>(t)));
+      ImGui::NextColumn();
+    }
+    ImGui::Separator();
+    for (uint32_t id = 0; id < head_info.size(); id++) {
+      ImGui::Text("%u", head_info[id].serial);
+      ImGui::NextColumn();
+      for (auto &receiver : receivers) {
+        if (id == receiver->get_source().get_id()) {
+          ImGui::Text("%s, %u recoveries",
+                      ProfileReceiver::get_health_name(receiver->get_health()),
+                      receiver->get_recoveries());
         }
-        throw std::runtime_error("failed to connect to all scan heads");
-      }
-
-      // Once configured, we can then read the maximum scan rate supported by
-      // the scan system. This value depends on how all of the scan heads manged
-      // by the scan system are configured.
-      double max_scan_rate_hz = jsScanSystemGetMaxScanRate(scan_system);
-      if (max_scan_rate_hz <= 0.0) {
-        throw std::runtime_error("failed to read max scan rate");
-      }
-      std::cout << "max scan rate is " << max_scan_rate_hz << std::endl;
-
-      // To begin scanning on all of the scan heads, all we need to do is
-      // command the scan system to start scanning. This will cause all of the
-      // scan heads associated with it to begin scanning at the specified rate
-      // and data format.
-      jsDataFormat data_format = JS_DATA_FORMAT_XY_FULL_LM_FULL;
-      double scan_rate_hz = 200;
-      std::cout << "start scanning" << std::endl;
-      r = jsScanSystemStartScanning(scan_system, scan_rate_hz, data_format);
-      if (0 > r) {
-        throw std::runtime_error("failed to start scanning");
       }
-    } catch (std::exception &e) {
-      std::cout << "ERROR: " << e.what() << std::endl;
+      ImGui::NextColumn();
+      for (int t = 0; t < EVENT_TYPE_COUNT; t++) {
+        ImGui::Text("%llu", static_cast<unsigned long long>(
+                              events->get_count(id, static_cast<EventType>(t))));
+        ImGui::NextColumn();
+      }
+    }
+    ImGui::Columns(1);
+    ImGui::Separator();
+    if (nullptr != shm) {
+      ImGui::Text("Shared memory %s: %u readers, %llu profiles behind",
+                  shm->get_name().c_str(), shm->get_consumer_count(),
+                  static_cast<unsigned long long>(shm->get_max_lag()));
+      ImGui::Separator();
+    }
+
+    events->get_recent(recent_events);
+    uint64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+    ImGui::BeginChild("recent");
+    for (auto it = recent_events.rbegin(); it != recent_events.rend(); ++it) {
+      double age_s = (now_ns - it->time_ns) / 1.0e9;
+      uint32_t serial = (it->source < head_info.size()) ?
+                          head_info[it->source].serial : 0;
+      ImGui::Text("%8.2fs  %u: %s (%d)", -age_s, serial,
+                  EventLog::get_type_name(it->type), it->value);
+    }
+    ImGui::EndChild();
+    ImGui::End();
+  }
 
-      // If we end up with an error from the API, we can get some additional
-      // diagnostics by looking at the error code.
+  /**
+   * @brief Restarts scanning with the data format and scan rate picked in
+   * the scan settings window.
+   *
+   * The receivers are paused while the scan system stops and starts again,
+   * so nothing reads from the scan heads in between. Every buffer along the
+   * way is sized for a full resolution profile already, so a different data
+   * format needs no new allocations; a subsampled format just fills less of
+   * each profile. Only profiles in the old format are thrown out.
+   */
+  void apply_scan_settings()
+  {
+    pause_receivers();
+
+    auto get_error = [](int32_t error) {
+      const char *err_str = nullptr;
+      jsGetError(error, &err_str);
+      return "jsError (" + std::to_string(error) + "): " + err_str;
+    };
+    jsDataFormat format = static_cast<jsDataFormat>(pending_data_format);
+    double rate_hz = pending_scan_rate_hz;
+    int32_t r = 0;
+    if (nullptr != simulator) {
+      rate_hz = std::min(rate_hz, max_scan_rate_hz);
+      r = simulator->start_scanning(rate_hz, format);
       if (0 > r) {
-        const char *err_str = nullptr;
-        jsGetError(r, &err_str);
-        std::cout << "jsError (" << r << "): " << err_str << std::endl;
+        scan_settings_error = get_error(r);
       }
+    } else if (!is_scan_stopped &&
+               (0 > (r = jsScanSystemStopScanning(scan_system)))) {
+      scan_settings_error = get_error(r);
+    } else {
+      is_scan_stopped = true;
+      r = start_scanning(rate_hz, format);
+      if (0 > r) {
+        // Go back to what was working before rather than stop altogether.
+        double old_rate_hz = scan_rate_hz;
+        int32_t old_r = start_scanning(old_rate_hz, data_format);
+        scan_settings_error = get_error(r);
+        if (0 > old_r) {
+          scan_settings_error += "; going back to the previous settings "
+                                 "failed too, " +
+                                 get_error(old_r) + "; scanning stopped";
+        } else {
+          scan_rate_hz = old_rate_hz;
+        }
+      }
+    }
+    scan_settings_note.clear();
+    if (0 <= r) {
+      scan_settings_error.clear();
+      if (rate_hz < pending_scan_rate_hz) {
+        scan_settings_note = "Scan rate lowered to " +
+                             std::to_string(static_cast<int>(rate_hz)) +
+                             " Hz, the most the data format allows";
+      }
+      data_format = format;
+      scan_rate_hz = rate_hz;
+      scan_config.data_format = format;
+      scan_config.scan_rate_hz = rate_hz;
+      std::cout << "scanning at " << scan_rate_hz << " Hz, "
+                << get_data_format_name(data_format) << std::endl;
+    }
+    pending_data_format = data_format;
+    pending_scan_rate_hz = static_cast<float>(scan_rate_hz);
+    if (!is_scan_stopped) {
+      resume_receivers();
     }
   }
-    
+
+  /**
+   * @brief Starts the stopped scan system at no more than `rate_hz`, which
+   * is lowered to the highest rate the scan heads allow with `format`; a
+   * subsampled format allows a higher rate than full resolution.
+   *
+   * @return Zero or positive once scanning, negative `jsError` value
+   * otherwise.
+   */
+  int32_t start_scanning(double &rate_hz, jsDataFormat format)
+  {
+    rate_hz = std::min(rate_hz, jsScanSystemGetMaxScanRate(scan_system));
+    int32_t r = jsScanSystemStartScanning(scan_system, rate_hz, format);
+    if (0 > r) {
+      return r;
+    }
+    // The maximum read before starting still reflects the previous data
+    // format; with the new one applied, restart lower if it doesn't allow
+    // the rate asked for.
+    max_scan_rate_hz = jsScanSystemGetMaxScanRate(scan_system);
+    if ((0.0 < max_scan_rate_hz) && (max_scan_rate_hz < rate_hz)) {
+      rate_hz = max_scan_rate_hz;
+      if ((0 > (r = jsScanSystemStopScanning(scan_system))) ||
+          (0 > (r = jsScanSystemStartScanning(scan_system, rate_hz,
+                                              format)))) {
+        return r;
+      }
+    }
+    is_scan_stopped = false;
+    return r;
+  }
+
+  /**
+   * @brief Stops the receivers, so that nothing reads from the scan heads
+   * while scanning restarts.
+   */
+  void pause_receivers()
+  {
+    for (auto &receiver : receivers) {
+      receiver->stop();
+    }
+  }
+
+  /**
+   * @brief Throws out what was received before scanning restarted and starts
+   * the receivers again.
+   */
+  void resume_receivers()
+  {
+    for (auto &receiver : receivers) {
+      auto &ring = receiver->get_profiles();
+      ProfileHandle profile;
+      while (ring.try_pop(profile)) {
+      }
+    }
+    for (auto &s : series) {
+      s.history.clear();
+    }
+    waterfall.clear();
+    // Sequence numbers start over along with scanning.
+    if (nullptr != merger) {
+      merger->reset(scan_rate_hz);
+    }
+    for (auto &receiver : receivers) {
+      receiver->start();
+    }
+  }
+
+  /**
+   * @brief The part of a scan head's window the crop region covers, in the
+   * scan head's own coordinates. A scan head that is rolled sees the region
+   * at an angle, so the window is the rectangle enclosing it. A scan head
+   * that doesn't see the region at all keeps its whole window.
+   */
+  static HeadWindow narrow_window(const HeadWindow &window,
+                                  const PointRegion &region,
+                                  const PointTransform &transform)
+  {
+    PointTransform to_head = transform.inverse();
+    float xs[4] = {region.left, region.right, region.right, region.left};
+    float ys[4] = {region.bottom, region.bottom, region.top, region.top};
+    HeadWindow w;
+    w.left = w.bottom = HUGE_VAL;
+    w.right = w.top = -HUGE_VAL;
+    for (uint32_t k = 0; k < 4; k++) {
+      to_head.apply(xs[k], ys[k]);
+      w.left = std::min<double>(w.left, xs[k]);
+      w.right = std::max<double>(w.right, xs[k]);
+      w.bottom = std::min<double>(w.bottom, ys[k]);
+      w.top = std::max<double>(w.top, ys[k]);
+    }
+    w.left = std::max(w.left, window.left);
+    w.right = std::min(w.right, window.right);
+    w.bottom = std::max(w.bottom, window.bottom);
+    w.top = std::min(w.top, window.top);
+    if ((w.right <= w.left) || (w.top <= w.bottom)) {
+      return window;
+    }
+    return w;
+  }
+
+  /**
+   * @brief Restarts scanning with every scan head's window narrowed down to
+   * the crop region, or back to its configured window if there is no region
+   * or narrowing is off. A smaller window leaves the scan heads less to
+   * send, and may allow a higher scan rate; a wider one may need a lower
+   * rate, which the scan rate is lowered to. Like the scan settings, the
+   * windows can't change while recording, since the recording's header
+   * describes them.
+   */
+  void apply_scan_windows()
+  {
+    bool is_recording = (nullptr != recorder) && recorder->is_recording();
+    if ((nullptr == scan_system) || is_recording) {
+      return;
+    }
+    PointRegion region;
+    bool is_narrowed = is_window_narrowing && (nullptr != crop) &&
+                       crop->get_region(region);
+
+    pause_receivers();
+    int32_t r = 0;
+    if (!is_scan_stopped) {
+      r = jsScanSystemStopScanning(scan_system);
+    }
+    if (0 <= r) {
+      is_scan_stopped = true;
+      for (uint32_t id = 0; id < scan_heads.size(); id++) {
+        RecordingHeadHeader &head = head_info[id];
+        HeadWindow window = scan_config.get_head(head.serial).window;
+        if (is_narrowed) {
+          window = narrow_window(window, region, transforms[id]);
+        }
+        int32_t w = jsScanHeadSetWindowRectangular(
+          scan_heads[id], window.top, window.bottom, window.left,
+          window.right);
+        if (0 > w) {
+          r = w;
+          continue;
+        }
+        head.window_top = window.top;
+        head.window_bottom = window.bottom;
+        head.window_left = window.left;
+        head.window_right = window.right;
+        waterfall.set_range(id, head.window_left, head.window_right,
+                            head.window_bottom, head.window_top);
+      }
+      double rate_hz = scan_rate_hz;
+      int32_t started = start_scanning(rate_hz, data_format);
+      if ((0 <= started) && (rate_hz < scan_rate_hz)) {
+        scan_rate_hz = rate_hz;
+        scan_config.scan_rate_hz = rate_hz;
+        pending_scan_rate_hz = static_cast<float>(rate_hz);
+        std::cout << "scanning at " << scan_rate_hz << " Hz, "
+                  << get_data_format_name(data_format) << std::endl;
+      }
+      r = (0 > started) ? started : r;
+    }
+    if (0 > r) {
+      const char *err_str = nullptr;
+      jsGetError(r, &err_str);
+      crop_error = "jsError (" + std::to_string(r) + "): " + err_str;
+      if (is_scan_stopped) {
+        crop_error += "; scanning stopped";
+      }
+    } else {
+      crop_error.clear();
+    }
+    if (!is_scan_stopped) {
+      resume_receivers();
+    }
+  }
+
+  /**
+   * @brief Whether anything on screen shows the brightness of points.
+   */
+  bool is_brightness_shown() const
+  {
+    return (is_gpu_points_enabled && is_brightness_color_enabled) ||
+           (is_waterfall_open &&
+            (WATERFALL_MODE_BRIGHTNESS == waterfall.get_mode()));
+  }
+
+  /**
+   * @brief With the automatic data format, switches to the data format of
+   * the same resolution with or without brightness, depending on whether
+   * brightness is shown. Skipped while recording, since that can't change
+   * scan settings.
+   */
+  void update_data_format()
+  {
+    bool is_scanning = ((nullptr != scan_system) && !is_scan_stopped) ||
+                       (nullptr != simulator);
+    bool is_recording = (nullptr != recorder) && recorder->is_recording();
+    if (!is_auto_data_format || !is_scanning || is_recording) {
+      return;
+    }
+    jsDataFormat format = get_data_format(data_format, is_brightness_shown());
+    if (format == data_format) {
+      return;
+    }
+    pending_data_format = format;
+    pending_scan_rate_hz = static_cast<float>(scan_rate_hz);
+    apply_scan_settings();
+    // Rather than try again every frame, leave it to the user.
+    if (!scan_settings_error.empty()) {
+      is_auto_data_format = false;
+    }
+  }
+
+  /**
+   * @brief Lets the data format and scan rate be changed while scanning,
+   * trading resolution for throughput: subsampled formats allow higher scan
+   * rates for the same bandwidth.
+   */
+  void show_scan_settings()
+  {
+    if (!ImGui::Begin("Scan Settings", &is_scan_settings_open,
+                      ImGuiWindowFlags_AlwaysAutoResize)) {
+      ImGui::End();
+      return;
+    }
+    if ((nullptr == scan_system) && (nullptr == simulator)) {
+      ImGui::Text("Not scanning");
+      ImGui::End();
+      return;
+    }
+
+    ImGui::Text("Scanning at %.1f Hz, %s", scan_rate_hz,
+                get_data_format_name(data_format));
+    ImGui::Separator();
+    jsDataFormat pending = static_cast<jsDataFormat>(pending_data_format);
+    if (ImGui::BeginCombo("Data Format", get_data_format_name(pending))) {
+      for (uint32_t n = 0; n < get_data_format_count(); n++) {
+        jsDataFormat format = get_data_format(n);
+        if (ImGui::Selectable(get_data_format_name(format),
+                              format == pending)) {
+          pending_data_format = format;
+        }
+      }
+      ImGui::EndCombo();
+    }
+    ImGui::SliderFloat("Scan Rate [Hz]", &pending_scan_rate_hz, 1.0f,
+                       static_cast<float>(max_scan_rate_hz), "%.0f");
+
+    // The recording header describes a single data format and scan rate.
+    bool is_recording = (nullptr != recorder) && recorder->is_recording();
+    if (is_recording) {
+      ImGui::Text("Stop recording to change scan settings");
+    } else if (ImGui::Button("Apply")) {
+      apply_scan_settings();
+    }
+    if (!scan_settings_error.empty()) {
+      ImGui::Text("Failed: %s", scan_settings_error.c_str());
+    }
+    if (!scan_settings_note.empty()) {
+      ImGui::Text("%s", scan_settings_note.c_str());
+    }
+    ImGui::End();
+  }
+
+  /**
+   * @brief Shows every scan head's profiles over time side by side, the
+   * newest scan at the top. Profiles are only drawn into the waterfall while
+   * this window is open.
+   */
+  void show_waterfall()
+  {
+    if (!ImGui::Begin("Waterfall", &is_waterfall_open)) {
+      ImGui::End();
+      return;
+    }
+
+    int mode = waterfall.get_mode();
+    bool is_changed = ImGui::RadioButton("Height", &mode,
+                                         WATERFALL_MODE_HEIGHT);
+    ImGui::SameLine();
+    is_changed |= ImGui::RadioButton("Brightness", &mode,
+                                     WATERFALL_MODE_BRIGHTNESS);
+    if (is_changed) {
+      waterfall.set_mode(static_cast<WaterfallMode>(mode));
+    }
+    if ((WATERFALL_MODE_BRIGHTNESS == mode) && !has_brightness(data_format)) {
+      ImGui::SameLine();
+      ImGui::Text("(%s has no brightness)", get_data_format_name(data_format));
+    }
+    if (!waterfall.upload()) {
+      ImGui::Text("Failed to create waterfall textures");
+      ImGui::End();
+      return;
+    }
+
+    // One plot per scan head, sharing the width of the window.
+    uint32_t num_heads = static_cast<uint32_t>(head_info.size());
+    ImVec2 avail = ImGui::GetContentRegionAvail();
+    float spacing = ImGui::GetStyle().ItemSpacing.x;
+    float width = std::max(150.0f, (avail.x - spacing * (num_heads - 1)) /
+                                     std::max(num_heads, 1u));
+    float height = std::max(200.0f, avail.y);
+    double seconds = waterfall.get_depth() / scan_rate_hz;
+    for (uint32_t id = 0; id < num_heads; id++) {
+      if (0 < id) {
+        ImGui::SameLine();
+      }
+      std::string title = std::to_string(head_info[id].serial);
+      ImPlot::SetNextPlotLimits(waterfall.get_x_min(id), waterfall.get_x_max(id),
+                                -seconds, 0.0, ImGuiCond_Always);
+      if (ImPlot::BeginPlot(title.c_str(), "X [inches]",
+                            (0 == id) ? "Time [s]" : nullptr,
+                            ImVec2(width, height), ImPlotFlags_NoLegend)) {
+        waterfall.plot(id, scan_rate_hz);
+        ImPlot::EndPlot();
+      }
+    }
+    ImGui::End();
+  }
+
+  void update_transform(uint32_t id)
+  {
+    const HeadAlignment &a = alignments[id];
+    transforms[id] = make_alignment_transform(a.roll_deg, a.shift_x, a.shift_y,
+                                              a.is_cable_downstream);
+    if (nullptr != crop) {
+      crop->set_transform(id, transforms[id]);
+    }
+  }
+
+  /**
+   * @brief Lets the alignment of each scan head be adjusted while scanning.
+   * Everything is transformed as it is drawn, history included, so changes
+   * show up on the next frame.
+   */
+  void show_alignment()
+  {
+    if (!ImGui::Begin("Alignment", &is_alignment_open,
+                      ImGuiWindowFlags_AlwaysAutoResize)) {
+      ImGui::End();
+      return;
+    }
+
+    for (uint32_t id = 0; id < alignments.size(); id++) {
+      HeadAlignment &a = alignments[id];
+      bool is_changed = false;
+      ImGui::PushID(static_cast<int>(id));
+      ImGui::Text("Scan head %u", head_info[id].serial);
+      is_changed |= ImGui::SliderFloat("Roll [deg]", &a.roll_deg, -180.0f,
+                                       180.0f, "%.2f");
+      is_changed |= ImGui::DragFloat("Shift X [in]", &a.shift_x, 0.01f,
+                                     -100.0f, 100.0f, "%.3f");
+      is_changed |= ImGui::DragFloat("Shift Y [in]", &a.shift_y, 0.01f,
+                                     -100.0f, 100.0f, "%.3f");
+      is_changed |= ImGui::Checkbox("Cable Downstream",
+                                    &a.is_cable_downstream);
+      if (is_changed) {
+        update_transform(id);
+      }
+      ImGui::PopID();
+      ImGui::Separator();
+    }
+    ImGui::End();
+  }
+
+  /**
+   * @brief Marks the highest point each scan head currently sees, as found
+   * by the analytics stage.
+   */
+  void plot_highest_points()
+  {
+    for (size_t id = 0; id < head_analytics.size(); id++) {
+      const ProfileStats &stats = head_analytics[id].stats;
+      if (0 == stats.valid_count) {
+        continue;
+      }
+      float fx = static_cast<float>(stats.highest.x * kInchesPerUnit);
+      float fy = static_cast<float>(stats.highest.y * kInchesPerUnit);
+      transforms[id].apply(fx, fy);
+      double x = fx;
+      double y = fy;
+      std::string label = std::to_string(head_info[id].serial) + " Highest";
+      ImVec4 color = series_color(static_cast<uint32_t>(id), 0);
+      ImPlot::SetNextMarkerStyle(ImPlotMarker_Diamond, 6, color, 1.5f,
+                                 ImVec4(1, 1, 1, 1));
+      ImPlot::PlotScatter(label.c_str(), &x, &y, 1);
+      char text[32];
+      std::snprintf(text, sizeof(text), "%.3f", y);
+      ImPlot::PlotText(text, x, y, false, ImVec2(0, -12));
+    }
+  }
+
+  /**
+   * @brief Summarizes the metrics of every scan head every
+   * `kMetricsIntervalS`, adding the results to the rolling charts.
+   */
+  void sample_metrics()
+  {
+    uint64_t now_ns = get_time_ns();
+    double dt = (now_ns - last_metrics_ns) / 1.0e9;
+    if (dt < kMetricsIntervalS) {
+      return;
+    }
+    last_metrics_ns = now_ns;
+    float t = static_cast<float>((now_ns - start_ns) / 1.0e9);
+
+    for (size_t n = 0; n < head_metrics.size(); n++) {
+      HeadMetrics &m = *head_metrics[n];
+      HeadMetricsView &v = head_metrics_views[n];
+
+      uint64_t received = m.profiles_received.load();
+      uint64_t dropped = m.profiles_dropped.load();
+      uint64_t points = m.points_received.load();
+      v.received_per_sec = (received - v.last_received) / dt;
+      v.dropped_per_sec = (dropped - v.last_dropped) / dt;
+      v.points_per_sec = (points - v.last_points) / dt;
+      v.last_received = received;
+      v.last_dropped = dropped;
+      v.last_points = points;
+      v.read = m.read_time_ns.take_interval();
+      v.crop = m.crop_time_ns.take_interval();
+      v.convert = m.convert_time_ns.take_interval();
+      for (uint32_t k = 0; k < kMaxTimedStages; k++) {
+        v.stages[k] = m.stage_time_ns[k].take_interval();
+      }
+      v.latency = m.latency_ns.take_interval();
+
+      v.received_rate.add(t, static_cast<float>(v.received_per_sec));
+      v.queue_depth.add(t, static_cast<float>(m.queue_depth.load()));
+      v.latency_ms.add(t, static_cast<float>(v.latency.p50 / 1.0e6));
+    }
+
+    uint64_t frames = pacer.get_frame_count();
+    frames_per_sec = (frames - last_frame_count) / dt;
+    last_frame_count = frames;
+    if (nullptr != merger) {
+      uint64_t merged = merger->get_frames_merged();
+      uint64_t slow = merger->get_frames_slow();
+      frames_merged_per_sec = (merged - last_frames_merged) / dt;
+      merge_slow_percent = (merged > last_frames_merged) ?
+                             100.0 * (slow - last_frames_slow) /
+                               (merged - last_frames_merged) :
+                             0.0;
+      last_frames_merged = merged;
+      last_frames_slow = slow;
+      merge_depth = merger->take_max_depth();
+      merge_wait = merger->wait_time_ns.take_interval();
+    }
+    plot_time = plot_time_ns.take_interval();
+    plot_time_p50_ms.add(t, static_cast<float>(plot_time.p50 / 1.0e6));
+    plot_time_p99_ms.add(t, static_cast<float>(plot_time.p99 / 1.0e6));
+  }
+
+  /**
+   * @brief Shows throughput and timing of each scan head, along with rolling
+   * charts of how they change over time.
+   */
+  void show_metrics()
+  {
+    ImGui::SetNextWindowSize(ImVec2(600, 800), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Metrics", &is_metrics_open)) {
+      ImGui::End();
+      return;
+    }
+
+    auto us = [](uint64_t ns) { return ns / 1.0e3; };
+    auto show_timing = [&](const char *name, const Histogram::Summary &h) {
+      ImGui::Text("  %-7s p50 %7.1f us  p99 %7.1f us  max %7.1f us", name,
+                  us(h.p50), us(h.p99), us(h.max));
+    };
+    // Every receiver runs the same stages.
+    size_t num_stages = 0;
+    if (!receivers.empty()) {
+      num_stages = std::min<size_t>(receivers.front()->get_stages().size(),
+                                    kMaxTimedStages);
+    }
+    ImGui::Text("Scanning at %.1f Hz, %s", scan_rate_hz,
+                get_data_format_name(data_format));
+    ImGui::Separator();
+    for (size_t n = 0; n < head_metrics_views.size(); n++) {
+      const HeadMetricsView &v = head_metrics_views[n];
+      ImGui::Text("Scan head %s", v.label.c_str());
+      ImGui::Text("  %.1f profiles/s received, %.1f/s dropped, %d queued",
+                  v.received_per_sec, v.dropped_per_sec,
+                  head_metrics[n]->queue_depth.load());
+      ImGui::Text("  %.0f points/s, %.0f points/profile", v.points_per_sec,
+                  (0.0 < v.received_per_sec) ?
+                    v.points_per_sec / v.received_per_sec : 0.0);
+      show_timing("read", v.read);
+      show_timing("crop", v.crop);
+      show_timing("convert", v.convert);
+      for (size_t k = 0; k < num_stages; k++) {
+        show_timing(receivers.front()->get_stages()[k]->get_stage_name(),
+                    v.stages[k]);
+      }
+      const ProfileStats &stats = head_analytics[n].stats;
+      if (0 < stats.valid_count) {
+        ImGui::Text("  X %.3f to %.3f in, Y %.3f to %.3f in, %u points",
+                    stats.min_x * kInchesPerUnit, stats.max_x * kInchesPerUnit,
+                    stats.min_y * kInchesPerUnit, stats.max_y * kInchesPerUnit,
+                    stats.valid_count);
+        ImGui::Text("  brightness mean %.1f, %d to %d",
+                    stats.get_mean_brightness(), stats.min_brightness,
+                    stats.max_brightness);
+      }
+      ImGui::Text("  latency p50 %7.2f ms  p99 %7.2f ms  max %7.2f ms",
+                  v.latency.p50 / 1.0e6, v.latency.p99 / 1.0e6,
+                  v.latency.max / 1.0e6);
+    }
+    ImGui::Separator();
+    ImGui::Text("plot    p50 %7.2f ms  p99 %7.2f ms  max %7.2f ms",
+                plot_time.p50 / 1.0e6, plot_time.p99 / 1.0e6,
+                plot_time.max / 1.0e6);
+    ImGui::Text("%.1f frames/s", frames_per_sec);
+    if ((nullptr != merger) && merger->get_enabled()) {
+      ImGui::Text("%.1f scans/s merged, %llu incomplete, %llu late profiles",
+                  frames_merged_per_sec,
+                  static_cast<unsigned long long>(
+                    merger->get_frames_incomplete()),
+                  static_cast<unsigned long long>(
+                    merger->get_profiles_late()));
+      ImGui::Text("merge   p50 %7.2f ms  p99 %7.2f ms  max %7.2f ms, "
+                  "up to %u scans waiting",
+                  merge_wait.p50 / 1.0e6, merge_wait.p99 / 1.0e6,
+                  merge_wait.max / 1.0e6, merge_depth);
+      ImGui::Text("%.1f%% of scans waited longer than a scan period",
+                  merge_slow_percent);
+    }
+    ImGui::Text("latency is measured above the lowest transport delay seen");
+
+    float t = static_cast<float>((get_time_ns() - start_ns) / 1.0e9);
+    const ImVec2 size(-1, 180);
+    ImPlot::SetNextPlotLimitsX(t - 60.0, t, ImGuiCond_Always);
+    if (ImPlot::BeginPlot("Profiles/s", nullptr, nullptr, size, 0, 0,
+                          ImPlotAxisFlags_AutoFit)) {
+      for (size_t n = 0; n < head_metrics_views.size(); n++) {
+        const ScrollingSeries &r = head_metrics_views[n].received_rate;
+        ImPlot::PlotLine(head_metrics_views[n].label.c_str(), r.get_time(), r.get_value(), r.get_size(), r.get_offset());
+      }
+      ImPlot::EndPlot();
+    }
+    ImPlot::SetNextPlotLimitsX(t - 60.0, t, ImGuiCond_Always);
+    if (ImPlot::BeginPlot("Queue Depth", nullptr, nullptr, size, 0, 0,
+                          ImPlotAxisFlags_AutoFit)) {
+      for (size_t n = 0; n < head_metrics_views.size(); n++) {
+        const ScrollingSeries &q = head_metrics_views[n].queue_depth;
+        ImPlot::PlotLine(head_metrics_views[n].label.c_str(), q.get_time(), q.get_value(), q.get_size(), q.get_offset());
+      }
+      ImPlot::EndPlot();
+    }
+    ImPlot::SetNextPlotLimitsX(t - 60.0, t, ImGuiCond_Always);
+    if (ImPlot::BeginPlot("Latency p50 [ms]", nullptr, nullptr, size, 0, 0,
+                          ImPlotAxisFlags_AutoFit)) {
+      for (size_t n = 0; n < head_metrics_views.size(); n++) {
+        const ScrollingSeries &l = head_metrics_views[n].latency_ms;
+        ImPlot::PlotLine(head_metrics_views[n].label.c_str(), l.get_time(), l.get_value(), l.get_size(), l.get_offset());
+      }
+      ImPlot::EndPlot();
+    }
+    ImPlot::SetNextPlotLimitsX(t - 60.0, t, ImGuiCond_Always);
+    if (ImPlot::BeginPlot("Plot Time [ms]", nullptr, nullptr, size, 0, 0,
+                          ImPlotAxisFlags_AutoFit)) {
+      ImPlot::PlotLine("p50", plot_time_p50_ms.get_time(), plot_time_p50_ms.get_value(), plot_time_p50_ms.get_size(), plot_time_p50_ms.get_offset());
+      ImPlot::PlotLine("p99", plot_time_p99_ms.get_time(), plot_time_p99_ms.get_value(), plot_time_p99_ms.get_size(), plot_time_p99_ms.get_offset());
+      ImPlot::EndPlot();
+    }
+
+    ImGui::End();
+  }
+
   // Override update (called once per frame)
   void update() override {
-    int32_t r = 0;
     bool stay_open;
 
+    pacer.wait();
+    update_connection();
+    update_data_format();
+
+    for (auto &receiver : receivers) {
+      // Every profile goes through the receiver's ring. The live view only
+      // needs the newest profile per camera, but persistence keeps them all.
+      // Popping a profile hands it back to the receiver's pool as soon as
+      // the handle lets go of it. Replayed or streamed profiles carry
+      // whatever scan head ID they were recorded with, so they are filed
+      // under the receiver they came from.
+      const uint32_t id = receiver->get_source().get_id();
+      HeadMetrics &m = *head_metrics[id];
+      auto &ring = receiver->get_profiles();
+      ProfileHandle profile;
+      while (ring.try_pop(profile)) {
+        uint32_t camera = static_cast<uint32_t>(profile->camera);
+        size_t n = id * kCamerasPerHead + camera;
+        bool is_kept = is_persistence_enabled && (camera < kCamerasPerHead);
+        if (is_kept || is_waterfall_open) {
+          ScopedTimer timer(m.convert_time_ns);
+          if (is_kept) {
+            series[n].history.push(*profile);
+          }
+          if (is_waterfall_open) {
+            waterfall.add(id, *profile);
+          }
+        }
+      }
+    }
+
+    for (size_t id = 0; id < head_analytics.size(); id++) {
+      auto &results = analytics->get_results(static_cast<uint32_t>(id));
+      if (results.update()) {
+        head_analytics[id] = results.front();
+      }
+    }
+
+    // With frame merging, every series shows its profile of the newest
+    // complete frame, otherwise its newest profile.
+    uint64_t now_ns = get_time_ns();
+    if ((nullptr != merger) && merger->get_enabled()) {
+      auto &frames = merger->get_frames();
+      if (frames.update()) {
+        const MergedFrame &frame = frames.front();
+        for (size_t n = 0; n < series.size(); n++) {
+          series[n].live = (n < frame.profiles.size()) ? frame.profiles[n] :
+                                                         ProfileHandle();
+          record_latency(series[n], now_ns);
+        }
+      }
+    } else {
+      for (auto &s : series) {
+        if ((nullptr != s.latest) && s.latest->update()) {
+          s.live = s.latest->front();
+          record_latency(s, now_ns);
+        }
+      }
+    }
+    // The last profile of a scan head that is being recovered only gets
+    // staler, so it is taken off the plot; the other scan heads carry on.
+    for (auto &receiver : receivers) {
+      if (HEAD_HEALTH_RECOVERING == receiver->get_health()) {
+        uint32_t id = receiver->get_source().get_id();
+        for (uint32_t camera = 0; camera < kCamerasPerHead; camera++) {
+          series[id * kCamerasPerHead + camera].live.reset();
+        }
+      }
+    }
+
     ImGui::SetNextWindowPos(ImVec2(50, 50), ImGuiCond_FirstUseEver);
     ImGui::SetNextWindowSize(ImVec2(0, 0));
     // App logic and/or ImGui code goes here
     ImGui::Begin("Example", &stay_open, ImGuiWindowFlags_MenuBar);
-    ImPlot::SetNextPlotLimits(-30.0, 30.0, -30.0, 30.0);
-    if (ImPlot::BeginPlot("Profile Plot","X [inches]","Y [inches]",ImVec2(1200,800),ImPlotFlags_Equal)) {
-      for (unsigned int j = 0; j < scan_heads.size(); j++) {
-        auto profiles_available = jsScanHeadGetProfilesAvailable(scan_heads[j]);
-        if(profiles_available < 0) {
-            std::cout << "profiles availble fail?" << std::endl;
-            throw std::runtime_error("profiles availble fail?");
+    if (ImGui::BeginMenuBar()) {
+      if (ImGui::BeginMenu("View")) {
+        if (ImGui::MenuItem("Persistence", nullptr, &is_persistence_enabled)) {
+          resize_histories();
         }
-        
-        if(profiles_available == 0) {
-          std::cout << "No profiles available" << std::endl;
-          continue;
+        ImGui::SliderInt("Depth", &persistence_depth, 1,
+                         static_cast<int>(kHistoryDepth));
+        ImGui::MenuItem("Level of Detail", nullptr, &is_lod_enabled);
+        ImGui::Separator();
+        ImGui::MenuItem("GPU Points", nullptr, &is_gpu_points_enabled);
+        ImGui::MenuItem("Color by Brightness", nullptr,
+                        &is_brightness_color_enabled, is_gpu_points_enabled);
+        ImGui::MenuItem("Brightness Only When Shown", nullptr,
+                        &is_auto_data_format,
+                        (nullptr != scan_system) || (nullptr != simulator));
+        bool is_idle_throttling = pacer.is_idle_throttling_enabled();
+        if (ImGui::MenuItem("Idle Throttling", nullptr, &is_idle_throttling)) {
+          pacer.set_idle_throttling(is_idle_throttling);
         }
-        
-        if(profiles_available > 100) {
-          std::cout << "Too many profiles available" << std::endl;
+        float max_fps = static_cast<float>(pacer.get_max_fps());
+        if (ImGui::SliderFloat("Max FPS", &max_fps, 0.0f, 240.0f,
+                               (0.0f < max_fps) ? "%.0f" : "unlimited")) {
+          pacer.set_max_fps(max_fps);
         }
-
-        for(unsigned int k = 0; k < profiles_available; k++) {
-          r = jsScanHeadGetProfiles(scan_heads[j], &profile, 1);
-          if (0 > r) {
-            std::cout << "failed to get profiles" << std::endl;
-            throw std::runtime_error("failed to get profiles");
+        ImGui::MenuItem("Highest Points", nullptr,
+                        &is_analytics_overlay_enabled);
+        if (ImGui::MenuItem("Coherent Frames", nullptr,
+                            &is_frame_merge_enabled) && (nullptr != merger)) {
+          merger->set_enabled(is_frame_merge_enabled);
+        }
+        ImGui::Separator();
+        if (ImGui::MenuItem("Waterfall", nullptr, &is_waterfall_open)) {
+          waterfall.clear();
+        }
+        ImGui::MenuItem("Alignment", nullptr, &is_alignment_open);
+        ImGui::MenuItem("Scan Settings", nullptr, &is_scan_settings_open,
+                        (nullptr != scan_system) || (nullptr != simulator));
+        ImGui::MenuItem("Diagnostics", nullptr, &is_diagnostics_open);
+        ImGui::MenuItem("Metrics", nullptr, &is_metrics_open);
+        ImGui::EndMenu();
+      }
+      if (ImGui::BeginMenu("Crop")) {
+        // The recording's header describes the scan windows, and the profiles
+        // in it are cropped already, so neither changes while recording.
+        bool is_recording = (nullptr != recorder) && recorder->is_recording();
+        // The query rectangle is dragged out on the plot with the middle
+        // mouse button.
+        if (ImGui::MenuItem("Crop to Selection", nullptr, false,
+                            is_plot_queried && (nullptr != crop) &&
+                              !is_recording)) {
+          PointRegion region;
+          region.left = static_cast<float>(plot_query.X.Min);
+          region.right = static_cast<float>(plot_query.X.Max);
+          region.bottom = static_cast<float>(plot_query.Y.Min);
+          region.top = static_cast<float>(plot_query.Y.Max);
+          crop->set_region(region);
+          if (is_window_narrowing) {
+            apply_scan_windows();
           }
-          
-          for (unsigned int idx = 0; idx < profile.data_len; idx++) {
-            x_data[profile.camera][idx] = profile.data[idx].x / 1000.0;
-            y_data[profile.camera][idx] = profile.data[idx].y / 1000.0;
-            data_length[profile.camera] = profile.data_len;
+        }
+        PointRegion region;
+        bool is_cropped = (nullptr != crop) && crop->get_region(region);
+        if (ImGui::MenuItem("Clear Crop", nullptr, false,
+                            is_cropped && !is_recording)) {
+          crop->clear_region();
+          if (is_window_narrowing) {
+            apply_scan_windows();
           }
-
         }
+        if (ImGui::MenuItem("Narrow Scan Windows", nullptr,
+                            &is_window_narrowing,
+                            (nullptr != scan_system) && !is_recording)) {
+          apply_scan_windows();
+        }
+        if (is_recording) {
+          ImGui::Text("Stop recording to change the crop");
+        }
+        ImGui::EndMenu();
+      }
+      if (ImGui::BeginMenu("Record")) {
+        bool is_recording = (nullptr != recorder) && recorder->is_recording();
+        if (ImGui::MenuItem("Record", nullptr, is_recording,
+                            nullptr != recorder)) {
+          toggle_recording();
+        }
+        ImGui::MenuItem("Unbuffered I/O", nullptr, &is_unbuffered_recording,
+                        !is_recording);
+        ImGui::MenuItem("Compress", nullptr, &is_compressed_recording,
+                        !is_recording);
+        ImGui::EndMenu();
+      }
+      ImGui::EndMenuBar();
+    }
+
+    if (!startup_error.empty()) {
+      ImGui::Text("Failed to start: %s", startup_error.c_str());
+    }
+    if (nullptr != connector) {
+      show_connection_status();
+    }
+    show_head_health();
+    if (nullptr != replay_clock) {
+      show_replay_controls();
+    }
+    if ((nullptr != recorder) && recorder->is_recording()) {
+      uint64_t bytes = recorder->get_bytes_written();
+      double ratio = (0 < bytes) ?
+                       recorder->get_raw_bytes_written() / double(bytes) :
+                       1.0;
+      ImGui::Text("Recording %s%s: %.1f MB (%.1fx), %llu profiles, "
+                  "%llu dropped%s",
+                  recorder->get_path().c_str(),
+                  recorder->is_unbuffered() ? " (unbuffered)" : "",
+                  bytes / 1.0e6, ratio,
+                  static_cast<unsigned long long>(
+                    recorder->get_profiles_written()),
+                  static_cast<unsigned long long>(
+                    recorder->get_profiles_dropped()),
+                  recorder->has_write_error() ? ", write failed" : "");
+    } else if (!recording_error.empty()) {
+      ImGui::Text("Recording failed: %s", recording_error.c_str());
+    }
+    if (!crop_error.empty()) {
+      ImGui::Text("Changing scan windows failed: %s", crop_error.c_str());
+    }
 
-        ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, 1, ImVec4(0,1.0f,0,0.5f), IMPLOT_AUTO, ImVec4(0,1,0,1));
-        ImPlot::PlotScatter("Camera 1", x_data[0], y_data[0], data_length[0]);
-        ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, 1, ImVec4(0,0.75f,0,0.5f), IMPLOT_AUTO, ImVec4(0,0.5f,0,1));
-        ImPlot::PlotScatter("Camera 2", x_data[1], y_data[1], data_length[1]);
+    ImPlot::SetNextPlotLimits(-30.0, 30.0, -30.0, 30.0);
+    uint64_t plot_start_ns = get_time_ns();
+    if (ImPlot::BeginPlot("Profile Plot","X [inches]","Y [inches]",ImVec2(1200,800),ImPlotFlags_Equal | ImPlotFlags_Query)) {
+      bool use_gpu = is_gpu_points_enabled && point_renderer.begin_frame();
+      if (is_persistence_enabled) {
+        plot_history(use_gpu);
+      }
+
+      // Every series is drawn exactly once per frame, directly from the
+      // pool slot of its live profile. A profile is never written to once
+      // it is shared, so the data can't change underneath us mid-draw.
+      for (auto &s : series) {
+        if (!s.live) {
+          continue;
+        }
+        if (use_gpu) {
+          add_live_points(s);
+          // An empty item still gives the series its legend entry.
+          ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, 1, s.color, IMPLOT_AUTO, s.color);
+          ImPlot::PlotScatter(s.label.c_str(), history_x.data(), history_y.data(), 0);
+          continue;
+        }
+        ImVec4 fill(s.color.x, s.color.y, s.color.z, 0.5f);
+        ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, 1, fill, IMPLOT_AUTO, s.color);
+        if (transforms[s.id].is_identity()) {
+          jsProfile *profile = s.live.get();
+          ImPlot::PlotScatterG(s.label.c_str(), profile_getter, profile, static_cast<int>(profile->data_len));
+          continue;
+        }
+        // An aligned head is converted and transformed in one batch instead;
+        // the history is done with the scratch columns by now.
+        uint32_t n = convert_profile(*s.live, history_x.data(),
+                                     history_y.data());
+        transform_points(history_x.data(), history_y.data(), n,
+                         transforms[s.id]);
+        ImPlot::PlotScatter(s.label.c_str(), history_x.data(), history_y.data(), static_cast<int>(n));
+      }
+      if (use_gpu) {
+        point_renderer.draw();
+      }
+      if (is_analytics_overlay_enabled) {
+        plot_highest_points();
+      }
+      plot_crop_region();
+      is_plot_queried = ImPlot::IsPlotQueried();
+      if (is_plot_queried) {
+        plot_query = ImPlot::GetPlotQuery();
       }
       ImPlot::EndPlot();
     }
+    plot_time_ns.record(get_time_ns() - plot_start_ns);
 
     ImGui::End();
+
+    if (is_waterfall_open) {
+      show_waterfall();
+    }
+    if (is_alignment_open) {
+      show_alignment();
+    }
+    if (is_scan_settings_open) {
+      show_scan_settings();
+    }
+    if (is_diagnostics_open) {
+      show_diagnostics();
+    }
+    sample_metrics();
+    if (is_metrics_open) {
+      show_metrics();
+    }
     
     if(!stay_open) {
       
@@ -230,54 +1971,116 @@ public:
   }
 };
 
-/**
- * @brief This function is a small utility function used to explore profile
- * data. In this case, it will iterate over the valid profile data and
- * find the highest measurement in the Y axis.
- *
- * @param profiles Array of profiles from a single scan head.
- * @param num_profiles Total number of profiles contained in array.
- * @return jsProfileData The profile measurement with the greatest Y axis value
- * from the array of profiles passed in.
- */
-jsProfileData find_scan_profile_highest_point(jsProfile *profiles,
-                                              uint32_t num_profiles)
+static void print_usage(const char *name)
 {
-  jsProfileData p = {0, 0, 0};
-  
-
-  for (unsigned int i = 0; i < num_profiles; i++) {
-    for (unsigned int j = 0; j < profiles[i].data_len; j++) {
-      if (profiles[i].data[j].y > p.y) {
-        p.brightness = profiles[i].data[j].brightness;
-        p.x = profiles[i].data[j].x;
-        p.y = profiles[i].data[j].y;
-      }
-    }
-  }
-
-  return p;
+  std::cout << "Usage: " << name << " [--config FILE]"
+            << " [--align SERIAL:ROLL:SHIFT_X:SHIFT_Y[:downstream]] SERIAL..."
+            << std::endl;
+  std::cout << "       " << name << " --replay FILE [--speed N|max] [--loop]"
+            << std::endl;
+  std::cout << "       " << name << " [--config FILE] --simulate N"
+            << std::endl;
+  std::cout << "       " << name << " --connect HOST[:PORT]" << std::endl;
+  std::cout << "Add --fps N to cap the frame rate at N, 0 for no cap"
+            << std::endl;
+  std::cout << "Add --serve to stream profiles instead of showing them,"
+            << " with --port N and --stride N to send every Nth point"
+            << std::endl;
+  std::cout << "Add --shm NAME to publish profiles to shared memory for"
+            << " other processes" << std::endl;
 }
 
 int main(int argc, char *argv[])
 {
-  std::vector<uint32_t> serial_numbers;
+  AppOptions options;
 
   if (2 > argc) {
-    std::cout << "Usage: " << argv[0] << " SERIAL..." << std::endl;
+    print_usage(argv[0]);
     return 1;
   }
 
-  // Grab the serial number(s) passed in through the command line.
+  // Grab the serial number(s) passed in through the command line, or the
+  // recording to play back instead.
+  bool is_serving = false;
+  ServerOptions server_options;
   for (int i = 1; i < argc; i++) {
-    serial_numbers.emplace_back(strtoul(argv[i], NULL, 0));
+    std::string arg = argv[i];
+    if ("--serve" == arg) {
+      is_serving = true;
+    } else if (("--shm" == arg) && (i + 1 < argc)) {
+      options.shm_name = argv[++i];
+    } else if (("--port" == arg) && (i + 1 < argc)) {
+      server_options.port = static_cast<uint16_t>(strtoul(argv[++i], NULL, 0));
+    } else if (("--stride" == arg) && (i + 1 < argc)) {
+      server_options.point_stride =
+        static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+    } else if (("--connect" == arg) && (i + 1 < argc)) {
+      std::string address = argv[++i];
+      size_t colon = address.rfind(':');
+      options.connect_host = address.substr(0, colon);
+      if (std::string::npos != colon) {
+        options.connect_port =
+          static_cast<uint16_t>(strtoul(address.c_str() + colon + 1, NULL, 0));
+      }
+    } else if (("--replay" == arg) && (i + 1 < argc)) {
+      options.replay_path = argv[++i];
+    } else if (("--speed" == arg) && (i + 1 < argc)) {
+      std::string speed = argv[++i];
+      if ("max" == speed) {
+        options.is_replay_max_speed = true;
+      } else {
+        options.replay_speed = strtod(speed.c_str(), NULL);
+      }
+    } else if (("--fps" == arg) && (i + 1 < argc)) {
+      options.max_fps = strtod(argv[++i], NULL);
+    } else if (("--simulate" == arg) && (i + 1 < argc)) {
+      options.num_simulated_heads =
+        static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+    } else if ("--loop" == arg) {
+      options.is_replay_looping = true;
+    } else if (("--config" == arg) && (i + 1 < argc)) {
+      options.config_path = argv[++i];
+    } else if (("--align" == arg) && (i + 1 < argc)) {
+      // Roll in degrees and shifts in inches, optionally followed by
+      // ":downstream" for a scan head mounted with its cable downstream.
+      unsigned long serial = 0;
+      char cable[16] = {0};
+      HeadAlignment a;
+      int count = std::sscanf(argv[++i], "%lu:%f:%f:%f:%15s", &serial,
+                              &a.roll_deg, &a.shift_x, &a.shift_y, cable);
+      if ((4 > count) || ((5 == count) && ("downstream" != std::string(cable)))) {
+        std::cout << "invalid alignment " << argv[i] << std::endl;
+        return 1;
+      }
+      a.is_cable_downstream = (5 == count);
+      options.alignments[static_cast<uint32_t>(serial)] = a;
+    } else {
+      // Anything else has to be a serial number, so that a mistyped option
+      // isn't taken for scan head 0.
+      char *end = nullptr;
+      unsigned long serial = strtoul(argv[i], &end, 0);
+      if ((0 == arg.compare(0, 2, "--")) || arg.empty() || ('\0' != *end)) {
+        std::cout << "unknown argument " << arg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      options.serial_numbers.emplace_back(serial);
+    }
   }
 
   const char *version_str;
   jsGetAPIVersion(&version_str);
   std::cout << "joescanapi " << version_str << std::endl;
 
-  MyApp app(serial_numbers);
+  if (is_serving) {
+    server_options.serial_numbers = options.serial_numbers;
+    server_options.config_path = options.config_path;
+    server_options.num_simulated_heads = options.num_simulated_heads;
+    server_options.shm_name = options.shm_name;
+    return run_server(server_options);
+  }
+
+  MyApp app(options);
   app.run();
   return 0;
 
@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "scan_server.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <joescan_pinchot.h>
+#include "event_log.hpp"
+#include "metrics.hpp"
+#include "profile_receiver.hpp"
+#include "profile_server.hpp"
+#include "profile_shm.hpp"
+#include "profile_simulator.hpp"
+#include "profile_source.hpp"
+#include "scan_config.hpp"
+#include "scan_connector.hpp"
+
+// How often the server prints how streaming is going.
+static const uint64_t kStatsIntervalNs = 5000000000ull;
+
+// Set from the signal handler; a lock free atomic is safe to use there.
+static std::atomic<bool> is_interrupted{false};
+
+static void on_interrupt(int)
+{
+  is_interrupted = true;
+}
+
+int run_server(const ServerOptions &options)
+{
+  ScanConfig scan_config;
+  std::vector<uint32_t> serial_numbers = options.serial_numbers;
+  try {
+    scan_config = options.config_path.empty() ?
+      get_default_scan_config(serial_numbers) :
+      load_scan_config(options.config_path);
+  } catch (std::exception &e) {
+    std::cout << "ERROR: " << e.what() << std::endl;
+    return 1;
+  }
+  if (serial_numbers.empty()) {
+    for (auto &head : scan_config.heads) {
+      serial_numbers.push_back(head.serial);
+    }
+  }
+
+  std::signal(SIGINT, on_interrupt);
+
+  double scan_rate_hz = scan_config.scan_rate_hz;
+  jsDataFormat data_format = scan_config.data_format;
+  std::vector<RecordingHeadHeader> head_info;
+  std::vector<std::unique_ptr<ProfileSource>> sources;
+  std::unique_ptr<ProfileSimulator> simulator;
+  jsScanSystem scan_system = nullptr;
+
+  if (0 < options.num_simulated_heads) {
+    uint32_t num_heads = options.num_simulated_heads;
+    simulator = std::make_unique<ProfileSimulator>(num_heads);
+    scan_rate_hz = std::min(scan_rate_hz, simulator->get_max_scan_rate());
+    if (0 > simulator->start_scanning(scan_rate_hz, data_format)) {
+      std::cout << "ERROR: failed to start simulator" << std::endl;
+      return 1;
+    }
+    std::cout << "simulating " << num_heads << " scan heads" << std::endl;
+    for (uint32_t id = 0; id < num_heads; id++) {
+      HeadConfig head = scan_config.get_head(kSimulatedSerialBase + id);
+      head_info.push_back(make_head_info(id, head));
+      sources.emplace_back(std::make_unique<SimulatedSource>(*simulator, id));
+    }
+  } else {
+    // Without a window to show progress in, just print every change of
+    // state until the scan heads are scanning or giving up.
+    ScanConnector connector(scan_config, serial_numbers);
+    connector.start();
+    ScanConnector::Status status;
+    std::string last_message;
+    while (true) {
+      status = connector.get_status();
+      if (last_message != status.message) {
+        std::cout << ScanConnector::get_state_name(status.state) << ": "
+                  << status.message << std::endl;
+        last_message = status.message;
+      }
+      if ((CONNECT_STATE_SCANNING == status.state) ||
+          (CONNECT_STATE_FAILED == status.state) || is_interrupted) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (CONNECT_STATE_SCANNING != status.state) {
+      if (0 > status.error) {
+        const char *err_str = nullptr;
+        jsGetError(status.error, &err_str);
+        std::cout << "jsError (" << status.error << "): " << err_str
+                  << std::endl;
+      }
+      return 1;
+    }
+
+    scan_system = connector.get_scan_system();
+    head_info = connector.get_head_info();
+    for (auto scan_head : connector.get_scan_heads()) {
+      sources.emplace_back(std::make_unique<ScanHeadSource>(scan_head));
+    }
+    connector.release();
+  }
+  std::cout << "scanning at " << scan_rate_hz << " Hz, "
+            << get_data_format_name(data_format) << std::endl;
+
+  // Receive the same way the GUI does, only with room in every pool for
+  // the profiles the viewers are still sending.
+  uint32_t num_heads = static_cast<uint32_t>(head_info.size());
+  EventLog events(num_heads);
+  std::vector<std::unique_ptr<HeadMetrics>> head_metrics;
+  for (uint32_t n = 0; n < num_heads; n++) {
+    head_metrics.emplace_back(std::make_unique<HeadMetrics>());
+  }
+  std::unique_ptr<ShmPublisher> shm;
+  if (!options.shm_name.empty()) {
+    try {
+      shm = std::make_unique<ShmPublisher>(options.shm_name, data_format,
+                                           scan_rate_hz, head_info);
+      std::cout << "publishing profiles to shared memory "
+                << options.shm_name << std::endl;
+    } catch (std::exception &e) {
+      std::cout << "ERROR: " << e.what() << std::endl;
+    }
+  }
+  std::vector<std::unique_ptr<ProfileReceiver>> receivers;
+  for (auto &source : sources) {
+    uint32_t id = source->get_id();
+    receivers.emplace_back(std::make_unique<ProfileReceiver>(
+      *source, events, *head_metrics[id], BatchReadConfig(), 256,
+      ProfileServer::get_held_profiles()));
+    if (nullptr != shm) {
+      receivers.back()->add_stage(shm.get());
+    }
+  }
+
+  // Declared after the receivers, since it holds on to profiles from their
+  // pools; it has to be gone before they are.
+  StreamHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.data_format = static_cast<int32_t>(data_format);
+  header.scan_rate_hz = scan_rate_hz;
+  ProfileServer server(header, head_info, options.point_stride);
+  int exit_code = 0;
+  try {
+    server.start(options.port);
+    std::cout << "serving profiles on port " << options.port
+              << ", press Ctrl+C to stop" << std::endl;
+  } catch (std::exception &e) {
+    std::cout << "ERROR: " << e.what() << std::endl;
+    exit_code = 1;
+    is_interrupted = true;
+  }
+  for (auto &receiver : receivers) {
+    receiver->start();
+  }
+
+  // Hand every profile received to the server; it queues a reference to it
+  // for each viewer and never blocks.
+  uint64_t last_stats_ns = get_time_ns();
+  ProfileHandle profile;
+  while (!is_interrupted) {
+    bool is_idle = true;
+    for (auto &receiver : receivers) {
+      while (receiver->get_profiles().try_pop(profile)) {
+        server.publish(profile);
+        is_idle = false;
+      }
+    }
+    profile.reset();
+    if (is_idle) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    uint64_t now_ns = get_time_ns();
+    if (kStatsIntervalNs <= now_ns - last_stats_ns) {
+      last_stats_ns = now_ns;
+      std::cout << server.get_client_count() << " viewers, "
+                << server.get_profiles_sent() << " profiles sent, "
+                << server.get_profiles_dropped() << " dropped" << std::endl;
+      for (auto &receiver : receivers) {
+        HeadHealth health = receiver->get_health();
+        if (HEAD_HEALTH_OK != health) {
+          uint32_t id = receiver->get_source().get_id();
+          std::cout << "scan head " << head_info[id].serial << ": "
+                    << ProfileReceiver::get_health_name(health) << " ("
+                    << receiver->get_last_error() << ")" << std::endl;
+        }
+      }
+    }
+  }
+
+  std::cout << "stopping" << std::endl;
+  server.stop();
+  for (auto &receiver : receivers) {
+    receiver->stop();
+  }
+  if ((nullptr != scan_system) && !close_scan_system(scan_system)) {
+    std::cout << "timed out stopping the scan heads" << std::endl;
+  }
+  return exit_code;
+}
@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file scan_server.hpp
+ * @brief Runs a scan system without a window, streaming its profiles.
+ *
+ * In server mode the application only acquires: it brings up the scan heads,
+ * or simulated ones, receives their profiles the same way the GUI does and
+ * hands every one of them to a `ProfileServer`. Any number of viewers on
+ * other machines can then connect with `--connect` and display the stream,
+ * leaving the machine by the scan heads free to keep up with them.
+ */
+#ifndef SCAN_GUI_SCAN_SERVER_HPP
+#define SCAN_GUI_SCAN_SERVER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "profile_stream.hpp"
+
+struct ServerOptions {
+  // Serial numbers of the scan heads to connect to.
+  std::vector<uint32_t> serial_numbers;
+  // Scan system settings; see `scan_config.hpp`.
+  std::string config_path;
+  // Number of simulated scan heads to serve instead of real ones.
+  uint32_t num_simulated_heads = 0;
+  uint16_t port = kStreamDefaultPort;
+  // Every how many points of a profile are streamed.
+  uint32_t point_stride = 1;
+  // Shared memory to publish profiles to as well; empty for none.
+  std::string shm_name;
+};
+
+/**
+ * @brief Serves profiles until interrupted with Ctrl+C.
+ *
+ * @return Exit code for the application.
+ */
+int run_server(const ServerOptions &options);
+
+#endif
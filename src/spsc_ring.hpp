@@ -0,0 +1,185 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file spsc_ring.hpp
+ * @brief Lock-free single-producer/single-consumer ring buffer.
+ *
+ * The ring is used to hand data from a producer thread (such as a scan head
+ * receiver) to a consumer thread (such as the GUI) without either side ever
+ * blocking on the other. Slots are preallocated when the ring is constructed
+ * and are written and read in place, so large elements like `jsProfile` are
+ * never copied through the ring itself.
+ */
+#ifndef SCAN_GUI_SPSC_RING_HPP
+#define SCAN_GUI_SPSC_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class SpscRing {
+public:
+  /**
+   * @brief Creates a ring able to hold at least `min_capacity` elements. The
+   * capacity is rounded up to the next power of two.
+   */
+  explicit SpscRing(size_t min_capacity)
+  {
+    size_t capacity = 1;
+    while (capacity < min_capacity) {
+      capacity <<= 1;
+    }
+    slots.resize(capacity);
+    mask = capacity - 1;
+  }
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  /**
+   * @brief Producer side; returns the next free slot to be filled in place,
+   * or `nullptr` if the ring is full. The slot becomes visible to the
+   * consumer only after `commit_write` is called.
+   */
+  T *write_slot()
+  {
+    const size_t head = write_index.load(std::memory_order_relaxed);
+    if (head - cached_read_index == slots.size()) {
+      cached_read_index = read_index.load(std::memory_order_acquire);
+      if (head - cached_read_index == slots.size()) {
+        return nullptr;
+      }
+    }
+    return &slots[head & mask];
+  }
+
+  /**
+   * @brief Producer side; returns the longest run of free slots that are
+   * contiguous in memory, so that several elements can be filled with a
+   * single call into an API that writes arrays. The run stops at the end of
+   * the underlying storage even if more slots are free past the wrap point.
+   *
+   * @param count Set to the number of contiguous free slots, zero if full.
+   * @return Pointer to the first free slot, or `nullptr` if the ring is full.
+   */
+  T *write_slots(size_t &count)
+  {
+    const size_t head = write_index.load(std::memory_order_relaxed);
+    const size_t to_end = slots.size() - (head & mask);
+    if (slots.size() - (head - cached_read_index) < to_end) {
+      cached_read_index = read_index.load(std::memory_order_acquire);
+    }
+
+    const size_t free = slots.size() - (head - cached_read_index);
+    count = (free < to_end) ? free : to_end;
+    return (0 == count) ? nullptr : &slots[head & mask];
+  }
+
+  /**
+   * @brief Producer side; publishes `count` slots previously returned by
+   * `write_slot` or `write_slots`.
+   */
+  void commit_write(size_t count = 1)
+  {
+    const size_t head = write_index.load(std::memory_order_relaxed);
+    write_index.store(head + count, std::memory_order_release);
+  }
+
+  /**
+   * @brief Producer side; copies an element into the ring.
+   *
+   * @return `true` if the element was pushed, `false` if the ring is full.
+   */
+  bool try_push(const T &value)
+  {
+    T *slot = write_slot();
+    if (nullptr == slot) {
+      return false;
+    }
+    *slot = value;
+    commit_write();
+    return true;
+  }
+
+  /**
+   * @brief Consumer side; returns the oldest element in the ring without
+   * removing it, or `nullptr` if the ring is empty.
+   */
+  T *front()
+  {
+    const size_t tail = read_index.load(std::memory_order_relaxed);
+    if (tail == cached_write_index) {
+      cached_write_index = write_index.load(std::memory_order_acquire);
+      if (tail == cached_write_index) {
+        return nullptr;
+      }
+    }
+    return &slots[tail & mask];
+  }
+
+  /**
+   * @brief Consumer side; releases the element returned by `front` back to
+   * the producer.
+   */
+  void pop()
+  {
+    const size_t tail = read_index.load(std::memory_order_relaxed);
+    read_index.store(tail + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Consumer side; moves the oldest element out of the ring and
+   * removes it. Unlike reading it through `front`, this leaves nothing
+   * behind in the slot, which matters for elements that own something, such
+   * as a `ProfileHandle`.
+   *
+   * @return `true` if an element was popped, `false` if the ring is empty.
+   */
+  bool try_pop(T &value)
+  {
+    T *slot = front();
+    if (nullptr == slot) {
+      return false;
+    }
+    value = std::move(*slot);
+    pop();
+    return true;
+  }
+
+  /**
+   * @brief Approximate number of elements in the ring; exact when called
+   * from either the producer or consumer while the other side is idle.
+   */
+  size_t size() const
+  {
+    return write_index.load(std::memory_order_acquire) -
+           read_index.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const
+  {
+    return slots.size();
+  }
+
+private:
+  std::vector<T> slots;
+  size_t mask = 0;
+
+  // The producer and consumer indices live on separate cache lines so that
+  // the two threads don't constantly invalidate each other's cache. Each side
+  // also keeps a private copy of the other's index and only reloads it when
+  // the ring appears full or empty.
+  alignas(64) std::atomic<size_t> write_index{0};
+  size_t cached_read_index = 0;
+  alignas(64) std::atomic<size_t> read_index{0};
+  size_t cached_write_index = 0;
+};
+
+#endif
@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "stream_client.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include "metrics.hpp"
+
+// Profiles buffered per scan head between the stream and its receiver.
+static const size_t kRingCapacity = 256;
+// Longest a source sleeps at once while waiting for profiles.
+static const uint64_t kMaxSleepNs = 1000000;
+// More scan heads than this means the stream header is garbage.
+static const uint32_t kMaxHeads = 255;
+
+StreamClient::StreamClient(const std::string &host, uint16_t port)
+{
+  if (!net_init()) {
+    throw std::runtime_error("failed to initialize sockets");
+  }
+  socket = net_connect(host, port);
+  if (kInvalidSocket == socket) {
+    throw std::runtime_error("failed to connect to " + host + ":" +
+                             std::to_string(port));
+  }
+
+  bool is_valid = net_receive(socket, &header, sizeof(header)) &&
+                  (0 == std::memcmp(header.magic, kStreamMagic,
+                                    sizeof(kStreamMagic))) &&
+                  (kStreamVersion == header.version) &&
+                  (kMaxHeads >= header.num_heads);
+  if (is_valid) {
+    heads.resize(header.num_heads);
+    is_valid = net_receive(socket, heads.data(),
+                           heads.size() * sizeof(RecordingHeadHeader));
+  }
+  for (uint32_t id = 0; is_valid && (id < heads.size()); id++) {
+    is_valid = (id == heads[id].id);
+  }
+  if (!is_valid) {
+    net_close(socket);
+    throw std::runtime_error(host + ":" + std::to_string(port) +
+                             " is not a profile stream");
+  }
+
+  for (size_t n = 0; n < heads.size(); n++) {
+    rings.emplace_back(std::make_unique<SpscRing<jsProfile>>(kRingCapacity));
+  }
+}
+
+StreamClient::~StreamClient()
+{
+  // Closing our end makes the pending receive fail, ending the thread.
+  net_shutdown(socket);
+  if (thread.joinable()) {
+    thread.join();
+  }
+  net_close(socket);
+}
+
+void StreamClient::start()
+{
+  thread = std::thread(&StreamClient::run, this);
+}
+
+void StreamClient::run()
+{
+  // Profiles that don't fit in their ring are still read, to stay in step
+  // with the stream.
+  std::unique_ptr<jsProfile> scratch = std::make_unique<jsProfile>();
+  while (true) {
+    RecordingProfileHeader hdr;
+    if (!net_receive(socket, &hdr, sizeof(hdr)) ||
+        (JS_PROFILE_DATA_LEN < hdr.data_len)) {
+      break;
+    }
+
+    jsProfile *profile = nullptr;
+    if (hdr.scan_head_id < rings.size()) {
+      profile = rings[hdr.scan_head_id]->write_slot();
+    }
+    jsProfile *dst = (nullptr != profile) ? profile : scratch.get();
+    recording_apply_header(hdr, *dst);
+    if (!net_receive(socket, dst->data,
+                     dst->data_len * sizeof(jsProfileData))) {
+      break;
+    }
+    if (nullptr != profile) {
+      rings[hdr.scan_head_id]->commit_write();
+    } else {
+      profiles_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  is_closed = true;
+}
+
+StreamSource::StreamSource(StreamClient &client, uint32_t id)
+  : client(client), id(id)
+{
+}
+
+int32_t StreamSource::wait_until_available(uint32_t count,
+                                           uint32_t timeout_us)
+{
+  const uint64_t deadline = get_time_ns() + timeout_us * 1000ull;
+  SpscRing<jsProfile> &ring = *client.rings[id];
+  while (true) {
+    size_t available = ring.size();
+    uint64_t now = get_time_ns();
+    if ((available >= count) || (now >= deadline)) {
+      return static_cast<int32_t>(available);
+    }
+    uint64_t wait = std::min(deadline - now, kMaxSleepNs);
+    std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+  }
+}
+
+int32_t StreamSource::get_profiles(jsProfile *profiles, uint32_t max_profiles)
+{
+  SpscRing<jsProfile> &ring = *client.rings[id];
+  uint32_t n = 0;
+  while (n < max_profiles) {
+    const jsProfile *src = ring.front();
+    if (nullptr == src) {
+      break;
+    }
+    // Only copy the points the profile actually holds.
+    jsProfile &dst = profiles[n++];
+    std::memcpy(&dst, src, offsetof(jsProfile, data));
+    std::memcpy(dst.data, src->data, src->data_len * sizeof(jsProfileData));
+    ring.pop();
+  }
+  return static_cast<int32_t>(n);
+}
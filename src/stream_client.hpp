@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file stream_client.hpp
+ * @brief Receives the profile stream of a remote server.
+ *
+ * The client reads the stream on a thread of its own, sorting profiles into
+ * a ring per scan head as they come in. Each scan head then gets a source
+ * reading out of its ring, so the rest of the application receives streamed
+ * profiles exactly like those of live scan heads. Should the application
+ * fall behind, the newest profiles are dropped at the ring, without ever
+ * holding up the stream for the other scan heads.
+ */
+#ifndef SCAN_GUI_STREAM_CLIENT_HPP
+#define SCAN_GUI_STREAM_CLIENT_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <joescan_pinchot.h>
+#include "net_socket.hpp"
+#include "profile_source.hpp"
+#include "profile_stream.hpp"
+#include "spsc_ring.hpp"
+
+class StreamClient {
+public:
+  /**
+   * @brief Connects to a server and reads the description of its scan
+   * system. No profiles are read until `start` is called.
+   *
+   * @throws std::runtime_error if the server can't be reached or doesn't
+   * send a valid stream header.
+   */
+  StreamClient(const std::string &host, uint16_t port);
+  ~StreamClient();
+
+  StreamClient(const StreamClient &) = delete;
+  StreamClient &operator=(const StreamClient &) = delete;
+
+  const StreamHeader &get_header() const
+  {
+    return header;
+  }
+
+  const std::vector<RecordingHeadHeader> &get_heads() const
+  {
+    return heads;
+  }
+
+  /**
+   * @brief Starts reading profiles in the background.
+   */
+  void start();
+
+  /**
+   * @brief Whether the server closed the stream or it failed.
+   */
+  bool is_disconnected() const
+  {
+    return is_closed.load(std::memory_order_relaxed);
+  }
+
+  uint64_t get_profiles_dropped() const
+  {
+    return profiles_dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  friend class StreamSource;
+
+  void run();
+
+  net_socket_t socket = kInvalidSocket;
+  StreamHeader header;
+  std::vector<RecordingHeadHeader> heads;
+  // Profiles read but not yet taken by a source, indexed by scan head ID.
+  std::vector<std::unique_ptr<SpscRing<jsProfile>>> rings;
+  std::thread thread;
+  std::atomic<bool> is_closed{false};
+  std::atomic<uint64_t> profiles_dropped{0};
+};
+
+/**
+ * @brief Streamed profiles of one scan head.
+ */
+class StreamSource : public ProfileSource {
+public:
+  StreamSource(StreamClient &client, uint32_t id);
+
+  uint32_t get_id() const override
+  {
+    return id;
+  }
+
+  int32_t wait_until_available(uint32_t count, uint32_t timeout_us) override;
+  int32_t get_profiles(jsProfile *profiles, uint32_t max_profiles) override;
+
+  /**
+   * @brief A lost connection can't be recovered from here; the scan heads
+   * behind the server are recovered by the server itself.
+   */
+  int32_t recover() override
+  {
+    return client.is_disconnected() ? JS_ERROR_NOT_CONNECTED : 0;
+  }
+
+  bool is_idle() override
+  {
+    // From here a stalled scan head on the server can't be told from one
+    // that is idle, so a quiet stream counts as idle while it is open.
+    return !client.is_disconnected();
+  }
+
+private:
+  StreamClient &client;
+  uint32_t id;
+};
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file triple_buffer.hpp
+ * @brief Lock-free "latest value" hand-off between two threads.
+ *
+ * The writer always has a back buffer it can fill, and the reader always has
+ * a front buffer that stays untouched for as long as it is being read. A
+ * third buffer in the middle is swapped with either side, so neither thread
+ * ever waits on the other or sees a half written value. Values the reader
+ * doesn't get to before the writer publishes again are simply replaced.
+ */
+#ifndef SCAN_GUI_TRIPLE_BUFFER_HPP
+#define SCAN_GUI_TRIPLE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+template <typename T>
+class TripleBuffer {
+public:
+  TripleBuffer() = default;
+  TripleBuffer(const TripleBuffer &) = delete;
+  TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+  /**
+   * @brief Writer side; the buffer to fill before calling `publish`.
+   */
+  T &back()
+  {
+    return buffers[back_index];
+  }
+
+  /**
+   * @brief Writer side; makes the back buffer the newest value.
+   */
+  void publish()
+  {
+    uint8_t prev = middle.exchange(back_index | kDirty,
+                                   std::memory_order_acq_rel);
+    back_index = prev & kIndexMask;
+  }
+
+  /**
+   * @brief Reader side; switches the front buffer to the newest published
+   * value, if there is one.
+   *
+   * @return `true` if the front buffer changed.
+   */
+  bool update()
+  {
+    if (0 == (middle.load(std::memory_order_relaxed) & kDirty)) {
+      return false;
+    }
+    uint8_t prev = middle.exchange(front_index, std::memory_order_acq_rel);
+    front_index = prev & kIndexMask;
+    return true;
+  }
+
+  /**
+   * @brief Reader side; the value most recently taken by `update`.
+   */
+  const T &front() const
+  {
+    return buffers[front_index];
+  }
+
+private:
+  static const uint8_t kIndexMask = 0x3;
+  static const uint8_t kDirty = 0x4;
+
+  T buffers[3] = {};
+  std::atomic<uint8_t> middle{1};
+  uint8_t back_index = 0;
+  uint8_t front_index = 2;
+};
+
+#endif
@@ -0,0 +1,263 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+#include "waterfall.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <glad/glad.h>
+#include <imgui.h>
+#include <implot.h>
+
+// Profile units are thousandths of an inch.
+static const double kUnitsPerInch = 1000.0;
+// Highest color level; level zero is reserved for pixels without a point.
+static const uint32_t kMaxLevel = 255;
+
+/**
+ * @brief Fills `palette` with a ramp through the given colors, spread evenly
+ * over levels one and up.
+ */
+static void make_ramp(uint32_t palette[256], const ImVec4 *colors,
+                      uint32_t num_colors)
+{
+  palette[0] = IM_COL32(0, 0, 0, 0);
+  for (uint32_t level = 1; level <= kMaxLevel; level++) {
+    float t = (level - 1) * (num_colors - 1) / float(kMaxLevel - 1);
+    uint32_t n = std::min(static_cast<uint32_t>(t), num_colors - 2);
+    float f = t - n;
+    const ImVec4 &a = colors[n];
+    const ImVec4 &b = colors[n + 1];
+    palette[level] = IM_COL32(static_cast<int>(255.0f * (a.x + (b.x - a.x) * f)),
+                              static_cast<int>(255.0f * (a.y + (b.y - a.y) * f)),
+                              static_cast<int>(255.0f * (a.z + (b.z - a.z) * f)),
+                              255);
+  }
+}
+
+Waterfall::Waterfall(uint32_t width, uint32_t depth)
+  : width(std::max(width, 1u)),
+    depth(std::max(depth, 2u))
+{
+  set_mode(WATERFALL_MODE_HEIGHT);
+}
+
+Waterfall::~Waterfall()
+{
+  release();
+}
+
+void Waterfall::resize(uint32_t num_heads)
+{
+  release();
+  heads.resize(num_heads);
+  for (auto &head : heads) {
+    head.pixels.assign(static_cast<size_t>(width) * depth, palette[0]);
+    head.levels.assign(width, 0);
+  }
+}
+
+void Waterfall::set_range(uint32_t id, double x_min, double x_max,
+                          double y_min, double y_max)
+{
+  Head &head = heads[id];
+  head.x_min = std::min(x_min, x_max);
+  head.x_max = std::max(x_min, x_max);
+  head.min_x = static_cast<int32_t>(head.x_min * kUnitsPerInch);
+  head.min_y = static_cast<int32_t>(std::min(y_min, y_max) * kUnitsPerInch);
+  head.span_x = std::max(1, static_cast<int32_t>(
+                              (head.x_max - head.x_min) * kUnitsPerInch));
+  head.span_y = std::max(1, static_cast<int32_t>(
+                              std::abs(y_max - y_min) * kUnitsPerInch));
+}
+
+void Waterfall::set_mode(WaterfallMode mode)
+{
+  this->mode = mode;
+  if (WATERFALL_MODE_BRIGHTNESS == mode) {
+    const ImVec4 colors[] = {ImVec4(0.0f, 0.0f, 0.0f, 1.0f),
+                             ImVec4(1.0f, 1.0f, 1.0f, 1.0f)};
+    make_ramp(palette, colors, 2);
+  } else {
+    // Low is blue, high is red.
+    const ImVec4 colors[] = {
+      ImVec4(0.0f, 0.0f, 0.5f, 1.0f), ImVec4(0.0f, 0.4f, 1.0f, 1.0f),
+      ImVec4(0.0f, 1.0f, 0.6f, 1.0f), ImVec4(1.0f, 1.0f, 0.0f, 1.0f),
+      ImVec4(1.0f, 0.1f, 0.0f, 1.0f)};
+    make_ramp(palette, colors, 5);
+  }
+  // Rows already drawn are in the old colors.
+  clear();
+}
+
+void Waterfall::clear()
+{
+  for (auto &head : heads) {
+    std::fill(head.pixels.begin(), head.pixels.end(), palette[0]);
+    std::fill(head.levels.begin(), head.levels.end(), 0);
+    head.pending = depth;
+    head.sequence_number = UINT32_MAX;
+  }
+}
+
+void Waterfall::next_row(Head &head)
+{
+  head.row = (head.row + 1) % depth;
+  uint32_t *pixels = &head.pixels[static_cast<size_t>(head.row) * width];
+  std::fill(pixels, pixels + width, palette[0]);
+  std::fill(head.levels.begin(), head.levels.end(), 0);
+  head.pending = std::min(head.pending + 1, depth);
+}
+
+void Waterfall::add(uint32_t id, const jsProfile &profile)
+{
+  if (heads.size() <= id) {
+    return;
+  }
+  Head &head = heads[id];
+  if (profile.sequence_number != head.sequence_number) {
+    head.sequence_number = profile.sequence_number;
+    next_row(head);
+  }
+  head.pending = std::max(head.pending, 1u);
+
+  // Integer math only; this runs for every point of every profile.
+  const bool is_brightness = (WATERFALL_MODE_BRIGHTNESS == mode);
+  const uint32_t len = std::min<uint32_t>(profile.data_len,
+                                          JS_PROFILE_DATA_LEN);
+  uint32_t *pixels = &head.pixels[static_cast<size_t>(head.row) * width];
+  uint8_t *levels = head.levels.data();
+  for (uint32_t n = 0; n < len; n++) {
+    const jsProfileData &d = profile.data[n];
+    if ((JS_PROFILE_DATA_INVALID_XY == d.x) ||
+        (JS_PROFILE_DATA_INVALID_XY == d.y)) {
+      continue;
+    }
+    int64_t column = static_cast<int64_t>(d.x - head.min_x) * width /
+                     head.span_x;
+    if ((0 > column) || (width <= column)) {
+      continue;
+    }
+    int64_t level = 0;
+    if (is_brightness) {
+      if (JS_PROFILE_DATA_INVALID_BRIGHTNESS == d.brightness) {
+        continue;
+      }
+      level = 1 + static_cast<int64_t>(d.brightness) * (kMaxLevel - 1) / 255;
+    } else {
+      level = 1 + static_cast<int64_t>(d.y - head.min_y) * (kMaxLevel - 1) /
+                    head.span_y;
+    }
+    level = std::min<int64_t>(std::max<int64_t>(level, 1), kMaxLevel);
+    if (levels[column] < level) {
+      levels[column] = static_cast<uint8_t>(level);
+      pixels[column] = palette[level];
+    }
+  }
+}
+
+bool Waterfall::init()
+{
+  GLint previous = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+  for (auto &head : heads) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    head.texture = texture;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    // Every pixel is a bin of points; blending bins together would smear
+    // profiles of different scans into each other.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    // Rows wrap around, so the ring can be drawn starting at any row.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, depth, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, head.pixels.data());
+    head.pending = 0;
+  }
+  glBindTexture(GL_TEXTURE_2D, previous);
+
+  GLenum error = glGetError();
+  if (GL_NO_ERROR != error) {
+    std::cout << "waterfall texture failed: " << error << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void Waterfall::release()
+{
+  for (auto &head : heads) {
+    if (0 != head.texture) {
+      GLuint texture = head.texture;
+      glDeleteTextures(1, &texture);
+      head.texture = 0;
+    }
+  }
+  is_initialized = false;
+}
+
+bool Waterfall::upload()
+{
+  if (is_failed) {
+    return false;
+  }
+  if (!is_initialized) {
+    if (!init()) {
+      release();
+      is_failed = true;
+      return false;
+    }
+    is_initialized = true;
+    return true;
+  }
+
+  GLint previous = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+  for (auto &head : heads) {
+    if (0 == head.pending) {
+      continue;
+    }
+
+    // The changed rows end at the newest one, wrapping around to the end of
+    // the texture if they start before the first; one upload per run.
+    uint32_t first = (head.row + depth + 1 - head.pending) % depth;
+    glBindTexture(GL_TEXTURE_2D, head.texture);
+    if (first > head.row) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, width, depth - first,
+                      GL_RGBA, GL_UNSIGNED_BYTE,
+                      &head.pixels[static_cast<size_t>(first) * width]);
+      first = 0;
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, width, head.row + 1 - first,
+                    GL_RGBA, GL_UNSIGNED_BYTE,
+                    &head.pixels[static_cast<size_t>(first) * width]);
+    head.pending = 0;
+  }
+  glBindTexture(GL_TEXTURE_2D, previous);
+  return true;
+}
+
+void Waterfall::plot(uint32_t id, double scan_rate_hz) const
+{
+  const Head &head = heads[id];
+  if (0 == head.texture) {
+    return;
+  }
+
+  // The texture repeats vertically, so starting just past the newest row
+  // and going up a full turn of the ring ends on the newest row at the top.
+  float top = (head.row + 1) / float(depth);
+  double seconds = depth / ((0.0 < scan_rate_hz) ? scan_rate_hz : 1.0);
+  ImTextureID texture = reinterpret_cast<ImTextureID>(
+    static_cast<intptr_t>(head.texture));
+  ImPlot::PlotImage("##waterfall", texture,
+                    ImPlotPoint(head.x_min, -seconds),
+                    ImPlotPoint(head.x_max, 0.0), ImVec2(0.0f, top - 1.0f),
+                    ImVec2(1.0f, top));
+}
@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) JoeScan Inc. All Rights Reserved.
+ *
+ * Licensed under the BSD 3 Clause License. See LICENSE.txt in the project
+ * root for license information.
+ */
+
+/**
+ * @file waterfall.hpp
+ * @brief Scrolling image of every scan head's profiles over time.
+ *
+ * Each scan taken by a scan head becomes one row of pixels: its points are
+ * binned across the row by X, and colored by either their Y or their
+ * brightness. The rows of each scan head go into an OpenGL texture that is
+ * used as a ring, so a new scan costs one row of upload rather than the
+ * whole image, and older scans scroll down as new ones come in without
+ * anything being moved. Drawing wraps the texture around so that the newest
+ * row is always on top.
+ */
+#ifndef SCAN_GUI_WATERFALL_HPP
+#define SCAN_GUI_WATERFALL_HPP
+
+#include <cstdint>
+#include <vector>
+#include <joescan_pinchot.h>
+
+enum WaterfallMode {
+  WATERFALL_MODE_HEIGHT,
+  WATERFALL_MODE_BRIGHTNESS,
+};
+
+class Waterfall {
+public:
+  /**
+   * @param width Pixels per row, i.e. bins across the scan head's window.
+   * @param depth Rows per scan head, i.e. how many scans the image goes back.
+   */
+  explicit Waterfall(uint32_t width = 512, uint32_t depth = 1024);
+  ~Waterfall();
+
+  Waterfall(const Waterfall &) = delete;
+  Waterfall &operator=(const Waterfall &) = delete;
+
+  /**
+   * @brief Sets up an image for each of `num_heads` scan heads, all of them
+   * blank. The pixels are allocated here; no OpenGL resources are created
+   * until the first call to `upload`.
+   */
+  void resize(uint32_t num_heads);
+
+  /**
+   * @brief Sets the part of a scan head's field of view its image covers,
+   * in inches; points outside of it are left out.
+   */
+  void set_range(uint32_t id, double x_min, double x_max, double y_min,
+                 double y_max);
+
+  void set_mode(WaterfallMode mode);
+
+  WaterfallMode get_mode() const
+  {
+    return mode;
+  }
+
+  /**
+   * @brief Blanks every image.
+   */
+  void clear();
+
+  /**
+   * @brief Draws a profile of scan head `id` into the newest row of its
+   * image. Profiles of the same scan, one per camera, share a row; a profile
+   * of a new scan starts the next row.
+   */
+  void add(uint32_t id, const jsProfile &profile);
+
+  /**
+   * @brief Copies the rows added since the last call into the textures.
+   * Must be called from the thread that owns the OpenGL context, i.e. from
+   * `Application::update`.
+   *
+   * @return `false` if the OpenGL resources could not be created.
+   */
+  bool upload();
+
+  /**
+   * @brief Draws a scan head's image into the current ImPlot plot, the
+   * newest scan at the top. X is in inches; Y counts scans back in time,
+   * divided by `scan_rate_hz` to give seconds.
+   */
+  void plot(uint32_t id, double scan_rate_hz) const;
+
+  uint32_t get_depth() const
+  {
+    return depth;
+  }
+
+  double get_x_min(uint32_t id) const
+  {
+    return heads[id].x_min;
+  }
+
+  double get_x_max(uint32_t id) const
+  {
+    return heads[id].x_max;
+  }
+
+private:
+  struct Head {
+    // RGBA pixels of every row, in the same order as in the texture.
+    std::vector<uint32_t> pixels;
+    // Color level of each pixel of the newest row, so that of the points
+    // falling on the same pixel the one that stands out most is shown.
+    std::vector<uint8_t> levels;
+    // Row the newest scan is drawn into.
+    uint32_t row = 0;
+    // Rows up to and including `row` that have changed since the last
+    // upload.
+    uint32_t pending = 0;
+    uint32_t sequence_number = UINT32_MAX;
+    // Image bounds in inches, and the same in profile units.
+    double x_min = -30.0;
+    double x_max = 30.0;
+    int32_t min_x = -30000;
+    int32_t min_y = -30000;
+    int32_t span_x = 60000;
+    int32_t span_y = 60000;
+    uint32_t texture = 0;
+  };
+
+  bool init();
+  void release();
+  void next_row(Head &head);
+
+  uint32_t width;
+  uint32_t depth;
+  WaterfallMode mode = WATERFALL_MODE_HEIGHT;
+  // Color of each level; level zero is no point at all.
+  uint32_t palette[256];
+  std::vector<Head> heads;
+  bool is_initialized = false;
+  bool is_failed = false;
+};
+
+#endif